@@ -9,6 +9,12 @@
 #include <windows.h>
 #endif
 #include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && defined(__linux__) && defined(_7ZIP_LARGE_PAGES)
+#include <sys/mman.h>
+#define _7ZIP_LINUX_LARGE_PAGES
+#endif
 
 #include "Alloc.h"
 
@@ -236,6 +242,121 @@ void BigFree(void *address)
 
 #endif
 
+#ifdef _7ZIP_LINUX_LARGE_PAGES
+
+size_t g_LargePageSize = 0;
+
+void SetLargePageSize()
+{
+  char s[80];
+  FILE *f = fopen("/proc/meminfo", "r");
+  if (!f)
+    return;
+  while (fgets(s, sizeof(s), f))
+  {
+    if (strncmp(s, "Hugepagesize:", 13) == 0)
+    {
+      size_t size = (size_t)strtoul(s + 13, NULL, 10) << 10;
+      if (size != 0 && (size & (size - 1)) == 0)
+        g_LargePageSize = size;
+      break;
+    }
+  }
+  fclose(f);
+}
+
+/*
+  The block header holds the size of the mapping, or 0 if the block is from MyAlloc().
+  It keeps the returned address aligned for cache lines.
+*/
+
+#define BIG_ALLOC_HEADER_SIZE ((size_t)1 << 6)
+
+static void *BigAlloc_Map(size_t size2, size_t ps)
+{
+  char *p;
+  size_t lead;
+  
+  #ifdef MAP_HUGETLB
+  p = (char *)mmap(NULL, size2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != (char *)MAP_FAILED)
+    return p;
+  #endif
+
+  /* no reserved huge pages are free: we use transparent huge pages,
+     that require the mapping to be aligned for page size */
+  p = (char *)mmap(NULL, size2 + ps, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == (char *)MAP_FAILED)
+    return NULL;
+  lead = (ps - ((size_t)p & (ps - 1))) & (ps - 1);
+  if (lead != 0)
+    munmap(p, lead);
+  p += lead;
+  munmap(p + size2, ps - lead);
+  #ifdef MADV_HUGEPAGE
+  madvise(p, size2, MADV_HUGEPAGE);
+  #endif
+  return p;
+}
+
+void *BigAlloc(size_t size)
+{
+  size_t size1;
+  char *p = NULL;
+  size_t mapSize = 0;
+
+  if (size == 0)
+    return NULL;
+
+  PRINT_ALLOC("Alloc-Big", g_allocCountBig, size, NULL);
+  
+  size1 = size + BIG_ALLOC_HEADER_SIZE;
+  if (size1 < size)
+    return NULL;
+  {
+    size_t ps = g_LargePageSize;
+    if (ps != 0 && ps <= (1 << 30) && size1 > (ps / 2))
+    {
+      size_t size2;
+      ps--;
+      size2 = (size1 + ps) & ~ps;
+      if (size2 >= size1)
+      {
+        p = (char *)BigAlloc_Map(size2, ps + 1);
+        if (p)
+          mapSize = size2;
+      }
+    }
+  }
+  if (!p)
+  {
+    p = (char *)MyAlloc(size1);
+    if (!p)
+      return NULL;
+  }
+  *(size_t *)(void *)p = mapSize;
+  return p + BIG_ALLOC_HEADER_SIZE;
+}
+
+void BigFree(void *address)
+{
+  char *p;
+  size_t mapSize;
+  
+  PRINT_FREE("Free-Big", g_allocCountBig, address);
+  
+  if (!address)
+    return;
+  p = (char *)address - BIG_ALLOC_HEADER_SIZE;
+  mapSize = *(size_t *)(void *)p;
+  if (mapSize != 0)
+    munmap(p, mapSize);
+  else
+    MyFree(p);
+}
+
+#endif
+
 
 static void *SzAlloc(ISzAllocPtr p, size_t size) { UNUSED_VAR(p); return MyAlloc(size); }
 static void SzFree(ISzAllocPtr p, void *address) { UNUSED_VAR(p); MyFree(address); }
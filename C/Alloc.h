@@ -24,11 +24,23 @@ void BigFree(void *address);
 
 #define MidAlloc(size) MyAlloc(size)
 #define MidFree(address) MyFree(address)
+
+#if defined(__linux__) && defined(_7ZIP_LARGE_PAGES)
+
+void SetLargePageSize();
+
+void *BigAlloc(size_t size);
+void BigFree(void *address);
+
+#else
+
 #define BigAlloc(size) MyAlloc(size)
 #define BigFree(address) MyFree(address)
 
 #endif
 
+#endif
+
 extern const ISzAlloc g_Alloc;
 extern const ISzAlloc g_BigAlloc;
 extern const ISzAlloc g_MidAlloc;
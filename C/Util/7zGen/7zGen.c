@@ -0,0 +1,215 @@
+/* 7zGen.c -- writes a synthetic 7z archive for open/list benchmarks.
+ * The archive holds only a header: numFiles empty files spread over directories,
+ * each with a name, modification time and attributes. Opening it exercises the
+ * header parser and the database setup without any decoding, so
+ *   7z l -bt big.7z
+ * measures the open/list cost of large archives on its own. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../7zCrc.h"
+#include "../../CpuArch.h"
+
+#define k7zIdHeader 1
+#define k7zIdFilesInfo 5
+#define k7zIdEmptyStream 14
+#define k7zIdEmptyFile 15
+#define k7zIdName 17
+#define k7zIdMTime 20
+#define k7zIdWinAttrib 21
+#define k7zIdEnd 0
+
+#define GEN_FILES_PER_DIR 1000
+#define GEN_NAME_MAX 32
+#define GEN_ATTRIB_ARCHIVE 0x20
+
+typedef struct
+{
+  Byte *data;
+  size_t size;
+  size_t pos;
+} CGenBuf;
+
+static void Buf_WriteByte(CGenBuf *p, Byte b)
+{
+  p->data[p->pos++] = b;
+}
+
+static void Buf_WriteUi32(CGenBuf *p, UInt32 v)
+{
+  SetUi32(p->data + p->pos, v);
+  p->pos += 4;
+}
+
+static void Buf_WriteUi64(CGenBuf *p, UInt64 v)
+{
+  SetUi64(p->data + p->pos, v);
+  p->pos += 8;
+}
+
+/* 7z NUMBER: the count of leading 1 bits in the first byte gives the count of extra bytes */
+static void Buf_WriteNumber(CGenBuf *p, UInt64 v)
+{
+  Byte firstByte = 0;
+  Byte mask = 0x80;
+  unsigned i;
+  for (i = 0; i < 8; i++)
+  {
+    if (v < ((UInt64)1 << (7 * (i + 1))))
+    {
+      firstByte |= (Byte)(v >> (8 * i));
+      break;
+    }
+    firstByte |= mask;
+    mask >>= 1;
+  }
+  Buf_WriteByte(p, firstByte);
+  for (; i > 0; i--)
+  {
+    Buf_WriteByte(p, (Byte)v);
+    v >>= 8;
+  }
+}
+
+static void Buf_WriteAllOnes(CGenBuf *p, UInt32 numBits)
+{
+  UInt32 i;
+  for (i = 0; i < numBits / 8; i++)
+    Buf_WriteByte(p, 0xFF);
+  if (numBits & 7)
+    Buf_WriteByte(p, (Byte)(0xFF << (8 - (numBits & 7))));
+}
+
+static unsigned MakeName(char *name, UInt32 index, UInt32 filesPerDir)
+{
+  return (unsigned)sprintf(name, "d%05u/f%08u.txt", (unsigned)(index / filesPerDir), (unsigned)index);
+}
+
+static int WriteArchive(FILE *f, UInt32 numFiles, UInt32 filesPerDir)
+{
+  CGenBuf buf;
+  char name[GEN_NAME_MAX];
+  size_t namesSize = 1;
+  UInt32 i;
+  Byte startHeader[32];
+  UInt32 headerCrc;
+
+  for (i = 0; i < numFiles; i++)
+    namesSize += (MakeName(name, i, filesPerDir) + 1) * 2;
+
+  /* property ids, sizes and bit vectors take well under 64 bytes each */
+  buf.size = 64 * 8 + (numFiles + 7) / 8 * 2 + namesSize + (size_t)numFiles * (8 + 4);
+  buf.data = (Byte *)malloc(buf.size);
+  buf.pos = 0;
+  if (!buf.data)
+    return 1;
+
+  Buf_WriteByte(&buf, k7zIdHeader);
+  Buf_WriteByte(&buf, k7zIdFilesInfo);
+  Buf_WriteNumber(&buf, numFiles);
+
+  Buf_WriteByte(&buf, k7zIdEmptyStream);
+  Buf_WriteNumber(&buf, (numFiles + 7) / 8);
+  Buf_WriteAllOnes(&buf, numFiles);
+
+  Buf_WriteByte(&buf, k7zIdEmptyFile);
+  Buf_WriteNumber(&buf, (numFiles + 7) / 8);
+  Buf_WriteAllOnes(&buf, numFiles);
+
+  Buf_WriteByte(&buf, k7zIdName);
+  Buf_WriteNumber(&buf, namesSize);
+  Buf_WriteByte(&buf, 0); /* not external */
+  for (i = 0; i < numFiles; i++)
+  {
+    unsigned len = MakeName(name, i, filesPerDir);
+    unsigned k;
+    for (k = 0; k <= len; k++)
+    {
+      Buf_WriteByte(&buf, (Byte)name[k]);
+      Buf_WriteByte(&buf, 0);
+    }
+  }
+
+  Buf_WriteByte(&buf, k7zIdMTime);
+  Buf_WriteNumber(&buf, 2 + (UInt64)numFiles * 8);
+  Buf_WriteByte(&buf, 1); /* all defined */
+  Buf_WriteByte(&buf, 0); /* not external */
+  for (i = 0; i < numFiles; i++)
+    Buf_WriteUi64(&buf, (UInt64)132000000000000000 + (UInt64)i * 10000000);
+
+  Buf_WriteByte(&buf, k7zIdWinAttrib);
+  Buf_WriteNumber(&buf, 2 + (UInt64)numFiles * 4);
+  Buf_WriteByte(&buf, 1);
+  Buf_WriteByte(&buf, 0);
+  for (i = 0; i < numFiles; i++)
+    Buf_WriteUi32(&buf, GEN_ATTRIB_ARCHIVE);
+
+  Buf_WriteByte(&buf, k7zIdEnd); /* FilesInfo */
+  Buf_WriteByte(&buf, k7zIdEnd); /* Header */
+
+  if (buf.pos > buf.size)
+  {
+    free(buf.data);
+    return 1;
+  }
+
+  headerCrc = CrcCalc(buf.data, buf.pos);
+
+  memset(startHeader, 0, sizeof(startHeader));
+  startHeader[0] = '7'; startHeader[1] = 'z';
+  startHeader[2] = 0xBC; startHeader[3] = 0xAF; startHeader[4] = 0x27; startHeader[5] = 0x1C;
+  startHeader[6] = 0; startHeader[7] = 4;
+  SetUi64(startHeader + 12, 0);
+  SetUi64(startHeader + 20, buf.pos);
+  SetUi32(startHeader + 28, headerCrc);
+  SetUi32(startHeader + 8, CrcCalc(startHeader + 12, 20));
+
+  if (fwrite(startHeader, 1, sizeof(startHeader), f) != sizeof(startHeader)
+      || fwrite(buf.data, 1, buf.pos, f) != buf.pos)
+  {
+    free(buf.data);
+    return 1;
+  }
+  printf("%u files, header %u bytes\n", (unsigned)numFiles, (unsigned)buf.pos);
+  free(buf.data);
+  return 0;
+}
+
+int MY_CDECL main(int numArgs, const char *args[])
+{
+  FILE *f;
+  UInt32 numFiles;
+  UInt32 filesPerDir = GEN_FILES_PER_DIR;
+  int res;
+
+  if (numArgs < 3)
+  {
+    printf("\nUsage: 7zgen <numFiles> <archive.7z> [filesPerDir]\n");
+    return 1;
+  }
+  numFiles = (UInt32)strtoul(args[1], NULL, 10);
+  if (numArgs > 3)
+    filesPerDir = (UInt32)strtoul(args[3], NULL, 10);
+  if (numFiles == 0 || numFiles > ((UInt32)1 << 26) || filesPerDir == 0)
+  {
+    printf("\nincorrect number of files\n");
+    return 1;
+  }
+
+  CrcGenerateTable();
+
+  f = fopen(args[2], "wb");
+  if (!f)
+  {
+    printf("\ncan't open output file\n");
+    return 1;
+  }
+  res = WriteArchive(f, numFiles, filesPerDir);
+  if (fclose(f) != 0)
+    res = 1;
+  if (res != 0)
+    printf("\nwrite error\n");
+  return res;
+}
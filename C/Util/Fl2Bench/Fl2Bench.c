@@ -0,0 +1,902 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+/* Fl2Bench.c -- benchmark for the fast-lzma2 library.
+ * Compresses files or generated data over a matrix of levels, threads, dictionary sizes and
+ * dual buffer modes, verifies the round trip, and writes the results as JSON.
+ * Mode init times the match table initialization alone, serial against segmented.
+ * Mode dispatch times rounds of empty jobs on the thread pool. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../fast-lzma2/fast-lzma2.h"
+#include "../../fast-lzma2/fl2_errors.h"
+#include "../../fast-lzma2/util.h"    /* UTIL_getTime, UTIL_clockSpanMicro, UTIL_getFileSize */
+#include "../../fast-lzma2/radix_mf.h"
+#include "../../fast-lzma2/fl2_pool.h"
+
+#if defined(_WIN32)
+#  include <psapi.h>
+#elif defined(__linux__)
+   /* peak RSS is read from /proc */
+#else
+#  include <sys/resource.h>
+#endif
+
+#define BENCH_MAX_LIST 64
+#define BENCH_DEFAULT_GEN_SIZE ((size_t)16 << 20)
+#define BENCH_STREAM_CHUNK ((size_t)1 << 20)
+#define BENCH_DISPATCH_ROUNDS 2000
+
+#define BENCH_ERROR(name) ((size_t)-FL2_error_##name)
+
+typedef struct {
+    int values[BENCH_MAX_LIST];
+    unsigned count;
+} BenchList;
+
+typedef struct {
+    char name[260];
+    BYTE* data;
+    size_t size;
+} BenchInput;
+
+typedef enum {
+    BENCH_CCTX = 1,
+    BENCH_STREAM = 2,
+    BENCH_INIT = 4,
+    BENCH_DISPATCH = 8
+} BenchMode;
+
+typedef struct {
+    BenchList levels;
+    BenchList threads;
+    BenchList dictLogs;     /* 0 = the level's dictionary */
+    BenchList dualBuffers;  /* stream mode only */
+    BenchList largePages;
+    unsigned modes;
+    int high;
+    int strategy;           /* -1 = the level's value */
+    int depth;
+    int overlap;
+    int cycles;
+    int throughput;         /* FL2_p_minThroughput, -1 = unset */
+    unsigned iterations;
+    size_t genSize;
+    int quiet;
+} BenchParams;
+
+typedef struct {
+    size_t cSize;
+    U64 cTime;  /* best of all iterations, microseconds */
+    U64 dTime;
+    U64 peakRss;
+    U64 hugeBytes;
+    size_t memEstimate;
+    FL2_cStreamStats stats;
+    unsigned nbThreads;
+    size_t dictSize;
+    int strategy;
+    int depth;
+    int overlap;
+    int cycles;
+    int throughput;
+    int verified;
+} BenchResult;
+
+typedef struct {
+    size_t dictSize;
+    size_t blockSize;
+    unsigned nbThreads;
+    size_t segments;
+    int largePages;
+    U64 serialTime;     /* best of all iterations, microseconds */
+    U64 segmentedTime;
+    U64 mergeTime;      /* the serial part of the segmented time */
+    int sameProgress;   /* both paths returned the same progress */
+} BenchInitResult;
+
+/* Peak resident set size in bytes. On Linux the peak is reset for each configuration,
+ * elsewhere it is the peak for the process so far. Returns 0 if unknown. */
+static void BENCH_resetPeakRss(void)
+{
+#if defined(__linux__)
+    FILE* const f = fopen("/proc/self/clear_refs", "w");
+    if (f != NULL) {
+        fputs("5", f);
+        fclose(f);
+    }
+#endif
+}
+
+/* Anonymous memory backed by huge pages, which tells if FL2_p_largePages took effect.
+ * Returns 0 if unknown. */
+static U64 BENCH_hugePageBytes(void)
+{
+#if defined(__linux__)
+    U64 huge = 0;
+    char line[128];
+    FILE* const f = fopen("/proc/self/smaps_rollup", "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "AnonHugePages:", 14) == 0)
+            huge += strtoull(line + 14, NULL, 10) << 10;
+        else if (strncmp(line, "Private_Hugetlb:", 16) == 0)
+            huge += strtoull(line + 16, NULL, 10) << 10;
+    }
+    fclose(f);
+    return huge;
+#else
+    return 0;
+#endif
+}
+
+static U64 BENCH_peakRss(void)
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    U64 peak = 0;
+    char line[128];
+    FILE* const f = fopen("/proc/self/status", "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            peak = strtoull(line + 6, NULL, 10) << 10;
+            break;
+        }
+    }
+    fclose(f);
+    return peak;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#  if defined(__APPLE__)
+    return (U64)usage.ru_maxrss;
+#  else
+    return (U64)usage.ru_maxrss << 10;
+#  endif
+#endif
+}
+
+/* Deterministic generators, so results are comparable between runs and machines */
+
+/* xorshift32 : state must be nonzero */
+static U32 BENCH_rand(U32* const state)
+{
+    U32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void BENCH_genRandom(BYTE* const dst, size_t const size, U32 seed)
+{
+    seed |= 1;
+    for (size_t i = 0; i < size; ++i)
+        dst[i] = (BYTE)(BENCH_rand(&seed) >> 24);
+}
+
+/* Words from a small vocabulary with a skewed distribution, in lines of varying length */
+static void BENCH_genText(BYTE* const dst, size_t const size, U32 seed)
+{
+    static const char* const words[] = {
+        "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was", "with", "be", "by",
+        "on", "not", "he", "this", "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+        "they", "you", "were", "their", "one", "all", "we", "can", "her", "has", "there", "been", "if",
+        "more", "when", "will", "would", "who", "so", "no", "compression", "dictionary", "matchfinder",
+        "radix", "stream", "buffer", "thread", "encoder", "literal", "distance", "length", "block"
+    };
+    size_t const nbWords = sizeof(words) / sizeof(words[0]);
+    size_t pos = 0;
+    size_t lineLen = 0;
+
+    while (pos < size) {
+        U32 const r = BENCH_rand(&seed);
+        /* Favour the start of the list */
+        size_t const w = ((r & 0xFFFF) * (r & 0xFFFF) >> 16) * nbWords >> 16;
+        const char* word = words[w];
+        while (*word && pos < size)
+            dst[pos++] = (BYTE)*word++;
+        lineLen += strlen(words[w]) + 1;
+        if (pos < size) {
+            if (lineLen > 60 + (r >> 20) % 20) {
+                dst[pos++] = '\n';
+                lineLen = 0;
+            }
+            else {
+                dst[pos++] = ((r >> 16) % 17 == 0) ? ',' : ' ';
+            }
+        }
+    }
+}
+
+/* Fixed-size records of counters, small deltas, flags and occasional noise */
+static void BENCH_genBinary(BYTE* const dst, size_t const size, U32 seed)
+{
+    U32 counter = 0;
+    U32 value = 1000;
+    size_t pos = 0;
+
+    while (pos < size) {
+        BYTE record[16];
+        U32 const r = BENCH_rand(&seed);
+        value += (r & 0xF) - 7;
+        MEM_writeLE32(record, counter++);
+        MEM_writeLE32(record + 4, value);
+        MEM_writeLE32(record + 8, (r >> 4) & 0x3 ? 0 : r);
+        MEM_writeLE32(record + 12, 0xABCD0000U | ((r >> 8) & 0x7));
+        for (size_t i = 0; i < sizeof(record) && pos < size; ++i)
+            dst[pos++] = record[i];
+    }
+}
+
+/* Random phrases repeated at long distances, with some byte runs */
+static void BENCH_genRepeat(BYTE* const dst, size_t const size, U32 seed)
+{
+    size_t pos = 0;
+
+    while (pos < size) {
+        U32 const r = BENCH_rand(&seed);
+        size_t len = 16 + (r & 0x3FF);
+        if (len > size - pos)
+            len = size - pos;
+        if ((r >> 12) % 8 == 0) {
+            memset(dst + pos, (BYTE)(r >> 16), len);
+        }
+        else if (pos > ((size_t)1 << 16) && (r >> 12) % 8 != 1) {
+            size_t const dist = 1 + (size_t)BENCH_rand(&seed) % (pos < ((size_t)1 << 24) ? pos : ((size_t)1 << 24));
+            for (size_t i = 0; i < len; ++i)
+                dst[pos + i] = dst[pos + i - dist];
+        }
+        else {
+            BENCH_genRandom(dst + pos, len, r);
+        }
+        pos += len;
+    }
+}
+
+static int BENCH_loadInput(BenchInput* const input, const char* const name, size_t const genSize)
+{
+    static const struct {
+        const char* name;
+        void (*gen)(BYTE*, size_t, U32);
+    } generators[] = {
+        { "text", BENCH_genText },
+        { "binary", BENCH_genBinary },
+        { "random", BENCH_genRandom },
+        { "repeat", BENCH_genRepeat }
+    };
+
+    strncpy(input->name, name, sizeof(input->name) - 1);
+    input->name[sizeof(input->name) - 1] = 0;
+
+    if (strncmp(name, "gen:", 4) == 0) {
+        for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); ++i) {
+            if (strcmp(name + 4, generators[i].name) == 0) {
+                input->size = genSize;
+                input->data = malloc(genSize + !genSize);
+                if (input->data == NULL)
+                    return 1;
+                generators[i].gen(input->data, genSize, (U32)i + 1);
+                return 0;
+            }
+        }
+        fprintf(stderr, "Unknown generator: %s\n", name);
+        return 1;
+    }
+
+    U64 const fileSize = UTIL_getFileSize(name);
+    if (fileSize == UTIL_FILESIZE_UNKNOWN || fileSize != (size_t)fileSize) {
+        fprintf(stderr, "Can not read input file: %s\n", name);
+        return 1;
+    }
+    input->size = (size_t)fileSize;
+    input->data = malloc(input->size + !input->size);
+    if (input->data == NULL)
+        return 1;
+    FILE* const f = fopen(name, "rb");
+    if (f == NULL || fread(input->data, 1, input->size, f) != input->size) {
+        fprintf(stderr, "Can not read input file: %s\n", name);
+        if (f != NULL)
+            fclose(f);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Parse a list such as 1,3-6,9 */
+static int BENCH_parseList(BenchList* const list, const char* s)
+{
+    list->count = 0;
+    while (*s) {
+        char* end;
+        long first = strtol(s, &end, 10);
+        long last = first;
+        if (end == s)
+            return 1;
+        s = end;
+        if (*s == '-') {
+            ++s;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first)
+                return 1;
+            s = end;
+        }
+        for (long v = first; v <= last; ++v) {
+            if (list->count == BENCH_MAX_LIST)
+                return 1;
+            list->values[list->count++] = (int)v;
+        }
+        if (*s == ',')
+            ++s;
+        else if (*s)
+            return 1;
+    }
+    return list->count == 0;
+}
+
+static size_t BENCH_parseSize(const char* s)
+{
+    char* end;
+    size_t size = (size_t)strtoull(s, &end, 10);
+    if (*end == 'K' || *end == 'k')
+        size <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        size <<= 20;
+    else if (*end == 'G' || *end == 'g')
+        size <<= 30;
+    return size;
+}
+
+static size_t BENCH_compressStream(FL2_CStream* const fcs, const BenchInput* const input, void* const dst, size_t const dstCapacity)
+{
+    FL2_outBuffer out = { dst, dstCapacity, 0 };
+    size_t pos = 0;
+    size_t res = FL2_initCStream(fcs, 0);
+
+    if (FL2_isError(res))
+        return res;
+    /* Feed the input in pieces, as an application reading a file would */
+    while (pos < input->size) {
+        size_t const chunk = (input->size - pos < BENCH_STREAM_CHUNK) ? input->size - pos : BENCH_STREAM_CHUNK;
+        FL2_inBuffer in = { input->data + pos, chunk, 0 };
+        while (in.pos < in.size) {
+            res = FL2_compressStream(fcs, &out, &in);
+            if (FL2_isError(res))
+                return res;
+            if (res != 0 && out.pos == out.size)
+                return BENCH_ERROR(dstSize_tooSmall);
+        }
+        pos += chunk;
+    }
+    do {
+        res = FL2_endStream(fcs, &out);
+        if (FL2_isError(res))
+            return res;
+        if (res != 0 && out.pos == out.size)
+            return BENCH_ERROR(dstSize_tooSmall);
+    } while (res != 0);
+    return out.pos;
+}
+
+static void BENCH_setParams(FL2_CCtx* const cctx, const BenchParams* const p, int const level, int const dictLog, int const largePages)
+{
+    FL2_CCtx_setParameter(cctx, FL2_p_largePages, largePages);
+    FL2_CCtx_setParameter(cctx, FL2_p_highCompression, p->high);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, level);
+    if (dictLog > 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, dictLog);
+    if (p->strategy >= 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_strategy, p->strategy);
+    if (p->depth >= 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_searchDepth, p->depth);
+    if (p->overlap >= 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_overlapFraction, p->overlap);
+    if (p->cycles >= 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_hybridCycles, p->cycles);
+    if (p->throughput >= 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_minThroughput, p->throughput);
+}
+
+static size_t BENCH_run(const BenchInput* const input, const BenchParams* const p, BenchMode const mode,
+    int const level, unsigned const threads, int const dictLog, int const dualBuffer, int const largePages, BenchResult* const result)
+{
+    size_t const bound = FL2_compressBound(input->size);
+    BYTE* const cBuf = malloc(bound);
+    BYTE* const dBuf = malloc(input->size + !input->size);
+    FL2_CCtx* const cctx = (mode == BENCH_STREAM) ? FL2_createCStreamMt(threads, dualBuffer) : FL2_createCCtxMt(threads);
+    FL2_DCtx* const dctx = FL2_createDCtxMt(threads);
+    size_t res = 0;
+
+    memset(result, 0, sizeof(*result));
+    result->cTime = (U64)-1;
+    result->dTime = (U64)-1;
+    result->verified = 1;
+
+    if (cBuf == NULL || dBuf == NULL || cctx == NULL || dctx == NULL) {
+        res = BENCH_ERROR(memory_allocation);
+        goto cleanup;
+    }
+    BENCH_setParams(cctx, p, level, dictLog, largePages);
+    BENCH_resetPeakRss();
+
+    for (unsigned i = 0; i < p->iterations; ++i) {
+        UTIL_time_t start = UTIL_getTime();
+        if (mode == BENCH_STREAM)
+            res = BENCH_compressStream(cctx, input, cBuf, bound);
+        else
+            res = FL2_compressCCtx(cctx, cBuf, bound, input->data, input->size, 0);
+        U64 const cTime = UTIL_clockSpanMicro(start);
+        if (FL2_isError(res))
+            goto cleanup;
+        if (cTime < result->cTime) {
+            result->cTime = cTime;
+            FL2_getCStreamStats(cctx, NULL, &result->stats);
+        }
+        result->cSize = res;
+
+        start = UTIL_getTime();
+        res = FL2_decompressDCtx(dctx, dBuf, input->size, cBuf, result->cSize);
+        U64 const dTime = UTIL_clockSpanMicro(start);
+        if (FL2_isError(res))
+            goto cleanup;
+        if (dTime < result->dTime)
+            result->dTime = dTime;
+        if (res != input->size || memcmp(dBuf, input->data, input->size) != 0)
+            result->verified = 0;
+    }
+    result->peakRss = BENCH_peakRss();
+    result->hugeBytes = BENCH_hugePageBytes();
+    result->memEstimate = FL2_estimateCStreamSize_usingCStream(cctx);
+    result->nbThreads = FL2_getCCtxThreadCount(cctx);
+    result->dictSize = FL2_CCtx_getParameter(cctx, FL2_p_dictionarySize);
+    result->strategy = (int)FL2_CCtx_getParameter(cctx, FL2_p_strategy);
+    result->depth = (int)FL2_CCtx_getParameter(cctx, FL2_p_searchDepth);
+    result->overlap = (int)FL2_CCtx_getParameter(cctx, FL2_p_overlapFraction);
+    result->cycles = (int)FL2_CCtx_getParameter(cctx, FL2_p_hybridCycles);
+    result->throughput = (int)FL2_CCtx_getParameter(cctx, FL2_p_minThroughput);
+    res = 0;
+
+cleanup:
+    FL2_freeDCtx(dctx);
+    FL2_freeCCtx(cctx);
+    free(dBuf);
+    free(cBuf);
+    return res;
+}
+
+typedef struct {
+    FL2_matchTable* table;
+    const BYTE* data;
+    size_t end;
+} BenchInitJob;
+
+/* BENCH_initSegment() : FL2POOL_function type */
+static void BENCH_initSegment(void* const opaque, ptrdiff_t const n)
+{
+    BenchInitJob* const job = (BenchInitJob*)opaque;
+    RMF_initTableSegment(job->table, job->data, job->end, n);
+}
+
+/* Time the match table initialization on one thread and split into segments as the
+ * compressor does it, with the calling thread running segment 0 */
+static size_t BENCH_runInit(const BenchInput* const input, const BenchParams* const p,
+    unsigned const threads, int const dictLog, int const largePages, BenchInitResult* const result)
+{
+    RMF_parameters params;
+    FL2_matchTable* table;
+    FL2POOL_ctx* pool = NULL;
+    BenchInitJob job;
+
+    memset(result, 0, sizeof(*result));
+    result->serialTime = (U64)-1;
+    result->segmentedTime = (U64)-1;
+    result->sameProgress = 1;
+
+    memset(&params, 0, sizeof(params));
+    params.dictionary_size = dictLog > 0 ? (size_t)1 << dictLog : input->size;
+    params.depth = 42;
+    params.divide_and_conquer = 1;
+    params.large_pages = largePages != 0;
+    table = RMF_createMatchTable(&params, 0, threads);
+    if (table == NULL)
+        return BENCH_ERROR(memory_allocation);
+    if (threads > 1) {
+        pool = FL2POOL_create(threads - 1);
+        if (pool == NULL) {
+            RMF_freeMatchTable(table);
+            return BENCH_ERROR(memory_allocation);
+        }
+    }
+    result->dictSize = params.dictionary_size;
+    result->blockSize = input->size < params.dictionary_size ? input->size : params.dictionary_size;
+    result->nbThreads = threads;
+    result->largePages = largePages;
+    result->segments = RMF_initSegmentCount(table, result->blockSize);
+
+    job.table = table;
+    job.data = input->data;
+    job.end = result->blockSize;
+    for (unsigned i = 0; i < p->iterations; ++i) {
+        UTIL_time_t start = UTIL_getTime();
+        size_t const serial = RMF_initTable(table, job.data, job.end);
+        U64 time = UTIL_clockSpanMicro(start);
+        if (time < result->serialTime)
+            result->serialTime = time;
+
+        size_t segmented;
+        U64 mergeTime = 0;
+        start = UTIL_getTime();
+        if (result->segments > 1) {
+            FL2POOL_addRange(pool, BENCH_initSegment, &job, 1, result->segments);
+            RMF_initTableSegment(table, job.data, job.end, 0);
+            FL2POOL_waitAll(pool, 0);
+            UTIL_time_t const mergeStart = UTIL_getTime();
+            segmented = RMF_mergeTableSegments(table, job.data, job.end);
+            mergeTime = UTIL_clockSpanMicro(mergeStart);
+        }
+        else {
+            segmented = RMF_initTable(table, job.data, job.end);
+        }
+        time = UTIL_clockSpanMicro(start);
+        if (time < result->segmentedTime) {
+            result->segmentedTime = time;
+            result->mergeTime = mergeTime;
+        }
+        if (segmented != serial)
+            result->sameProgress = 0;
+    }
+    FL2POOL_free(pool);
+    RMF_freeMatchTable(table);
+    return 0;
+}
+
+/* BENCH_emptyJob() : FL2POOL_function type */
+static void BENCH_emptyJob(void* const opaque, ptrdiff_t const n)
+{
+    (void)opaque;
+    (void)n;
+}
+
+/* Time rounds of one empty job per thread followed by FL2POOL_waitAll(), which is the
+ * pattern of the match table build and the encoder. Returns the best average round time
+ * in microseconds, or a negative value if the pool could not be created. */
+static double BENCH_runDispatch(const BenchParams* const p, unsigned const threads)
+{
+    FL2POOL_ctx* const pool = FL2POOL_create(threads);
+    double best = -1.0;
+
+    if (pool == NULL)
+        return best;
+    /* Let the threads start */
+    FL2POOL_addRange(pool, BENCH_emptyJob, NULL, 0, threads);
+    FL2POOL_waitAll(pool, 0);
+
+    for (unsigned i = 0; i < p->iterations; ++i) {
+        UTIL_time_t const start = UTIL_getTime();
+        for (unsigned r = 0; r < BENCH_DISPATCH_ROUNDS; ++r) {
+            FL2POOL_addRange(pool, BENCH_emptyJob, NULL, 0, threads);
+            FL2POOL_waitAll(pool, 0);
+        }
+        double const round = (double)UTIL_clockSpanMicro(start) / BENCH_DISPATCH_ROUNDS;
+        if (best < 0 || round < best)
+            best = round;
+    }
+    FL2POOL_free(pool);
+    return best;
+}
+
+static void BENCH_printJsonString(FILE* const out, const char* s)
+{
+    fputc('"', out);
+    for (; *s; ++s) {
+        unsigned char const c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static double BENCH_mbps(size_t const size, U64 const micro)
+{
+    return micro ? (double)size / (double)micro : 0.0;
+}
+
+static void BENCH_printResult(FILE* const out, int const first, const BenchInput* const input, BenchMode const mode,
+    int const high, int const level, int const dualBuffer, int const largePages, const BenchResult* const r)
+{
+    fprintf(out, "%s    {\"input\": ", first ? "" : ",\n");
+    BENCH_printJsonString(out, input->name);
+    fprintf(out, ", \"size\": %llu, \"mode\": \"%s\", \"level\": %d, \"high\": %d,"
+        " \"threads\": %u, \"dictSize\": %llu, \"dualBuffer\": %d, \"largePages\": %d,"
+        " \"strategy\": %d, \"depth\": %d, \"overlap\": %d, \"cycles\": %d, \"minThroughput\": %d,\n",
+        (unsigned long long)input->size, mode == BENCH_STREAM ? "stream" : "cctx", level, high,
+        r->nbThreads, (unsigned long long)r->dictSize, mode == BENCH_STREAM ? dualBuffer : 0, largePages,
+        r->strategy, r->depth, r->overlap, r->cycles, r->throughput);
+    fprintf(out, "     \"compressedSize\": %llu, \"ratio\": %.4f, \"compressMBps\": %.2f, \"decompressMBps\": %.2f,"
+        " \"verified\": %s, \"peakRss\": %llu, \"hugePageBytes\": %llu, \"memEstimate\": %llu,\n",
+        (unsigned long long)r->cSize, r->cSize ? (double)input->size / (double)r->cSize : 0.0,
+        BENCH_mbps(input->size, r->cTime), BENCH_mbps(input->size, r->dTime),
+        r->verified ? "true" : "false", (unsigned long long)r->peakRss, (unsigned long long)r->hugeBytes,
+        (unsigned long long)r->memEstimate);
+    fprintf(out, "     \"phases\": {\"compressUs\": %llu, \"decompressUs\": %llu, \"initUs\": %llu, \"buildUs\": %llu,"
+        " \"encodeUs\": %llu, \"poolWaitUs\": %llu, \"blocks\": %llu, \"dictShiftBytes\": %llu, \"skippedBytes\": %llu,"
+        " \"fastChunks\": %llu}}",
+        (unsigned long long)r->cTime, (unsigned long long)r->dTime, r->stats.initTime, r->stats.buildTime,
+        r->stats.encodeTime, r->stats.poolWaitTime, r->stats.blocks, r->stats.dictShiftBytes, r->stats.skippedBytes,
+        r->stats.fastChunks);
+}
+
+static void BENCH_printInitResult(FILE* const out, int const first, const BenchInput* const input, const BenchInitResult* const r)
+{
+    fprintf(out, "%s    {\"input\": ", first ? "" : ",\n");
+    BENCH_printJsonString(out, input->name);
+    fprintf(out, ", \"size\": %llu, \"mode\": \"init\", \"threads\": %u, \"dictSize\": %llu, \"blockSize\": %llu, \"largePages\": %d,"
+        " \"segments\": %llu, \"serialUs\": %llu, \"segmentedUs\": %llu, \"mergeUs\": %llu, \"serialMBps\": %.2f, \"segmentedMBps\": %.2f,"
+        " \"sameProgress\": %s}",
+        (unsigned long long)input->size, r->nbThreads, (unsigned long long)r->dictSize, (unsigned long long)r->blockSize, r->largePages,
+        (unsigned long long)r->segments, (unsigned long long)r->serialTime, (unsigned long long)r->segmentedTime,
+        (unsigned long long)r->mergeTime,
+        BENCH_mbps(r->blockSize, r->serialTime), BENCH_mbps(r->blockSize, r->segmentedTime),
+        r->sameProgress ? "true" : "false");
+}
+
+static void BENCH_usage(void)
+{
+    fprintf(stderr,
+        "fl2bench " FL2_VERSION_STRING " : benchmark for fast-lzma2\n\n"
+        "Usage: fl2bench [options] input...\n"
+        "  input         file name, or gen:text, gen:binary, gen:random, gen:repeat\n"
+        "  -l LIST       compression levels, e.g. 1,3-6 (default 5)\n"
+        "  -x            use the high compression level table\n"
+        "  -t LIST       thread counts, 0 = all cores (default 1)\n"
+        "  -d LIST       dictionary size as a power of 2, 0 = the level's size (default 0)\n"
+        "  -b LIST       dual buffer modes for stream mode: 0, 1, 2 = pipelined (default 0)\n"
+        "  -p LIST       large pages off/on, see FL2_p_largePages (default 0)\n"
+        "  -m MODE       cctx, stream, all, or init to time match table initialization\n"
+        "                (default cctx). In init mode dictionary size 0 = the input size\n"
+        "  -m dispatch   time rounds of empty pool jobs for each thread count, no input\n"
+        "  -i N          iterations per configuration, the fastest is reported (default 3)\n"
+        "  -s SIZE       size of generated inputs, K/M/G suffix allowed (default 16M)\n"
+        "  -o FILE       write the JSON results to FILE (default stdout)\n"
+        "  -q            no progress messages\n"
+        "  --strategy=N  override the strategy: 0 = fast, 1 = opt, 2 = ultra\n"
+        "  --depth=N     override the search depth\n"
+        "  --overlap=N   override the block overlap in 1/16 units\n"
+        "  --cycles=N    override the hybrid mode cycles\n"
+        "  --throughput=N  minimum compression speed in MB/s, see FL2_p_minThroughput\n");
+}
+
+static int BENCH_parseOverride(const char* const arg, const char* const name, int* const value)
+{
+    size_t const len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return 0;
+    *value = atoi(arg + len + 1);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    BenchParams p;
+    const char* outName = NULL;
+    BenchInput* inputs = calloc(argc, sizeof(BenchInput));
+    unsigned nbInputs = 0;
+
+    if (inputs == NULL)
+        return 1;
+
+    memset(&p, 0, sizeof(p));
+    p.levels.values[0] = 5;
+    p.levels.count = 1;
+    p.threads.values[0] = 1;
+    p.threads.count = 1;
+    p.dictLogs.count = 1;
+    p.dualBuffers.count = 1;
+    p.largePages.count = 1;
+    p.modes = BENCH_CCTX;
+    p.strategy = -1;
+    p.depth = -1;
+    p.overlap = -1;
+    p.cycles = -1;
+    p.throughput = -1;
+    p.iterations = 3;
+    p.genSize = BENCH_DEFAULT_GEN_SIZE;
+
+    const char** names = (const char**)calloc(argc, sizeof(char*));
+    if (names == NULL)
+        return 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* const arg = argv[i];
+        int bad = 0;
+        if (arg[0] != '-' || arg[1] == 0) {
+            names[nbInputs++] = arg;
+        }
+        else if (arg[1] == '-') {
+            bad = !BENCH_parseOverride(arg + 2, "strategy", &p.strategy)
+                && !BENCH_parseOverride(arg + 2, "depth", &p.depth)
+                && !BENCH_parseOverride(arg + 2, "overlap", &p.overlap)
+                && !BENCH_parseOverride(arg + 2, "cycles", &p.cycles)
+                && !BENCH_parseOverride(arg + 2, "throughput", &p.throughput);
+        }
+        else if (arg[2] != 0) {
+            bad = 1;
+        }
+        else if (arg[1] == 'x') {
+            p.high = 1;
+        }
+        else if (arg[1] == 'q') {
+            p.quiet = 1;
+        }
+        else if (i + 1 == argc) {
+            bad = 1;
+        }
+        else {
+            const char* const val = argv[++i];
+            switch (arg[1]) {
+            case 'l': bad = BENCH_parseList(&p.levels, val); break;
+            case 't': bad = BENCH_parseList(&p.threads, val); break;
+            case 'd': bad = BENCH_parseList(&p.dictLogs, val); break;
+            case 'b': bad = BENCH_parseList(&p.dualBuffers, val); break;
+            case 'p': bad = BENCH_parseList(&p.largePages, val); break;
+            case 'i': p.iterations = (unsigned)atoi(val); bad = (p.iterations == 0); break;
+            case 's': p.genSize = BENCH_parseSize(val); break;
+            case 'o': outName = val; break;
+            case 'm':
+                if (strcmp(val, "cctx") == 0)
+                    p.modes = BENCH_CCTX;
+                else if (strcmp(val, "stream") == 0)
+                    p.modes = BENCH_STREAM;
+                else if (strcmp(val, "all") == 0)
+                    p.modes = BENCH_CCTX | BENCH_STREAM;
+                else if (strcmp(val, "init") == 0)
+                    p.modes = BENCH_INIT;
+                else if (strcmp(val, "dispatch") == 0)
+                    p.modes = BENCH_DISPATCH;
+                else
+                    bad = 1;
+                break;
+            default: bad = 1; break;
+            }
+        }
+        if (bad) {
+            fprintf(stderr, "Incorrect option: %s\n", arg);
+            BENCH_usage();
+            return 1;
+        }
+    }
+    if (nbInputs == 0 && p.modes != BENCH_DISPATCH) {
+        BENCH_usage();
+        return 1;
+    }
+
+    for (unsigned n = 0; n < nbInputs; ++n) {
+        if (BENCH_loadInput(&inputs[n], names[n], p.genSize) != 0)
+            return 1;
+    }
+
+    FILE* const out = (outName != NULL) ? fopen(outName, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Can not write output file: %s\n", outName);
+        return 1;
+    }
+
+    fprintf(out, "{\"version\": \"" FL2_VERSION_STRING "\", \"iterations\": %u, \"results\": [\n", p.iterations);
+
+    int first = 1;
+    int failed = 0;
+    for (unsigned n = 0; n < nbInputs; ++n)
+    for (unsigned mode = BENCH_CCTX; mode <= BENCH_STREAM; mode <<= 1) {
+        if (!(p.modes & mode))
+            continue;
+        for (unsigned l = 0; l < p.levels.count; ++l)
+        for (unsigned t = 0; t < p.threads.count; ++t)
+        for (unsigned d = 0; d < p.dictLogs.count; ++d)
+        for (unsigned b = 0; b < (mode == BENCH_STREAM ? p.dualBuffers.count : 1); ++b)
+        for (unsigned lp = 0; lp < p.largePages.count; ++lp) {
+            int const level = p.levels.values[l];
+            int const dualBuffer = (mode == BENCH_STREAM) ? p.dualBuffers.values[b] : 0;
+            int const largePages = p.largePages.values[lp];
+            BenchResult result;
+
+            if (!p.quiet)
+                fprintf(stderr, "%s %s level %d threads %d dict %d dual %d large pages %d\n", inputs[n].name,
+                    mode == BENCH_STREAM ? "stream" : "cctx", level, p.threads.values[t], p.dictLogs.values[d], dualBuffer, largePages);
+
+            size_t const res = BENCH_run(&inputs[n], &p, (BenchMode)mode, level, (unsigned)p.threads.values[t],
+                p.dictLogs.values[d], dualBuffer, largePages, &result);
+            if (FL2_isError(res)) {
+                fprintf(stderr, "Error: %s\n", FL2_getErrorName(res));
+                failed = 1;
+                continue;
+            }
+            if (!result.verified) {
+                fprintf(stderr, "Error: decompressed data differs\n");
+                failed = 1;
+            }
+            BENCH_printResult(out, first, &inputs[n], (BenchMode)mode, p.high, level, dualBuffer, largePages, &result);
+            first = 0;
+            fflush(out);
+        }
+    }
+    if (p.modes & BENCH_INIT) {
+        for (unsigned n = 0; n < nbInputs; ++n)
+        for (unsigned t = 0; t < p.threads.count; ++t)
+        for (unsigned d = 0; d < p.dictLogs.count; ++d)
+        for (unsigned lp = 0; lp < p.largePages.count; ++lp) {
+            unsigned const threads = p.threads.values[t] > 0 ? (unsigned)p.threads.values[t] : (unsigned)UTIL_countPhysicalCores();
+            BenchInitResult result;
+
+            if (!p.quiet)
+                fprintf(stderr, "%s init threads %u dict %d large pages %d\n", inputs[n].name, threads, p.dictLogs.values[d],
+                    p.largePages.values[lp]);
+
+            size_t const res = BENCH_runInit(&inputs[n], &p, threads, p.dictLogs.values[d], p.largePages.values[lp], &result);
+            if (FL2_isError(res)) {
+                fprintf(stderr, "Error: %s\n", FL2_getErrorName(res));
+                failed = 1;
+                continue;
+            }
+            if (!result.sameProgress) {
+                fprintf(stderr, "Error: segmented initialization differs\n");
+                failed = 1;
+            }
+            BENCH_printInitResult(out, first, &inputs[n], &result);
+            first = 0;
+            fflush(out);
+        }
+    }
+    if (p.modes & BENCH_DISPATCH) {
+        for (unsigned t = 0; t < p.threads.count; ++t) {
+            unsigned const threads = p.threads.values[t] > 0 ? (unsigned)p.threads.values[t] : (unsigned)UTIL_countPhysicalCores();
+
+            if (!p.quiet)
+                fprintf(stderr, "dispatch threads %u\n", threads);
+
+            double const round = BENCH_runDispatch(&p, threads);
+            if (round < 0) {
+                fprintf(stderr, "Error: %s\n", FL2_getErrorName(BENCH_ERROR(memory_allocation)));
+                failed = 1;
+                continue;
+            }
+            fprintf(out, "%s    {\"mode\": \"dispatch\", \"threads\": %u, \"rounds\": %u, \"roundUs\": %.2f}",
+                first ? "" : ",\n", threads, BENCH_DISPATCH_ROUNDS, round);
+            first = 0;
+            fflush(out);
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    if (out != stdout)
+        fclose(out);
+    for (unsigned n = 0; n < nbInputs; ++n)
+        free(inputs[n].data);
+    free(inputs);
+    free((void*)names);
+
+    return failed;
+}
@@ -0,0 +1,1018 @@
+/*
+* Copyright (c) 2019, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+/* Fl2Test.c -- round trip tests for the fast-lzma2 decoder.
+ * Streams made by FL2_compressCCtx with several reset intervals are decoded by FL2_decompressMt,
+ * FL2_decompressDCtx and the streaming decoder with several thread counts and buffer sizes.
+ * Truncated and corrupted streams must fail cleanly. Each strategy must round trip with several
+ * settings of lc/lp/pb. Contexts attached to a shared thread pool compress at the same time and
+ * must round trip, as must streams with one buffer, two buffers and pipelined match table
+ * building. Reusing the overlap links must not change the output. Input compressed in place in
+ * source mode must round trip, and must refuse more input. Each item of a batch must match
+ * FL2_compressCCtx output for the item alone. Stream counters must total the input. Random data
+ * must be skipped as incompressible, but random data with repeated bytes must not. Stream
+ * parameters are fitted to memory limits, and lines of /proc/self/cgroup are parsed for the
+ * memory limit. Returns 0 if all tests pass. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../fast-lzma2/fast-lzma2.h"
+#include "../../fast-lzma2/fl2_errors.h"
+#include "../../fast-lzma2/mem.h"
+#include "../../fast-lzma2/fl2_threading.h"   /* FL2_pthread_create, FL2_pthread_join */
+#include "../../fast-lzma2/util.h"            /* UTIL_parseCgroupLine */
+
+#define TEST_DICT_LOG 20    /* the smallest dictionary, so a few MB of input has several resets */
+#define TEST_SIZE ((size_t)5 << 20)
+
+#define TEST_ERROR(name) ((size_t)-FL2_error_##name)
+
+typedef struct {
+    const BYTE* src;
+    size_t srcSize;
+    const BYTE* comp;
+    size_t compSize;
+    BYTE* dst;
+    const char* name;
+} TestCase;
+
+static unsigned g_failures = 0;
+static unsigned g_tests = 0;
+static int g_verbose = 0;
+
+#define TEST_FAIL(tc, ...) do { \
+    ++g_failures; \
+    fprintf(stderr, "FAIL %s : ", (tc)->name); \
+    fprintf(stderr, __VA_ARGS__); \
+    fputc('\n', stderr); \
+} while (0)
+
+/* xorshift32 : state must be nonzero */
+static U32 TEST_rand(U32* const state)
+{
+    U32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/* Phrases from a small vocabulary, repeats at long distances and some random runs */
+static void TEST_genData(BYTE* const dst, size_t const size, U32 seed)
+{
+    static const char* const words[] = {
+        "the ", "of ", "and ", "radix ", "match ", "finder ", "dictionary ", "reset ", "thread ", "stream ",
+        "chunk ", "literal ", "length ", "distance ", "\n", ", "
+    };
+    size_t pos = 0;
+
+    seed |= 1;
+    while (pos < size) {
+        U32 const r = TEST_rand(&seed);
+        size_t len;
+        if ((r & 7) < 5) {
+            const char* const word = words[(r >> 3) & 15];
+            len = strlen(word);
+            if (len > size - pos)
+                len = size - pos;
+            memcpy(dst + pos, word, len);
+        }
+        else if ((r & 7) == 5 && pos > 4096) {
+            size_t const dist = 1 + (TEST_rand(&seed) % pos);
+            len = 8 + ((r >> 8) & 0xFF);
+            if (len > size - pos)
+                len = size - pos;
+            for (size_t i = 0; i < len; ++i)
+                dst[pos + i] = dst[pos + i - dist];
+        }
+        else {
+            len = 1 + ((r >> 8) & 0x3F);
+            if (len > size - pos)
+                len = size - pos;
+            for (size_t i = 0; i < len; ++i)
+                dst[pos + i] = (BYTE)(TEST_rand(&seed) >> 24);
+        }
+        pos += len;
+    }
+}
+
+static size_t TEST_compress(const BYTE* const src, size_t const srcSize, BYTE* const dst, size_t const dstCapacity,
+    int const level, int const resetInterval, unsigned const nbThreads)
+{
+    FL2_CCtx* const cctx = FL2_createCCtxMt(nbThreads);
+    size_t res;
+
+    if (cctx == NULL)
+        return TEST_ERROR(memory_allocation);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, level);
+    FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    res = FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, resetInterval);
+    if (!FL2_isError(res))
+        res = FL2_compressCCtx(cctx, dst, dstCapacity, src, srcSize, 0);
+    FL2_freeCCtx(cctx);
+    return res;
+}
+
+static void TEST_check(const TestCase* const tc, size_t const res, const char* const what, unsigned const nbThreads)
+{
+    ++g_tests;
+    if (FL2_isError(res))
+        TEST_FAIL(tc, "%s, %u threads : %s", what, nbThreads, FL2_getErrorName(res));
+    else if (res != tc->srcSize)
+        TEST_FAIL(tc, "%s, %u threads : size %u, expected %u", what, nbThreads, (unsigned)res, (unsigned)tc->srcSize);
+    else if (tc->srcSize != 0 && memcmp(tc->dst, tc->src, tc->srcSize) != 0)
+        TEST_FAIL(tc, "%s, %u threads : decompressed data differs", what, nbThreads);
+    else if (g_verbose)
+        fprintf(stderr, "ok   %s : %s, %u threads\n", tc->name, what, nbThreads);
+}
+
+/* Decode with the streaming API, feeding at most inStep bytes and taking at most outStep bytes per call.
+ * memLimit = 0 leaves the default. Returns the decompressed size, or an error code. */
+static size_t TEST_decompressStream(const BYTE* const comp, size_t const compSize, BYTE* const dst, size_t const dstCapacity,
+    unsigned const nbThreads, size_t const inStep, size_t const outStep, size_t const memLimit, int* const finished)
+{
+    FL2_DStream* const fds = FL2_createDStreamMt(nbThreads);
+    FL2_outBuffer out = { dst, 0, 0 };
+    FL2_inBuffer in = { comp, 0, 0 };
+    size_t res;
+
+    *finished = 0;
+    if (fds == NULL)
+        return TEST_ERROR(memory_allocation);
+    if (memLimit != 0)
+        FL2_setDStreamMemoryLimitMt(fds, memLimit);
+    res = FL2_initDStream(fds);
+    while (!FL2_isError(res)) {
+        size_t const inPos = in.pos;
+        size_t const outPos = out.pos;
+        in.size = (compSize - in.pos > inStep) ? in.pos + inStep : compSize;
+        out.size = (dstCapacity - out.pos > outStep) ? out.pos + outStep : dstCapacity;
+        res = FL2_decompressStream(fds, &out, &in);
+        if (FL2_isError(res))
+            break;
+        if (res == 0) {
+            *finished = 1;
+            res = out.pos;
+            break;
+        }
+        /* No progress possible : input exhausted or output full */
+        if (in.pos == inPos && out.pos == outPos && in.size == compSize && out.size == dstCapacity) {
+            res = out.pos;
+            break;
+        }
+    }
+    FL2_freeDStream(fds);
+    return res;
+}
+
+static void TEST_roundTrip(TestCase* const tc)
+{
+    static const unsigned threads[] = { 1, 2, 4 };
+
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+        unsigned const nbThreads = threads[t];
+
+        memset(tc->dst, 0, tc->srcSize);
+        TEST_check(tc, FL2_decompressMt(tc->dst, tc->srcSize, tc->comp, tc->compSize, nbThreads), "FL2_decompressMt", nbThreads);
+
+        {
+            FL2_DCtx* const dctx = FL2_createDCtxMt(nbThreads);
+            if (dctx == NULL) {
+                TEST_FAIL(tc, "FL2_createDCtxMt");
+                continue;
+            }
+            /* Twice, to check the context is reusable */
+            for (int i = 0; i < 2; ++i) {
+                memset(tc->dst, 0, tc->srcSize);
+                TEST_check(tc, FL2_decompressDCtx(dctx, tc->dst, tc->srcSize, tc->comp, tc->compSize), "FL2_decompressDCtx", nbThreads);
+            }
+            FL2_freeDCtx(dctx);
+        }
+
+        {
+            static const struct {
+                size_t inStep;
+                size_t outStep;
+                size_t memLimit;
+                const char* name;
+            } modes[] = {
+                { (size_t)-1, (size_t)-1, 0, "stream, whole buffers" },
+                { 4093, 65521, 0, "stream, small buffers" },
+                { 1 << 20, 1000, 0, "stream, small output" },
+                /* Segments larger than the memory limit force the single-threaded circular dictionary */
+                { 65536, 65536, (size_t)3 << 20, "stream, low memory limit" }
+            };
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+                int finished;
+                memset(tc->dst, 0, tc->srcSize);
+                size_t const res = TEST_decompressStream(tc->comp, tc->compSize, tc->dst, tc->srcSize,
+                    nbThreads, modes[m].inStep, modes[m].outStep, modes[m].memLimit, &finished);
+                if (!FL2_isError(res) && !finished) {
+                    ++g_tests;
+                    TEST_FAIL(tc, "%s, %u threads : end of stream not reported", modes[m].name, nbThreads);
+                    continue;
+                }
+                TEST_check(tc, res, modes[m].name, nbThreads);
+            }
+        }
+    }
+}
+
+/* A truncated stream must not be reported as complete */
+static void TEST_truncated(const TestCase* const tc)
+{
+    size_t const cuts[] = { 1, 2, tc->compSize / 3, tc->compSize / 2, tc->compSize - 2, tc->compSize - 1 };
+
+    for (size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); ++c) {
+        size_t const cut = cuts[c];
+        if (cut == 0 || cut >= tc->compSize)
+            continue;
+        for (unsigned nbThreads = 1; nbThreads <= 4; nbThreads *= 2) {
+            int finished;
+            size_t res;
+
+            ++g_tests;
+            res = FL2_decompressMt(tc->dst, tc->srcSize, tc->comp, cut, nbThreads);
+            if (!FL2_isError(res))
+                TEST_FAIL(tc, "FL2_decompressMt, %u threads : stream cut to %u bytes accepted", nbThreads, (unsigned)cut);
+
+            ++g_tests;
+            res = TEST_decompressStream(tc->comp, cut, tc->dst, tc->srcSize, nbThreads, 65536, (size_t)-1, 0, &finished);
+            if (finished)
+                TEST_FAIL(tc, "stream, %u threads : stream cut to %u bytes reported complete", nbThreads, (unsigned)cut);
+        }
+    }
+}
+
+/* Corrupted streams must not crash or write beyond the output buffer. Not all corruption is
+ * detectable without a checksum, so any result within bounds is accepted. */
+static void TEST_corrupt(const TestCase* const tc)
+{
+    BYTE* const bad = malloc(tc->compSize);
+    U32 seed = 0x1234567;
+
+    if (bad == NULL) {
+        TEST_FAIL(tc, "out of memory");
+        return;
+    }
+    for (int i = 0; i < 24; ++i) {
+        memcpy(bad, tc->comp, tc->compSize);
+        /* Corrupt the first bytes of a chunk header or of the data */
+        size_t const pos = (i < 4) ? (size_t)i : (size_t)(TEST_rand(&seed) % tc->compSize);
+        bad[pos] ^= (BYTE)(1 + (TEST_rand(&seed) & 0xFE));
+
+        for (unsigned nbThreads = 1; nbThreads <= 4; nbThreads *= 2) {
+            int finished;
+            size_t res;
+
+            ++g_tests;
+            res = FL2_decompressMt(tc->dst, tc->srcSize, bad, tc->compSize, nbThreads);
+            if (!FL2_isError(res) && res > tc->srcSize)
+                TEST_FAIL(tc, "FL2_decompressMt, %u threads : corrupt byte at %u, size %u out of bounds", nbThreads, (unsigned)pos, (unsigned)res);
+
+            ++g_tests;
+            res = TEST_decompressStream(bad, tc->compSize, tc->dst, tc->srcSize, nbThreads, 65536, (size_t)-1, 0, &finished);
+            if (!FL2_isError(res) && res > tc->srcSize)
+                TEST_FAIL(tc, "stream, %u threads : corrupt byte at %u, size %u out of bounds", nbThreads, (unsigned)pos, (unsigned)res);
+        }
+    }
+    free(bad);
+}
+
+typedef struct {
+    const BYTE* src;
+    size_t srcSize;
+    BYTE* comp;
+    size_t compCapacity;
+    FL2_threadPool* pool;
+    int stream;
+    size_t res;
+} TestPoolJob;
+
+static void* TEST_poolThread(void* const arg)
+{
+    TestPoolJob* const job = (TestPoolJob*)arg;
+    FL2_CCtx* const cctx = job->stream ? FL2_createCStreamWithPool(4, 1, job->pool) : FL2_createCCtxWithPool(4, job->pool);
+
+    if (cctx == NULL) {
+        job->res = TEST_ERROR(memory_allocation);
+        return NULL;
+    }
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 3);
+    FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    if (job->stream) {
+        FL2_outBuffer out = { job->comp, job->compCapacity, 0 };
+        FL2_inBuffer in = { job->src, job->srcSize, 0 };
+        job->res = FL2_initCStream(cctx, 0);
+        while (!FL2_isError(job->res) && in.pos < in.size)
+            job->res = FL2_compressStream(cctx, &out, &in);
+        while (!FL2_isError(job->res) && (job->res = FL2_endStream(cctx, &out)) != 0 && out.pos < out.size)
+            ;
+        if (!FL2_isError(job->res))
+            job->res = job->res ? TEST_ERROR(dstSize_tooSmall) : out.pos;
+    }
+    else {
+        job->res = FL2_compressCCtx(cctx, job->comp, job->compCapacity, job->src, job->srcSize, 0);
+    }
+    FL2_freeCCtx(cctx);
+    return NULL;
+}
+
+/* Compress with the streaming API, feeding at most inStep bytes per call, with FL2_p_reuseOverlap set to
+ * reuseOverlap */
+static size_t TEST_compressStream(const BYTE* const src, size_t const srcSize, BYTE* const dst, size_t const dstCapacity,
+    unsigned const nbThreads, int const dualBuffer, size_t const inStep, int const reuseOverlap)
+{
+    FL2_CStream* const fcs = FL2_createCStreamMt(nbThreads, dualBuffer);
+    FL2_outBuffer out = { dst, dstCapacity, 0 };
+    FL2_inBuffer in = { src, 0, 0 };
+    size_t res;
+
+    if (fcs == NULL)
+        return TEST_ERROR(memory_allocation);
+    FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, 5);
+    FL2_CCtx_setParameter(fcs, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    FL2_CCtx_setParameter(fcs, FL2_p_reuseOverlap, reuseOverlap);
+    res = FL2_initCStream(fcs, 0);
+    while (!FL2_isError(res) && in.pos < srcSize) {
+        in.size = (srcSize - in.pos > inStep) ? in.pos + inStep : srcSize;
+        res = FL2_compressStream(fcs, &out, &in);
+    }
+    while (!FL2_isError(res) && (res = FL2_endStream(fcs, &out)) != 0 && out.pos < out.size)
+        ;
+    if (!FL2_isError(res))
+        res = res ? TEST_ERROR(dstSize_tooSmall) : out.pos;
+    FL2_freeCStream(fcs);
+    return res;
+}
+
+/* Streams with one buffer, two buffers and pipelined match table building must round trip */
+static void TEST_dualBuffer(const BYTE* const src, size_t const srcSize)
+{
+    static const char* const names[] = { "single buffer", "dual buffer", "pipelined" };
+    size_t const bound = FL2_compressBound(srcSize);
+    BYTE* const comp = malloc(bound);
+    BYTE* const dst = malloc(srcSize);
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "dual buffer";
+    tc.src = src;
+    tc.srcSize = srcSize;
+    tc.comp = comp;
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+    if (comp == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    for (int dual = 0; dual <= FL2_DUAL_BUFFER_PIPELINED; ++dual) {
+        size_t const res = TEST_compressStream(src, srcSize, comp, bound, 4, dual, 65536, 0);
+        if (FL2_isError(res)) {
+            ++g_tests;
+            TEST_FAIL(&tc, "%s : %s", names[dual], FL2_getErrorName(res));
+            continue;
+        }
+        TEST_check(&tc, FL2_decompress(dst, srcSize, comp, res), names[dual], 4);
+    }
+
+cleanup:
+    free(dst);
+    free(comp);
+}
+
+/* Compress with FL2_compressCCtx and FL2_p_reuseOverlap set to reuse */
+static size_t TEST_compressReuse(const BYTE* const src, size_t const srcSize, BYTE* const dst, size_t const dstCapacity,
+    int const level, unsigned const nbThreads, int const reuse)
+{
+    FL2_CCtx* const cctx = FL2_createCCtxMt(nbThreads);
+    size_t res;
+
+    if (cctx == NULL)
+        return TEST_ERROR(memory_allocation);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, level);
+    FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    res = FL2_CCtx_setParameter(cctx, FL2_p_reuseOverlap, reuse);
+    if (!FL2_isError(res))
+        res = FL2_compressCCtx(cctx, dst, dstCapacity, src, srcSize, 0);
+    FL2_freeCCtx(cctx);
+    return res;
+}
+
+/* Reusing the overlap links must not change the output of FL2_compressCCtx or of streams */
+static void TEST_reuseOverlap(const BYTE* const src, size_t const srcSize)
+{
+    static const char* const names[] = {
+        "level 1, 1 thread", "level 6, 2 threads", "stream, single buffer", "stream, pipelined"
+    };
+    size_t const bound = FL2_compressBound(srcSize);
+    BYTE* const comp[2] = { malloc(bound), malloc(bound) };
+    BYTE* const dst = malloc(srcSize);
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "reuse overlap";
+    tc.src = src;
+    tc.srcSize = srcSize;
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+    if (comp[0] == NULL || comp[1] == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    for (int i = 0; i < 4; ++i) {
+        size_t sizes[2];
+
+        for (int reuse = 0; reuse < 2; ++reuse) {
+            if (i == 0)
+                sizes[reuse] = TEST_compressReuse(src, srcSize, comp[reuse], bound, 1, 1, reuse);
+            else if (i == 1)
+                sizes[reuse] = TEST_compressReuse(src, srcSize, comp[reuse], bound, 6, 2, reuse);
+            else
+                sizes[reuse] = TEST_compressStream(src, srcSize, comp[reuse], bound, 4,
+                    (i == 2) ? 0 : FL2_DUAL_BUFFER_PIPELINED, 65536, reuse);
+        }
+        ++g_tests;
+        if (FL2_isError(sizes[0]) || FL2_isError(sizes[1])) {
+            TEST_FAIL(&tc, "%s : %s", names[i], FL2_getErrorName(FL2_isError(sizes[0]) ? sizes[0] : sizes[1]));
+            continue;
+        }
+        if (sizes[0] != sizes[1] || memcmp(comp[0], comp[1], sizes[0]) != 0)
+            TEST_FAIL(&tc, "%s : %u bytes with reuse, %u without", names[i], (unsigned)sizes[1], (unsigned)sizes[0]);
+        TEST_check(&tc, FL2_decompress(dst, srcSize, comp[1], sizes[1]), names[i], (i < 2) ? i + 1 : 4);
+    }
+
+cleanup:
+    free(dst);
+    free(comp[1]);
+    free(comp[0]);
+}
+
+/* Compress all of src in source mode, taking at most outStep bytes of output per call to FL2_endStream */
+static size_t TEST_compressSource(const BYTE* const src, size_t const srcSize, BYTE* const dst, size_t const dstCapacity,
+    unsigned const nbThreads, int const dualBuffer, size_t const outStep)
+{
+    FL2_CStream* const fcs = FL2_createCStreamMt(nbThreads, dualBuffer);
+    FL2_outBuffer out = { dst, 0, 0 };
+    size_t res;
+
+    if (fcs == NULL)
+        return TEST_ERROR(memory_allocation);
+    FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, 5);
+    FL2_CCtx_setParameter(fcs, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    res = FL2_initCStreamSource(fcs, srcSize ? src : NULL, srcSize, 0);
+    if (!FL2_isError(res)) {
+        /* No other input can be added */
+        FL2_inBuffer in = { src, 1, 0 };
+        if (!FL2_isError(FL2_compressStream(fcs, &out, &in)))
+            res = TEST_ERROR(GENERIC);
+    }
+    while (!FL2_isError(res)) {
+        out.size = (dstCapacity - out.pos > outStep) ? out.pos + outStep : dstCapacity;
+        res = FL2_endStream(fcs, &out);
+        if (res == 0 || out.size == dstCapacity)
+            break;
+    }
+    if (!FL2_isError(res))
+        res = res ? TEST_ERROR(dstSize_tooSmall) : out.pos;
+    FL2_freeCStream(fcs);
+    return res;
+}
+
+/* Input compressed in place must round trip, for one and several threads, with and without
+ * pipelined table building, and for input smaller than the dictionary */
+static void TEST_sourceMode(const BYTE* const src)
+{
+    static const size_t sizes[] = { 0, 1000, (size_t)3 << 19, TEST_SIZE };
+    size_t const bound = FL2_compressBound(TEST_SIZE);
+    BYTE* const comp = malloc(bound);
+    BYTE* const dst = malloc(TEST_SIZE);
+    char name[64];
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "source mode";
+    tc.src = src;
+    tc.comp = comp;
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+    if (comp == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    tc.name = name;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        tc.srcSize = sizes[i];
+        snprintf(name, sizeof(name), "source mode, size %u", (unsigned)tc.srcSize);
+        for (int dual = 0; dual <= FL2_DUAL_BUFFER_PIPELINED; dual += FL2_DUAL_BUFFER_PIPELINED) {
+            const char* const what = dual ? "pipelined" : "single buffer";
+            for (unsigned t = 1; t <= 4; t += 3) {
+                size_t const res = TEST_compressSource(src, tc.srcSize, comp, bound, t, dual, 65536);
+                if (FL2_isError(res)) {
+                    ++g_tests;
+                    TEST_FAIL(&tc, "%s, %u threads : %s", what, t, FL2_getErrorName(res));
+                    continue;
+                }
+                TEST_check(&tc, FL2_decompress(dst, tc.srcSize, comp, res), what, t);
+            }
+        }
+    }
+
+cleanup:
+    free(dst);
+    free(comp);
+}
+
+/* Compress with FL2_compressCCtx using the given strategy and lc/lp/pb */
+static size_t TEST_compressProps(const BYTE* const src, size_t const srcSize, BYTE* const dst, size_t const dstCapacity,
+    int const strategy, unsigned const lc, unsigned const lp, unsigned const pb)
+{
+    FL2_CCtx* const cctx = FL2_createCCtxMt(2);
+    size_t res;
+
+    if (cctx == NULL)
+        return TEST_ERROR(memory_allocation);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 6);
+    FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    FL2_CCtx_setParameter(cctx, FL2_p_strategy, strategy);
+    /* lp first, because lc + lp must not exceed FL2_LCLP_MAX at any time */
+    FL2_CCtx_setParameter(cctx, FL2_p_literalPosBits, 0);
+    res = FL2_CCtx_setParameter(cctx, FL2_p_literalCtxBits, lc);
+    if (!FL2_isError(res))
+        res = FL2_CCtx_setParameter(cctx, FL2_p_literalPosBits, lp);
+    if (!FL2_isError(res))
+        res = FL2_CCtx_setParameter(cctx, FL2_p_posBits, pb);
+    if (!FL2_isError(res))
+        res = FL2_compressCCtx(cctx, dst, dstCapacity, src, srcSize, 0);
+    FL2_freeCCtx(cctx);
+    return res;
+}
+
+/* Each strategy must round trip with the default lc/lp/pb, which has its own encoder instance,
+ * and with other settings */
+static void TEST_lcLpPb(const BYTE* const src, size_t const srcSize)
+{
+    static const unsigned props[][3] = { { 3, 0, 2 }, { 0, 0, 0 }, { 4, 0, 4 }, { 1, 3, 1 }, { 0, 2, 2 } };
+    static const char* const strategies[] = { "fast", "opt", "ultra" };
+    size_t const bound = FL2_compressBound(srcSize);
+    BYTE* const comp = malloc(bound);
+    BYTE* const dst = malloc(srcSize);
+    char name[64];
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "lc lp pb";
+    tc.src = src;
+    tc.srcSize = srcSize;
+    tc.comp = comp;
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+    if (comp == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    tc.name = name;
+    for (size_t i = 0; i < sizeof(props) / sizeof(props[0]); ++i) {
+        snprintf(name, sizeof(name), "lc %u lp %u pb %u", props[i][0], props[i][1], props[i][2]);
+        for (int strategy = 0; strategy < 3; ++strategy) {
+            size_t const res = TEST_compressProps(src, srcSize, comp, bound, strategy,
+                props[i][0], props[i][1], props[i][2]);
+            if (FL2_isError(res)) {
+                ++g_tests;
+                TEST_FAIL(&tc, "%s : %s", strategies[strategy], FL2_getErrorName(res));
+                continue;
+            }
+            TEST_check(&tc, FL2_decompress(dst, srcSize, comp, res), strategies[strategy], 2);
+        }
+    }
+
+cleanup:
+    free(dst);
+    free(comp);
+}
+
+/* The totals of the stream counters must account for all of the input */
+static void TEST_streamStats(const BYTE* const src, size_t const srcSize)
+{
+    size_t const bound = FL2_compressBound(srcSize);
+    BYTE* const comp = malloc(bound);
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "stream stats";
+    tc.src = src;
+    tc.srcSize = srcSize;
+    fprintf(stderr, "%s\n", tc.name);
+    if (comp == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        return;
+    }
+    for (int dual = 0; dual <= FL2_DUAL_BUFFER_PIPELINED; dual += FL2_DUAL_BUFFER_PIPELINED) {
+        FL2_CStream* const fcs = FL2_createCStreamMt(4, dual);
+        FL2_outBuffer out = { comp, bound, 0 };
+        FL2_inBuffer in = { src, srcSize, 0 };
+        FL2_cStreamStats block, total;
+        size_t res;
+
+        ++g_tests;
+        if (fcs == NULL) {
+            TEST_FAIL(&tc, "out of memory");
+            continue;
+        }
+        FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, 5);
+        FL2_CCtx_setParameter(fcs, FL2_p_dictionaryLog, TEST_DICT_LOG);
+        res = FL2_initCStream(fcs, 0);
+        while (!FL2_isError(res) && in.pos < in.size)
+            res = FL2_compressStream(fcs, &out, &in);
+        while (!FL2_isError(res) && (res = FL2_endStream(fcs, &out)) != 0)
+            ;
+        FL2_getCStreamStats(fcs, &block, &total);
+        if (FL2_isError(res))
+            TEST_FAIL(&tc, "dual %d : %s", dual, FL2_getErrorName(res));
+        else if (total.inputSize != srcSize)
+            TEST_FAIL(&tc, "dual %d : input size %llu", dual, total.inputSize);
+        else if (total.blocks < srcSize >> TEST_DICT_LOG || block.blocks != 1 || block.inputSize > total.inputSize)
+            TEST_FAIL(&tc, "dual %d : %llu blocks, last block %llu bytes", dual, total.blocks, block.inputSize);
+        else if (total.compressedChunks == 0 || total.encodeBusyTime == 0)
+            TEST_FAIL(&tc, "dual %d : %llu chunks, %llu us busy", dual, total.compressedChunks, total.encodeBusyTime);
+        FL2_freeCStream(fcs);
+    }
+    free(comp);
+}
+
+/* Two contexts of 4 threads attached to one pool of 2 threads compress at once */
+static void TEST_sharedPool(const BYTE* const src, size_t const srcSize)
+{
+    size_t const bound = FL2_compressBound(srcSize);
+    FL2_threadPool* const pool = FL2_createThreadPool(2);
+    BYTE* const dst = malloc(srcSize);
+    TestPoolJob jobs[2];
+    FL2_pthread_t threads[2];
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "shared pool";
+    tc.src = src;
+    tc.srcSize = srcSize;
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+
+    ++g_tests;
+    if (FL2_getThreadPoolSize(pool) != 2 || FL2_getThreadPoolSize(NULL) != 0)
+        TEST_FAIL(&tc, "FL2_getThreadPoolSize returned %u", FL2_getThreadPoolSize(pool));
+    if (pool == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        free(dst);
+        FL2_freeThreadPool(pool);
+        return;
+    }
+    for (int i = 0; i < 2; ++i) {
+        jobs[i].src = src;
+        jobs[i].srcSize = srcSize;
+        jobs[i].compCapacity = bound;
+        jobs[i].comp = malloc(bound);
+        jobs[i].pool = pool;
+        jobs[i].stream = i;
+        jobs[i].res = TEST_ERROR(memory_allocation);
+        if (jobs[i].comp != NULL && FL2_pthread_create(&threads[i], NULL, TEST_poolThread, &jobs[i]) != 0) {
+            free(jobs[i].comp);
+            jobs[i].comp = NULL;
+        }
+    }
+    for (int i = 0; i < 2; ++i) {
+        const char* const what = jobs[i].stream ? "stream with pool" : "cctx with pool";
+        if (jobs[i].comp == NULL) {
+            ++g_tests;
+            TEST_FAIL(&tc, "%s : thread not started", what);
+            continue;
+        }
+        FL2_pthread_join(threads[i], NULL);
+        if (FL2_isError(jobs[i].res)) {
+            ++g_tests;
+            TEST_FAIL(&tc, "%s : %s", what, FL2_getErrorName(jobs[i].res));
+        }
+        else {
+            TEST_check(&tc, FL2_decompress(dst, srcSize, jobs[i].comp, jobs[i].res), what, 4);
+        }
+        free(jobs[i].comp);
+    }
+    FL2_freeThreadPool(pool);
+    free(dst);
+}
+
+/* Compress with FL2_p_skipIncompressible set to skip. Returns the compressed size or an error, and the
+ * bytes skipped in *skipped */
+static size_t TEST_compressSkip(const BYTE* const src, size_t const srcSize, BYTE* const dst, size_t const dstCapacity,
+    int const skip, unsigned long long* const skipped)
+{
+    FL2_CCtx* const cctx = FL2_createCCtx();
+    FL2_cStreamStats stats;
+    size_t res;
+
+    *skipped = 0;
+    if (cctx == NULL)
+        return TEST_ERROR(memory_allocation);
+    FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, 5);
+    FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, TEST_DICT_LOG);
+    FL2_CCtx_setParameter(cctx, FL2_p_skipIncompressible, skip);
+    res = FL2_compressCCtx(cctx, dst, dstCapacity, src, srcSize, 0);
+    FL2_getCStreamStats(cctx, NULL, &stats);
+    *skipped = stats.skippedBytes;
+    FL2_freeCCtx(cctx);
+    return res;
+}
+
+/* Random data must be skipped. Random data with every byte written twice has a flat character
+ * distribution but compresses to about half, so it must not be skipped */
+static void TEST_skipIncompressible(void)
+{
+    size_t const randomSize = (size_t)2 << 20;
+    size_t const srcSize = randomSize * 2;
+    size_t const bound = FL2_compressBound(srcSize);
+    BYTE* const src = malloc(srcSize);
+    BYTE* const comp = malloc(bound);
+    BYTE* const dst = malloc(srcSize);
+    U32 seed = 0x5EED;
+    size_t sizes[2];
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "skip incompressible";
+    tc.src = src;
+    tc.srcSize = srcSize;
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+    if (src == NULL || comp == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    for (size_t i = 0; i < randomSize; ++i)
+        src[i] = (BYTE)(TEST_rand(&seed) >> 24);
+    for (size_t i = 0; i < randomSize; i += 2)
+        src[randomSize + i] = src[randomSize + i + 1] = (BYTE)(TEST_rand(&seed) >> 24);
+
+    for (int skip = 0; skip < 2; ++skip) {
+        const char* const what = skip ? "skip on" : "skip off";
+        unsigned long long skipped;
+        size_t const res = TEST_compressSkip(src, srcSize, comp, bound, skip, &skipped);
+
+        sizes[skip] = res;
+        ++g_tests;
+        if (FL2_isError(res)) {
+            TEST_FAIL(&tc, "%s : %s", what, FL2_getErrorName(res));
+            goto cleanup;
+        }
+        if (skip ? (skipped == 0 || skipped > randomSize) : skipped != 0)
+            TEST_FAIL(&tc, "%s : %llu bytes skipped", what, skipped);
+        fprintf(stderr, "%s : %u -> %u bytes, %llu skipped\n", what, (unsigned)srcSize, (unsigned)res, skipped);
+        TEST_check(&tc, FL2_decompress(dst, srcSize, comp, res), what, 1);
+    }
+    ++g_tests;
+    if (sizes[1] > sizes[0] + sizes[0] / 100)
+        TEST_FAIL(&tc, "skipping made the output larger : %u bytes, %u without", (unsigned)sizes[1], (unsigned)sizes[0]);
+
+cleanup:
+    free(dst);
+    free(comp);
+    free(src);
+}
+
+/* Items of a batch, one of them empty, must each be the same as FL2_compressCCtx output for the item
+ * alone. The second batch reuses the match tables of the first */
+static void TEST_compressBatch(const BYTE* const src)
+{
+    static const size_t sizes[] = { 100000, 0, 1, 1000, 300000, (size_t)3 << 19, 65536 };
+    size_t const nbItems = sizeof(sizes) / sizeof(sizes[0]);
+    size_t const bound = FL2_compressBound((size_t)3 << 19);
+    FL2_CCtx* const cctx = FL2_createCCtxMt(3);
+    BYTE* const comp = malloc(bound * nbItems);
+    BYTE* const ref = malloc(bound);
+    BYTE* const dst = malloc((size_t)3 << 19);
+    FL2_batchItem items[sizeof(sizes) / sizeof(sizes[0])];
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "compress batch";
+    tc.dst = dst;
+    fprintf(stderr, "%s\n", tc.name);
+    if (cctx == NULL || comp == NULL || ref == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        const char* const what = pass ? "second batch" : "first batch";
+        size_t res;
+
+        /* The level sets the dictionary size, so it must come first */
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, pass ? 6 : 5);
+        FL2_CCtx_setParameter(cctx, FL2_p_dictionaryLog, TEST_DICT_LOG);
+        FL2_CCtx_setParameter(cctx, FL2_p_resetInterval, 4);
+
+        for (size_t i = 0; i < nbItems; ++i) {
+            items[i].src = src + i * 4096;
+            items[i].srcSize = sizes[i];
+            items[i].dst = comp + i * bound;
+            items[i].dstCapacity = bound;
+            items[i].cSize = 0;
+        }
+        res = FL2_compressBatch(cctx, items, nbItems, 0);
+        ++g_tests;
+        if (FL2_isError(res)) {
+            TEST_FAIL(&tc, "%s : %s", what, FL2_getErrorName(res));
+            continue;
+        }
+        for (size_t i = 0; i < nbItems; ++i) {
+            size_t const refSize = TEST_compress(items[i].src, sizes[i], ref, bound, pass ? 6 : 5, 4, 1);
+
+            tc.src = items[i].src;
+            tc.srcSize = sizes[i];
+            ++g_tests;
+            if (FL2_isError(refSize))
+                TEST_FAIL(&tc, "%s, item %u : FL2_compressCCtx : %s", what, (unsigned)i, FL2_getErrorName(refSize));
+            else if (items[i].cSize != refSize || memcmp(items[i].dst, ref, refSize) != 0)
+                TEST_FAIL(&tc, "%s, item %u : %u bytes differ from FL2_compressCCtx, %u bytes", what, (unsigned)i,
+                    (unsigned)items[i].cSize, (unsigned)refSize);
+            TEST_check(&tc, FL2_decompress(dst, sizes[i], items[i].dst, items[i].cSize), what, 3);
+        }
+    }
+
+cleanup:
+    free(dst);
+    free(ref);
+    free(comp);
+    FL2_freeCCtx(cctx);
+}
+
+/* Check one FL2_fitCStreamParams result against the expected configuration */
+static void TEST_fitCase(const TestCase* const tc, const char* const what, unsigned long long const memLimit,
+    size_t const dictSize, unsigned const nbThreads, int const dualBuffer)
+{
+    FL2_compressionParameters params;
+    unsigned t = 4;
+    int dual = FL2_DUAL_BUFFER_PIPELINED;
+    size_t size;
+
+    ++g_tests;
+    FL2_getLevelParameters(7, 0, &params);
+    size = FL2_fitCStreamParams(&params, &t, &dual, memLimit);
+    if (params.dictionarySize != dictSize || t != nbThreads || dual != dualBuffer)
+        TEST_FAIL(tc, "%s : dict %u, %u threads, dual %d, expected dict %u, %u threads, dual %d", what,
+            (unsigned)params.dictionarySize, t, dual, (unsigned)dictSize, nbThreads, dualBuffer);
+    else if (size != FL2_estimateCStreamSize_byParams(&params, t, dual))
+        TEST_FAIL(tc, "%s : result %u is not the estimate", what, (unsigned)size);
+    else if (memLimit != 0 && size > memLimit && !(t == 1 && dual == 0 && dictSize == FL2_DICTSIZE_MIN))
+        TEST_FAIL(tc, "%s : %u bytes over the limit", what, (unsigned)size);
+}
+
+/* The fit keeps the dictionary, then the threads, then the dual buffer */
+static void TEST_fitParams(void)
+{
+    FL2_compressionParameters params;
+    size_t dict;
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "fit params";
+    fprintf(stderr, "%s\n", tc.name);
+
+    FL2_getLevelParameters(7, 0, &params);
+    dict = params.dictionarySize;
+    TEST_fitCase(&tc, "no limit", 0, dict, 4, FL2_DUAL_BUFFER_PIPELINED);
+    TEST_fitCase(&tc, "exact fit", FL2_estimateCStreamSize_byParams(&params, 4, FL2_DUAL_BUFFER_PIPELINED),
+        dict, 4, FL2_DUAL_BUFFER_PIPELINED);
+    TEST_fitCase(&tc, "pipelined too big", FL2_estimateCStreamSize_byParams(&params, 4, FL2_DUAL_BUFFER_PIPELINED) - 1,
+        dict, 4, 1);
+    TEST_fitCase(&tc, "dual too big", FL2_estimateCStreamSize_byParams(&params, 4, 1) - 1, dict, 4, 0);
+    TEST_fitCase(&tc, "threads too many", FL2_estimateCStreamSize_byParams(&params, 4, 0) - 1, dict, 3, 0);
+    TEST_fitCase(&tc, "one thread", FL2_estimateCStreamSize_byParams(&params, 2, 0) - 1, dict, 1, 0);
+    /* 64 MB does not fit in 256 MB with 4 threads, the next step of 48 MB does with 3 */
+    TEST_fitCase(&tc, "256 MB", (unsigned long long)256 << 20, (size_t)48 << 20, 3, 0);
+    TEST_fitCase(&tc, "nothing fits", 1, FL2_DICTSIZE_MIN, 1, 0);
+}
+
+/* Lines of /proc/self/cgroup must be classified as v2, v1 memory or other */
+static void TEST_cgroupParse(void)
+{
+    static const struct {
+        const char* line;
+        int version;
+        const char* dir;
+    } lines[] = {
+        { "0::/user.slice/user-1000.slice/session-2.scope\n", 2, "/user.slice/user-1000.slice/session-2.scope" },
+        { "0::/\n", 2, "/" },
+        { "4:memory:/docker/abc\n", 1, "/docker/abc" },
+        { "7:cpu,memory:/kubepods\n", 1, "/kubepods" },
+        { "3:cpu,cpuacct:/docker/abc\n", 0, NULL },
+        { "10::/not/v2\n", 0, NULL },
+        { "0:memory\n", 0, NULL },
+        { "garbage\n", 0, NULL }
+    };
+    TestCase tc;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.name = "cgroup parse";
+    fprintf(stderr, "%s\n", tc.name);
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); ++i) {
+        char buff[128];
+        char* dir = NULL;
+        int version;
+
+        ++g_tests;
+        strcpy(buff, lines[i].line);
+        version = UTIL_parseCgroupLine(buff, &dir);
+        if (version != lines[i].version)
+            TEST_FAIL(&tc, "%s : version %d, expected %d", lines[i].line, version, lines[i].version);
+        else if (version != 0 && strcmp(dir, lines[i].dir) != 0)
+            TEST_FAIL(&tc, "%s : path %s", lines[i].line, dir);
+    }
+}
+
+static void TEST_run(const BYTE* const src, size_t const srcSize, int const level, int const resetInterval,
+    unsigned const cThreads, int const damage)
+{
+    char name[128];
+    size_t const bound = FL2_compressBound(srcSize);
+    BYTE* const comp = malloc(bound);
+    BYTE* const dst = malloc(srcSize + !srcSize);
+    TestCase tc;
+
+    snprintf(name, sizeof(name), "size %u level %d resetInterval %d cthreads %u",
+        (unsigned)srcSize, level, resetInterval, cThreads);
+    tc.name = name;
+    tc.src = src;
+    tc.srcSize = srcSize;
+    tc.comp = comp;
+    tc.dst = dst;
+
+    if (comp == NULL || dst == NULL) {
+        TEST_FAIL(&tc, "out of memory");
+        goto cleanup;
+    }
+    tc.compSize = TEST_compress(src, srcSize, comp, bound, level, resetInterval, cThreads);
+    if (FL2_isError(tc.compSize)) {
+        TEST_FAIL(&tc, "compression : %s", FL2_getErrorName(tc.compSize));
+        goto cleanup;
+    }
+    ++g_tests;
+    if (FL2_findDecompressedSize(comp, tc.compSize) != srcSize)
+        TEST_FAIL(&tc, "FL2_findDecompressedSize returned %llu", FL2_findDecompressedSize(comp, tc.compSize));
+
+    fprintf(stderr, "%s : %u -> %u bytes\n", name, (unsigned)srcSize, (unsigned)tc.compSize);
+    TEST_roundTrip(&tc);
+    if (damage) {
+        TEST_truncated(&tc);
+        TEST_corrupt(&tc);
+    }
+
+cleanup:
+    free(dst);
+    free(comp);
+}
+
+int main(int argc, char** argv)
+{
+    static const int resetIntervals[] = { 1, 2, 4, 0 };
+    BYTE* const data = malloc(TEST_SIZE);
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+        g_verbose = 1;
+    if (data == NULL)
+        return 1;
+    TEST_genData(data, TEST_SIZE, 1);
+
+    /* Edge cases */
+    TEST_run(data, 0, 5, 4, 1, 0);
+    TEST_run(data, 1, 5, 4, 1, 0);
+    TEST_run(data, 1000, 5, 4, 1, 1);
+
+    for (size_t r = 0; r < sizeof(resetIntervals) / sizeof(resetIntervals[0]); ++r) {
+        /* Fast and optimized strategies, single and multithreaded encoders */
+        TEST_run(data, TEST_SIZE, 1, resetIntervals[r], 1, r == 0 || r == 3);
+        TEST_run(data, TEST_SIZE, 6, resetIntervals[r], 2, 0);
+    }
+
+    TEST_lcLpPb(data, (size_t)3 << 19);
+    TEST_sharedPool(data, TEST_SIZE);
+    TEST_dualBuffer(data, TEST_SIZE);
+    TEST_reuseOverlap(data, TEST_SIZE);
+    TEST_sourceMode(data);
+    TEST_compressBatch(data);
+    TEST_streamStats(data, TEST_SIZE);
+    TEST_skipIncompressible();
+    TEST_fitParams();
+    TEST_cgroupParse();
+
+    free(data);
+    fprintf(stderr, "%u tests, %u failures\n", g_tests, g_failures);
+    return g_failures != 0;
+}
@@ -18,6 +18,9 @@
 
 #include "XzEnc.h"
 
+#include "fast-lzma2/fast-lzma2.h"
+#include "fast-lzma2/fl2_errors.h"
+
 // #define _7ZIP_ST
 
 #ifndef _7ZIP_ST
@@ -480,6 +483,7 @@ void XzProps_Init(CXzProps *p)
   p->reduceSize = (UInt64)(Int64)-1;
   p->forceWriteSizesInHeader = 0;
   // p->forceWriteSizesInHeader = 1;
+  p->fastLzma2 = 0;
 
   XzFilterProps_Init(&p->filterProps);
   Lzma2EncProps_Init(&p->lzma2Props);
@@ -571,6 +575,14 @@ static void XzProps_Normalize(CXzProps *p)
   /* we normalize xzProps properties, but we normalize only some of CXzProps::lzma2Props properties.
      Lzma2Enc_SetProps() will normalize lzma2Props later. */
   
+  if (p->fastLzma2)
+  {
+    // XzEnc_SetFastProps() selects the block size. All threads are used by Fast LZMA2 inside the block.
+    p->numBlockThreads_Reduced = 1;
+    p->numBlockThreads_Max = 1;
+    return;
+  }
+
   if (p->blockSize == XZ_PROPS__BLOCK_SIZE__SOLID)
   {
     p->lzma2Props.lzmaProps.reduceSize = p->reduceSize;
@@ -701,6 +713,45 @@ typedef struct
 } CXzEncBlockInfo;
 
 
+/* returns the pre-filter of block, or NULL if there is none */
+
+static CXzFilter *XzBlock_SetFilters(CXzBlock *block, const CXzFilterProps *fp, Byte lzma2Prop)
+{
+  unsigned filterIndex = 0;
+  CXzFilter *filter = NULL;
+  
+  XzBlock_ClearFlags(block);
+  XzBlock_SetNumFilters(block, 1 + (fp ? 1 : 0));
+  
+  if (fp)
+  {
+    filter = &block->filters[filterIndex++];
+    filter->id = fp->id;
+    filter->propsSize = 0;
+    
+    if (fp->id == XZ_ID_Delta)
+    {
+      filter->props[0] = (Byte)(fp->delta - 1);
+      filter->propsSize = 1;
+    }
+    else if (fp->ipDefined)
+    {
+      SetUi32(filter->props, fp->ip);
+      filter->propsSize = 4;
+    }
+  }
+  
+  {
+    CXzFilter *f = &block->filters[filterIndex++];
+    f->id = XZ_ID_LZMA2;
+    f->propsSize = 1;
+    f->props[0] = lzma2Prop;
+  }
+
+  return filter;
+}
+
+
 static SRes Xz_CompressBlock(
     CLzma2WithFilters *lzmaf,
     
@@ -723,8 +774,7 @@ static SRes Xz_CompressBlock(
   CSeqCheckInStream checkInStream;
   CSeqSizeOutStream seqSizeOutStream;
   CXzBlock block;
-  unsigned filterIndex = 0;
-  CXzFilter *filter = NULL;
+  CXzFilter *filter;
   const CXzFilterProps *fp = &props->filterProps;
   if (fp->id == 0)
     fp = NULL;
@@ -735,33 +785,7 @@ static SRes Xz_CompressBlock(
   
   RINOK(Lzma2Enc_SetProps(lzmaf->lzma2, &props->lzma2Props));
   
-  XzBlock_ClearFlags(&block);
-  XzBlock_SetNumFilters(&block, 1 + (fp ? 1 : 0));
-  
-  if (fp)
-  {
-    filter = &block.filters[filterIndex++];
-    filter->id = fp->id;
-    filter->propsSize = 0;
-    
-    if (fp->id == XZ_ID_Delta)
-    {
-      filter->props[0] = (Byte)(fp->delta - 1);
-      filter->propsSize = 1;
-    }
-    else if (fp->ipDefined)
-    {
-      SetUi32(filter->props, fp->ip);
-      filter->propsSize = 4;
-    }
-  }
-  
-  {
-    CXzFilter *f = &block.filters[filterIndex++];
-    f->id = XZ_ID_LZMA2;
-    f->propsSize = 1;
-    f->props[0] = Lzma2Enc_WriteProperties(lzmaf->lzma2);
-  }
+  filter = XzBlock_SetFilters(&block, fp, Lzma2Enc_WriteProperties(lzmaf->lzma2));
   
   seqSizeOutStream.vt.Write = SeqSizeOutStream_Write;
   seqSizeOutStream.realStream = outStream;
@@ -902,6 +926,228 @@ static SRes Xz_CompressBlock(
 
 
 
+/* ---------- Fast LZMA2 ---------- */
+
+/*
+  Fast LZMA2 compresses each xz block as a separate LZMA2 stream that starts with a dictionary reset,
+  so the blocks can be decoded in parallel. The block is compressed in the dictionary buffer(s) of FL2_CStream,
+  which uses all threads, so there is one block thread.
+*/
+
+#define XZ_FAST_BLOCK_SIZE_MIN ((UInt64)1 << 20)
+#define XZ_FAST_BLOCK_SIZE_MAX ((UInt64)1 << 28)
+#define XZ_FAST_TIMEOUT 500
+
+static SRes Fl2_ToSRes(size_t res)
+{
+  if (!FL2_isError(res))
+    return SZ_OK;
+  switch (FL2_getErrorCode(res))
+  {
+    case FL2_error_memory_allocation: return SZ_ERROR_MEM;
+    case FL2_error_canceled: return SZ_ERROR_PROGRESS;
+    case FL2_error_parameter_unsupported:
+    case FL2_error_parameter_outOfBound:
+    case FL2_error_lclpMax_exceeded: return SZ_ERROR_PARAM;
+    default: break;
+  }
+  return SZ_ERROR_FAIL;
+}
+
+static SRes XzFast_Progress(FL2_CStream *fcs, ICompressProgress *progress)
+{
+  if (progress)
+  {
+    unsigned long long outSize;
+    unsigned long long inSize = FL2_getCStreamProgress(fcs, &outSize);
+    SRes res = ICompressProgress_Progress(progress, inSize, outSize);
+    if (res != SZ_OK)
+    {
+      FL2_cancelCStream(fcs);
+      return res;
+    }
+  }
+  return SZ_OK;
+}
+
+static SRes XzFast_Wait(FL2_CStream *fcs, size_t *res, ICompressProgress *progress)
+{
+  while (FL2_isTimedOut(*res))
+  {
+    RINOK(XzFast_Progress(fcs, progress));
+    *res = FL2_waitCStream(fcs);
+  }
+  return Fl2_ToSRes(*res);
+}
+
+static SRes XzFast_WriteBuffers(FL2_CStream *fcs, ISeqOutStream *s)
+{
+  for (;;)
+  {
+    FL2_cBuffer cbuf;
+    size_t res;
+    do
+      res = FL2_getNextCompressedBuffer(fcs, &cbuf);
+    while (FL2_isTimedOut(res));
+    RINOK(Fl2_ToSRes(res));
+    if (res == 0)
+      return SZ_OK;
+    RINOK(WriteBytes(s, cbuf.src, cbuf.size));
+  }
+}
+
+
+static SRes Xz_CompressBlockFast(
+    CLzma2WithFilters *lzmaf, // only the filter is used
+    FL2_CStream *fcs,
+    
+    ISeqOutStream *outStream,
+    Byte *outBufHeader,
+    Byte *outBufData, size_t outBufDataLimit,
+
+    ISeqInStream *inStream,
+
+    const CXzProps *props,
+    ICompressProgress *progress,
+    int *inStreamFinished,
+    CXzEncBlockInfo *blockSizes,
+    ISzAllocPtr alloc)
+{
+  CSeqCheckInStream checkInStream;
+  CSeqSizeOutStream seqSizeOutStream;
+  CXzBlock block;
+  CXzFilter *filter;
+  ISeqInStream *reader;
+  size_t res;
+  const CXzFilterProps *fp = &props->filterProps;
+  if (fp->id == 0)
+    fp = NULL;
+  
+  *inStreamFinished = False;
+
+  RINOK(Fl2_ToSRes(FL2_initCStream(fcs, 0)));
+  
+  filter = XzBlock_SetFilters(&block, fp, FL2_getCCtxDictProp(fcs));
+  
+  seqSizeOutStream.vt.Write = SeqSizeOutStream_Write;
+  seqSizeOutStream.realStream = outStream;
+  seqSizeOutStream.outBuf = outBufData;
+  seqSizeOutStream.outBufLimit = outBufDataLimit;
+  seqSizeOutStream.processed = 0;
+  
+  if (outStream)
+  {
+    RINOK(XzBlock_WriteHeader(&block, &seqSizeOutStream.vt));
+  }
+  
+  checkInStream.vt.Read = SeqCheckInStream_Read;
+  SeqCheckInStream_Init(&checkInStream, props->checkId);
+  
+  checkInStream.realStream = inStream;
+  checkInStream.data = NULL;
+  checkInStream.limit = props->blockSize;
+
+  reader = &checkInStream.vt;
+  if (fp)
+  {
+    lzmaf->filter.realStream = &checkInStream.vt;
+    RINOK(SeqInFilter_Init(&lzmaf->filter, filter, alloc));
+    reader = &lzmaf->filter.p;
+  }
+
+  /* read the input directly into the dictionary buffer */
+  for (;;)
+  {
+    FL2_dictBuffer dict;
+    size_t pos = 0;
+    
+    res = FL2_getDictionaryBuffer(fcs, &dict);
+    while (FL2_isTimedOut(res))
+    {
+      RINOK(XzFast_Progress(fcs, progress));
+      res = FL2_getDictionaryBuffer(fcs, &dict);
+    }
+    RINOK(Fl2_ToSRes(res));
+
+    while (pos < dict.size)
+    {
+      size_t size = dict.size - pos;
+      SRes sres = ISeqInStream_Read(reader, (Byte *)dict.dst + pos, &size);
+      if (sres != SZ_OK)
+      {
+        FL2_cancelCStream(fcs);
+        return sres;
+      }
+      if (size == 0)
+        break;
+      pos += size;
+    }
+
+    if (pos != 0)
+    {
+      res = FL2_updateDictionary(fcs, pos);
+      RINOK(XzFast_Wait(fcs, &res, progress));
+      if (res != 0)
+      {
+        RINOK(XzFast_WriteBuffers(fcs, &seqSizeOutStream.vt));
+      }
+    }
+    RINOK(XzFast_Progress(fcs, progress));
+    
+    if (pos != dict.size)
+      break;
+  }
+
+  res = FL2_endStream(fcs, NULL);
+  RINOK(XzFast_Wait(fcs, &res, progress));
+  while (res != 0)
+  {
+    RINOK(XzFast_WriteBuffers(fcs, &seqSizeOutStream.vt));
+    res = FL2_endStream(fcs, NULL);
+    RINOK(XzFast_Wait(fcs, &res, progress));
+  }
+  
+  blockSizes->unpackSize = checkInStream.processed;
+  {
+    Byte buf[4 + 64];
+    unsigned padSize = XZ_GET_PAD_SIZE(seqSizeOutStream.processed);
+    UInt64 packSize = seqSizeOutStream.processed;
+    
+    buf[0] = 0;
+    buf[1] = 0;
+    buf[2] = 0;
+    buf[3] = 0;
+    
+    SeqCheckInStream_GetDigest(&checkInStream, buf + 4);
+    RINOK(WriteBytes(&seqSizeOutStream.vt, buf + (4 - padSize), padSize + XzFlags_GetCheckSize((CXzStreamFlags)props->checkId)));
+    
+    blockSizes->totalSize = seqSizeOutStream.processed - padSize;
+    
+    if (!outStream)
+    {
+      seqSizeOutStream.outBuf = outBufHeader;
+      seqSizeOutStream.outBufLimit = XZ_BLOCK_HEADER_SIZE_MAX;
+      seqSizeOutStream.processed = 0;
+      
+      block.unpackSize = blockSizes->unpackSize;
+      XzBlock_SetHasUnpackSize(&block);
+      
+      block.packSize = packSize;
+      XzBlock_SetHasPackSize(&block);
+      
+      RINOK(XzBlock_WriteHeader(&block, &seqSizeOutStream.vt));
+      
+      blockSizes->headerSize = (size_t)seqSizeOutStream.processed;
+      blockSizes->totalSize += seqSizeOutStream.processed;
+    }
+  }
+  
+  *inStreamFinished = checkInStream.realStreamFinished;
+  return SZ_OK;
+}
+
+
+
 typedef struct
 {
   ICompressProgress vt;
@@ -933,6 +1179,9 @@ typedef struct
   CXzEncIndex xzIndex;
 
   CLzma2WithFilters lzmaf_Items[MTCODER__THREADS_MAX];
+
+  FL2_CStream *fcs;        /* Fast LZMA2 encoder, if (xzProps.fastLzma2) */
+  unsigned fcsThreads;
   
   size_t outBufSize;       /* size of allocated outBufs[i] */
   Byte *outBufs[MTCODER__BLOCKS_MAX];
@@ -957,6 +1206,9 @@ static void XzEnc_Construct(CXzEnc *p)
   for (i = 0; i < MTCODER__THREADS_MAX; i++)
     Lzma2WithFilters_Construct(&p->lzmaf_Items[i]);
 
+  p->fcs = NULL;
+  p->fcsThreads = 0;
+
   #ifndef _7ZIP_ST
   p->mtCoder_WasConstructed = False;
   {
@@ -989,6 +1241,9 @@ static void XzEnc_Free(CXzEnc *p, ISzAllocPtr alloc)
 
   for (i = 0; i < MTCODER__THREADS_MAX; i++)
     Lzma2WithFilters_Free(&p->lzmaf_Items[i], alloc);
+
+  FL2_freeCStream(p->fcs);
+  p->fcs = NULL;
   
   #ifndef _7ZIP_ST
   if (p->mtCoder_WasConstructed)
@@ -1024,11 +1279,124 @@ void XzEnc_Destroy(CXzEncHandle pp)
 }
 
 
+/* Set up the Fast LZMA2 encoder from lzma2Props, and select the block size,
+   which must be known before XzEnc_Encode() */
+
+static SRes XzEnc_SetFastProps(CXzEnc *p)
+{
+  CXzProps *props = &p->xzProps;
+  const CLzma2EncProps *lzma2 = &props->lzma2Props;
+  const CLzmaEncProps *lp = &lzma2->lzmaProps;
+  FL2_CStream *fcs;
+  unsigned numThreads = 1;
+  UInt64 dictSize;
+  UInt64 blockSize;
+  unsigned r;
+
+  #ifndef _7ZIP_ST
+  {
+    int t = props->numTotalThreads;
+    if (t <= 0)
+      t = lzma2->numTotalThreads;
+    numThreads = (t > 0) ? (unsigned)t : 0; /* 0 : use the default of the library */
+  }
+  #endif
+  
+  if (p->fcs && p->fcsThreads != numThreads)
+  {
+    FL2_freeCStream(p->fcs);
+    p->fcs = NULL;
+  }
+  if (!p->fcs)
+  {
+    p->fcs = FL2_createCStreamMt(numThreads, 1);
+    if (!p->fcs)
+      return SZ_ERROR_MEM;
+    p->fcsThreads = numThreads;
+  }
+  fcs = p->fcs;
+
+  if (lp->algo > 3)
+    return SZ_ERROR_PARAM;
+  if (FL2_isError(FL2_CCtx_setParameter(fcs, FL2_p_highCompression, lp->algo > 2)))
+    return SZ_ERROR_PARAM;
+  if (FL2_isError(FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, (size_t)lp->level)))
+    return SZ_ERROR_PARAM;
+
+  dictSize = lp->dictSize;
+  if (dictSize == 0)
+    dictSize = FL2_CCtx_getParameter(fcs, FL2_p_dictionarySize);
+  if (props->reduceSize != (UInt64)(Int64)-1 && dictSize > props->reduceSize + 1)
+    dictSize = props->reduceSize + 1; /* prevent extra buffer shift after read */
+  if (dictSize < FL2_DICTSIZE_MIN)
+    dictSize = FL2_DICTSIZE_MIN;
+  RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_dictionarySize, (size_t)dictSize)));
+
+  if (lp->algo >= 0)
+  {
+    RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_strategy, (unsigned)(lp->algo > 2 ? 2 : lp->algo))));
+  }
+  if (lp->fb > 0)
+  {
+    RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_fastLength, (unsigned)lp->fb)));
+  }
+  if (lp->mc > 0)
+  {
+    RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_hybridCycles, lp->mc)));
+  }
+  if (lp->lc >= 0)
+  {
+    RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_literalCtxBits, (unsigned)lp->lc)));
+  }
+  if (lp->lp >= 0)
+  {
+    RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_literalPosBits, (unsigned)lp->lp)));
+  }
+  if (lp->pb >= 0)
+  {
+    RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_posBits, (unsigned)lp->pb)));
+  }
+  
+  /* the properties byte is in the xz block header */
+  FL2_CCtx_setParameter(fcs, FL2_p_omitProperties, 1);
+  FL2_setCStreamTimeout(fcs, XZ_FAST_TIMEOUT);
+
+  /* An xz block ends where the dictionary would be reset, so the auto block size is a multiple of it.
+     Larger fixed blocks also reset the dictionary every FL2_RESET_INTERVAL_MAX dictionary sizes. */
+  blockSize = props->blockSize;
+  if (blockSize == XZ_PROPS__BLOCK_SIZE__AUTO)
+    blockSize = lzma2->blockSize;
+  if (blockSize == XZ_PROPS__BLOCK_SIZE__AUTO)
+  {
+    blockSize = dictSize * 4;
+    if (blockSize < XZ_FAST_BLOCK_SIZE_MIN)
+      blockSize = XZ_FAST_BLOCK_SIZE_MIN;
+    if (blockSize > XZ_FAST_BLOCK_SIZE_MAX)
+      blockSize = XZ_FAST_BLOCK_SIZE_MAX;
+    if (blockSize > dictSize)
+      blockSize -= blockSize % dictSize;
+  }
+  
+  r = 0;
+  if (blockSize != XZ_PROPS__BLOCK_SIZE__SOLID)
+  {
+    UInt64 r64 = blockSize / dictSize;
+    r = (r64 == 0) ? 1 : (r64 > FL2_RESET_INTERVAL_MAX) ? FL2_RESET_INTERVAL_MAX : (unsigned)r64;
+  }
+  RINOK(Fl2_ToSRes(FL2_CCtx_setParameter(fcs, FL2_p_resetInterval, r)));
+
+  props->blockSize = blockSize;
+  return SZ_OK;
+}
+
+
 SRes XzEnc_SetProps(CXzEncHandle pp, const CXzProps *props)
 {
   CXzEnc *p = (CXzEnc *)pp;
   p->xzProps = *props;
   XzProps_Normalize(&p->xzProps);
+  if (p->xzProps.fastLzma2)
+    return XzEnc_SetFastProps(p);
   return SZ_OK;
 }
 
@@ -1125,6 +1493,92 @@ static SRes XzEnc_MtCallback_Write(void *pp, unsigned outBufIndex)
 
 
 
+/* Solid: the block is written to outStream as it is compressed.
+   Otherwise: each block is compressed to outBufs[0], so the sizes can be written in the block header. */
+
+static SRes XzEnc_EncodeFast(CXzEnc *p, ISeqOutStream *outStream, ISeqInStream *inStream, ICompressProgress *progress)
+{
+  const CXzProps *props = &p->xzProps;
+  BoolInt writeStartSizes = (props->blockSize != XZ_PROPS__BLOCK_SIZE__SOLID);
+  CCompressProgress_XzEncOffset progress2;
+  Byte *bufData = NULL;
+  size_t bufSize = 0;
+
+  progress2.vt.Progress = CompressProgress_XzEncOffset_Progress;
+  progress2.inOffset = 0;
+  progress2.outOffset = 0;
+  progress2.progress = progress;
+
+  if (writeStartSizes)
+  {
+    size_t t2;
+    size_t t = (size_t)props->blockSize;
+    if (t != props->blockSize)
+      return SZ_ERROR_PARAM;
+    t = XZ_GET_MAX_BLOCK_PACK_SIZE(t);
+    if (t < props->blockSize)
+      return SZ_ERROR_PARAM;
+    t2 = XZ_BLOCK_HEADER_SIZE_MAX + t;
+    if (!p->outBufs[0] || t2 != p->outBufSize)
+    {
+      XzEnc_FreeOutBufs(p);
+      p->outBufs[0] = (Byte *)ISzAlloc_Alloc(p->alloc, t2);
+      if (!p->outBufs[0])
+        return SZ_ERROR_MEM;
+      p->outBufSize = t2;
+    }
+    bufData = p->outBufs[0] + XZ_BLOCK_HEADER_SIZE_MAX;
+    bufSize = t;
+  }
+
+  for (;;)
+  {
+    CXzEncBlockInfo blockSizes;
+    int inStreamFinished;
+
+    blockSizes.headerSize = 0; // for GCC
+
+    RINOK(Xz_CompressBlockFast(
+        &p->lzmaf_Items[0],
+        p->fcs,
+        
+        writeStartSizes ? NULL : outStream,
+        writeStartSizes ? p->outBufs[0] : NULL,
+        bufData, bufSize,
+        
+        inStream,
+        
+        props,
+        progress ? &progress2.vt : NULL,
+        &inStreamFinished,
+        &blockSizes,
+        p->alloc));
+
+    /* an empty block is written only for a solid stream */
+    if (blockSizes.unpackSize != 0 || !writeStartSizes)
+    {
+      UInt64 totalPackFull = blockSizes.totalSize + XZ_GET_PAD_SIZE(blockSizes.totalSize);
+      
+      if (writeStartSizes)
+      {
+        RINOK(WriteBytes(outStream, p->outBufs[0], blockSizes.headerSize));
+        RINOK(WriteBytes(outStream, bufData, (size_t)totalPackFull - blockSizes.headerSize));
+      }
+      
+      RINOK(XzEncIndex_AddIndexRecord(&p->xzIndex, blockSizes.unpackSize, blockSizes.totalSize, p->alloc));
+      
+      progress2.inOffset += blockSizes.unpackSize;
+      progress2.outOffset += totalPackFull;
+    }
+    
+    if (inStreamFinished)
+      break;
+  }
+  
+  return SZ_OK;
+}
+
+
 SRes XzEnc_Encode(CXzEncHandle pp, ISeqOutStream *outStream, ISeqInStream *inStream, ICompressProgress *progress)
 {
   CXzEnc *p = (CXzEnc *)pp;
@@ -1152,6 +1606,11 @@ SRes XzEnc_Encode(CXzEncHandle pp, ISeqOutStream *outStream, ISeqInStream *inStr
   RINOK(Xz_WriteHeader((CXzStreamFlags)props->checkId, outStream));
 
 
+  if (props->fastLzma2)
+  {
+    RINOK(XzEnc_EncodeFast(p, outStream, inStream, progress));
+  }
+  else
   #ifndef _7ZIP_ST
   if (props->numBlockThreads_Reduced > 1)
   {
@@ -37,6 +37,7 @@ typedef struct
   int numTotalThreads;
   int forceWriteSizesInHeader;
   UInt64 reduceSize;
+  int fastLzma2; /* use the Fast LZMA2 encoder, that writes one xz block per dictionary reset */
 } CXzProps;
 
 void XzProps_Init(CXzProps *p);
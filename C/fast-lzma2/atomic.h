@@ -40,7 +40,10 @@ typedef LONG volatile FL2_atomic;
 #define ATOMIC_INITIAL_VALUE -1
 #define FL2_atomic_increment(n) InterlockedIncrement(&n)
 #define FL2_atomic_add(n, a) InterlockedAdd(&n, a)
+#define FL2_atomic_compareExchange(n, o, v) (InterlockedCompareExchange(&n, v, o) == (o))
+#define FL2_atomic_load(n) InterlockedCompareExchange(&(n), 0, 0)
 #define FL2_nonAtomic_increment(n) (++n)
+#define FL2_pause() YieldProcessor()
 
 #elif !defined(FL2_SINGLETHREAD) && defined(__GNUC__)
 
@@ -48,6 +51,8 @@ typedef long FL2_atomic;
 #define ATOMIC_INITIAL_VALUE 0
 #define FL2_atomic_increment(n) __sync_fetch_and_add(&n, 1)
 #define FL2_atomic_add(n, a) __sync_fetch_and_add(&n, a)
+#define FL2_atomic_compareExchange(n, o, v) __sync_bool_compare_and_swap(&n, o, v)
+#define FL2_atomic_load(n) __atomic_load_n(&(n), __ATOMIC_ACQUIRE)
 #define FL2_nonAtomic_increment(n) (n++)
 
 #elif !defined(FL2_SINGLETHREAD) && defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__) /* C11 */
@@ -58,8 +63,15 @@ typedef _Atomic long FL2_atomic;
 #define ATOMIC_INITIAL_VALUE 0
 #define FL2_atomic_increment(n) atomic_fetch_add(&n, 1)
 #define FL2_atomic_add(n, a) atomic_fetch_add(&n, a)
+#define FL2_atomic_compareExchange(n, o, v) FL2_atomic_cas(&n, o, v)
+#define FL2_atomic_load(n) atomic_load_explicit(&(n), memory_order_acquire)
 #define FL2_nonAtomic_increment(n) (n++)
 
+static inline int FL2_atomic_cas(FL2_atomic* const n, long o, long const v)
+{
+    return atomic_compare_exchange_strong(n, &o, v);
+}
+
 #else  /* No atomics */
 
 #	ifndef FL2_SINGLETHREAD
@@ -70,10 +82,25 @@ typedef long FL2_atomic;
 #define ATOMIC_INITIAL_VALUE 0
 #define FL2_atomic_increment(n) (n++)
 #define FL2_atomic_add(n, a) (n += (a))
+#define FL2_atomic_compareExchange(n, o, v) ((n) == (o) ? ((n) = (v), 1) : 0)
+#define FL2_atomic_load(n) (n)
 #define FL2_nonAtomic_increment(n) (n++)
 
 #endif /* FL2_SINGLETHREAD */
 
+/* FL2_atomic_load() reads an atomic which other threads may change without a lock. It has acquire
+ * ordering: writes made by another thread before it changed the value with one of the read-modify-write
+ * operations above, which are full barriers, are visible after the load returns the new value. */
+
+/* Processor hint for spin-wait loops */
+#ifndef FL2_pause
+#  if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#    define FL2_pause() __builtin_ia32_pause()
+#  else
+#    define FL2_pause()
+#  endif
+#endif
+
 
 #if defined (__cplusplus)
 }
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include "dict_buffer.h"
 #include "fl2_internal.h"
+#include "util.h"
 
 #define ALIGNMENT_SIZE 16U
 #define ALIGNMENT_MASK (~(size_t)(ALIGNMENT_SIZE-1))
@@ -24,26 +25,63 @@ int DICT_construct(DICT_buffer * const buf, int const async)
     buf->size = 0;
 
     buf->async = (async != 0);
+    buf->shift_count = 0;
+    buf->shift_bytes = 0;
+    buf->overlap_from = 0;
+    buf->source = NULL;
+    buf->source_size = 0;
+    buf->source_pos = 0;
+    buf->large_pages = 0;
 
 #ifndef NO_XXHASH
     buf->xxh = NULL;
+    buf->hash_block.start = 0;
+    buf->hash_block.end = 0;
 #endif
 
     return 0;
 }
 
-int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash)
+static int DICT_initHash(DICT_buffer * const buf, int const do_hash)
 {
-    /* Allocate if not yet allocated or existing dict too small */
-    if (buf->data[0] == NULL || dict_size > buf->size) {
+#ifndef NO_XXHASH
+    buf->hash_block.start = 0;
+    buf->hash_block.end = 0;
+    if (do_hash) {
+        if (buf->xxh == NULL) {
+            buf->xxh = XXH32_createState();
+            if (buf->xxh == NULL) {
+                DICT_destruct(buf);
+                return 1;
+            }
+        }
+        XXH32_reset(buf->xxh, 0);
+    }
+    else {
+        XXH32_freeState(buf->xxh);
+        buf->xxh = NULL;
+    }
+#else
+    (void)buf;
+    (void)do_hash;
+#endif
+    return 0;
+}
+
+int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash,
+    int const large_pages)
+{
+    /* Allocate if not yet allocated, existing dict too small, the buffers are a source window, or the page type changed */
+    if (buf->data[0] == NULL || dict_size > buf->size || buf->source != NULL || buf->large_pages != (large_pages != 0)) {
         /* Free any existing buffers */
         DICT_destruct(buf);
 
-        buf->data[0] = malloc(dict_size);
+        buf->large_pages = (large_pages != 0);
+        buf->data[0] = UTIL_allocLarge(dict_size, large_pages);
 
         buf->data[1] = NULL;
         if (buf->async)
-            buf->data[1] = malloc(dict_size);
+            buf->data[1] = UTIL_allocLarge(dict_size, large_pages);
 
         if (buf->data[0] == NULL || (buf->async && buf->data[1] == NULL)) {
             DICT_destruct(buf);
@@ -57,36 +95,47 @@ int DICT_init(DICT_buffer * const buf, size_t const dict_size, size_t const over
     buf->size = dict_size;
     buf->total = 0;
     buf->reset_interval = (reset_multiplier != 0) ? dict_size * reset_multiplier : ((size_t)1 << 31);
+    buf->overlap_from = 0;
 
-#ifndef NO_XXHASH
-    if (do_hash) {
-        if (buf->xxh == NULL) {
-            buf->xxh = XXH32_createState();
-            if (buf->xxh == NULL) {
-                DICT_destruct(buf);
-                return 1;
-            }
-        }
-        XXH32_reset(buf->xxh, 0);
-    }
-    else {
-        XXH32_freeState(buf->xxh);
-        buf->xxh = NULL;
-    }
-#else
-    (void)do_hash;
-#endif
+    return DICT_initHash(buf, do_hash);
+}
 
-    return 0;
+/* Use src as the input for the whole stream, without copying it. Any allocated buffers are freed.
+ * The first window is filled immediately. */
+int DICT_initSource(DICT_buffer * const buf, const void * const src, size_t const src_size,
+    size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash)
+{
+    DICT_destruct(buf);
+
+    buf->source = (const BYTE*)src;
+    buf->source_size = src_size;
+    buf->source_pos = 0;
+    buf->data[0] = (BYTE*)buf->source;
+    buf->data[1] = (BYTE*)buf->source;
+    buf->index = 0;
+    buf->overlap = overlap;
+    buf->start = 0;
+    buf->end = MIN(dict_size, src_size);
+    buf->size = dict_size;
+    buf->total = 0;
+    buf->reset_interval = (reset_multiplier != 0) ? dict_size * reset_multiplier : ((size_t)1 << 31);
+    buf->overlap_from = 0;
+
+    return DICT_initHash(buf, do_hash);
 }
 
 void DICT_destruct(DICT_buffer * const buf)
 {
-    free(buf->data[0]);
-    free(buf->data[1]);
+    if (buf->source == NULL) {
+        UTIL_freeLarge(buf->data[0]);
+        UTIL_freeLarge(buf->data[1]);
+    }
     buf->data[0] = NULL;
     buf->data[1] = NULL;
     buf->size = 0;
+    buf->source = NULL;
+    buf->source_size = 0;
+    buf->source_pos = 0;
 #ifndef NO_XXHASH
     XXH32_freeState(buf->xxh);
     buf->xxh = NULL;
@@ -98,6 +147,11 @@ size_t DICT_size(const DICT_buffer * const buf)
     return buf->size;
 }
 
+int DICT_isSource(const DICT_buffer * const buf)
+{
+    return buf->source != NULL;
+}
+
 /* Get the dictionary buffer for adding input */
 size_t DICT_get(DICT_buffer * const buf, void **const dict)
 {
@@ -132,6 +186,9 @@ void DICT_put(DICT_buffer * const buf, FL2_inBuffer * const input)
 
 size_t DICT_availSpace(const DICT_buffer * const buf)
 {
+    /* A source window can't accept input */
+    if (buf->source != NULL)
+        return 0;
     return buf->size - buf->end;
 }
 
@@ -141,6 +198,34 @@ int DICT_hasUnprocessed(const DICT_buffer * const buf)
     return buf->start < buf->end;
 }
 
+/* Move the source window forward so the overlap is at the start, and extend it over
+ * as much new data as will fit. Nothing is moved, so the block just taken from the
+ * window remains valid while it is compressed. */
+static void DICT_advanceSource(DICT_buffer * const buf)
+{
+    size_t overlap = buf->overlap;
+    /* Reset the dict if the next compression cycle would exceed the reset interval */
+    if (buf->total + buf->size - buf->overlap > buf->reset_interval) {
+        DEBUGLOG(4, "Resetting dictionary after %u bytes", (unsigned)buf->total);
+        overlap = 0;
+        buf->total = 0;
+    }
+
+    size_t from = buf->end;
+    if (overlap != 0) {
+        if (buf->end < overlap + ALIGNMENT_SIZE)
+            return;
+        from = (buf->end - overlap) & ALIGNMENT_MASK;
+        buf->overlap_from = from;
+    }
+    buf->source_pos += from;
+    buf->data[0] = (BYTE*)buf->source + buf->source_pos;
+    buf->data[1] = buf->data[0];
+    buf->start = buf->end - from;
+    buf->end = buf->start + MIN(buf->size - buf->start, buf->source_size - buf->source_pos - buf->start);
+    DEBUGLOG(5, "Source window at %u, overlap %u, new data %u", (unsigned)buf->source_pos, (unsigned)buf->start, (unsigned)(buf->end - buf->start));
+}
+
 /* Get the buffer, overlap and end for compression */
 void DICT_getBlock(DICT_buffer * const buf, FL2_dataBlock * const block)
 {
@@ -149,18 +234,36 @@ void DICT_getBlock(DICT_buffer * const buf, FL2_dataBlock * const block)
     block->end = buf->end;
 
 #ifndef NO_XXHASH
+    /* Hashing is deferred to DICT_hashBlock() so it can run while the block's table is built */
     if (buf->xxh != NULL)
-        XXH32_update(buf->xxh, buf->data[buf->index] + buf->start, buf->end - buf->start);
+        buf->hash_block = *block;
 #endif
 
     buf->total += buf->end - buf->start;
     buf->start = buf->end;
+    buf->overlap_from = 0;
+
+    if (buf->source != NULL) {
+        DICT_advanceSource(buf);
+    }
+    else if (buf->total + buf->size - buf->overlap <= buf->reset_interval
+        && buf->overlap != 0 && buf->end >= buf->overlap + ALIGNMENT_SIZE) {
+        /* The position DICT_shift() will copy from */
+        buf->overlap_from = (buf->end - buf->overlap) & ALIGNMENT_MASK;
+    }
+}
+
+/* Returns the position in the last block taken by DICT_getBlock() from which its data will be kept as the
+ * overlap of the next block, or 0 if none is kept */
+size_t DICT_overlapFrom(const DICT_buffer * const buf)
+{
+    return buf->overlap_from;
 }
 
 /* Shift occurs when all is processed and end is beyond the overlap size */
 int DICT_needShift(DICT_buffer * const buf)
 {
-    if (buf->start < buf->end)
+    if (buf->start < buf->end || buf->source != NULL)
         return 0;
     /* Reset the dict if the next compression cycle would exceed the reset interval */
     size_t overlap = (buf->total + buf->size - buf->overlap > buf->reset_interval) ? 0 : buf->overlap;
@@ -176,7 +279,7 @@ int DICT_async(const DICT_buffer * const buf)
  * if it exists */
 void DICT_shift(DICT_buffer * const buf)
 {
-    if (buf->start < buf->end)
+    if (buf->start < buf->end || buf->source != NULL)
         return;
 
     size_t overlap = buf->overlap;
@@ -209,6 +312,10 @@ void DICT_shift(DICT_buffer * const buf)
             DEBUGLOG(5, "Move overlap data : %u bytes from %u", (unsigned)overlap, (unsigned)from);
             memmove(dst, src + from, overlap);
         }
+        if (dst != src || from != 0) {
+            ++buf->shift_count;
+            buf->shift_bytes += overlap;
+        }
         /* New data will be written after the overlap */
         buf->start = overlap;
         buf->end = overlap;
@@ -217,6 +324,31 @@ void DICT_shift(DICT_buffer * const buf)
     }
 }
 
+/* Returns 1 if the last block taken by DICT_getBlock() has not been hashed */
+int DICT_hashPending(const DICT_buffer * const buf)
+{
+#ifndef NO_XXHASH
+    return buf->hash_block.start < buf->hash_block.end;
+#else
+    (void)buf;
+    return 0;
+#endif
+}
+
+/* Add the last block taken by DICT_getBlock() to the hash. Must be called before the next
+ * DICT_getBlock() and while the block's data is unchanged, i.e. before it is compressed. */
+void DICT_hashBlock(DICT_buffer * const buf)
+{
+#ifndef NO_XXHASH
+    if (DICT_hashPending(buf)) {
+        XXH32_update(buf->xxh, buf->hash_block.data + buf->hash_block.start, buf->hash_block.end - buf->hash_block.start);
+        buf->hash_block.start = buf->hash_block.end;
+    }
+#else
+    (void)buf;
+#endif
+}
+
 #ifndef NO_XXHASH
 XXH32_hash_t DICT_getDigest(const DICT_buffer * const buf)
 {
@@ -226,5 +358,7 @@ XXH32_hash_t DICT_getDigest(const DICT_buffer * const buf)
 
 size_t DICT_memUsage(const DICT_buffer * const buf)
 {
+    if (buf->source != NULL)
+        return 0;
     return (1 + buf->async) * buf->size;
 }
@@ -26,7 +26,10 @@ extern "C" {
  * Maintains one or two dictionary buffers. In a dual dict configuration (asyc==1), when the
  * current buffer is full, the overlap region will be copied to the other buffer and it
  * becomes the destination for input while the first is compressed. This is useful when I/O
- * is much slower than compression. */
+ * is much slower than compression.
+ * In source mode (source != NULL) no buffers are allocated. The dictionary is a read-only window
+ * on the caller's data, e.g. a memory-mapped file, which is moved forward instead of copying the
+ * overlap. All of the source is available as input and no more can be added. */
 typedef struct {
     BYTE* data[2];
     size_t index;
@@ -37,17 +40,31 @@ typedef struct {
     size_t size;   /* allocation size */
     size_t total;  /* total size compressed after last dict reset */
     size_t reset_interval;
+    size_t overlap_from;  /* position in the last block taken from which the next overlap is kept, or 0 */
+    U64 shift_count;  /* number of times overlap data was copied or moved */
+    U64 shift_bytes;  /* total overlap data copied or moved */
+    const BYTE* source;
+    size_t source_size;
+    size_t source_pos;  /* offset of the window in the source */
+    int large_pages;    /* buffers were requested with large pages */
 #ifndef NO_XXHASH
     XXH32_state_t *xxh;
+    FL2_dataBlock hash_block;  /* new data of the last block taken, not yet hashed */
 #endif
 } DICT_buffer;
 
 int DICT_construct(DICT_buffer *const buf, int const async);
 
-int DICT_init(DICT_buffer *const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash);
+int DICT_init(DICT_buffer *const buf, size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash,
+    int const large_pages);
+
+int DICT_initSource(DICT_buffer *const buf, const void *const src, size_t const src_size,
+    size_t const dict_size, size_t const overlap, unsigned const reset_multiplier, int const do_hash);
 
 void DICT_destruct(DICT_buffer *const buf);
 
+int DICT_isSource(const DICT_buffer *const buf);
+
 size_t DICT_size(const DICT_buffer *const buf);
 
 size_t DICT_get(DICT_buffer *const buf, void **const dict);
@@ -62,12 +79,18 @@ int DICT_hasUnprocessed(const DICT_buffer *const buf);
 
 void DICT_getBlock(DICT_buffer *const buf, FL2_dataBlock *const block);
 
+size_t DICT_overlapFrom(const DICT_buffer *const buf);
+
 int DICT_needShift(DICT_buffer *const buf);
 
 int DICT_async(const DICT_buffer *const buf);
 
 void DICT_shift(DICT_buffer *const buf);
 
+int DICT_hashPending(const DICT_buffer *const buf);
+
+void DICT_hashBlock(DICT_buffer *const buf);
+
 #ifndef NO_XXHASH
 XXH32_hash_t DICT_getDigest(const DICT_buffer *const buf);
 #endif
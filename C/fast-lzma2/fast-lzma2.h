@@ -149,6 +149,40 @@ FL2LIB_API void      FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx);
 
 FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadCount(const FL2_CCtx* cctx);
 
+/*! FL2_getCCtxThreadTimes() :
+ *  Each block is divided into slices which are handed out to the encoder threads as they become free.
+ *  This function reports the time in microseconds each encoder thread spent encoding slices (busy)
+ *  and waiting for the other threads to finish (idle), summed since the last compression operation or
+ *  stream began. Either array may be NULL. Each must hold FL2_getCCtxThreadCount() elements.
+ *  Returns the number of threads. */
+FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadTimes(const FL2_CCtx* cctx, unsigned long long* busyTimes, unsigned long long* idleTimes);
+
+/*= Shared thread pool
+ *  Applications which run many compression contexts at once can create a single pool of threads and
+ *  attach each context to it, instead of each context creating its own threads. Jobs from all attached
+ *  contexts are taken in turn. The thread count of an attached context becomes the maximum number of
+ *  threads it may use at once: the calling thread always does part of the work, and the pool supplies up
+ *  to nbThreads - 1 more. Pipelined streams still create their own encoding and building threads.
+ *  Returns NULL if the library is compiled for single-threaded compression.
+ *  The pool must not be freed until all attached contexts are freed. */
+typedef struct FL2POOL_shared_s FL2_threadPool;
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool(unsigned nbThreads);
+FL2LIB_API void            FL2LIB_CALL FL2_freeThreadPool(FL2_threadPool* pool);
+
+/*! FL2_getThreadPoolSize() :
+ *  Returns the number of threads in pool, or 0 if pool is NULL. */
+FL2LIB_API unsigned FL2LIB_CALL FL2_getThreadPoolSize(const FL2_threadPool* pool);
+
+/*! FL2_createCCtxWithPool() :
+ *  Same as FL2_createCCtxMt(), but the context runs its jobs on the threads of pool from the start
+ *  and creates no threads of its own. A NULL pool is the same as FL2_createCCtxMt(). */
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxWithPool(unsigned nbThreads, FL2_threadPool* pool);
+
+/*! FL2_CCtx_attachThreadPool() :
+ *  Run the context's jobs on the threads of pool, or on its own threads again if pool is NULL.
+ *  Must be called between compression operations, i.e. not while a stream is in progress. */
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_attachThreadPool(FL2_CCtx* cctx, FL2_threadPool* pool);
+
 /*! FL2_compressCCtx() :
  *  Same as FL2_compress(), but requires an allocated FL2_CCtx (see FL2_createCCtx()). */
 FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
@@ -156,6 +190,29 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     const void* src, size_t srcSize,
     int compressionLevel);
 
+/*= Batch compression
+ *  Many small independent buffers can be compressed in one call. Each item becomes a separate stream, the
+ *  same as the output of FL2_compressCCtx() for that item alone. Items are handed out to the context's
+ *  threads as they become free, and each is compressed by one thread with its own match table, sized for
+ *  the largest item in the batch. The tables are kept in the context and reused by the next batch if the
+ *  parameters are compatible, so the setup cost is paid once for many items.
+ *  Memory usage is up to one match table per thread, which can be large if the items are. */
+typedef struct {
+    const void* src;    /**< input */
+    size_t srcSize;
+    void* dst;          /**< output buffer; FL2_compressBound(srcSize) guarantees success */
+    size_t dstCapacity;
+    size_t cSize;       /**< compressed size or error code, set by FL2_compressBatch() */
+} FL2_batchItem;
+
+/*! FL2_compressBatch() :
+ *  Compress nbItems independent items. Must not be called while a stream is in progress.
+ *  @return : 0 if all items were compressed, or the error code of the first item that failed.
+ *  Check the cSize of each item for its result. */
+FL2LIB_API size_t FL2LIB_CALL FL2_compressBatch(FL2_CCtx* cctx,
+    FL2_batchItem* items, size_t nbItems,
+    int compressionLevel);
+
 /*! FL2_getCCtxDictProp() :
  *  Get the dictionary size property.
  *  Intended for use with the FL2_p_omitProperties parameter for creating a
@@ -237,6 +294,10 @@ typedef struct {
  *  The stream will not block on FL2_compressStream() and continues to accept data while compression is
  *  underway, until both buffers are full. Useful when I/O is slow.
  *  To compress with a single thread with dual buffering, call FL2_createCStreamMt with nbThreads=1.
+ *  Specify FL2_DUAL_BUFFER_PIPELINED for the dualBuffer parameter to also build the match table for
+ *  each block while the previous block is being encoded. This uses a second match table and a second
+ *  set of match finder threads, trading memory for throughput. Use FL2_estimateCStreamSize() with the
+ *  same dualBuffer value to obtain the memory cost.
  *
  *  Use FL2_initCStream() on the FL2_CStream object to start a new compression operation.
  *
@@ -263,9 +324,13 @@ typedef struct {
 
 typedef struct FL2_CCtx_s FL2_CStream;
 
+#define FL2_DUAL_BUFFER_PIPELINED 2
+
 /*===== FL2_CStream management functions =====*/
 FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStream(void);
 FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamMt(unsigned nbThreads, int dualBuffer);
+/* Same as FL2_createCStreamMt(), attached to pool as for FL2_createCCtxWithPool() */
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamWithPool(unsigned nbThreads, int dualBuffer, FL2_threadPool* pool);
 FL2LIB_API void FL2LIB_CALL FL2_freeCStream(FL2_CStream * fcs);
 
 /*===== Streaming compression functions =====*/
@@ -276,6 +341,16 @@ FL2LIB_API void FL2LIB_CALL FL2_freeCStream(FL2_CStream * fcs);
  *  level upon creation. */
 FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionLevel);
 
+/*! FL2_initCStreamSource() :
+ *  Begin a new compressed data stream whose input is all of src, compressed in place without
+ *  copying it into the dictionary buffer(s), which are not allocated. Intended for large
+ *  memory-mapped files. The block overlap is handled by moving a window over src, and the
+ *  dictionary is reduced to srcSize if smaller. src must remain valid and unchanged until
+ *  FL2_endStream() returns 0. No other input can be added, so FL2_compressStream() with input,
+ *  FL2_getDictionaryBuffer() and FL2_updateDictionary() return an error. Compress by calling
+ *  FL2_endStream() until it returns 0, reading the output each time. */
+FL2LIB_API size_t FL2LIB_CALL FL2_initCStreamSource(FL2_CStream* fcs, const void* src, size_t srcSize, int compressionLevel);
+
 /*! FL2_setCStreamTimeout() :
  *  Sets a timeout in milliseconds. Zero disables the timeout (default). If a nonzero timout is set, functions
  *  FL2_compressStream(), FL2_getDictionaryBuffer(), FL2_updateDictionary(), FL2_getNextCompressedBuffer(),
@@ -321,6 +396,15 @@ FL2LIB_API size_t FL2LIB_CALL FL2_updateDictionary(FL2_CStream* fcs, size_t adde
  *  this function will wait for completion before returning, or it will return the timeout code. */
 FL2LIB_API size_t FL2LIB_CALL FL2_getNextCompressedBuffer(FL2_CStream* fcs, FL2_cBuffer* cbuf);
 
+/*! FL2_getCStreamBlockStart() :
+ *  Returns the position in the uncompressed stream at which the data of the block currently
+ *  being output begins. Call it before reading the first of the block's compressed buffers.
+ *  If dictReset is not NULL, it is set to 1 if the block begins with a dictionary reset, so a
+ *  new LZMA2 decoder can start at the block's compressed data without reading any of the data
+ *  preceding it. Resets occur at the start of the stream and when the dictionary is restarted
+ *  at the interval set by FL2_p_resetInterval. */
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getCStreamBlockStart(const FL2_CStream* fcs, int* dictReset);
+
 /******/
 
 /*! FL2_getCStreamProgress() :
@@ -329,10 +413,40 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getNextCompressedBuffer(FL2_CStream* fcs, FL2_
  *  outputSize is not NULL, returns the number of bytes of compressed data generated. */
 FL2LIB_API unsigned long long FL2LIB_CALL FL2_getCStreamProgress(const FL2_CStream * fcs, unsigned long long *outputSize);
 
+/*! FL2_getCStreamStats() :
+ *  Performance counters for finding bottlenecks. Times are in microseconds of elapsed time.
+ *  Encoder busy and idle times are summed over all encoder threads. FL2_getCCtxThreadTimes()
+ *  reports them per thread. Pool wait time is spent by the thread which dispatches the match
+ *  table and encoder jobs, waiting for the other threads to finish. Dictionary shifts are
+ *  counted with the block which follows them.
+ *  If blockStats is not NULL it receives the counters for the last block completed. If totalStats
+ *  is not NULL it receives the sums for all blocks since the stream or compression operation began.
+ *  Also valid for a FL2_CCtx after FL2_compressCCtx(). */
+typedef struct {
+    unsigned long long blocks;           /* blocks compressed */
+    unsigned long long inputSize;        /* bytes of input encoded */
+    unsigned long long initTime;         /* initializing the match table */
+    unsigned long long buildTime;        /* building the match table */
+    unsigned long long encodeTime;       /* encoding, from start until all encoder threads finish */
+    unsigned long long encodeBusyTime;   /* encoder threads encoding */
+    unsigned long long encodeIdleTime;   /* encoder threads waiting for other encoder threads */
+    unsigned long long poolWaitTime;     /* waiting for match table and encoder jobs to finish */
+    unsigned long long dictShifts;       /* dictionary overlap data moved for the next block */
+    unsigned long long dictShiftBytes;   /* bytes of overlap data moved */
+    unsigned long long compressedChunks; /* LZMA2 chunks written compressed */
+    unsigned long long storedChunks;     /* LZMA2 chunks written uncompressed */
+    unsigned long long fastChunks;       /* chunks encoded in fast mode to meet FL2_p_minThroughput */
+    unsigned long long skippedBytes;     /* input found incompressible before matchfinding, see FL2_p_skipIncompressible */
+} FL2_cStreamStats;
+
+FL2LIB_API void FL2LIB_CALL FL2_getCStreamStats(const FL2_CStream * fcs, FL2_cStreamStats *blockStats, FL2_cStreamStats *totalStats);
+
 /*! FL2_waitCStream() :
  *  Waits for compression to end. This function returns after the timeout set using
  *  FL2_setCStreamTimeout has elapsed. Unnecessary when no timeout is set.
- *  Returns 1 if compressed output is available, 0 if not, or the timeout code. */
+ *  Returns 1 if compressed output is available, 0 if not, or the timeout code.
+ *  In pipelined mode, also returns 1 while a block is waiting to be encoded, because
+ *  another call to the compression function is needed to start it. */
 FL2LIB_API size_t FL2LIB_CALL FL2_waitCStream(FL2_CStream * fcs);
 
 /*! FL2_cancelCStream() :
@@ -478,6 +592,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuff
 #define FL2_PB_MIN 0
 #define FL2_PB_MAX 4
 #define FL2_LCLP_MAX 4
+#define FL2_THROUGHPUT_MAX 65536
 
 typedef enum {
     FL2_fast,
@@ -558,6 +673,26 @@ typedef enum {
     FL2_p_omitProperties,   /* Omit the property byte at the start of the stream. For use within 7-zip */
                             /* or other containers which store the property byte elsewhere. */
                             /* A stream compressed under this setting cannot be decoded by this library. */
+    FL2_p_skipIncompressible, /* Scan each block for regions of incompressible data before building the match
+                             * table. These are left out of the table and stored uncompressed, saving time on
+                             * input which contains already compressed or encrypted data.
+                             * Default = enabled */
+    FL2_p_largePages,       /* Allocate the match table and dictionary buffers using large (huge) pages to reduce
+                             * TLB misses, which dominate match finding with large dictionaries. On Linux,
+                             * reserved huge pages are used if available, otherwise transparent huge pages are
+                             * requested. On Windows the process must hold the lock pages in memory privilege.
+                             * Ordinary memory is used if large pages can't be obtained.
+                             * Default = disabled */
+    FL2_p_reuseOverlap,     /* Keep the initial match table links of the data which becomes the next block's
+                             * overlap, instead of scanning the overlap again when the next table is built.
+                             * Costs 4 bytes per byte of overlap. Output is unchanged.
+                             * Default = disabled */
+    FL2_p_minThroughput,    /* Minimum compression speed in MB/s (1 MB = 2^20 bytes of input). The optimized and
+                             * ultra strategies fall back to fast mode for individual chunks when the encoders
+                             * fall behind this rate, or when a periodic trial shows the optimal parser gaining
+                             * less than 0.5% over fast mode. For a time budget, pass the input size divided by
+                             * the time allowed. Output then varies between runs. Not applied by FL2_compressBatch().
+                             * 0 = fixed strategy (default) */
 #ifndef NO_XXHASH
     FL2_p_doXXHash,         /* Calculate a 32-bit xxhash value from the input data and store it 
                              * after the stream terminator. The value will be checked on decompression.
@@ -618,6 +753,22 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsi
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_byParams(const FL2_compressionParameters *params, unsigned nbThreads, int dualBuffer); /*!< memory usage determined by params */
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_usingCStream(const FL2_CStream* fcs);   /*!< memory usage determined by settings */
 
+/*! FL2_getMemoryLimit() :
+ *  The memory available to the process. On Linux this is the lowest of physical memory and any cgroup
+ *  v1 or v2 memory limit which applies to the process, so it reflects container limits.
+ *  @result : the limit in bytes, or 0 if unknown. */
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getMemoryLimit(void);
+
+/*! FL2_fitCStreamParams() :
+ *  Reduce the dictionary size, thread count and dual buffer mode of a stream so its estimated memory
+ *  usage fits within memLimit. The dictionary size is kept as large as possible, then the thread count,
+ *  then the dual buffer mode. The dictionary is reduced in steps of 2^n and 1.5 * 2^n, down to
+ *  FL2_DICTSIZE_MIN. If nothing fits, one thread and no dual buffer are selected. *nbThreads == 0 selects
+ *  the number of physical cores, as for FL2_createCStreamMt(). If memLimit == 0 the values are only
+ *  normalized.
+ *  @result : the estimated memory usage of the selected configuration. */
+FL2LIB_API size_t FL2LIB_CALL FL2_fitCStreamParams(FL2_compressionParameters *params, unsigned *nbThreads, int *dualBuffer, unsigned long long memLimit);
+
 /*! FL2_getDictSizeFromProp() :
  *  Get the dictionary size from the property byte for a stream. The property byte is the first byte
 *   in the stream, unless omitProperties was enabled, in which case the caller must store it. */
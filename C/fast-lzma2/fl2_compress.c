@@ -23,6 +23,7 @@
 #include "lzma2_enc.h"
 
 #define FL2_MAX_LOOPS 10U
+#define FL2_SLICES_PER_THREAD 4U
 
 /*-=====  Pre-defined compression levels  =====-*/
 
@@ -135,7 +136,19 @@ static void FL2_fillParameters(FL2_CCtx* const cctx, const FL2_compressionParame
 #endif
 }
 
-static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffer)
+#ifndef FL2_SINGLETHREAD
+/* FL2_createPool() :
+ * Create a pool which runs up to maxThreads jobs on the threads of shared,
+ * or on its own threads if shared is NULL. */
+static FL2POOL_ctx* FL2_createPool(FL2_threadPool* const shared, unsigned const maxThreads)
+{
+    return shared != NULL
+        ? FL2POOL_createClient(shared, maxThreads)
+        : FL2POOL_create(maxThreads);
+}
+#endif
+
+static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffer, FL2_threadPool* const pool)
 {
     nbThreads = FL2_checkNbThreads(nbThreads);
 
@@ -146,18 +159,30 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
         return NULL;
 
     cctx->jobCount = nbThreads;
-    for (unsigned u = 0; u < nbThreads; ++u)
+    for (unsigned u = 0; u < nbThreads; ++u) {
         cctx->jobs[u].enc = NULL;
+        cctx->jobs[u].batchTable = NULL;
+    }
+
+    cctx->slices = malloc(nbThreads * FL2_SLICES_PER_THREAD * sizeof(FL2_slice));
+    if (cctx->slices == NULL) {
+        free(cctx);
+        return NULL;
+    }
 
 #ifndef NO_XXHASH
     cctx->params.doXXH = 1;
 #endif
 
     cctx->matchTable = NULL;
+    cctx->carry = NULL;
 
 #ifndef FL2_SINGLETHREAD
+    cctx->nextTable = NULL;
     cctx->compressThread = NULL;
-    cctx->factory = FL2POOL_create(nbThreads - 1);
+    cctx->buildFactory = NULL;
+    cctx->buildThread = NULL;
+    cctx->factory = FL2_createPool(pool, nbThreads - 1);
     if (nbThreads > 1 && cctx->factory == NULL) {
         FL2_freeCCtx(cctx);
         return NULL;
@@ -167,6 +192,16 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
       if (cctx->compressThread == NULL)
         return NULL;
     }
+    if (dualBuffer >= FL2_DUAL_BUFFER_PIPELINED) {
+        cctx->buildThread = FL2POOL_create(1);
+        cctx->buildFactory = FL2_createPool(pool, nbThreads - 1);
+        if (cctx->buildThread == NULL || (nbThreads > 1 && cctx->buildFactory == NULL)) {
+            FL2_freeCCtx(cctx);
+            return NULL;
+        }
+    }
+#else
+    (void)pool;
 #endif
 
     for (unsigned u = 0; u < nbThreads; ++u) {
@@ -180,6 +215,7 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
 
     DICT_construct(&cctx->buf, dualBuffer);
 
+    cctx->params.rParams.skip_incompressible = 1;
     FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, FL2_CLEVEL_DEFAULT);
     cctx->params.cParams.reset_interval = 4;
 
@@ -188,12 +224,17 @@ static FL2_CCtx* FL2_createCCtx_internal(unsigned nbThreads, int const dualBuffe
 
 FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtx(void)
 {
-    return FL2_createCCtx_internal(1, 0);
+    return FL2_createCCtx_internal(1, 0, NULL);
 }
 
 FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxMt(unsigned nbThreads)
 {
-    return FL2_createCCtx_internal(nbThreads, 0);
+    return FL2_createCCtx_internal(nbThreads, 0, NULL);
+}
+
+FL2LIB_API FL2_CCtx* FL2LIB_CALL FL2_createCCtxWithPool(unsigned nbThreads, FL2_threadPool* pool)
+{
+    return FL2_createCCtx_internal(nbThreads, 0, pool);
 }
 
 FL2LIB_API void FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx)
@@ -207,14 +248,20 @@ FL2LIB_API void FL2LIB_CALL FL2_freeCCtx(FL2_CCtx* cctx)
 
     for (unsigned u = 0; u < cctx->jobCount; ++u) {
         LZMA2_freeECtx(cctx->jobs[u].enc);
+        RMF_freeMatchTable(cctx->jobs[u].batchTable);
     }
 
 #ifndef FL2_SINGLETHREAD
     FL2POOL_free(cctx->factory);
     FL2POOL_free(cctx->compressThread);
+    FL2POOL_free(cctx->buildThread);
+    FL2POOL_free(cctx->buildFactory);
+    RMF_freeMatchTable(cctx->nextTable);
 #endif
 
     RMF_freeMatchTable(cctx->matchTable);
+    RMF_freeCarry(cctx->carry);
+    free(cctx->slices);
     free(cctx);
 }
 
@@ -223,24 +270,149 @@ FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadCount(const FL2_CCtx* cctx)
     return cctx->jobCount;
 }
 
+FL2LIB_API FL2_threadPool* FL2LIB_CALL FL2_createThreadPool(unsigned nbThreads)
+{
+#ifndef FL2_SINGLETHREAD
+    nbThreads = FL2_checkNbThreads(nbThreads);
+
+    DEBUGLOG(3, "FL2_createThreadPool : %u threads", nbThreads);
+
+    return FL2POOL_createShared(nbThreads);
+#else
+    (void)nbThreads;
+    return NULL;
+#endif
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_freeThreadPool(FL2_threadPool* pool)
+{
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_freeShared(pool);
+#else
+    (void)pool;
+#endif
+}
+
+FL2LIB_API unsigned FL2LIB_CALL FL2_getThreadPoolSize(const FL2_threadPool* pool)
+{
+#ifndef FL2_SINGLETHREAD
+    return (unsigned)FL2POOL_sharedThreads(pool);
+#else
+    (void)pool;
+    return 0;
+#endif
+}
+
+#ifndef FL2_SINGLETHREAD
+/* FL2_replacePool() :
+ * Replace *pool with one which runs up to maxThreads jobs on the threads of shared,
+ * or on its own threads if shared is NULL. */
+static size_t FL2_replacePool(FL2POOL_ctx** const pool, FL2_threadPool* const shared, unsigned const maxThreads)
+{
+    FL2POOL_ctx* const newPool = FL2_createPool(shared, maxThreads);
+    if (newPool == NULL)
+        return FL2_ERROR(memory_allocation);
+    FL2POOL_free(*pool);
+    *pool = newPool;
+    return 0;
+}
+#endif
+
+FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_attachThreadPool(FL2_CCtx* cctx, FL2_threadPool* pool)
+{
+    if (cctx->lockParams)
+        return FL2_ERROR(stage_wrong);
+
+#ifndef FL2_SINGLETHREAD
+    DEBUGLOG(3, "FL2_CCtx_attachThreadPool : %u threads, %s pool", cctx->jobCount, pool != NULL ? "shared" : "private");
+
+    /* The calling thread always runs job 0 so a single-threaded context has nothing to share */
+    if (cctx->jobCount < 2)
+        return 0;
+
+    CHECK_F(FL2_replacePool(&cctx->factory, pool, cctx->jobCount - 1));
+    if (cctx->buildFactory != NULL)
+        CHECK_F(FL2_replacePool(&cctx->buildFactory, pool, cctx->jobCount - 1));
+#else
+    (void)pool;
+#endif
+    return 0;
+}
+
+FL2LIB_API unsigned FL2LIB_CALL FL2_getCCtxThreadTimes(const FL2_CCtx* cctx, unsigned long long* busyTimes, unsigned long long* idleTimes)
+{
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        if (busyTimes != NULL)
+            busyTimes[u] = cctx->jobs[u].busyTime;
+        if (idleTimes != NULL)
+            idleTimes[u] = cctx->jobs[u].idleTime;
+    }
+    return cctx->jobCount;
+}
+
+/* Match table and data block for the radix build functions */
+typedef struct {
+    FL2_matchTable* table;
+    FL2_dataBlock block;
+    DICT_buffer* hashBuf; /* if not NULL, pool job 1 hashes the block instead of building */
+} FL2_tableJob;
+
+/* FL2_initRadixTable() : FL2POOL_function type */
+static void FL2_initRadixTable(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_tableJob* const job = (FL2_tableJob*)jobDescription;
+
+    RMF_initTableSegment(job->table, job->block.data, job->block.end, n);
+}
+
 /* FL2_buildRadixTable() : FL2POOL_function type */
-static void FL2_buildRadixTable(void* const jobDescription, ptrdiff_t const n)
+static void FL2_buildRadixTable(void* const jobDescription, ptrdiff_t n)
 {
-    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+    FL2_tableJob* const job = (FL2_tableJob*)jobDescription;
+
+    if (job->hashBuf != NULL) {
+        /* The hash is the first job so it overlaps the build. Builders take work from a shared
+         * list, so a build job which starts late still does its share. */
+        if (n == 1) {
+            DICT_hashBlock(job->hashBuf);
+            return;
+        }
+        --n;
+    }
+    RMF_buildTable(job->table, n, 1, job->block);
+}
 
-    RMF_buildTable(cctx->matchTable, n, 1, cctx->curBlock);
+/* FL2_encodeSlices() :
+ * Encode slices of cctx->curBlock using the encoder for job n until none remain.
+ * Job 0 encodes slice 0 first, which begins with streamProp if >= 0.
+ */
+static void FL2_encodeSlices(FL2_CCtx* const cctx, size_t const n, int const streamProp)
+{
+    UTIL_time_t const start = UTIL_getTime();
+    LZMA2_ECtx* const enc = cctx->jobs[n].enc;
+
+    if (n == 0)
+        cctx->slices[0].cSize = LZMA2_encode(enc, cctx->matchTable,
+            cctx->slices[0].block,
+            &cctx->params.cParams, streamProp,
+            &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+
+    for (;;) {
+        size_t const u = (size_t)FL2_atomic_increment(cctx->sliceIndex) - ATOMIC_INITIAL_VALUE;
+        if (u >= cctx->encodeSlices)
+            break;
+        cctx->slices[u].cSize = LZMA2_encode(enc, cctx->matchTable,
+            cctx->slices[u].block,
+            &cctx->params.cParams, -1,
+            &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+    }
+    cctx->jobs[n].blockBusy = UTIL_clockSpanMicro(start);
 }
 
 /* FL2_compressRadixChunk() : FL2POOL_function type */
 static void FL2_compressRadixChunk(void* const jobDescription, ptrdiff_t const n)
 {
-    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
-
-    cctx->jobs[n].cSize = LZMA2_encode(cctx->jobs[n].enc, cctx->matchTable,
-        cctx->jobs[n].block,
-        &cctx->params.cParams,
-        -1,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+    FL2_encodeSlices((FL2_CCtx*)jobDescription, n, -1);
 }
 
 static int FL2_initEncoders(FL2_CCtx* const cctx)
@@ -261,103 +433,243 @@ static void FL2_initProgress(FL2_CCtx* const cctx)
     cctx->canceled = 0;
 }
 
-/* FL2_compressCurBlock_blocking() :
- * Compress cctx->curBlock and wait until complete.
- * Write streamProp as the first byte if >= 0
+/* FL2_buildMatchTable() :
+ * Initialize and build tbl for block using the calling thread and the threads in factory.
+ * If the block taken from hashBuf is waiting to be hashed, the hash is done on a pool thread during the build.
  */
-static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const streamProp)
+static size_t FL2_buildMatchTable(FL2_CCtx* const cctx, FL2_matchTable* const tbl, FL2_dataBlock const block, FL2POOL_ctx* const factory,
+    DICT_buffer* const hashBuf, FL2_cStreamStats* const stats)
 {
-    size_t const encodeSize = (cctx->curBlock.end - cctx->curBlock.start);
+    UTIL_time_t start = UTIL_getTime();
+
 #ifndef FL2_SINGLETHREAD
-    size_t mfThreads = cctx->curBlock.end / RMF_MIN_BYTES_PER_THREAD;
-    size_t nbThreads = MIN(cctx->jobCount, encodeSize / ENC_MIN_BYTES_PER_THREAD);
-    nbThreads += !nbThreads;
+    FL2_tableJob job;
+    job.table = tbl;
+    job.block = block;
+    job.hashBuf = NULL;
+
+    size_t mfThreads = block.end / RMF_MIN_BYTES_PER_THREAD;
 #else
     size_t mfThreads = 1;
-    size_t nbThreads = 1;
+    (void)factory;
 #endif
 
-    DEBUGLOG(5, "FL2_compressCurBlock : %u threads, %u start, %u bytes", (U32)nbThreads, (U32)cctx->curBlock.start, (U32)encodeSize);
+    stats->skippedBytes += RMF_scanIncompressible(tbl, block);
 
-    size_t sliceStart = cctx->curBlock.start;
-    size_t const sliceSize = encodeSize / nbThreads;
-    cctx->jobs[0].block.data = cctx->curBlock.data;
-    cctx->jobs[0].block.start = sliceStart;
-    cctx->jobs[0].block.end = sliceStart + sliceSize;
+    /* initialize to length 2 */
+#ifndef FL2_SINGLETHREAD
+    size_t const initThreads = RMF_initSegmentCount(tbl, block.end);
+    if (initThreads > 1) {
+        FL2POOL_addRange(factory, FL2_initRadixTable, &job, 1, initThreads);
 
-    for (size_t u = 1; u < nbThreads; ++u) {
-        sliceStart += sliceSize;
-        cctx->jobs[u].block.data = cctx->curBlock.data;
-        cctx->jobs[u].block.start = sliceStart;
-        cctx->jobs[u].block.end = sliceStart + sliceSize;
+        RMF_initTableSegment(tbl, block.data, block.end, 0);
+
+        UTIL_time_t const wait = UTIL_getTime();
+        FL2POOL_waitAll(factory, 0);
+        stats->poolWaitTime += UTIL_clockSpanMicro(wait);
+
+        tbl->progress = RMF_mergeTableSegments(tbl, block.data, block.end);
     }
-    cctx->jobs[nbThreads - 1].block.end = cctx->curBlock.end;
+    else
+#endif
+        tbl->progress = RMF_initTable(tbl, block.data, block.end);
 
-    /* initialize to length 2 */
-    cctx->matchTable->progress = RMF_initTable(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.end);
+    stats->initTime += UTIL_clockSpanMicro(start);
+    start = UTIL_getTime();
 
     if (cctx->canceled) {
-        RMF_resetIncompleteBuild(cctx->matchTable);
+        RMF_resetIncompleteBuild(tbl);
         return FL2_ERROR(canceled);
     }
 
+    int hashOnPool = 0;
+
 #ifndef FL2_SINGLETHREAD
 
-    mfThreads = MIN(RMF_threadCount(cctx->matchTable), mfThreads);
-    FL2POOL_addRange(cctx->factory, FL2_buildRadixTable, cctx, 1, mfThreads);
+    mfThreads = MIN(RMF_threadCount(tbl), mfThreads);
+    hashOnPool = (hashBuf != NULL && factory != NULL && DICT_hashPending(hashBuf));
+    if (hashOnPool)
+        job.hashBuf = hashBuf;
+    FL2POOL_addRange(factory, FL2_buildRadixTable, &job, 1, mfThreads + hashOnPool);
 
 #endif
 
-    int err = RMF_buildTable(cctx->matchTable, 0, mfThreads > 1, cctx->curBlock);
+    if (hashBuf != NULL && !hashOnPool)
+        DICT_hashBlock(hashBuf);
+
+    int err = RMF_buildTable(tbl, 0, mfThreads > 1, block);
 
 #ifndef FL2_SINGLETHREAD
+    UTIL_time_t const wait = UTIL_getTime();
+    FL2POOL_waitAll(factory, 0);
+    stats->poolWaitTime += UTIL_clockSpanMicro(wait);
+#endif
 
-    FL2POOL_waitAll(cctx->factory, 0);
+    stats->buildTime += UTIL_clockSpanMicro(start);
 
     if (err)
         return FL2_ERROR(canceled);
 
 #ifdef RMF_CHECK_INTEGRITY
-    err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
+    err = RMF_integrityCheck(tbl, block.data, block.start, block.end, cctx->params.rParams.depth);
     if (err)
         return FL2_ERROR(internal);
 #endif
 
-    FL2POOL_addRange(cctx->factory, FL2_compressRadixChunk, cctx, 1, nbThreads);
-
-    cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
-        cctx->jobs[0].block,
-        &cctx->params.cParams, streamProp,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+    return FL2_error_no_error;
+}
 
-    FL2POOL_waitAll(cctx->factory, 0);
+/* FL2_endBlockStats() :
+ * Make the counters for curBlock available as the last block's and add them to the totals.
+ */
+static void FL2_endBlockStats(FL2_CCtx* const cctx)
+{
+    FL2_cStreamStats* const cur = &cctx->curStats;
+    FL2_cStreamStats* const total = &cctx->totalStats;
+
+    total->blocks += cur->blocks;
+    total->inputSize += cur->inputSize;
+    total->initTime += cur->initTime;
+    total->buildTime += cur->buildTime;
+    total->encodeTime += cur->encodeTime;
+    total->encodeBusyTime += cur->encodeBusyTime;
+    total->encodeIdleTime += cur->encodeIdleTime;
+    total->poolWaitTime += cur->poolWaitTime;
+    total->dictShifts += cur->dictShifts;
+    total->dictShiftBytes += cur->dictShiftBytes;
+    total->compressedChunks += cur->compressedChunks;
+    total->storedChunks += cur->storedChunks;
+    total->fastChunks += cur->fastChunks;
+    total->skippedBytes += cur->skippedBytes;
+
+    cctx->blockStats = *cur;
+    memset(cur, 0, sizeof(*cur));
+}
 
-#else /* FL2_SINGLETHREAD */
+/* FL2_setEncodeRate() :
+ * Set the rate each encoder thread must sustain for cctx->curBlock to meet FL2_p_minThroughput.
+ * The match table build time is deducted from the block's time budget unless the table was
+ * built while the previous block was encoded.
+ */
+static void FL2_setEncodeRate(FL2_CCtx* const cctx, size_t const encodeSize, size_t const nbThreads)
+{
+    FL2_lzma2Parameters* const cParams = &cctx->params.cParams;
 
-    if (err)
-        return FL2_ERROR(canceled);
+    cParams->min_rate = 0;
+    if (cctx->params.minThroughput == 0 || cParams->strategy == FL2_fast)
+        return;
 
-#ifdef RMF_CHECK_INTEGRITY
-    err = RMF_integrityCheck(cctx->matchTable, cctx->curBlock.data, cctx->curBlock.start, cctx->curBlock.end, cctx->params.rParams.depth);
-    if (err)
-        return FL2_ERROR(internal);
+    /* Microseconds allowed for the block */
+    U64 budget = ((U64)encodeSize * 1000000U) / ((U64)cctx->params.minThroughput << 20);
+#ifndef FL2_SINGLETHREAD
+    if (cctx->buildThread == NULL)
 #endif
-    cctx->jobs[0].cSize = LZMA2_encode(cctx->jobs[0].enc, cctx->matchTable,
-        cctx->jobs[0].block,
-        &cctx->params.cParams, streamProp,
-        &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+    {
+        U64 const buildTime = cctx->curStats.initTime + cctx->curStats.buildTime;
+        budget = (budget > buildTime) ? budget - buildTime : 0;
+    }
+    budget += !budget;
+    U64 const rate = ((U64)encodeSize * 1000U) / (budget * nbThreads) + 1;
+    cParams->min_rate = (unsigned)MIN(rate, (U32)-1);
 
+    DEBUGLOG(5, "FL2_setEncodeRate : %u us budget, %u bytes/ms per thread", (U32)budget, cParams->min_rate);
+}
+
+/* FL2_encodeCurBlock_blocking() :
+ * Encode cctx->curBlock from the built match table and wait until complete.
+ * Write streamProp as the first byte if >= 0
+ */
+static size_t FL2_encodeCurBlock_blocking(FL2_CCtx* const cctx, int const streamProp)
+{
+    size_t const encodeSize = (cctx->curBlock.end - cctx->curBlock.start);
+#ifndef FL2_SINGLETHREAD
+    size_t nbThreads = MIN(cctx->jobCount, encodeSize / ENC_MIN_BYTES_PER_THREAD);
+    nbThreads += !nbThreads;
+    /* Use smaller slices than one per thread so the threads can balance the load */
+    size_t const nbSlices = (nbThreads > 1) ? MIN(nbThreads * FL2_SLICES_PER_THREAD, encodeSize / ENC_MIN_BYTES_PER_THREAD) : 1;
+#else
+    size_t const nbThreads = 1;
+    size_t const nbSlices = 1;
 #endif
 
+    DEBUGLOG(5, "FL2_encodeCurBlock : %u threads, %u slices, %u start, %u bytes", (U32)nbThreads, (U32)nbSlices, (U32)cctx->curBlock.start, (U32)encodeSize);
+
+    size_t sliceStart = cctx->curBlock.start;
+    size_t const sliceSize = encodeSize / nbSlices;
+
+    for (size_t u = 0; u < nbSlices; ++u) {
+        cctx->slices[u].block.data = cctx->curBlock.data;
+        cctx->slices[u].block.start = sliceStart;
+        cctx->slices[u].block.end = sliceStart + sliceSize;
+        sliceStart += sliceSize;
+    }
+    cctx->slices[nbSlices - 1].block.end = cctx->curBlock.end;
+
+    /* Slice 0 is reserved for job 0 */
+    cctx->sliceIndex = ATOMIC_INITIAL_VALUE + 1;
+    cctx->encodeSlices = nbSlices;
+
     for (size_t u = 0; u < nbThreads; ++u)
-        if (FL2_isError(cctx->jobs[u].cSize))
-            return cctx->jobs[u].cSize;
+        LZMA2_resetChunkCounts(cctx->jobs[u].enc);
+
+    FL2_setEncodeRate(cctx, encodeSize, nbThreads);
+
+    UTIL_time_t const start = UTIL_getTime();
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_addRange(cctx->factory, FL2_compressRadixChunk, cctx, 1, nbThreads);
+#endif
 
-    cctx->threadCount = nbThreads;
+    FL2_encodeSlices(cctx, 0, streamProp);
+
+#ifndef FL2_SINGLETHREAD
+    UTIL_time_t const wait = UTIL_getTime();
+    FL2POOL_waitAll(cctx->factory, 0);
+    cctx->curStats.poolWaitTime += UTIL_clockSpanMicro(wait);
+#endif
+
+    U64 const elapsed = UTIL_clockSpanMicro(start);
+    cctx->curStats.encodeTime += elapsed;
+    for (size_t u = 0; u < nbThreads; ++u) {
+        U64 const busy = MIN(cctx->jobs[u].blockBusy, elapsed);
+        cctx->jobs[u].busyTime += busy;
+        cctx->jobs[u].idleTime += elapsed - busy;
+        cctx->curStats.encodeBusyTime += busy;
+        cctx->curStats.encodeIdleTime += elapsed - busy;
+
+        size_t compressed, stored, fast;
+        LZMA2_getChunkCounts(cctx->jobs[u].enc, &compressed, &stored, &fast);
+        cctx->curStats.compressedChunks += compressed;
+        cctx->curStats.storedChunks += stored;
+        cctx->curStats.fastChunks += fast;
+    }
+    cctx->curStats.blocks = 1;
+    cctx->curStats.inputSize = encodeSize;
+    FL2_endBlockStats(cctx);
+
+    for (size_t u = 0; u < nbSlices; ++u)
+        if (FL2_isError(cctx->slices[u].cSize))
+            return cctx->slices[u].cSize;
+
+    cctx->sliceCount = nbSlices;
 
     return FL2_error_no_error;
 }
 
+/* FL2_compressCurBlock_blocking() :
+ * Compress cctx->curBlock and wait until complete.
+ * Write streamProp as the first byte if >= 0
+ */
+static size_t FL2_compressCurBlock_blocking(FL2_CCtx* const cctx, int const streamProp)
+{
+#ifndef FL2_SINGLETHREAD
+    CHECK_F(FL2_buildMatchTable(cctx, cctx->matchTable, cctx->curBlock, cctx->factory, &cctx->buf, &cctx->curStats));
+#else
+    CHECK_F(FL2_buildMatchTable(cctx, cctx->matchTable, cctx->curBlock, NULL, &cctx->buf, &cctx->curStats));
+#endif
+    return FL2_encodeCurBlock_blocking(cctx, streamProp);
+}
+
 /* FL2_compressCurBlock_async() : FL2POOL_function type */
 static void FL2_compressCurBlock_async(void* const jobDescription, ptrdiff_t const n)
 {
@@ -366,24 +678,30 @@ static void FL2_compressCurBlock_async(void* const jobDescription, ptrdiff_t con
     cctx->asyncRes = FL2_compressCurBlock_blocking(cctx, (int)n);
 }
 
-/* FL2_compressCurBlock() :
+/* FL2_beginCurBlock() :
  * Update total input size.
  * Clear the compressed data buffers.
  * Init progress info.
- * Start compression of cctx->curBlock, and wait for completion if no async compression thread exists.
+ * Returns 0 if cctx->curBlock is empty.
  */
-static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
+static int FL2_beginCurBlock(FL2_CCtx* const cctx)
 {
     FL2_initProgress(cctx);
 
     if (cctx->curBlock.start == cctx->curBlock.end)
-        return FL2_error_no_error;
+        return 0;
 
     /* update largest dict size used */
     cctx->dictMax = MAX(cctx->dictMax, cctx->curBlock.end);
 
-    cctx->outThread = 0;
-    cctx->threadCount = 0;
+    /* Attribute dict shifts since the last block to this one */
+    cctx->curStats.dictShifts = cctx->buf.shift_count - cctx->shiftCountMark;
+    cctx->curStats.dictShiftBytes = cctx->buf.shift_bytes - cctx->shiftBytesMark;
+    cctx->shiftCountMark = cctx->buf.shift_count;
+    cctx->shiftBytesMark = cctx->buf.shift_bytes;
+
+    cctx->outSlice = 0;
+    cctx->sliceCount = 0;
     cctx->outPos = 0;
 
     U32 rmfWeight = ZSTD_highbit32((U32)cctx->curBlock.end);
@@ -409,6 +727,17 @@ static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
     cctx->rmfWeight = rmfWeight;
     cctx->encWeight = encWeight;
 
+    return 1;
+}
+
+/* FL2_compressCurBlock() :
+ * Start compression of cctx->curBlock, and wait for completion if no async compression thread exists.
+ */
+static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
+{
+    if (!FL2_beginCurBlock(cctx))
+        return FL2_error_no_error;
+
 #ifndef FL2_SINGLETHREAD
     if(cctx->compressThread != NULL)
         FL2POOL_add(cctx->compressThread, FL2_compressCurBlock_async, cctx, streamProp);
@@ -419,6 +748,27 @@ static size_t FL2_compressCurBlock(FL2_CCtx* const cctx, int const streamProp)
     return cctx->asyncRes;
 }
 
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_buildNextTable_async() : FL2POOL_function type */
+static void FL2_buildNextTable_async(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+    (void)n;
+
+    cctx->buildRes = FL2_buildMatchTable(cctx, cctx->nextTable, cctx->nextBlock, cctx->buildFactory, &cctx->buf, &cctx->nextStats);
+}
+
+/* FL2_encodeCurBlock_async() : FL2POOL_function type */
+static void FL2_encodeCurBlock_async(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_CCtx* const cctx = (FL2_CCtx*)jobDescription;
+
+    cctx->asyncRes = FL2_encodeCurBlock_blocking(cctx, (int)n);
+}
+
+#endif
+
 /* FL2_getProp() :
  * Get the LZMA2 dictionary size property byte. If xxhash is enabled, includes the xxhash flag bit.
  */
@@ -439,6 +789,12 @@ static void FL2_preBeginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
         RMF_freeMatchTable(cctx->matchTable);
         cctx->matchTable = NULL;
     }
+#ifndef FL2_SINGLETHREAD
+    if (cctx->nextTable && !RMF_compatibleParameters(cctx->nextTable, &cctx->params.rParams, dictReduce)) {
+        RMF_freeMatchTable(cctx->nextTable);
+        cctx->nextTable = NULL;
+    }
+#endif
 }
 
 static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
@@ -456,6 +812,36 @@ static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
         RMF_applyParameters(cctx->matchTable, &cctx->params.rParams, dictReduce);
     }
 
+#ifndef FL2_SINGLETHREAD
+    if (cctx->buildThread != NULL) {
+        /* Second table for pipelined building */
+        if (cctx->nextTable == NULL) {
+            cctx->nextTable = RMF_createMatchTable(&cctx->params.rParams, dictReduce, cctx->jobCount);
+            if (cctx->nextTable == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        else {
+            RMF_applyParameters(cctx->nextTable, &cctx->params.rParams, dictReduce);
+        }
+    }
+    cctx->nextPending = 0;
+#endif
+
+    if (cctx->params.rParams.reuse_overlap) {
+        size_t const overlap = OVERLAP_FROM_DICT_SIZE(cctx->params.rParams.dictionary_size, cctx->params.rParams.overlap_fraction);
+        if (cctx->carry == NULL || RMF_carryCapacity(cctx->carry) < overlap) {
+            RMF_freeCarry(cctx->carry);
+            cctx->carry = RMF_createCarry(overlap);
+            if (cctx->carry == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        RMF_resetCarry(cctx->carry);
+    }
+    else {
+        RMF_freeCarry(cctx->carry);
+        cctx->carry = NULL;
+    }
+
     cctx->dictMax = 0;
     cctx->streamTotal = 0;
     cctx->streamCsize = 0;
@@ -463,12 +849,24 @@ static size_t FL2_beginFrame(FL2_CCtx* const cctx, size_t const dictReduce)
     cctx->progressOut = 0;
     RMF_initProgress(cctx->matchTable);
     cctx->asyncRes = 0;
-    cctx->outThread = 0;
-    cctx->threadCount = 0;
+    cctx->outSlice = 0;
+    cctx->sliceCount = 0;
     cctx->outPos = 0;
     cctx->curBlock.start = 0;
     cctx->curBlock.end = 0;
     cctx->lockParams = 1;
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        cctx->jobs[u].busyTime = 0;
+        cctx->jobs[u].idleTime = 0;
+    }
+    memset(&cctx->curStats, 0, sizeof(cctx->curStats));
+    memset(&cctx->blockStats, 0, sizeof(cctx->blockStats));
+    memset(&cctx->totalStats, 0, sizeof(cctx->totalStats));
+    cctx->shiftCountMark = cctx->buf.shift_count;
+    cctx->shiftBytesMark = cctx->buf.shift_bytes;
+#ifndef FL2_SINGLETHREAD
+    memset(&cctx->nextStats, 0, sizeof(cctx->nextStats));
+#endif
 
     return FL2_error_no_error;
 }
@@ -477,6 +875,10 @@ static void FL2_endFrame(FL2_CCtx* const cctx)
 {
     cctx->dictMax = 0;
     cctx->asyncRes = 0;
+#ifndef FL2_SINGLETHREAD
+    cctx->buildRes = 0;
+    cctx->nextPending = 0;
+#endif
     cctx->lockParams = 0;
 }
 
@@ -505,26 +907,32 @@ static size_t FL2_compressBuffer(FL2_CCtx* const cctx,
         cctx->curBlock.end = cctx->curBlock.start + MIN(srcSize, dictionarySize - cctx->curBlock.start);
         blockTotal += cctx->curBlock.end - cctx->curBlock.start;
 
+        size_t const remaining = srcSize - (cctx->curBlock.end - cctx->curBlock.start);
+        /* periodically reset the dictionary for mt decompression */
+        int const reset = cctx->params.cParams.reset_interval
+            && blockTotal + MIN(dictionarySize - blockOverlap, remaining) > dictionarySize * cctx->params.cParams.reset_interval;
+
+        RMF_setCarry(cctx->matchTable, cctx->carry, cctx->curBlock.start,
+            (remaining != 0 && !reset) ? cctx->curBlock.end - blockOverlap : 0);
+
         CHECK_F(FL2_compressCurBlock(cctx, streamProp));
 
         streamProp = -1;
 
-        for (size_t u = 0; u < cctx->threadCount; ++u) {
-            DEBUGLOG(5, "Write thread %u : %u bytes", (U32)u, (U32)cctx->jobs[u].cSize);
+        for (size_t u = 0; u < cctx->sliceCount; ++u) {
+            DEBUGLOG(5, "Write slice %u : %u bytes", (U32)u, (U32)cctx->slices[u].cSize);
 
-            if (dstCapacity < cctx->jobs[u].cSize) 
+            if (dstCapacity < cctx->slices[u].cSize) 
                 return FL2_ERROR(dstSize_tooSmall);
 
-            const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->jobs[u].block.start);
-            memcpy(dstBuf, outBuf, cctx->jobs[u].cSize);
+            const BYTE* const outBuf = RMF_getTableAsOutputBuffer(cctx->matchTable, cctx->slices[u].block.start);
+            memcpy(dstBuf, outBuf, cctx->slices[u].cSize);
 
-            dstBuf += cctx->jobs[u].cSize;
-            dstCapacity -= cctx->jobs[u].cSize;
+            dstBuf += cctx->slices[u].cSize;
+            dstCapacity -= cctx->slices[u].cSize;
         }
-        srcSize -= cctx->curBlock.end - cctx->curBlock.start;
-        if (cctx->params.cParams.reset_interval
-            && blockTotal + MIN(dictionarySize - blockOverlap, srcSize) > dictionarySize * cctx->params.cParams.reset_interval) {
-            /* periodically reset the dictionary for mt decompression */
+        srcSize = remaining;
+        if (reset) {
             DEBUGLOG(4, "Resetting dictionary after %u bytes", (unsigned)blockTotal);
             cctx->curBlock.start = 0;
             blockTotal = 0;
@@ -554,6 +962,12 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressCCtx(FL2_CCtx* cctx,
     /* No async compression for in-memory function */
     FL2POOL_free(cctx->compressThread);
     cctx->compressThread = NULL;
+    FL2POOL_free(cctx->buildThread);
+    cctx->buildThread = NULL;
+    FL2POOL_free(cctx->buildFactory);
+    cctx->buildFactory = NULL;
+    RMF_freeMatchTable(cctx->nextTable);
+    cctx->nextTable = NULL;
     cctx->timeout = 0;
 #endif
 
@@ -617,6 +1031,179 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compress(void* dst, size_t dstCapacity,
     return FL2_compressMt(dst, dstCapacity, src, srcSize, compressionLevel, 1);
 }
 
+/* Shared state of the threads compressing a batch */
+typedef struct {
+    FL2_CCtx* cctx;
+    FL2_batchItem* items;
+    size_t nbItems;
+    FL2_atomic itemIndex;
+} FL2_batchJob;
+
+/* FL2_compressBatchItem() :
+ * Compress one item using the encoder and batch table of job n, in the same format as FL2_compressCCtx().
+ * Return: compressed size or error code.
+ */
+static size_t FL2_compressBatchItem(FL2_CCtx* const cctx, size_t const n, const FL2_batchItem* const item)
+{
+    FL2_matchTable* const tbl = cctx->jobs[n].batchTable;
+    LZMA2_ECtx* const enc = cctx->jobs[n].enc;
+    size_t const dictionarySize = cctx->params.rParams.dictionary_size;
+    size_t const blockOverlap = OVERLAP_FROM_DICT_SIZE(dictionarySize, cctx->params.rParams.overlap_fraction);
+    size_t srcSize = item->srcSize;
+    BYTE* dstBuf = item->dst;
+    BYTE* const end = dstBuf + item->dstCapacity;
+    int streamProp = cctx->params.omitProp ? -1 : FL2_getProp(cctx, MIN(srcSize, dictionarySize));
+    FL2_cStreamStats stats;
+    FL2_dataBlock block;
+    size_t blockTotal = 0;
+
+    memset(&stats, 0, sizeof(stats));
+    block.data = item->src;
+    block.start = 0;
+
+    while (srcSize != 0) {
+        block.end = block.start + MIN(srcSize, dictionarySize - block.start);
+        blockTotal += block.end - block.start;
+
+        RMF_initProgress(tbl);
+        CHECK_F(FL2_buildMatchTable(cctx, tbl, block, NULL, NULL, &stats));
+
+        size_t const cSize = LZMA2_encode(enc, tbl, block, &cctx->params.cParams, streamProp,
+            &cctx->progressIn, &cctx->progressOut, &cctx->canceled);
+        if (FL2_isError(cSize))
+            return cSize;
+        streamProp = -1;
+
+        if ((size_t)(end - dstBuf) < cSize)
+            return FL2_ERROR(dstSize_tooSmall);
+        memcpy(dstBuf, RMF_getTableAsOutputBuffer(tbl, block.start), cSize);
+        dstBuf += cSize;
+
+        srcSize -= block.end - block.start;
+        if (cctx->params.cParams.reset_interval
+            && blockTotal + MIN(dictionarySize - blockOverlap, srcSize) > dictionarySize * cctx->params.cParams.reset_interval) {
+            block.start = 0;
+            blockTotal = 0;
+        }
+        else {
+            block.start = blockOverlap;
+        }
+        block.data += block.end - block.start;
+    }
+
+    if ((size_t)(end - dstBuf) < 2U - (streamProp < 0))
+        return FL2_ERROR(dstSize_tooSmall);
+    if (streamProp >= 0)
+        *dstBuf++ = (BYTE)streamProp;
+    *dstBuf++ = LZMA2_END_MARKER;
+
+#ifndef NO_XXHASH
+    if (cctx->params.doXXH && !cctx->params.omitProp) {
+        XXH32_canonical_t canonical;
+        if (end - dstBuf < XXHASH_SIZEOF)
+            return FL2_ERROR(dstSize_tooSmall);
+        XXH32_canonicalFromHash(&canonical, XXH32(item->src, item->srcSize, 0));
+        memcpy(dstBuf, &canonical, XXHASH_SIZEOF);
+        dstBuf += XXHASH_SIZEOF;
+    }
+#endif
+
+    return dstBuf - (BYTE*)item->dst;
+}
+
+/* FL2_compressBatchItems() : FL2POOL_function type
+ * Compress items until none remain.
+ */
+static void FL2_compressBatchItems(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_batchJob* const job = (FL2_batchJob*)jobDescription;
+    UTIL_time_t const start = UTIL_getTime();
+
+    for (;;) {
+        size_t const u = (size_t)FL2_atomic_increment(job->itemIndex) - ATOMIC_INITIAL_VALUE;
+        if (u >= job->nbItems)
+            break;
+        job->items[u].cSize = FL2_compressBatchItem(job->cctx, n, &job->items[u]);
+    }
+    job->cctx->jobs[n].busyTime += UTIL_clockSpanMicro(start);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_compressBatch(FL2_CCtx* cctx,
+    FL2_batchItem* items, size_t nbItems,
+    int compressionLevel)
+{
+    if (cctx->lockParams)
+        return FL2_ERROR(stage_wrong);
+
+    if (compressionLevel > 0)
+        FL2_CCtx_setParameter(cctx, FL2_p_compressionLevel, compressionLevel);
+
+    size_t maxSize = 0;
+    for (size_t u = 0; u < nbItems; ++u)
+        maxSize = MAX(maxSize, items[u].srcSize);
+
+#ifndef FL2_SINGLETHREAD
+    size_t const nbThreads = MIN(cctx->jobCount, nbItems);
+#else
+    size_t const nbThreads = MIN(1, nbItems);
+#endif
+
+    DEBUGLOG(4, "FL2_compressBatch : level %u, %u items, %u threads, largest %u", cctx->params.compressionLevel, (U32)nbItems, (U32)nbThreads, (U32)maxSize);
+
+    if (FL2_initEncoders(cctx) != 0)
+        return FL2_ERROR(memory_allocation);
+
+    /* The throughput target is not applied to batch items */
+    cctx->params.cParams.min_rate = 0;
+
+    /* One single-thread table per job, reduced to the largest item. Empty items don't need one. */
+    for (size_t u = 0; u < nbThreads && maxSize != 0; ++u) {
+        FL2_job* const fj = &cctx->jobs[u];
+        if (fj->batchTable != NULL && !RMF_compatibleParameters(fj->batchTable, &cctx->params.rParams, maxSize)) {
+            RMF_freeMatchTable(fj->batchTable);
+            fj->batchTable = NULL;
+        }
+        if (fj->batchTable == NULL) {
+            fj->batchTable = RMF_createMatchTable(&cctx->params.rParams, maxSize, 1);
+            if (fj->batchTable == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        else {
+            RMF_applyParameters(fj->batchTable, &cctx->params.rParams, maxSize);
+        }
+    }
+
+    FL2_batchJob job;
+    job.cctx = cctx;
+    job.items = items;
+    job.nbItems = nbItems;
+    job.itemIndex = ATOMIC_INITIAL_VALUE;
+
+    cctx->progressIn = 0;
+    cctx->progressOut = 0;
+    cctx->canceled = 0;
+    for (unsigned u = 0; u < cctx->jobCount; ++u) {
+        cctx->jobs[u].busyTime = 0;
+        cctx->jobs[u].idleTime = 0;
+    }
+
+    if (nbThreads != 0) {
+#ifndef FL2_SINGLETHREAD
+        FL2POOL_addRange(cctx->factory, FL2_compressBatchItems, &job, 1, nbThreads);
+#endif
+        FL2_compressBatchItems(&job, 0);
+#ifndef FL2_SINGLETHREAD
+        FL2POOL_waitAll(cctx->factory, 0);
+#endif
+    }
+
+    for (size_t u = 0; u < nbItems; ++u)
+        if (FL2_isError(items[u].cSize))
+            return items[u].cSize;
+
+    return 0;
+}
+
 FL2LIB_API BYTE FL2LIB_CALL FL2_getCCtxDictProp(FL2_CCtx* cctx)
 {
     return LZMA2_getDictSizeProp(cctx->dictMax ? cctx->dictMax : cctx->params.rParams.dictionary_size);
@@ -745,6 +1332,23 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_setParameter(FL2_CCtx* cctx, FL2_cParamet
     case FL2_p_omitProperties:
         cctx->params.omitProp = value != 0;
         break;
+
+    case FL2_p_skipIncompressible:
+        cctx->params.rParams.skip_incompressible = value != 0;
+        break;
+
+    case FL2_p_largePages:
+        cctx->params.rParams.large_pages = value != 0;
+        break;
+
+    case FL2_p_reuseOverlap:
+        cctx->params.rParams.reuse_overlap = value != 0;
+        break;
+
+    case FL2_p_minThroughput:
+        MAXCHECK(value, FL2_THROUGHPUT_MAX);
+        cctx->params.minThroughput = (unsigned)value;
+        break;
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         cctx->params.rParams.use_ref_mf = value != 0;
@@ -818,6 +1422,18 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CCtx_getParameter(FL2_CCtx* cctx, FL2_cParamet
 
     case FL2_p_omitProperties:
         return cctx->params.omitProp;
+
+    case FL2_p_skipIncompressible:
+        return cctx->params.rParams.skip_incompressible;
+
+    case FL2_p_largePages:
+        return cctx->params.rParams.large_pages;
+
+    case FL2_p_reuseOverlap:
+        return cctx->params.rParams.reuse_overlap;
+
+    case FL2_p_minThroughput:
+        return cctx->params.minThroughput;
 #ifdef RMF_REFERENCE
     case FL2_p_useReferenceMF:
         return cctx->params.rParams.use_ref_mf;
@@ -838,12 +1454,17 @@ FL2LIB_API size_t FL2LIB_CALL FL2_CStream_getParameter(FL2_CStream* fcs, FL2_cPa
 
 FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStream(void)
 {
-    return FL2_createCCtx_internal(1, 0);
+    return FL2_createCCtx_internal(1, 0, NULL);
 }
 
 FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamMt(unsigned nbThreads, int dualBuffer)
 {
-    return FL2_createCCtx_internal(nbThreads, dualBuffer);
+    return FL2_createCCtx_internal(nbThreads, dualBuffer, NULL);
+}
+
+FL2LIB_API FL2_CStream* FL2LIB_CALL FL2_createCStreamWithPool(unsigned nbThreads, int dualBuffer, FL2_threadPool* pool)
+{
+    return FL2_createCCtx_internal(nbThreads, dualBuffer, pool);
 }
 
 FL2LIB_API void FL2LIB_CALL FL2_freeCStream(FL2_CStream * fcs)
@@ -877,7 +1498,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionL
     int const doHash = (fcs->params.doXXH && !fcs->params.omitProp);
 #endif
     size_t dictOverlap = OVERLAP_FROM_DICT_SIZE(fcs->params.rParams.dictionary_size, fcs->params.rParams.overlap_fraction);
-    if (DICT_init(buf, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash) != 0)
+    if (DICT_init(buf, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash, fcs->params.rParams.large_pages) != 0)
         return FL2_ERROR(memory_allocation);
 
     CHECK_F(FL2_beginFrame(fcs, 0));
@@ -885,6 +1506,43 @@ FL2LIB_API size_t FL2LIB_CALL FL2_initCStream(FL2_CStream* fcs, int compressionL
     return 0;
 }
 
+FL2LIB_API size_t FL2LIB_CALL FL2_initCStreamSource(FL2_CStream* fcs, const void* src, size_t srcSize, int compressionLevel)
+{
+    static const BYTE emptySource = 0;
+
+    DEBUGLOG(4, "FL2_initCStreamSource level %d, %u bytes", compressionLevel, (U32)srcSize);
+
+    if (src == NULL) {
+        if (srcSize != 0)
+            return FL2_ERROR(srcSize_wrong);
+        src = &emptySource;
+    }
+
+    fcs->endMarked = 0;
+    fcs->wroteProp = 0;
+    fcs->loopCount = 0;
+
+    if(compressionLevel > 0)
+        FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, compressionLevel);
+
+    FL2_preBeginFrame(fcs, srcSize);
+
+#ifdef NO_XXHASH
+    int const doHash = 0;
+#else
+    int const doHash = (fcs->params.doXXH && !fcs->params.omitProp);
+#endif
+    /* The window must not exceed the reduced match table */
+    size_t const dictSize = MIN(fcs->params.rParams.dictionary_size, MAX(srcSize, FL2_DICTSIZE_MIN));
+    size_t dictOverlap = OVERLAP_FROM_DICT_SIZE(fcs->params.rParams.dictionary_size, fcs->params.rParams.overlap_fraction);
+    if (DICT_initSource(&fcs->buf, src, srcSize, dictSize, dictOverlap, fcs->params.cParams.reset_interval, doHash) != 0)
+        return FL2_ERROR(memory_allocation);
+
+    CHECK_F(FL2_beginFrame(fcs, srcSize));
+
+    return 0;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_setCStreamTimeout(FL2_CStream * fcs, unsigned timeout)
 {
 #ifndef FL2_SINGLETHREAD
@@ -905,30 +1563,109 @@ FL2LIB_API size_t FL2LIB_CALL FL2_setCStreamTimeout(FL2_CStream * fcs, unsigned
     return FL2_error_no_error;
 }
 
+/* FL2_nextPending() :
+ * Returns 1 if a block is being built in pipelined mode and is not yet encoding.
+ */
+static int FL2_nextPending(const FL2_CStream* const fcs)
+{
+#ifndef FL2_SINGLETHREAD
+    return fcs->nextPending;
+#else
+    (void)fcs;
+    return 0;
+#endif
+}
+
+/* FL2_getStreamProp() :
+ * If the LZMA2 property byte is required and not already written, return it
+ * for passing to the compression function. Otherwise return -1.
+ */
+static int FL2_getStreamProp(FL2_CStream* const fcs, size_t const blockEnd, int const ending)
+{
+    int streamProp = -1;
+
+    if (!fcs->wroteProp && !fcs->params.omitProp) {
+        size_t dictionarySize = ending ? MAX(fcs->dictMax, blockEnd)
+            : fcs->params.rParams.dictionary_size;
+        streamProp = FL2_getProp(fcs, dictionarySize);
+        DEBUGLOG(4, "Writing property byte : 0x%X", streamProp);
+        fcs->wroteProp = 1;
+    }
+    return streamProp;
+}
+
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_compressStream_pipelined() :
+ * The table for unprocessed data is built in nextTable while the current block is encoded.
+ * The tables are swapped and the next block is encoded once its table is built, the current
+ * block is encoded, and the compressed output has been read.
+ */
+static size_t FL2_compressStream_pipelined(FL2_CStream* const fcs, int const ending)
+{
+    DICT_buffer *const buf = &fcs->buf;
+
+    if (fcs->nextPending) {
+        CHECK_F(FL2_waitCStream(fcs));
+
+        /* no encoding can occur while compressed output exists */
+        if (fcs->outSlice < fcs->sliceCount)
+            return FL2_error_no_error;
+
+        if (FL2POOL_waitAll(fcs->buildThread, fcs->timeout) != 0)
+            return FL2_ERROR(timedOut);
+        CHECK_F(fcs->buildRes);
+
+        FL2_matchTable* const tbl = fcs->matchTable;
+        fcs->matchTable = fcs->nextTable;
+        fcs->nextTable = tbl;
+
+        fcs->streamTotal += fcs->curBlock.end - fcs->curBlock.start;
+        fcs->curBlock = fcs->nextBlock;
+        fcs->curStats = fcs->nextStats;
+        memset(&fcs->nextStats, 0, sizeof(fcs->nextStats));
+        fcs->nextPending = 0;
+
+        if (FL2_beginCurBlock(fcs)) {
+            /* match finding is complete */
+            fcs->matchTable->progress = fcs->curBlock.end;
+            FL2POOL_add(fcs->compressThread, FL2_encodeCurBlock_async, fcs, fcs->nextProp);
+        }
+    }
+    if (DICT_hasUnprocessed(buf)) {
+        DICT_getBlock(buf, &fcs->nextBlock);
+        RMF_setCarry(fcs->nextTable, fcs->carry, fcs->nextBlock.start, DICT_overlapFrom(buf));
+        fcs->nextProp = FL2_getStreamProp(fcs, fcs->nextBlock.end, ending);
+        fcs->nextPending = 1;
+
+        FL2POOL_add(fcs->buildThread, FL2_buildNextTable_async, fcs, 0);
+
+        CHECK_F(FL2_waitCStream(fcs));
+    }
+    return FL2_error_no_error;
+}
+
+#endif
+
 static size_t FL2_compressStream_internal(FL2_CStream* const fcs, int const ending)
 {
+#ifndef FL2_SINGLETHREAD
+    if (fcs->buildThread != NULL)
+        return FL2_compressStream_pipelined(fcs, ending);
+#endif
+
     CHECK_F(FL2_waitCStream(fcs));
 
     DICT_buffer *const buf = &fcs->buf;
 
     /* no compression can occur while compressed output exists */
-    if (fcs->outThread == fcs->threadCount && DICT_hasUnprocessed(buf)) {
+    if (fcs->outSlice == fcs->sliceCount && DICT_hasUnprocessed(buf)) {
         fcs->streamTotal += fcs->curBlock.end - fcs->curBlock.start;
 
         DICT_getBlock(buf, &fcs->curBlock);
+        RMF_setCarry(fcs->matchTable, fcs->carry, fcs->curBlock.start, DICT_overlapFrom(buf));
 
-        int streamProp = -1;
-
-        if (!fcs->wroteProp && !fcs->params.omitProp) {
-            /* If the LZMA2 property byte is required and not already written,
-             * pass it to the compression function 
-             */
-            size_t dictionarySize = ending ? MAX(fcs->dictMax, fcs->curBlock.end)
-                : fcs->params.rParams.dictionary_size;
-            streamProp = FL2_getProp(fcs, dictionarySize);
-            DEBUGLOG(4, "Writing property byte : 0x%X", streamProp);
-            fcs->wroteProp = 1;
-        }
+        int const streamProp = FL2_getStreamProp(fcs, fcs->curBlock.end, ending);
 
         CHECK_F(FL2_compressCurBlock(fcs, streamProp));
     }
@@ -940,11 +1677,11 @@ static size_t FL2_compressStream_internal(FL2_CStream* const fcs, int const endi
  */
 FL2LIB_API size_t FL2LIB_CALL FL2_copyCStreamOutput(FL2_CStream* fcs, FL2_outBuffer *output)
 {
-    for (; fcs->outThread < fcs->threadCount; ++fcs->outThread) {
-        const BYTE* const outBuf = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[fcs->outThread].block.start) + fcs->outPos;
+    for (; fcs->outSlice < fcs->sliceCount; ++fcs->outSlice) {
+        const BYTE* const outBuf = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->slices[fcs->outSlice].block.start) + fcs->outPos;
         BYTE* const dstBuf = (BYTE*)output->dst + output->pos;
         size_t const dstCapacity = output->size - output->pos;
-        size_t toWrite = fcs->jobs[fcs->outThread].cSize;
+        size_t toWrite = fcs->slices[fcs->outSlice].cSize;
 
         toWrite = MIN(toWrite - fcs->outPos, dstCapacity);
 
@@ -955,7 +1692,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_copyCStreamOutput(FL2_CStream* fcs, FL2_outBuf
         output->pos += toWrite;
 
         /* If the slice is not flushed, the output is full */
-        if (fcs->outPos < fcs->jobs[fcs->outThread].cSize)
+        if (fcs->outPos < fcs->slices[fcs->outSlice].cSize)
             return 1;
 
         fcs->outPos = 0;
@@ -969,12 +1706,18 @@ static size_t FL2_compressStream_input(FL2_CStream* fcs, FL2_inBuffer* input)
 
     DICT_buffer * const buf = &fcs->buf;
 
+    if (DICT_isSource(buf) && input->pos < input->size)
+        return FL2_ERROR(stage_wrong);
+
     while (input->pos < input->size) {
         /* read input until the buffer(s) are full */
         if (DICT_needShift(buf)) {
             /* cannot shift single dict during compression */
             if(!DICT_async(buf))
                 CHECK_F(FL2_waitCStream(fcs));
+            /* nor the other dict while its block may still be encoding */
+            if (FL2_nextPending(fcs))
+                CHECK_F(FL2_compressStream_internal(fcs, 0));
             DICT_shift(buf);
         }
         
@@ -984,7 +1727,7 @@ static size_t FL2_compressStream_input(FL2_CStream* fcs, FL2_inBuffer* input)
         
         if (!DICT_availSpace(buf)) {
             /* break if the compressor is not available */
-            if (fcs->outThread < fcs->threadCount)
+            if (fcs->outSlice < fcs->sliceCount)
                 break;
 
             CHECK_F(FL2_compressStream_internal(fcs, 0));
@@ -1019,17 +1762,17 @@ FL2LIB_API size_t FL2LIB_CALL FL2_compressStream(FL2_CStream* fcs, FL2_outBuffer
     size_t const prevIn = input->pos;
     size_t const prevOut = (output != NULL) ? output->pos : 0;
 
-    if (output != NULL && fcs->outThread < fcs->threadCount)
+    if (output != NULL && fcs->outSlice < fcs->sliceCount)
         FL2_copyCStreamOutput(fcs, output);
 
     CHECK_F(FL2_compressStream_input(fcs, input));
 
-    if(output != NULL && fcs->outThread < fcs->threadCount)
+    if(output != NULL && fcs->outSlice < fcs->sliceCount)
         FL2_copyCStreamOutput(fcs, output);
 
     CHECK_F(FL2_loopCheck(fcs, prevIn == input->pos && (output == NULL || prevOut == output->pos)));
 
-    return fcs->outThread < fcs->threadCount;
+    return fcs->outSlice < fcs->sliceCount;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_getDictionaryBuffer(FL2_CStream * fcs, FL2_dictBuffer * dict)
@@ -1041,12 +1784,18 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getDictionaryBuffer(FL2_CStream * fcs, FL2_dic
 
     DICT_buffer *buf = &fcs->buf;
 
+    if (DICT_isSource(buf))
+        return FL2_ERROR(stage_wrong);
+
     if (!DICT_availSpace(buf) && DICT_hasUnprocessed(buf))
         CHECK_F(FL2_compressStream_internal(fcs, 0));
 
     if (DICT_needShift(buf) && !DICT_async(buf))
         CHECK_F(FL2_waitCStream(fcs));
 
+    if (DICT_needShift(buf) && FL2_nextPending(fcs))
+        CHECK_F(FL2_compressStream_internal(fcs, 0));
+
     dict->size = (unsigned long)DICT_get(buf, &dict->dst);
 
     return FL2_error_no_error;
@@ -1054,10 +1803,13 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getDictionaryBuffer(FL2_CStream * fcs, FL2_dic
 
 FL2LIB_API size_t FL2LIB_CALL FL2_updateDictionary(FL2_CStream * fcs, size_t addedSize)
 {
+    if (DICT_isSource(&fcs->buf))
+        return FL2_ERROR(stage_wrong);
+
     if (DICT_update(&fcs->buf, addedSize))
         CHECK_F(FL2_compressStream_internal(fcs, 0));
 
-    return fcs->outThread < fcs->threadCount;
+    return fcs->outSlice < fcs->sliceCount;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_getNextCompressedBuffer(FL2_CStream* fcs, FL2_cBuffer* cbuf)
@@ -1069,15 +1821,24 @@ FL2LIB_API size_t FL2LIB_CALL FL2_getNextCompressedBuffer(FL2_CStream* fcs, FL2_
 	CHECK_F(FL2_waitCStream(fcs));
 #endif
 
-    if (fcs->outThread < fcs->threadCount) {
-        cbuf->src = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[fcs->outThread].block.start) + fcs->outPos;
-        cbuf->size = fcs->jobs[fcs->outThread].cSize - fcs->outPos;
-        ++fcs->outThread;
+    if (fcs->outSlice < fcs->sliceCount) {
+        cbuf->src = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->slices[fcs->outSlice].block.start) + fcs->outPos;
+        cbuf->size = fcs->slices[fcs->outSlice].cSize - fcs->outPos;
+        ++fcs->outSlice;
         fcs->outPos = 0;
     }
     return cbuf->size;
 }
 
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getCStreamBlockStart(const FL2_CStream* fcs, int* dictReset)
+{
+    /* streamTotal is advanced past curBlock only when the next block is taken, which can't
+     * occur while its compressed output remains unread */
+    if (dictReset != NULL)
+        *dictReset = fcs->curBlock.start == 0 && fcs->curBlock.end != 0;
+    return fcs->streamTotal;
+}
+
 FL2LIB_API unsigned long long FL2LIB_CALL FL2_getCStreamProgress(const FL2_CStream * fcs, unsigned long long *outputSize)
 {
     if (outputSize != NULL)
@@ -1091,6 +1852,14 @@ FL2LIB_API unsigned long long FL2LIB_CALL FL2_getCStreamProgress(const FL2_CStre
     return fcs->streamTotal + ((fcs->rmfWeight * encodeSize) >> 4) + ((fcs->progressIn * fcs->encWeight) >> 4);
 }
 
+FL2LIB_API void FL2LIB_CALL FL2_getCStreamStats(const FL2_CStream * fcs, FL2_cStreamStats *blockStats, FL2_cStreamStats *totalStats)
+{
+    if (blockStats != NULL)
+        *blockStats = fcs->blockStats;
+    if (totalStats != NULL)
+        *totalStats = fcs->totalStats;
+}
+
 FL2LIB_API size_t FL2LIB_CALL FL2_waitCStream(FL2_CStream * fcs)
 {
 #ifndef FL2_SINGLETHREAD
@@ -1098,7 +1867,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_waitCStream(FL2_CStream * fcs)
         return FL2_ERROR(timedOut);
     CHECK_F(fcs->asyncRes);
 #endif
-    return fcs->outThread < fcs->threadCount;
+    return fcs->outSlice < fcs->sliceCount || FL2_nextPending(fcs);
 }
 
 FL2LIB_API void FL2LIB_CALL FL2_cancelCStream(FL2_CStream *fcs)
@@ -1108,6 +1877,10 @@ FL2LIB_API void FL2LIB_CALL FL2_cancelCStream(FL2_CStream *fcs)
         fcs->canceled = 1;
 
         RMF_cancelBuild(fcs->matchTable);
+        if (fcs->buildThread != NULL) {
+            RMF_cancelBuild(fcs->nextTable);
+            FL2POOL_waitAll(fcs->buildThread, 0);
+        }
         FL2POOL_waitAll(fcs->compressThread, 0);
 
         fcs->canceled = 0;
@@ -1121,8 +1894,8 @@ FL2LIB_API size_t FL2LIB_CALL FL2_remainingOutputSize(const FL2_CStream* fcs)
     CHECK_F(fcs->asyncRes);
 
     size_t cSize = 0;
-    for (size_t u = fcs->outThread; u < fcs->threadCount; ++u)
-        cSize += fcs->jobs[u].cSize;
+    for (size_t u = fcs->outSlice; u < fcs->sliceCount; ++u)
+        cSize += fcs->slices[u].cSize;
 
     return cSize;
 }
@@ -1132,15 +1905,16 @@ FL2LIB_API size_t FL2LIB_CALL FL2_remainingOutputSize(const FL2_CStream* fcs)
  */
 static void FL2_writeEnd(FL2_CStream* const fcs)
 {
-    size_t thread = fcs->threadCount - 1;
-    if (fcs->outThread == fcs->threadCount) {
-        fcs->outThread = 0; 
-        fcs->threadCount = 1;
-        fcs->jobs[0].cSize = 0;
-        thread = 0;
+    size_t slice = fcs->sliceCount - 1;
+    if (fcs->outSlice == fcs->sliceCount) {
+        fcs->outSlice = 0; 
+        fcs->sliceCount = 1;
+        fcs->slices[0].block.start = 0;
+        fcs->slices[0].cSize = 0;
+        slice = 0;
     }
-    BYTE *const dst = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->jobs[thread].block.start)
-        + fcs->jobs[thread].cSize;
+    BYTE *const dst = RMF_getTableAsOutputBuffer(fcs->matchTable, fcs->slices[slice].block.start)
+        + fcs->slices[slice].cSize;
 
     size_t pos = 0;
 
@@ -1159,6 +1933,7 @@ static void FL2_writeEnd(FL2_CStream* const fcs)
     if (fcs->params.doXXH && !fcs->params.omitProp) {
         XXH32_canonical_t canonical;
 
+        DICT_hashBlock(&fcs->buf);
         XXH32_canonicalFromHash(&canonical, DICT_getDigest(&fcs->buf));
         DEBUGLOG(4, "Writing XXH32");
         memcpy(dst + pos, &canonical, XXHASH_SIZEOF);
@@ -1166,7 +1941,7 @@ static void FL2_writeEnd(FL2_CStream* const fcs)
         pos += XXHASH_SIZEOF;
     }
 #endif
-    fcs->jobs[thread].cSize += pos;
+    fcs->slices[slice].cSize += pos;
     fcs->endMarked = 1;
 
     FL2_endFrame(fcs);
@@ -1182,7 +1957,7 @@ static size_t FL2_flushStream_internal(FL2_CStream* fcs, int const ending)
 
     CHECK_F(FL2_compressStream_internal(fcs, ending));
 
-    return fcs->outThread < fcs->threadCount;
+    return fcs->outSlice < fcs->sliceCount || FL2_nextPending(fcs);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer *output)
@@ -1192,7 +1967,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer *o
 
     size_t const prevOut = (output != NULL) ? output->pos : 0;
 
-    if (output != NULL && fcs->outThread < fcs->threadCount)
+    if (output != NULL && fcs->outSlice < fcs->sliceCount)
         FL2_copyCStreamOutput(fcs, output);
 
     size_t res = FL2_flushStream_internal(fcs, 0);
@@ -1200,7 +1975,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_flushStream(FL2_CStream* fcs, FL2_outBuffer *o
 
     if (output != NULL && res != 0) {
         FL2_copyCStreamOutput(fcs, output);
-        res = fcs->outThread < fcs->threadCount;
+        res = fcs->outSlice < fcs->sliceCount || FL2_nextPending(fcs);
     }
 
     CHECK_F(FL2_loopCheck(fcs, output != NULL && prevOut == output->pos));
@@ -1215,7 +1990,7 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer *out
 
     size_t const prevOut = (output != NULL) ? output->pos : 0;
     
-    if (output != NULL && fcs->outThread < fcs->threadCount)
+    if (output != NULL && fcs->outSlice < fcs->sliceCount)
         FL2_copyCStreamOutput(fcs, output);
 
     CHECK_F(FL2_flushStream_internal(fcs, 1));
@@ -1223,14 +1998,14 @@ FL2LIB_API size_t FL2LIB_CALL FL2_endStream(FL2_CStream* fcs, FL2_outBuffer *out
     size_t res = FL2_waitCStream(fcs);
     CHECK_F(res);
 
-    if (!fcs->endMarked && !DICT_hasUnprocessed(&fcs->buf)) {
+    if (!fcs->endMarked && !DICT_hasUnprocessed(&fcs->buf) && !FL2_nextPending(fcs)) {
         FL2_writeEnd(fcs);
         res = 1;
     }
 
     if (output != NULL && res != 0) {
         FL2_copyCStreamOutput(fcs, output);
-        res = fcs->outThread < fcs->threadCount || DICT_hasUnprocessed(&fcs->buf);
+        res = fcs->outSlice < fcs->sliceCount || DICT_hasUnprocessed(&fcs->buf) || FL2_nextPending(fcs);
     }
 
     CHECK_F(FL2_loopCheck(fcs, output != NULL && prevOut == output->pos));
@@ -1288,22 +2063,102 @@ FL2LIB_API size_t FL2LIB_CALL FL2_estimateCCtxSize_usingCCtx(const FL2_CCtx * cc
         cctx->params.rParams.match_buffer_resize,
         cctx->params.cParams.second_dict_bits,
         cctx->params.cParams.strategy,
-        cctx->jobCount) + DICT_memUsage(&cctx->buf);
+        cctx->jobCount) + DICT_memUsage(&cctx->buf)
+        + (cctx->params.rParams.reuse_overlap ? RMF_carryMemoryUsage(OVERLAP_FROM_DICT_SIZE(cctx->params.rParams.dictionary_size,
+            cctx->params.rParams.overlap_fraction)) : 0)
+#ifndef FL2_SINGLETHREAD
+        + (cctx->buildThread != NULL) * RMF_memoryUsage(cctx->params.rParams.dictionary_size,
+            cctx->params.rParams.match_buffer_resize,
+            cctx->jobCount)
+#endif
+        ;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize(int compressionLevel, unsigned nbThreads, int dualBuffer)
 {
-    return FL2_estimateCCtxSize(compressionLevel, nbThreads)
-        + (FL2_defaultCParameters[compressionLevel].dictionarySize << (dualBuffer != 0));
+    if (compressionLevel == 0)
+        compressionLevel = FL2_CLEVEL_DEFAULT;
+
+    CLAMPCHECK(compressionLevel, 1, FL2_MAX_CLEVEL);
+
+    return FL2_estimateCStreamSize_byParams(FL2_defaultCParameters + compressionLevel, nbThreads, dualBuffer);
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_byParams(const FL2_compressionParameters * params, unsigned nbThreads, int dualBuffer)
 {
-    return FL2_estimateCCtxSize_byParams(params, nbThreads)
+    size_t size = FL2_estimateCCtxSize_byParams(params, nbThreads)
         + (params->dictionarySize << (dualBuffer != 0));
+#ifndef FL2_SINGLETHREAD
+    /* pipelined building uses a second match table */
+    if (dualBuffer >= FL2_DUAL_BUFFER_PIPELINED)
+        size += RMF_memoryUsage(params->dictionarySize, FL2_BUFFER_RESIZE_DEFAULT, FL2_checkNbThreads(nbThreads));
+#endif
+    return size;
 }
 
 FL2LIB_API size_t FL2LIB_CALL FL2_estimateCStreamSize_usingCStream(const FL2_CStream* fcs)
 {
     return FL2_estimateCCtxSize_usingCCtx(fcs);
 }
+
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getMemoryLimit(void)
+{
+    return UTIL_memoryLimit();
+}
+
+/* next smaller dictionary size in the sequence 2^n, 1.5 * 2^n */
+static size_t FL2_lowerDictSize(size_t dictSize)
+{
+    size_t top = 1;
+    while (top <= dictSize / 2)
+        top <<= 1;
+    if (dictSize > top + (top >> 1))
+        return top + (top >> 1);
+    if (dictSize > top)
+        return top;
+    return (top >> 1) + (top >> 2);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_fitCStreamParams(FL2_compressionParameters *params, unsigned *nbThreads, int *dualBuffer, unsigned long long memLimit)
+{
+    unsigned const maxThreads = FL2_checkNbThreads(*nbThreads);
+    int const maxDual = MIN(MAX(*dualBuffer, 0), FL2_DUAL_BUFFER_PIPELINED);
+    size_t dictSize = MIN(MAX(params->dictionarySize, FL2_DICTSIZE_MIN), FL2_DICTSIZE_MAX);
+
+    *nbThreads = maxThreads;
+    *dualBuffer = maxDual;
+    params->dictionarySize = dictSize;
+    if (memLimit == 0)
+        return FL2_estimateCStreamSize_byParams(params, maxThreads, maxDual);
+
+    /* Dictionary size matters most for the ratio and threads for the speed, so drop
+     * the second buffer first, then reduce threads, then step the dictionary down */
+    for (;;) {
+        params->dictionarySize = dictSize;
+        for (unsigned t = maxThreads; t >= 1; --t) {
+            size_t const size = FL2_estimateCStreamSize_byParams(params, t, 0);
+            if (size > memLimit)
+                continue;
+            *nbThreads = t;
+            *dualBuffer = 0;
+            if (t == maxThreads) {
+                for (int dual = maxDual; dual > 0; --dual) {
+                    size_t const dualSize = FL2_estimateCStreamSize_byParams(params, t, dual);
+                    if (dualSize <= memLimit) {
+                        *dualBuffer = dual;
+                        return dualSize;
+                    }
+                }
+            }
+            DEBUGLOG(4, "FL2_fitCStreamParams : dict %u, %u threads, dual %d", (unsigned)dictSize, t, *dualBuffer);
+            return size;
+        }
+        if (dictSize <= FL2_DICTSIZE_MIN)
+            break;
+        dictSize = MAX(FL2_lowerDictSize(dictSize), FL2_DICTSIZE_MIN);
+    }
+    /* Nothing fits, so use the smallest configuration */
+    *nbThreads = 1;
+    *dualBuffer = 0;
+    return FL2_estimateCStreamSize_byParams(params, 1, 0);
+}
@@ -39,6 +39,7 @@ typedef struct {
     FL2_lzma2Parameters cParams;
     RMF_parameters rParams;
     unsigned compressionLevel;
+    unsigned minThroughput; /* MB/s, see FL2_p_minThroughput */
     BYTE highCompression;
 #ifndef NO_XXHASH
     BYTE doXXH;
@@ -49,9 +50,16 @@ typedef struct {
 typedef struct {
     FL2_CCtx* cctx;
     LZMA2_ECtx* enc;
+    FL2_matchTable* batchTable; /* single-thread table for FL2_compressBatch() */
+    U64 blockBusy;  /* microseconds spent encoding the current block */
+    U64 busyTime;
+    U64 idleTime;
+} FL2_job;
+
+typedef struct {
     FL2_dataBlock block;
     size_t cSize;
-} FL2_job;
+} FL2_slice;
 
 struct FL2_CCtx_s {
     DICT_buffer buf;
@@ -59,17 +67,34 @@ struct FL2_CCtx_s {
 #ifndef FL2_SINGLETHREAD
     FL2POOL_ctx* factory;
     FL2POOL_ctx* compressThread;
+    FL2POOL_ctx* buildFactory; /* pipelined mode: threads which build nextTable while curBlock is encoded */
+    FL2POOL_ctx* buildThread;
 #endif
     FL2_dataBlock curBlock;
     size_t asyncRes;
-    size_t threadCount;
-    size_t outThread;
+    FL2_slice* slices;
+    size_t sliceCount;
+    size_t outSlice;
+    size_t encodeSlices;
+    FL2_atomic sliceIndex;
     size_t outPos;
     size_t dictMax;
     U64 streamTotal;
     U64 streamCsize;
     FL2_matchTable* matchTable;
+    RMF_carry* carry;            /* overlap links kept between blocks, see FL2_p_reuseOverlap */
+    FL2_cStreamStats curStats;   /* counters for curBlock */
+    FL2_cStreamStats blockStats; /* counters for the last block completed */
+    FL2_cStreamStats totalStats;
+    U64 shiftCountMark;          /* dict shift counters when the last block began */
+    U64 shiftBytesMark;
 #ifndef FL2_SINGLETHREAD
+    FL2_dataBlock nextBlock;
+    FL2_matchTable* nextTable;
+    FL2_cStreamStats nextStats;  /* counters for nextBlock */
+    size_t buildRes;
+    int nextProp;
+    BYTE nextPending;
     U32 timeout;
 #endif
     U32 rmfWeight;
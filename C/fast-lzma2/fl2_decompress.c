@@ -0,0 +1,996 @@
+/*
+* Copyright (c) 2018, Conor McCarthy
+* All rights reserved.
+*
+* This source code is licensed under both the BSD-style license (found in the
+* LICENSE file in the root directory of this source tree) and the GPLv2 (found
+* in the COPYING file in the root directory of this source tree).
+* You may select, at your option, one of the above-listed licenses.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "fast-lzma2.h"
+#include "fl2_errors.h"
+#include "fl2_internal.h"
+#include "mem.h"
+#include "util.h"
+#include "fl2_threading.h"
+#include "fl2_pool.h"
+#include "atomic.h"
+#include "lzma2_dec.h"
+#ifndef NO_XXHASH
+#  include "xxhash.h"
+#endif
+
+/* Amount of output decoded between checks for cancelation and progress updates */
+#define FL2_DEC_STEP_SIZE ((size_t)1 << 20)
+
+/* Default limit on MT stream decoder input + output buffers */
+#define FL2_DSTREAM_MEMLIMIT_DEFAULT ((size_t)1 << (sizeof(size_t) == 4 ? 30 : 32))
+
+#define FL2_HASH_SIZE 4U
+
+/* A series of chunks beginning with a dictionary reset, which can be decoded independently */
+typedef struct
+{
+    size_t packPos;
+    size_t packSize;
+    size_t unpackPos;
+    size_t unpackSize;
+    size_t res;
+} FL2_decSegment;
+
+struct FL2_DCtx_s
+{
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_ctx* factory;
+#endif
+    const BYTE* src;
+    BYTE* dst;
+    FL2_decSegment* segs;
+    size_t segCount;
+    size_t segCapacity;
+    FL2_atomic segIndex;
+    FL2_atomic* progress;
+    const int* canceled;
+    int lzma2prop;
+    BYTE curProp;
+    unsigned jobCount;
+    LZMA2_DCtx decoders[1];
+};
+
+typedef enum {
+    FL2DEC_STAGE_NONE,
+    FL2DEC_STAGE_INIT,
+    FL2DEC_STAGE_DECOMP,
+    FL2DEC_STAGE_HASH,
+    FL2DEC_STAGE_FINISHED
+} FL2_decStage;
+
+struct FL2_DStream_s
+{
+    FL2_DCtx* dctx;
+    /* Single-threaded decoding */
+    BYTE* dict;
+    size_t dictCapacity;
+    /* Input buffered for MT decoding, or pending input after switching to a single thread */
+    BYTE* inBuf;
+    size_t inSize;
+    size_t inCapacity;
+    size_t inPos;
+    size_t inNeed;
+    /* Segments parsed from inBuf */
+    size_t segTotal;
+    size_t unpackTotal;
+    /* MT batch in progress */
+    size_t batchSegs;
+    size_t batchEnd;
+    BYTE* outBuf;
+    size_t outCapacity;
+    size_t outTotal;
+    size_t outPos;
+    size_t memLimit;
+    U64 streamTotal;
+    FL2_atomic progress;
+    unsigned timeout;
+    int canceled;
+    int decoding;
+    int useMt;
+    int endFound;
+    FL2_decStage stage;
+    BYTE lzma2prop;
+    BYTE doHash;
+    BYTE hashPos;
+    BYTE hashBuf[FL2_HASH_SIZE];
+#ifndef NO_XXHASH
+    XXH32_state_t *xxh;
+#endif
+};
+
+FL2LIB_API size_t FL2LIB_CALL FL2_getDictSizeFromProp(unsigned char prop)
+{
+    return LZMA2_getDictSizeFromProp(prop & FL2_LZMA_PROP_MASK);
+}
+
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_findDecompressedSize(const void *src, size_t srcSize)
+{
+    const BYTE* const in = (const BYTE*)src;
+    U64 total = 0;
+
+    if (srcSize == 0 || FL2_isError(FL2_getDictSizeFromProp(in[0])))
+        return FL2_CONTENTSIZE_ERROR;
+
+    for (size_t pos = 1;;) {
+        LZMA2_chunk chunk;
+        size_t headerSize;
+        LZMA2_parseRes const type = LZMA2_parseInput(in, pos, (ptrdiff_t)(srcSize - pos), &chunk, &headerSize);
+        if (type == CHUNK_FINAL)
+            return total;
+        if (type == CHUNK_MORE_DATA || type == CHUNK_ERROR)
+            return FL2_CONTENTSIZE_ERROR;
+        pos += headerSize + chunk.pack_size;
+        total += chunk.unpack_size;
+    }
+}
+
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_decodeSegment() :
+ * Decode chunks beginning with a dictionary reset into a buffer of exactly unpackSize bytes.
+ * Output is produced in steps so cancelation and progress are handled in a timely manner. */
+static size_t FL2_decodeSegment(LZMA2_DCtx* const dec, BYTE const prop,
+    BYTE* const dst, size_t const unpackSize,
+    const BYTE* const src, size_t const packSize,
+    FL2_atomic* const progress, const int* const canceled)
+{
+    size_t inPos = 0;
+
+    CHECK_F(LZMA2_initDecoder(dec, prop, dst, unpackSize));
+
+    while (dec->dic_pos < unpackSize) {
+        size_t const limit = MIN(unpackSize, dec->dic_pos + FL2_DEC_STEP_SIZE);
+        size_t const prev = dec->dic_pos;
+        size_t srcLen = packSize - inPos;
+
+        CHECK_F(LZMA2_decodeToDic(dec, limit, src + inPos, &srcLen,
+            (limit == unpackSize) ? LZMA2_FINISH_END : LZMA2_FINISH_ANY));
+
+        inPos += srcLen;
+        if (progress != NULL)
+            FL2_atomic_add(*progress, (long)(dec->dic_pos - prev));
+        if (canceled != NULL && *canceled)
+            return FL2_ERROR(canceled);
+        if (dec->dic_pos == prev && srcLen == 0)
+            break;
+    }
+    if (dec->dic_pos != unpackSize || inPos != packSize)
+        return FL2_ERROR(corruption_detected);
+
+    return unpackSize;
+}
+
+/* FL2_decompressSegments() : FL2POOL_function type */
+static void FL2_decompressSegments(void* const jobDescription, ptrdiff_t const n)
+{
+    FL2_DCtx* const dctx = (FL2_DCtx*)jobDescription;
+
+    for (;;) {
+        size_t const index = (size_t)FL2_atomic_increment(dctx->segIndex);
+        if (index >= dctx->segCount)
+            break;
+
+        FL2_decSegment* const seg = dctx->segs + index;
+        seg->res = FL2_decodeSegment(dctx->decoders + n, dctx->curProp,
+            dctx->dst + seg->unpackPos, seg->unpackSize,
+            dctx->src + seg->packPos, seg->packSize,
+            dctx->progress, dctx->canceled);
+    }
+}
+
+static FL2_decSegment* FL2_addSegment(FL2_DCtx* const dctx, size_t const count)
+{
+    if (count >= dctx->segCapacity) {
+        size_t const capacity = MAX(dctx->segCapacity * 2, (size_t)dctx->jobCount + 1);
+        FL2_decSegment* const segs = realloc(dctx->segs, capacity * sizeof(FL2_decSegment));
+        if (segs == NULL)
+            return NULL;
+        dctx->segs = segs;
+        dctx->segCapacity = capacity;
+    }
+    FL2_decSegment* const seg = dctx->segs + count;
+    seg->packPos = 0;
+    seg->packSize = 0;
+    seg->unpackPos = 0;
+    seg->unpackSize = 0;
+    seg->res = 0;
+    return seg;
+}
+
+#endif /* FL2_SINGLETHREAD */
+
+static FL2_DCtx* FL2_createDCtx_internal(unsigned nbThreads, int const fullPool)
+{
+    nbThreads = FL2_checkNbThreads(nbThreads);
+
+    DEBUGLOG(3, "FL2_createDCtxMt : %u threads", nbThreads);
+
+    FL2_DCtx* const dctx = calloc(1, sizeof(FL2_DCtx) + (nbThreads - 1) * sizeof(LZMA2_DCtx));
+    if (dctx == NULL)
+        return NULL;
+
+    dctx->jobCount = nbThreads;
+    dctx->lzma2prop = -1;
+
+    for (unsigned u = 0; u < nbThreads; ++u)
+        LZMA_constructDCtx(dctx->decoders + u);
+
+#ifndef FL2_SINGLETHREAD
+    /* The stream decoder runs all jobs on the pool so the caller can be released on timeout */
+    dctx->factory = FL2POOL_create((nbThreads > 1) ? nbThreads - !fullPool : 0);
+    if (nbThreads > 1 && dctx->factory == NULL) {
+        FL2_freeDCtx(dctx);
+        return NULL;
+    }
+#else
+    (void)fullPool;
+#endif
+
+    return dctx;
+}
+
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtx(void)
+{
+    return FL2_createDCtx_internal(1, 0);
+}
+
+FL2LIB_API FL2_DCtx* FL2LIB_CALL FL2_createDCtxMt(unsigned nbThreads)
+{
+    return FL2_createDCtx_internal(nbThreads, 0);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_freeDCtx(FL2_DCtx* dctx)
+{
+    if (dctx == NULL)
+        return 0;
+
+    DEBUGLOG(3, "FL2_freeDCtx : %u threads", dctx->jobCount);
+
+#ifndef FL2_SINGLETHREAD
+    FL2POOL_free(dctx->factory);
+#endif
+
+    free(dctx->segs);
+    free(dctx);
+    return 0;
+}
+
+FL2LIB_API unsigned FL2LIB_CALL FL2_getDCtxThreadCount(const FL2_DCtx* dctx)
+{
+    return dctx->jobCount;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_initDCtx(FL2_DCtx* dctx, unsigned char prop)
+{
+    prop &= FL2_LZMA_PROP_MASK;
+    CHECK_F(LZMA2_getDictSizeFromProp(prop));
+    dctx->lzma2prop = prop;
+    return 0;
+}
+
+static size_t FL2_decompressDCtx_st(FL2_DCtx* const dctx,
+    BYTE* const dst, size_t const dstCapacity,
+    const BYTE* const src, size_t* const srcPos, size_t const srcSize)
+{
+    LZMA2_DCtx* const dec = dctx->decoders;
+    size_t srcLen = srcSize - *srcPos;
+
+    CHECK_F(LZMA2_initDecoder(dec, dctx->curProp, dst, dstCapacity));
+
+    size_t const res = LZMA2_decodeToDic(dec, dstCapacity, src + *srcPos, &srcLen, LZMA2_FINISH_END);
+    *srcPos += srcLen;
+
+    if (FL2_isError(res))
+        return (dec->dic_pos == dstCapacity) ? FL2_ERROR(dstSize_tooSmall) : res;
+    if (res != LZMA2_STATUS_FINISHED_WITH_MARK)
+        return FL2_ERROR(srcSize_wrong);
+
+    return dec->dic_pos;
+}
+
+#ifndef FL2_SINGLETHREAD
+
+/* FL2_findSegments() :
+ * Read all chunk headers and divide the stream at dictionary resets.
+ * Returns the position following the end marker, or an error code. */
+static size_t FL2_findSegments(FL2_DCtx* const dctx,
+    const BYTE* const src, size_t pos, size_t const srcSize,
+    size_t const dstCapacity)
+{
+    size_t unpackTotal = 0;
+    size_t count = 0;
+    FL2_decSegment* seg = NULL;
+
+    for (;;) {
+        LZMA2_chunk chunk;
+        size_t headerSize;
+        LZMA2_parseRes const type = LZMA2_parseInput(src, pos, (ptrdiff_t)(srcSize - pos), &chunk, &headerSize);
+
+        if (type == CHUNK_MORE_DATA)
+            return FL2_ERROR(srcSize_wrong);
+        if (type == CHUNK_ERROR)
+            return FL2_ERROR(corruption_detected);
+        if (type == CHUNK_FINAL) {
+            if (seg != NULL)
+                seg->packSize = pos - seg->packPos;
+            dctx->segCount = count;
+            return pos + 1;
+        }
+        if (type == CHUNK_DICT_RESET) {
+            if (seg != NULL)
+                seg->packSize = pos - seg->packPos;
+            seg = FL2_addSegment(dctx, count);
+            if (seg == NULL)
+                return FL2_ERROR(memory_allocation);
+            ++count;
+            seg->packPos = pos;
+            seg->unpackPos = unpackTotal;
+        }
+        else if (seg == NULL) {
+            return FL2_ERROR(corruption_detected);
+        }
+        pos += headerSize + chunk.pack_size;
+        if (pos > srcSize)
+            return FL2_ERROR(srcSize_wrong);
+        seg->unpackSize += chunk.unpack_size;
+        unpackTotal += chunk.unpack_size;
+        if (unpackTotal > dstCapacity)
+            return FL2_ERROR(dstSize_tooSmall);
+    }
+}
+
+static size_t FL2_decompressDCtx_mt(FL2_DCtx* const dctx,
+    BYTE* const dst, size_t const dstCapacity,
+    const BYTE* const src, size_t* const srcPos, size_t const srcSize)
+{
+    size_t const endPos = FL2_findSegments(dctx, src, *srcPos, srcSize, dstCapacity);
+    if (FL2_isError(endPos))
+        return endPos;
+
+    if (dctx->segCount < 2)
+        return FL2_decompressDCtx_st(dctx, dst, dstCapacity, src, srcPos, srcSize);
+
+    size_t const nbJobs = MIN(dctx->segCount, dctx->jobCount);
+
+    DEBUGLOG(4, "FL2_decompressDCtx_mt : %u segments, %u threads", (U32)dctx->segCount, (U32)nbJobs);
+
+    dctx->src = src;
+    dctx->dst = dst;
+    dctx->segIndex = ATOMIC_INITIAL_VALUE;
+    dctx->progress = NULL;
+    dctx->canceled = NULL;
+
+    FL2POOL_addRange(dctx->factory, FL2_decompressSegments, dctx, 1, nbJobs);
+
+    FL2_decompressSegments(dctx, 0);
+
+    FL2POOL_waitAll(dctx->factory, 0);
+
+    for (size_t u = 0; u < dctx->segCount; ++u)
+        CHECK_F(dctx->segs[u].res);
+
+    *srcPos = endPos;
+
+    FL2_decSegment const* const last = dctx->segs + dctx->segCount - 1;
+    return last->unpackPos + last->unpackSize;
+}
+
+#endif /* FL2_SINGLETHREAD */
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressDCtx(FL2_DCtx* dctx,
+    void* dst, size_t dstCapacity,
+    const void* src, size_t srcSize)
+{
+    const BYTE* const in = (const BYTE*)src;
+    size_t pos = 0;
+    int doHash = 0;
+
+    if (dctx->lzma2prop < 0) {
+        if (srcSize < 1)
+            return FL2_ERROR(srcSize_wrong);
+        dctx->curProp = in[0] & FL2_LZMA_PROP_MASK;
+        doHash = in[0] >> FL2_PROP_HASH_BIT;
+        pos = 1;
+    }
+    else {
+        dctx->curProp = (BYTE)dctx->lzma2prop;
+        dctx->lzma2prop = -1;
+    }
+
+    DEBUGLOG(4, "FL2_decompressDCtx : %u src, %u avail", (U32)srcSize, (U32)dstCapacity);
+
+    size_t dSize;
+#ifndef FL2_SINGLETHREAD
+    if (dctx->jobCount > 1)
+        dSize = FL2_decompressDCtx_mt(dctx, dst, dstCapacity, in, &pos, srcSize);
+    else
+#endif
+        dSize = FL2_decompressDCtx_st(dctx, dst, dstCapacity, in, &pos, srcSize);
+
+    if (FL2_isError(dSize))
+        return dSize;
+
+    if (doHash) {
+        if (srcSize - pos < FL2_HASH_SIZE)
+            return FL2_ERROR(srcSize_wrong);
+#ifndef NO_XXHASH
+        XXH32_canonical_t canonical;
+        memcpy(&canonical, in + pos, XXHASH_SIZEOF);
+        if (XXH32_hashFromCanonical(&canonical) != XXH32(dst, dSize, 0))
+            return FL2_ERROR(checksum_wrong);
+#endif
+    }
+
+    return dSize;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressMt(void* dst, size_t dstCapacity,
+    const void* src, size_t compressedSize,
+    unsigned nbThreads)
+{
+    FL2_DCtx* const dctx = FL2_createDCtxMt(nbThreads);
+    if (dctx == NULL)
+        return FL2_ERROR(memory_allocation);
+
+    size_t const dSize = FL2_decompressDCtx(dctx, dst, dstCapacity, src, compressedSize);
+
+    FL2_freeDCtx(dctx);
+
+    return dSize;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompress(void* dst, size_t dstCapacity,
+    const void* src, size_t compressedSize)
+{
+    return FL2_decompressMt(dst, dstCapacity, src, compressedSize, 1);
+}
+
+/* Streaming */
+
+FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStreamMt(unsigned nbThreads)
+{
+    FL2_DStream* const fds = calloc(1, sizeof(FL2_DStream));
+    if (fds == NULL)
+        return NULL;
+
+    fds->dctx = FL2_createDCtx_internal(nbThreads, 1);
+    if (fds->dctx == NULL) {
+        free(fds);
+        return NULL;
+    }
+    fds->memLimit = FL2_DSTREAM_MEMLIMIT_DEFAULT;
+    fds->stage = FL2DEC_STAGE_NONE;
+
+    return fds;
+}
+
+FL2LIB_API FL2_DStream* FL2LIB_CALL FL2_createDStream(void)
+{
+    return FL2_createDStreamMt(1);
+}
+
+static void FL2_freeMtBuffers(FL2_DStream* const fds)
+{
+    free(fds->inBuf);
+    fds->inBuf = NULL;
+    fds->inCapacity = 0;
+    fds->inSize = 0;
+    free(fds->outBuf);
+    fds->outBuf = NULL;
+    fds->outCapacity = 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_freeDStream(FL2_DStream* fds)
+{
+    if (fds == NULL)
+        return 0;
+
+    DEBUGLOG(3, "FL2_freeDStream");
+
+    FL2_cancelDStream(fds);
+    FL2_freeDCtx(fds->dctx);
+    free(fds->dict);
+#ifndef NO_XXHASH
+    XXH32_freeState(fds->xxh);
+#endif
+    free(fds);
+    return 0;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_setDStreamMemoryLimitMt(FL2_DStream* fds, size_t limit)
+{
+    fds->memLimit = limit;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_setDStreamTimeout(FL2_DStream* fds, unsigned timeout)
+{
+#ifndef FL2_SINGLETHREAD
+    fds->timeout = timeout;
+#else
+    (void)fds;
+    (void)timeout;
+#endif
+    return 0;
+}
+
+#ifndef FL2_SINGLETHREAD
+
+static size_t FL2_waitBatch(FL2_DStream* const fds)
+{
+    if (FL2POOL_waitAll(fds->dctx->factory, fds->timeout))
+        return FL2_ERROR(timedOut);
+
+    fds->decoding = 0;
+    fds->streamTotal += fds->outTotal;
+    fds->progress = 0;
+
+    for (size_t u = 0; u < fds->batchSegs; ++u)
+        CHECK_F(fds->dctx->segs[u].res);
+
+    return 0;
+}
+
+#endif
+
+FL2LIB_API size_t FL2LIB_CALL FL2_waitDStream(FL2_DStream* fds)
+{
+#ifndef FL2_SINGLETHREAD
+    if (fds->decoding)
+        CHECK_F(FL2_waitBatch(fds));
+#endif
+    return fds->stage != FL2DEC_STAGE_FINISHED;
+}
+
+FL2LIB_API void FL2LIB_CALL FL2_cancelDStream(FL2_DStream *fds)
+{
+#ifndef FL2_SINGLETHREAD
+    if (fds->decoding) {
+        fds->canceled = 1;
+        FL2POOL_waitAll(fds->dctx->factory, 0);
+        fds->decoding = 0;
+    }
+#endif
+    FL2_freeMtBuffers(fds);
+    fds->stage = FL2DEC_STAGE_NONE;
+}
+
+FL2LIB_API unsigned long long FL2LIB_CALL FL2_getDStreamProgress(const FL2_DStream * fds)
+{
+    return fds->streamTotal + (U64)fds->progress;
+}
+
+static size_t FL2_initDStream_internal(FL2_DStream* const fds)
+{
+    if (fds->decoding)
+        return FL2_ERROR(stage_wrong);
+
+    fds->inSize = 0;
+    fds->inPos = 0;
+    fds->inNeed = 0;
+    fds->segTotal = 0;
+    fds->unpackTotal = 0;
+    fds->batchSegs = 0;
+    fds->batchEnd = 0;
+    fds->outTotal = 0;
+    fds->outPos = 0;
+    fds->streamTotal = 0;
+    fds->progress = 0;
+    fds->canceled = 0;
+    fds->useMt = fds->dctx->jobCount > 1;
+    fds->endFound = 0;
+    fds->doHash = 0;
+    fds->hashPos = 0;
+    fds->stage = FL2DEC_STAGE_INIT;
+
+    return 0;
+}
+
+static size_t FL2_initDStream_st(FL2_DStream* const fds)
+{
+    size_t const dictSize = LZMA2_getDictSizeFromProp(fds->lzma2prop);
+    if (FL2_isError(dictSize))
+        return dictSize;
+
+    if (fds->dictCapacity < dictSize) {
+        free(fds->dict);
+        fds->dictCapacity = 0;
+        fds->dict = malloc(dictSize);
+        if (fds->dict == NULL)
+            return FL2_ERROR(memory_allocation);
+        fds->dictCapacity = dictSize;
+    }
+    return LZMA2_initDecoder(fds->dctx->decoders, fds->lzma2prop, fds->dict, dictSize);
+}
+
+static size_t FL2_setDStreamProp(FL2_DStream* const fds, BYTE const prop, int const doHash)
+{
+    fds->lzma2prop = prop & FL2_LZMA_PROP_MASK;
+    CHECK_F(LZMA2_getDictSizeFromProp(fds->lzma2prop));
+    fds->doHash = (BYTE)doHash;
+
+#ifndef NO_XXHASH
+    if (doHash) {
+        if (fds->xxh == NULL) {
+            fds->xxh = XXH32_createState();
+            if (fds->xxh == NULL)
+                return FL2_ERROR(memory_allocation);
+        }
+        XXH32_reset(fds->xxh, 0);
+    }
+#endif
+
+    fds->dctx->curProp = fds->lzma2prop;
+    if (!fds->useMt)
+        CHECK_F(FL2_initDStream_st(fds));
+
+    fds->stage = FL2DEC_STAGE_DECOMP;
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_initDStream(FL2_DStream* fds)
+{
+    return FL2_initDStream_internal(fds);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_initDStream_withProp(FL2_DStream* fds, unsigned char prop)
+{
+    CHECK_F(FL2_initDStream_internal(fds));
+    return FL2_setDStreamProp(fds, prop, 0);
+}
+
+static void FL2_updateHash(FL2_DStream* const fds, const BYTE* const data, size_t const size)
+{
+#ifndef NO_XXHASH
+    if (fds->doHash && size)
+        XXH32_update(fds->xxh, data, size);
+#else
+    (void)fds;
+    (void)data;
+    (void)size;
+#endif
+}
+
+/* Decode pending input left over from MT parsing first, then the caller's input */
+static size_t FL2_decompressStream_st(FL2_DStream* const fds, FL2_outBuffer* const output, FL2_inBuffer* const input)
+{
+    LZMA2_DCtx* const dec = fds->dctx->decoders;
+
+    for (;;) {
+        int const pending = fds->inPos < fds->inSize;
+        const BYTE* const src = pending ? fds->inBuf + fds->inPos : (const BYTE*)input->src + input->pos;
+        size_t srcLen = pending ? fds->inSize - fds->inPos : input->size - input->pos;
+        BYTE* const dst = (BYTE*)output->dst + output->pos;
+        size_t dstLen = output->size - output->pos;
+
+        size_t const res = LZMA2_decodeToBuf(dec, dst, &dstLen, src, &srcLen, LZMA2_FINISH_ANY);
+        if (FL2_isError(res))
+            return res;
+
+        FL2_updateHash(fds, dst, dstLen);
+        fds->streamTotal += dstLen;
+        output->pos += dstLen;
+        if (pending)
+            fds->inPos += srcLen;
+        else
+            input->pos += srcLen;
+
+        if (res == LZMA2_STATUS_FINISHED_WITH_MARK) {
+            fds->stage = fds->doHash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED;
+            return 0;
+        }
+        if (pending && fds->inPos == fds->inSize) {
+            fds->inPos = 0;
+            fds->inSize = 0;
+            continue;
+        }
+        if (srcLen == 0 && dstLen == 0)
+            return 1;
+    }
+}
+
+#ifndef FL2_SINGLETHREAD
+
+#define FL2DEC_BATCH_MORE_INPUT 0
+#define FL2DEC_BATCH_READY 1
+#define FL2DEC_BATCH_SINGLE 2
+
+static size_t FL2_chunkHeaderSize(BYTE const control)
+{
+    if (control == 0)
+        return 1;
+    if (control < 0x80)
+        return 3;
+    return 5 + (control >= 0xC0);
+}
+
+/* FL2_loadInput() :
+ * Copy input to inBuf until inSize reaches inNeed or the input is exhausted. No more input
+ * is taken than the stream requires, so data following the end of the stream is left alone. */
+static size_t FL2_loadInput(FL2_DStream* const fds, FL2_inBuffer* const input)
+{
+    if (fds->inNeed > fds->inCapacity) {
+        size_t const capacity = MAX(fds->inNeed, MIN(fds->inCapacity * 2, fds->memLimit));
+        BYTE* const inBuf = realloc(fds->inBuf, capacity);
+        if (inBuf == NULL)
+            return FL2_ERROR(memory_allocation);
+        fds->inBuf = inBuf;
+        fds->inCapacity = capacity;
+    }
+    size_t const toCopy = MIN(fds->inNeed - fds->inSize, input->size - input->pos);
+    memcpy(fds->inBuf + fds->inSize, (const BYTE*)input->src + input->pos, toCopy);
+    fds->inSize += toCopy;
+    input->pos += toCopy;
+    return 0;
+}
+
+static void FL2_closeSegment(FL2_DStream* const fds, size_t const count, size_t const end)
+{
+    FL2_decSegment* const seg = fds->dctx->segs + count - 1;
+    seg->packSize = end - seg->packPos;
+}
+
+static size_t FL2_closeBatch(FL2_DStream* const fds, size_t const count, size_t const end)
+{
+    FL2_closeSegment(fds, count, end);
+    fds->batchSegs = count;
+    fds->batchEnd = end;
+    return FL2DEC_BATCH_READY;
+}
+
+/* FL2_parseBatch() :
+ * Buffer input and divide it into segments at dictionary resets until there is one segment
+ * per thread, the end marker is found, or the memory limit is reached. */
+static size_t FL2_parseBatch(FL2_DStream* const fds, FL2_inBuffer* const input)
+{
+    FL2_DCtx* const dctx = fds->dctx;
+
+    for (;;) {
+        if (fds->inSize < fds->inNeed) {
+            CHECK_F(FL2_loadInput(fds, input));
+            if (fds->inSize < fds->inNeed)
+                return FL2DEC_BATCH_MORE_INPUT;
+        }
+        if (fds->inNeed <= fds->inPos) {
+            fds->inNeed = fds->inPos + 1;
+            continue;
+        }
+
+        LZMA2_chunk chunk;
+        size_t headerSize;
+        LZMA2_parseRes const type = LZMA2_parseInput(fds->inBuf, fds->inPos, (ptrdiff_t)(fds->inSize - fds->inPos), &chunk, &headerSize);
+
+        if (type == CHUNK_MORE_DATA) {
+            fds->inNeed = fds->inPos + FL2_chunkHeaderSize(fds->inBuf[fds->inPos]);
+            continue;
+        }
+        if (type == CHUNK_ERROR || (type == CHUNK_CONTINUE && fds->segTotal == 0))
+            return FL2_ERROR(corruption_detected);
+
+        if (type == CHUNK_FINAL) {
+            fds->endFound = 1;
+            if (fds->segTotal)
+                FL2_closeSegment(fds, fds->segTotal, fds->inPos);
+            ++fds->inPos;
+            fds->batchSegs = fds->segTotal;
+            fds->batchEnd = fds->inPos;
+            return FL2DEC_BATCH_READY;
+        }
+
+        if (type == CHUNK_DICT_RESET && fds->segTotal == dctx->jobCount)
+            return FL2_closeBatch(fds, fds->segTotal, fds->inPos);
+
+        size_t const chunkEnd = fds->inPos + headerSize + chunk.pack_size;
+
+        if (chunkEnd + fds->unpackTotal + chunk.unpack_size > fds->memLimit) {
+            DEBUGLOG(4, "DStream memory limit reached with %u segments", (U32)fds->segTotal);
+            if (type == CHUNK_DICT_RESET && fds->segTotal > 0)
+                return FL2_closeBatch(fds, fds->segTotal, fds->inPos);
+            if (fds->segTotal > 1)
+                return FL2_closeBatch(fds, fds->segTotal - 1, dctx->segs[fds->segTotal - 1].packPos);
+            return FL2DEC_BATCH_SINGLE;
+        }
+
+        if (type == CHUNK_DICT_RESET) {
+            if (fds->segTotal)
+                FL2_closeSegment(fds, fds->segTotal, fds->inPos);
+            FL2_decSegment* const seg = FL2_addSegment(dctx, fds->segTotal);
+            if (seg == NULL)
+                return FL2_ERROR(memory_allocation);
+            seg->packPos = fds->inPos;
+            seg->unpackPos = fds->unpackTotal;
+            ++fds->segTotal;
+        }
+        dctx->segs[fds->segTotal - 1].unpackSize += chunk.unpack_size;
+        fds->unpackTotal += chunk.unpack_size;
+        fds->inPos = chunkEnd;
+        fds->inNeed = chunkEnd;
+    }
+}
+
+static size_t FL2_dispatchBatch(FL2_DStream* const fds)
+{
+    FL2_DCtx* const dctx = fds->dctx;
+    FL2_decSegment const* const last = dctx->segs + fds->batchSegs - 1;
+    size_t const outTotal = last->unpackPos + last->unpackSize;
+
+    if (fds->outCapacity < outTotal) {
+        free(fds->outBuf);
+        fds->outCapacity = 0;
+        fds->outBuf = malloc(outTotal);
+        if (fds->outBuf == NULL)
+            return FL2_ERROR(memory_allocation);
+        fds->outCapacity = outTotal;
+    }
+    fds->outTotal = outTotal;
+    fds->outPos = 0;
+
+    DEBUGLOG(4, "FL2_dispatchBatch : %u segments, %u bytes", (U32)fds->batchSegs, (U32)outTotal);
+
+    dctx->src = fds->inBuf;
+    dctx->dst = fds->outBuf;
+    dctx->segCount = fds->batchSegs;
+    dctx->segIndex = ATOMIC_INITIAL_VALUE;
+    dctx->progress = &fds->progress;
+    dctx->canceled = &fds->canceled;
+
+    fds->decoding = 1;
+    FL2POOL_addRange(dctx->factory, FL2_decompressSegments, dctx, 0, MIN(fds->batchSegs, dctx->jobCount));
+
+    return FL2_waitBatch(fds);
+}
+
+/* FL2_endBatch() :
+ * Discard the input for the completed batch and move any remainder to the buffer start */
+static void FL2_endBatch(FL2_DStream* const fds)
+{
+    FL2_DCtx* const dctx = fds->dctx;
+    size_t const end = fds->batchEnd;
+
+    memmove(fds->inBuf, fds->inBuf + end, fds->inSize - end);
+    fds->inSize -= end;
+    fds->inPos -= end;
+    fds->inNeed -= end;
+
+    /* A partial segment remains if the batch was ended by the memory limit */
+    if (fds->segTotal > fds->batchSegs) {
+        dctx->segs[0] = dctx->segs[fds->batchSegs];
+        dctx->segs[0].packPos -= end;
+        dctx->segs[0].unpackPos = 0;
+    }
+    fds->segTotal -= fds->batchSegs;
+    fds->unpackTotal -= fds->outTotal;
+    fds->batchSegs = 0;
+    fds->batchEnd = 0;
+    fds->outTotal = 0;
+    fds->outPos = 0;
+}
+
+static size_t FL2_decompressStream_mt(FL2_DStream* const fds, FL2_outBuffer* const output, FL2_inBuffer* const input)
+{
+    for (;;) {
+        if (fds->decoding)
+            CHECK_F(FL2_waitBatch(fds));
+
+        if (fds->outPos < fds->outTotal) {
+            size_t const toCopy = MIN(output->size - output->pos, fds->outTotal - fds->outPos);
+            memcpy((BYTE*)output->dst + output->pos, fds->outBuf + fds->outPos, toCopy);
+            FL2_updateHash(fds, fds->outBuf + fds->outPos, toCopy);
+            fds->outPos += toCopy;
+            output->pos += toCopy;
+            if (fds->outPos < fds->outTotal)
+                return 1;
+        }
+        if (fds->batchEnd != 0)
+            FL2_endBatch(fds);
+
+        if (fds->endFound) {
+            fds->stage = fds->doHash ? FL2DEC_STAGE_HASH : FL2DEC_STAGE_FINISHED;
+            return 0;
+        }
+
+        size_t const res = FL2_parseBatch(fds, input);
+        if (FL2_isError(res))
+            return res;
+        if (res == FL2DEC_BATCH_MORE_INPUT)
+            return 1;
+        if (res == FL2DEC_BATCH_SINGLE) {
+            /* Buffered input begins at a dictionary reset, so the single-threaded decoder starts there */
+            DEBUGLOG(3, "DStream switching to single-threaded decoding");
+            fds->useMt = 0;
+            fds->inPos = 0;
+            fds->segTotal = 0;
+            fds->unpackTotal = 0;
+            free(fds->outBuf);
+            fds->outBuf = NULL;
+            fds->outCapacity = 0;
+            CHECK_F(FL2_initDStream_st(fds));
+            return FL2_decompressStream_st(fds, output, input);
+        }
+        if (fds->batchSegs)
+            CHECK_F(FL2_dispatchBatch(fds));
+    }
+}
+
+#endif /* FL2_SINGLETHREAD */
+
+static size_t FL2_readHash(FL2_DStream* const fds, FL2_inBuffer* const input)
+{
+    while (fds->hashPos < FL2_HASH_SIZE) {
+        if (fds->inPos < fds->inSize)
+            fds->hashBuf[fds->hashPos++] = fds->inBuf[fds->inPos++];
+        else if (input->pos < input->size)
+            fds->hashBuf[fds->hashPos++] = ((const BYTE*)input->src)[input->pos++];
+        else
+            return 1;
+    }
+#ifndef NO_XXHASH
+    {
+        XXH32_canonical_t canonical;
+        memcpy(&canonical, fds->hashBuf, XXHASH_SIZEOF);
+        if (XXH32_hashFromCanonical(&canonical) != XXH32_digest(fds->xxh))
+            return FL2_ERROR(checksum_wrong);
+    }
+#endif
+    fds->stage = FL2DEC_STAGE_FINISHED;
+    return 0;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_decompressStream(FL2_DStream* fds, FL2_outBuffer* output, FL2_inBuffer* input)
+{
+    if (fds->stage == FL2DEC_STAGE_NONE)
+        return FL2_ERROR(init_missing);
+
+    if (fds->stage == FL2DEC_STAGE_INIT) {
+        if (input->pos >= input->size)
+            return 1;
+        BYTE const prop = ((const BYTE*)input->src)[input->pos++];
+        CHECK_F(FL2_setDStreamProp(fds, prop, prop >> FL2_PROP_HASH_BIT));
+    }
+
+    if (fds->stage == FL2DEC_STAGE_DECOMP) {
+        size_t res;
+#ifndef FL2_SINGLETHREAD
+        if (fds->useMt)
+            res = FL2_decompressStream_mt(fds, output, input);
+        else
+#endif
+            res = FL2_decompressStream_st(fds, output, input);
+        if (res != 0)
+            return res;
+    }
+
+    if (fds->stage == FL2DEC_STAGE_HASH)
+        return FL2_readHash(fds, input);
+
+    return fds->stage != FL2DEC_STAGE_FINISHED;
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_estimateDCtxSize(unsigned nbThreads)
+{
+    nbThreads = FL2_checkNbThreads(nbThreads);
+    return sizeof(FL2_DCtx) + (nbThreads - 1) * sizeof(LZMA2_DCtx);
+}
+
+FL2LIB_API size_t FL2LIB_CALL FL2_estimateDStreamSize(size_t dictSize, unsigned nbThreads)
+{
+    nbThreads = FL2_checkNbThreads(nbThreads);
+    size_t const size = sizeof(FL2_DStream) + FL2_estimateDCtxSize(nbThreads);
+
+    if (nbThreads > 1) {
+        /* Output for one segment per thread at the default reset interval, plus the input
+         * for that amount of output in the worst case */
+        size_t const mtSize = dictSize * 4 * nbThreads;
+        return size + MIN(mtSize * 2, FL2_DSTREAM_MEMLIMIT_DEFAULT);
+    }
+    return size + dictSize;
+}
@@ -20,34 +20,127 @@
 #ifndef FL2_SINGLETHREAD
 
 #include "fl2_threading.h"   /* pthread adaptation */
+#include "atomic.h"
+#include "util.h"            /* UTIL_countPhysicalCores */
 
-struct FL2POOL_ctx_s {
+/* Number of times an idle thread polls for work before sleeping on a condition variable.
+ * Polling is disabled on a single core, where it only delays the threads doing the work. */
+#define FL2POOL_SPIN_COUNT 1000
+
+struct FL2POOL_shared_s {
     /* Keep track of the threads */
     size_t numThreads;
 
+    /* The mutex protects the pool list and the busy counts */
+    FL2_pthread_mutex_t queueMutex;
+    /* Condition variable for poppers to wait on when all queues are empty */
+    FL2_pthread_cond_t newJobsCond;
+    /* Incremented each time jobs are added. Spinning threads poll it without locking */
+    FL2_atomic jobGeneration;
+    /* The number of threads waiting on newJobsCond */
+    size_t numThreadsSleeping;
+    /* Number of polls before sleeping */
+    int spinCount;
+    /* Circular list of pools using the threads. Poppers begin searching at this pool */
+    FL2POOL_ctx* nextPool;
+    /* Indicates if the threads are shutting down */
+    int shutdown;
+
+    /* The threads. Extras to be calloc'd */
+    FL2_pthread_t threads[1];
+};
+
+struct FL2POOL_ctx_s {
+    /* The threads which run the jobs, possibly shared with other pools */
+    FL2POOL_shared* shared;
+    /* Indicates if the threads were created for this pool only */
+    int ownThreads;
+    /* The maximum number of threads which may work on the jobs at once */
+    size_t maxThreadsBusy;
+
     /* All threads work on the same function and object during a job */
     FL2POOL_function function;
     void *opaque;
 
-    /* The number of threads working on jobs */
+    /* The number of threads working on jobs. Protected by the shared mutex */
     size_t numThreadsBusy;
-    /* Indicates the number of threads requested and the values to pass */
-    ptrdiff_t queueIndex;
+    /* The range of values to pass. Changed only while no threads are busy on this pool */
+    ptrdiff_t queueFirst;
     ptrdiff_t queueEnd;
+    /* Jobs are claimed and completed by atomic increment, without locking */
+    FL2_atomic jobsClaimed;
+    FL2_atomic jobsDone;
+    /* Set while the master thread sleeps on busyCond */
+    FL2_atomic waiting;
 
-    /* The mutex protects the queue */
-    FL2_pthread_mutex_t queueMutex;
-    /* Condition variable for pushers to wait on when the queue is full */
+    /* Condition variable for the master thread to wait on until jobs complete */
     FL2_pthread_cond_t busyCond;
-    /* Condition variable for poppers to wait on when the queue is empty */
-    FL2_pthread_cond_t newJobsCond;
-    /* Indicates if the queue is shutting down */
-    int shutdown;
 
-    /* The threads. Extras to be calloc'd */
-    FL2_pthread_t threads[1];
+    /* Links in the shared list */
+    FL2POOL_ctx* next;
+    FL2POOL_ctx* prev;
 };
 
+/* Atomics are initialized to ATOMIC_INITIAL_VALUE so FL2_atomic_increment() returns 0, 1, 2...
+ * on all platforms. These return the number of increments made so far. */
+static ptrdiff_t FL2POOL_claimed(FL2POOL_ctx* const ctx)
+{
+    return (ptrdiff_t)(FL2_atomic_load(ctx->jobsClaimed) - ATOMIC_INITIAL_VALUE);
+}
+
+static ptrdiff_t FL2POOL_done(FL2POOL_ctx* const ctx)
+{
+    return (ptrdiff_t)(FL2_atomic_load(ctx->jobsDone) - ATOMIC_INITIAL_VALUE);
+}
+
+static int FL2POOL_pending(FL2POOL_ctx* const ctx)
+{
+    return FL2POOL_done(ctx) < ctx->queueEnd - ctx->queueFirst;
+}
+
+/* FL2POOL_findJob() :
+   Find a pool with a job waiting which is below its busy thread limit.
+   Pools are searched in turn so jobs are scheduled fairly among them.
+   Must be called with the queue mutex locked.
+*/
+static FL2POOL_ctx* FL2POOL_findJob(FL2POOL_shared* const shared)
+{
+    FL2POOL_ctx* const first = shared->nextPool;
+    FL2POOL_ctx* ctx = first;
+    if (!ctx) { return NULL; }
+    do {
+        if (ctx->queueFirst + FL2POOL_claimed(ctx) < ctx->queueEnd && ctx->numThreadsBusy < ctx->maxThreadsBusy) {
+            shared->nextPool = ctx->next;
+            return ctx;
+        }
+        ctx = ctx->next;
+    } while (ctx != first);
+    return NULL;
+}
+
+/* FL2POOL_runJobs() :
+   Claim and run jobs from ctx until none remain. The master thread is woken
+   if it is sleeping when the last job completes.
+*/
+static void FL2POOL_runJobs(FL2POOL_ctx* const ctx)
+{
+    for (;;) {
+        ptrdiff_t const n = ctx->queueFirst + FL2_atomic_increment(ctx->jobsClaimed);
+        if (n >= ctx->queueEnd)
+            return;
+
+        ctx->function(ctx->opaque, n);
+
+        /* The increment is a full barrier, so either the master thread sees all jobs done or this thread sees it waiting */
+        if (FL2_atomic_increment(ctx->jobsDone) + 1 == ctx->queueEnd - ctx->queueFirst
+            && FL2_atomic_load(ctx->waiting) != ATOMIC_INITIAL_VALUE) {
+            FL2_pthread_mutex_lock(&ctx->shared->queueMutex);
+            FL2_pthread_cond_signal(&ctx->busyCond);
+            FL2_pthread_mutex_unlock(&ctx->shared->queueMutex);
+        }
+    }
+}
+
 /* FL2POOL_thread() :
    Work thread for the thread pool.
    Waits for jobs and executes them.
@@ -55,97 +148,177 @@ struct FL2POOL_ctx_s {
 */
 static void* FL2POOL_thread(void* opaque)
 {
-    FL2POOL_ctx* const ctx = (FL2POOL_ctx*)opaque;
-    if (!ctx) { return NULL; }
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
+    FL2POOL_shared* const shared = (FL2POOL_shared*)opaque;
+    if (!shared) { return NULL; }
+    FL2_pthread_mutex_lock(&shared->queueMutex);
     for (;;) {
+        FL2POOL_ctx* ctx = FL2POOL_findJob(shared);
 
-        /* While the mutex is locked, wait for a non-empty queue or until shutdown */
-        while (ctx->queueIndex >= ctx->queueEnd && !ctx->shutdown) {
-            FL2_pthread_cond_wait(&ctx->newJobsCond, &ctx->queueMutex);
-        }
-        /* empty => shutting down: so stop */
-        if (ctx->shutdown) {
-            FL2_pthread_mutex_unlock(&ctx->queueMutex);
-            return opaque;
+        if (ctx == NULL) {
+            if (shared->shutdown) {
+                FL2_pthread_mutex_unlock(&shared->queueMutex);
+                return opaque;
+            }
+            /* Poll for new jobs for a while before sleeping, to avoid the cost of waking up */
+            FL2_atomic const generation = shared->jobGeneration;
+            FL2_pthread_mutex_unlock(&shared->queueMutex);
+            int spin = shared->spinCount;
+            while (spin > 0 && FL2_atomic_load(shared->jobGeneration) == generation) {
+                FL2_pause();
+                --spin;
+            }
+            FL2_pthread_mutex_lock(&shared->queueMutex);
+            if (shared->jobGeneration == generation && !shared->shutdown) {
+                ++shared->numThreadsSleeping;
+                FL2_pthread_cond_wait(&shared->newJobsCond, &shared->queueMutex);
+                --shared->numThreadsSleeping;
+            }
+            continue;
         }
-        /* Pop a job off the queue */
-        size_t n = ctx->queueIndex;
-        ++ctx->queueIndex;
         ++ctx->numThreadsBusy;
-        /* Unlock the mutex and run the job */
-        FL2_pthread_mutex_unlock(&ctx->queueMutex);
+        FL2_pthread_mutex_unlock(&shared->queueMutex);
 
-        ctx->function(ctx->opaque, n);
+        FL2POOL_runJobs(ctx);
 
-        FL2_pthread_mutex_lock(&ctx->queueMutex);
-        --ctx->numThreadsBusy;
-        /* Signal the master thread waiting for jobs to complete */
-        FL2_pthread_cond_signal(&ctx->busyCond);
+        FL2_pthread_mutex_lock(&shared->queueMutex);
+        /* Signal a master thread waiting to add jobs or free the pool */
+        if (--ctx->numThreadsBusy == 0)
+            FL2_pthread_cond_signal(&ctx->busyCond);
     }  /* for (;;) */
     /* Unreachable */
 }
 
-FL2POOL_ctx* FL2POOL_create(size_t numThreads)
+FL2POOL_shared* FL2POOL_createShared(size_t numThreads)
 {
-    FL2POOL_ctx* ctx;
+    FL2POOL_shared* shared;
     /* Check the parameters */
     if (!numThreads) { return NULL; }
     /* Allocate the context and zero initialize */
-    ctx = calloc(1, sizeof(FL2POOL_ctx) + (numThreads - 1) * sizeof(FL2_pthread_t));
-    if (!ctx) { return NULL; }
-    /* Initialize the busy count and jobs range */
-    ctx->numThreadsBusy = 0;
-    ctx->queueIndex = 0;
-    ctx->queueEnd = 0;
-    (void)FL2_pthread_mutex_init(&ctx->queueMutex, NULL);
-    (void)FL2_pthread_cond_init(&ctx->busyCond, NULL);
-    (void)FL2_pthread_cond_init(&ctx->newJobsCond, NULL);
-    ctx->shutdown = 0;
-    ctx->numThreads = 0;
+    shared = calloc(1, sizeof(FL2POOL_shared) + (numThreads - 1) * sizeof(FL2_pthread_t));
+    if (!shared) { return NULL; }
+    (void)FL2_pthread_mutex_init(&shared->queueMutex, NULL);
+    (void)FL2_pthread_cond_init(&shared->newJobsCond, NULL);
+    shared->jobGeneration = ATOMIC_INITIAL_VALUE;
+    shared->numThreadsSleeping = 0;
+    shared->spinCount = (UTIL_countPhysicalCores() > 1) ? FL2POOL_SPIN_COUNT : 0;
+    shared->nextPool = NULL;
+    shared->shutdown = 0;
+    shared->numThreads = 0;
     /* Initialize the threads */
     {   size_t i;
         for (i = 0; i < numThreads; ++i) {
-            if (FL2_pthread_create(&ctx->threads[i], NULL, &FL2POOL_thread, ctx)) {
-                ctx->numThreads = i;
-                FL2POOL_free(ctx);
+            if (FL2_pthread_create(&shared->threads[i], NULL, &FL2POOL_thread, shared)) {
+                shared->numThreads = i;
+                FL2POOL_freeShared(shared);
                 return NULL;
         }   }
-        ctx->numThreads = numThreads;
+        shared->numThreads = numThreads;
     }
-    return ctx;
+    return shared;
 }
 
-/*! FL2POOL_join() :
-    Shutdown the queue, wake any sleeping threads, and join all of the threads.
-*/
-static void FL2POOL_join(FL2POOL_ctx* ctx)
+void FL2POOL_freeShared(FL2POOL_shared* shared)
 {
+    if (!shared) { return; }
     /* Shut down the queue */
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
-    ctx->shutdown = 1;
+    FL2_pthread_mutex_lock(&shared->queueMutex);
+    shared->shutdown = 1;
+    FL2_atomic_increment(shared->jobGeneration);
     /* Wake up sleeping threads */
-    FL2_pthread_cond_broadcast(&ctx->newJobsCond);
-    FL2_pthread_mutex_unlock(&ctx->queueMutex);
+    FL2_pthread_cond_broadcast(&shared->newJobsCond);
+    FL2_pthread_mutex_unlock(&shared->queueMutex);
     /* Join all of the threads */
-    for (size_t i = 0; i < ctx->numThreads; ++i)
-        FL2_pthread_join(ctx->threads[i], NULL);
+    for (size_t i = 0; i < shared->numThreads; ++i)
+        FL2_pthread_join(shared->threads[i], NULL);
+    FL2_pthread_mutex_destroy(&shared->queueMutex);
+    FL2_pthread_cond_destroy(&shared->newJobsCond);
+    free(shared);
+}
+
+size_t FL2POOL_sharedThreads(const FL2POOL_shared* shared)
+{
+    return shared ? shared->numThreads : 0;
+}
+
+FL2POOL_ctx* FL2POOL_createClient(FL2POOL_shared* shared, size_t maxThreads)
+{
+    FL2POOL_ctx* ctx;
+    /* Check the parameters */
+    if (!shared || !maxThreads) { return NULL; }
+    ctx = calloc(1, sizeof(FL2POOL_ctx));
+    if (!ctx) { return NULL; }
+    ctx->shared = shared;
+    ctx->ownThreads = 0;
+    ctx->maxThreadsBusy = maxThreads;
+    /* Initialize the busy count and jobs range */
+    ctx->numThreadsBusy = 0;
+    ctx->queueFirst = 0;
+    ctx->queueEnd = 0;
+    ctx->jobsClaimed = ATOMIC_INITIAL_VALUE;
+    ctx->jobsDone = ATOMIC_INITIAL_VALUE;
+    ctx->waiting = ATOMIC_INITIAL_VALUE;
+    (void)FL2_pthread_cond_init(&ctx->busyCond, NULL);
+    /* Add to the shared list */
+    FL2_pthread_mutex_lock(&shared->queueMutex);
+    if (shared->nextPool) {
+        ctx->next = shared->nextPool;
+        ctx->prev = shared->nextPool->prev;
+        ctx->prev->next = ctx;
+        ctx->next->prev = ctx;
+    }
+    else {
+        ctx->next = ctx;
+        ctx->prev = ctx;
+        shared->nextPool = ctx;
+    }
+    FL2_pthread_mutex_unlock(&shared->queueMutex);
+    return ctx;
+}
+
+FL2POOL_ctx* FL2POOL_create(size_t numThreads)
+{
+    FL2POOL_shared* const shared = FL2POOL_createShared(numThreads);
+    if (!shared) { return NULL; }
+    FL2POOL_ctx* const ctx = FL2POOL_createClient(shared, numThreads);
+    if (!ctx) {
+        FL2POOL_freeShared(shared);
+        return NULL;
+    }
+    ctx->ownThreads = 1;
+    return ctx;
 }
 
 void FL2POOL_free(FL2POOL_ctx *ctx)
 {
     if (!ctx) { return; }
-    FL2POOL_join(ctx);
-    FL2_pthread_mutex_destroy(&ctx->queueMutex);
+    FL2POOL_shared* const shared = ctx->shared;
+    FL2_pthread_mutex_lock(&shared->queueMutex);
+    /* Drop jobs not yet started by claiming them all, and wait for running jobs, then leave the
+     * shared list. Working threads read queueEnd without the lock, so it is not changed. */
+    FL2_atomic_add(ctx->jobsClaimed, (long)(ctx->queueEnd - ctx->queueFirst));
+    while (ctx->numThreadsBusy && !shared->shutdown)
+        FL2_pthread_cond_wait(&ctx->busyCond, &shared->queueMutex);
+    if (ctx->next == ctx) {
+        shared->nextPool = NULL;
+    }
+    else {
+        ctx->prev->next = ctx->next;
+        ctx->next->prev = ctx->prev;
+        if (shared->nextPool == ctx)
+            shared->nextPool = ctx->next;
+    }
+    FL2_pthread_mutex_unlock(&shared->queueMutex);
     FL2_pthread_cond_destroy(&ctx->busyCond);
-    FL2_pthread_cond_destroy(&ctx->newJobsCond);
+    if (ctx->ownThreads)
+        FL2POOL_freeShared(shared);
     free(ctx);
 }
 
 size_t FL2POOL_sizeof(FL2POOL_ctx *ctx)
 {
     if (ctx==NULL) return 0;  /* supports sizeof NULL */
-    return sizeof(*ctx) + ctx->numThreads * sizeof(FL2_pthread_t);
+    if (!ctx->ownThreads) return sizeof(*ctx);
+    return sizeof(*ctx) + sizeof(FL2POOL_shared) + (ctx->shared->numThreads - 1) * sizeof(FL2_pthread_t);
 }
 
 void FL2POOL_addRange(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff_t first, ptrdiff_t end)
@@ -154,16 +327,23 @@ void FL2POOL_addRange(void* ctxVoid, FL2POOL_function function, void *opaque, pt
     if (!ctx)
 		return; 
 
-    /* Callers always wait for jobs to complete before adding a new set */
-    assert(!ctx->numThreadsBusy);
-
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
+    FL2POOL_shared* const shared = ctx->shared;
+    FL2_pthread_mutex_lock(&shared->queueMutex);
+    /* Callers always wait for jobs to complete before adding a new set, but threads
+     * may not have left the previous set yet. They leave without running anything more. */
+    assert(!FL2POOL_pending(ctx));
+    while (ctx->numThreadsBusy && !shared->shutdown)
+        FL2_pthread_cond_wait(&ctx->busyCond, &shared->queueMutex);
     ctx->function = function;
     ctx->opaque = opaque;
-    ctx->queueIndex = first;
+    ctx->queueFirst = first;
     ctx->queueEnd = end;
-    FL2_pthread_cond_broadcast(&ctx->newJobsCond);
-    FL2_pthread_mutex_unlock(&ctx->queueMutex);
+    ctx->jobsDone = ATOMIC_INITIAL_VALUE;
+    ctx->jobsClaimed = ATOMIC_INITIAL_VALUE;
+    FL2_atomic_increment(shared->jobGeneration);
+    if (shared->numThreadsSleeping)
+        FL2_pthread_cond_broadcast(&shared->newJobsCond);
+    FL2_pthread_mutex_unlock(&shared->queueMutex);
 }
 
 void FL2POOL_add(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff_t n)
@@ -174,20 +354,28 @@ void FL2POOL_add(void* ctxVoid, FL2POOL_function function, void *opaque, ptrdiff
 int FL2POOL_waitAll(void *ctxVoid, unsigned timeout)
 {
     FL2POOL_ctx* const ctx = (FL2POOL_ctx*)ctxVoid;
-    if (!ctx || (!ctx->numThreadsBusy && ctx->queueIndex >= ctx->queueEnd) || ctx->shutdown) { return 0; }
+    if (!ctx || !FL2POOL_pending(ctx) || ctx->shared->shutdown) { return 0; }
+
+    /* Jobs are often nearly done, so poll before sleeping */
+    for (int spin = ctx->shared->spinCount; spin > 0 && FL2POOL_pending(ctx); --spin)
+        FL2_pause();
+    if (!FL2POOL_pending(ctx)) { return 0; }
 
-    FL2_pthread_mutex_lock(&ctx->queueMutex);
-    /* Need to test for ctx->queueIndex < ctx->queueEnd in case not all jobs have started */
+    FL2POOL_shared* const shared = ctx->shared;
+    FL2_pthread_mutex_lock(&shared->queueMutex);
+    /* The increment is a full barrier, so either this thread sees all jobs done or the last job sees it waiting */
+    FL2_atomic_increment(ctx->waiting);
     if (timeout != 0) {
-        if ((ctx->numThreadsBusy || ctx->queueIndex < ctx->queueEnd) && !ctx->shutdown)
-            FL2_pthread_cond_timedwait(&ctx->busyCond, &ctx->queueMutex, timeout);
+        if (FL2POOL_pending(ctx) && !shared->shutdown)
+            FL2_pthread_cond_timedwait(&ctx->busyCond, &shared->queueMutex, timeout);
     }
     else {
-        while ((ctx->numThreadsBusy || ctx->queueIndex < ctx->queueEnd) && !ctx->shutdown)
-            FL2_pthread_cond_wait(&ctx->busyCond, &ctx->queueMutex);
+        while (FL2POOL_pending(ctx) && !shared->shutdown)
+            FL2_pthread_cond_wait(&ctx->busyCond, &shared->queueMutex);
     }
-    FL2_pthread_mutex_unlock(&ctx->queueMutex);
-    return ctx->numThreadsBusy && !ctx->shutdown;
+    FL2_atomic_add(ctx->waiting, -1);
+    FL2_pthread_mutex_unlock(&shared->queueMutex);
+    return FL2POOL_pending(ctx) && !shared->shutdown;
 }
 
 size_t FL2POOL_threadsBusy(void * ctx)
@@ -20,6 +20,7 @@ extern "C" {
 #include <stddef.h>   /* size_t */
 
 typedef struct FL2POOL_ctx_s FL2POOL_ctx;
+typedef struct FL2POOL_shared_s FL2POOL_shared;
 
 /*! FL2POOL_create() :
 *  Create a thread pool with at most `numThreads` threads.
@@ -29,8 +30,31 @@ typedef struct FL2POOL_ctx_s FL2POOL_ctx;
 FL2POOL_ctx *FL2POOL_create(size_t numThreads);
 
 
+/*! FL2POOL_createShared() :
+*  Create a set of `numThreads` threads which may run the jobs of many pools.
+* @return : FL2POOL_shared pointer on success, else NULL.
+*/
+FL2POOL_shared *FL2POOL_createShared(size_t numThreads);
+
+/*! FL2POOL_freeShared() :
+Free threads returned by FL2POOL_createShared(). All pools using them must be freed first.
+*/
+void FL2POOL_freeShared(FL2POOL_shared *shared);
+
+/*! FL2POOL_sharedThreads() :
+Return the number of threads in `shared`, or 0 if it is NULL.
+*/
+size_t FL2POOL_sharedThreads(const FL2POOL_shared *shared);
+
+/*! FL2POOL_createClient() :
+*  Create a thread pool which runs its jobs on the threads of `shared`, with at most
+*  `maxThreads` jobs running at once. Pools using the same threads are served in turn.
+* @return : FL2POOL_ctx pointer on success, else NULL.
+*/
+FL2POOL_ctx *FL2POOL_createClient(FL2POOL_shared *shared, size_t maxThreads);
+
 /*! FL2POOL_free() :
-Free a thread pool returned by FL2POOL_create().
+Free a thread pool returned by FL2POOL_create() or FL2POOL_createClient().
 */
 void FL2POOL_free(FL2POOL_ctx *ctx);
 
@@ -0,0 +1,1249 @@
+/* lzma2_dec.c -- LZMA2 Decoder
+Based on LzmaDec.c and Lzma2Dec.c : Igor Pavlov
+Modified for FL2 by Conor McCarthy
+Public domain
+*/
+
+#include <string.h>
+
+#include "fl2_errors.h"
+#include "fl2_internal.h"
+#include "lzma2_dec.h"
+
+#define kNumTopBits 24
+#define kTopValue ((U32)1 << kNumTopBits)
+
+#define kNumBitModelTotalBits 11
+#define kBitModelTotal (1 << kNumBitModelTotalBits)
+#define kNumMoveBits 5
+
+#define RC_INIT_SIZE 5
+
+#define NORMALIZE if (range < kTopValue) { range <<= 8; code = (code << 8) | (*buf++); }
+
+#define IF_BIT_0(p) ttt = *(p); NORMALIZE; bound = (range >> kNumBitModelTotalBits) * (U32)ttt; if (code < bound)
+#define UPDATE_0(p) range = bound; *(p) = (LZMA2_prob)(ttt + ((kBitModelTotal - ttt) >> kNumMoveBits));
+#define UPDATE_1(p) range -= bound; code -= bound; *(p) = (LZMA2_prob)(ttt - (ttt >> kNumMoveBits));
+#define GET_BIT2(p, i, A0, A1) IF_BIT_0(p) \
+    { UPDATE_0(p); i = (i + i); A0; } else \
+    { UPDATE_1(p); i = (i + i) + 1; A1; }
+
+#define TREE_GET_BIT(probs, i) { GET_BIT2(probs + i, i, ;, ;); }
+
+#define REV_BIT(p, i, A0, A1) IF_BIT_0(p + i) \
+    { UPDATE_0(p + i); A0; } else \
+    { UPDATE_1(p + i); A1; }
+#define REV_BIT_VAR(  p, i, m) REV_BIT(p, i, i += m; m += m, m += m; i += m; )
+#define REV_BIT_CONST(p, i, m) REV_BIT(p, i, i += m;       , i += m * 2; )
+#define REV_BIT_LAST( p, i, m) REV_BIT(p, i, i -= m        , ; )
+
+#define TREE_DECODE(probs, limit, i) \
+    { i = 1; do { TREE_GET_BIT(probs, i); } while (i < limit); i -= limit; }
+
+/* #define _LZMA_SIZE_OPT */
+
+#ifdef _LZMA_SIZE_OPT
+#define TREE_6_DECODE(probs, i) TREE_DECODE(probs, (1 << 6), i)
+#else
+#define TREE_6_DECODE(probs, i) \
+    { i = 1; \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    TREE_GET_BIT(probs, i); \
+    i -= 0x40; }
+#endif
+
+#define NORMAL_LITER_DEC TREE_GET_BIT(prob, symbol)
+#define MATCHED_LITER_DEC \
+    match_byte += match_byte; \
+    bit = offs; \
+    offs &= match_byte; \
+    prob_lit = prob + (offs + bit + symbol); \
+    GET_BIT2(prob_lit, symbol, offs ^= bit; , ;)
+
+
+
+#define NORMALIZE_CHECK if (range < kTopValue) { if (buf >= buf_limit) return DUMMY_ERROR; range <<= 8; code = (code << 8) | (*buf++); }
+
+#define IF_BIT_0_CHECK(p) ttt = *(p); NORMALIZE_CHECK; bound = (range >> kNumBitModelTotalBits) * (U32)ttt; if (code < bound)
+#define UPDATE_0_CHECK range = bound;
+#define UPDATE_1_CHECK range -= bound; code -= bound;
+#define GET_BIT2_CHECK(p, i, A0, A1) IF_BIT_0_CHECK(p) \
+    { UPDATE_0_CHECK; i = (i + i); A0; } else \
+    { UPDATE_1_CHECK; i = (i + i) + 1; A1; }
+#define GET_BIT_CHECK(p, i) GET_BIT2_CHECK(p, i, ; , ;)
+#define TREE_DECODE_CHECK(probs, limit, i) \
+    { i = 1; do { GET_BIT_CHECK(probs + i, i) } while (i < limit); i -= limit; }
+
+
+#define REV_BIT_CHECK(p, i, m) IF_BIT_0_CHECK(p + i) \
+    { UPDATE_0_CHECK; i += m; m += m; } else \
+    { UPDATE_1_CHECK; m += m; i += m; }
+
+
+#define kNumPosBitsMax 4
+#define kNumPosStatesMax (1 << kNumPosBitsMax)
+
+#define kLenNumLowBits 3
+#define kLenNumLowSymbols (1 << kLenNumLowBits)
+#define kLenNumHighBits 8
+#define kLenNumHighSymbols (1 << kLenNumHighBits)
+
+#define LenLow 0
+#define LenHigh (LenLow + 2 * (kNumPosStatesMax << kLenNumLowBits))
+#define kNumLenProbs (LenHigh + kLenNumHighSymbols)
+
+#define LenChoice LenLow
+#define LenChoice2 (LenLow + (1 << kLenNumLowBits))
+
+#define kNumStates 12
+#define kNumStates2 16
+#define kNumLitStates 7
+
+#define kStartPosModelIndex 4
+#define kEndPosModelIndex 14
+#define kNumFullDistances (1 << (kEndPosModelIndex >> 1))
+
+#define kNumPosSlotBits 6
+#define kNumLenToPosStates 4
+
+#define kNumAlignBits 4
+#define kAlignTableSize (1 << kNumAlignBits)
+
+#define kMatchMinLen 2
+#define kMatchSpecLenStart (kMatchMinLen + kLenNumLowSymbols * 2 + kLenNumHighSymbols)
+
+/* (probs + 1664) is faster and better for code size at some platforms */
+#define kStartOffset 1664
+#define GET_PROBS (p->probs + kStartOffset)
+
+#define SpecPos (-kStartOffset)
+#define IsRep0Long (SpecPos + kNumFullDistances)
+#define RepLenCoder (IsRep0Long + (kNumStates2 << kNumPosBitsMax))
+#define LenCoder (RepLenCoder + kNumLenProbs)
+#define IsMatch (LenCoder + kNumLenProbs)
+#define Align (IsMatch + (kNumStates2 << kNumPosBitsMax))
+#define IsRep (Align + kAlignTableSize)
+#define IsRepG0 (IsRep + kNumStates)
+#define IsRepG1 (IsRepG0 + kNumStates)
+#define IsRepG2 (IsRepG1 + kNumStates)
+#define PosSlot (IsRepG2 + kNumStates)
+#define Literal (PosSlot + (kNumLenToPosStates << kNumPosSlotBits))
+#define NUM_BASE_PROBS (Literal + kStartOffset)
+
+#if Align != 0 && kStartOffset != 0
+    #error Stop_Compiling_Bad_LZMA_kAlign
+#endif
+
+#if NUM_BASE_PROBS != 1984
+    #error Stop_Compiling_Bad_LZMA_PROBS
+#endif
+
+
+#define LZMA_LIT_SIZE 0x300
+
+#define LZMA_getNumProbs(p) (NUM_BASE_PROBS + ((U32)LZMA_LIT_SIZE << ((p)->lc + (p)->lp)))
+
+#if NUM_BASE_PROBS + (LZMA_LIT_SIZE << LZMA2_LCLP_MAX) != LZMA2_PROB_COUNT_MAX
+    #error Stop_Compiling_Bad_LZMA2_PROB_COUNT_MAX
+#endif
+
+
+#define CALC_POS_STATE(processed_pos, pb_mask) (((processed_pos) & (pb_mask)) << 4)
+#define COMBINED_PS_STATE (pos_state + state)
+#define GET_LEN_STATE (pos_state)
+
+/*
+p->remain_len : shows status of LZMA decoder:
+        < kMatchSpecLenStart : normal remain
+        = kMatchSpecLenStart : finished
+        = kMatchSpecLenStart + 1 : need init range coder
+        = kMatchSpecLenStart + 2 : need init range coder and state
+*/
+
+/* ---------- LZMA_decodeReal ---------- */
+/*
+LZMA_decodeReal()
+In:
+    RangeCoder is normalized
+    if (p->dic_pos == limit) {
+        LZMA_tryDummy() was called before to exclude LITERAL and MATCH-REP cases.
+        So first symbol can be only MATCH-NON-REP. And if that MATCH-NON-REP symbol
+        is not END_OF_PAYALOAD_MARKER, then function returns error code.
+    }
+
+Processing:
+    first LZMA symbol will be decoded in any case
+    All checks for limits are at the end of main loop,
+    It will decode new LZMA-symbols while (p->buf < buf_limit && dic_pos < limit),
+    RangeCoder is still without last normalization when (p->buf < buf_limit) is being checked.
+
+Out:
+    RangeCoder is normalized
+    Result:
+        0 - OK
+        1 - Error
+    p->remain_len:
+        < kMatchSpecLenStart : normal remain
+        = kMatchSpecLenStart : finished
+*/
+
+
+static int LZMA_decodeReal(LZMA2_DCtx *p, size_t limit, const BYTE *buf_limit)
+{
+    LZMA2_prob *probs = GET_PROBS;
+    unsigned state = (unsigned)p->state;
+    U32 rep0 = p->reps[0], rep1 = p->reps[1], rep2 = p->reps[2], rep3 = p->reps[3];
+    unsigned pb_mask = ((unsigned)1 << (p->prop.pb)) - 1;
+    unsigned lc = p->prop.lc;
+    unsigned lp_mask = ((unsigned)0x100 << p->prop.lp) - ((unsigned)0x100 >> lc);
+
+    BYTE *dic = p->dic;
+    size_t dic_buf_size = p->dic_buf_size;
+    size_t dic_pos = p->dic_pos;
+
+    U32 processed_pos = p->processed_pos;
+    U32 check_dic_size = p->check_dic_size;
+    unsigned len = 0;
+
+    const BYTE *buf = p->buf;
+    U32 range = p->range;
+    U32 code = p->code;
+
+    do {
+        LZMA2_prob *prob;
+        U32 bound;
+        unsigned ttt;
+        unsigned pos_state = CALC_POS_STATE(processed_pos, pb_mask);
+
+        prob = probs + IsMatch + COMBINED_PS_STATE;
+        IF_BIT_0(prob) {
+            unsigned symbol;
+            UPDATE_0(prob);
+            prob = probs + Literal;
+            if (processed_pos != 0 || check_dic_size != 0)
+                prob += (U32)3 * ((((processed_pos << 8) + dic[(dic_pos == 0 ? dic_buf_size : dic_pos) - 1]) & lp_mask) << lc);
+            processed_pos++;
+
+            if (state < kNumLitStates) {
+                state -= (state < 4) ? state : 3;
+                symbol = 1;
+                #ifdef _LZMA_SIZE_OPT
+                do { NORMAL_LITER_DEC } while (symbol < 0x100);
+                #else
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                NORMAL_LITER_DEC
+                #endif
+            }
+            else {
+                unsigned match_byte = dic[dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0)];
+                unsigned offs = 0x100;
+                state -= (state < 10) ? 3 : 6;
+                symbol = 1;
+                #ifdef _LZMA_SIZE_OPT
+                do {
+                    unsigned bit;
+                    LZMA2_prob *prob_lit;
+                    MATCHED_LITER_DEC
+                }
+                while (symbol < 0x100);
+                #else
+                {
+                    unsigned bit;
+                    LZMA2_prob *prob_lit;
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                    MATCHED_LITER_DEC
+                }
+                #endif
+            }
+
+            dic[dic_pos++] = (BYTE)symbol;
+            continue;
+        }
+
+        {
+            UPDATE_1(prob);
+            prob = probs + IsRep + state;
+            IF_BIT_0(prob) {
+                UPDATE_0(prob);
+                state += kNumStates;
+                prob = probs + LenCoder;
+            }
+            else {
+                UPDATE_1(prob);
+                /*
+                // that case was checked before with kBadRepCode
+                if (check_dic_size == 0 && processed_pos == 0)
+                    return 1;
+                */
+                prob = probs + IsRepG0 + state;
+                IF_BIT_0(prob) {
+                    UPDATE_0(prob);
+                    prob = probs + IsRep0Long + COMBINED_PS_STATE;
+                    IF_BIT_0(prob) {
+                        UPDATE_0(prob);
+                        dic[dic_pos] = dic[dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0)];
+                        dic_pos++;
+                        processed_pos++;
+                        state = state < kNumLitStates ? 9 : 11;
+                        continue;
+                    }
+                    UPDATE_1(prob);
+                }
+                else {
+                    U32 distance;
+                    UPDATE_1(prob);
+                    prob = probs + IsRepG1 + state;
+                    IF_BIT_0(prob) {
+                        UPDATE_0(prob);
+                        distance = rep1;
+                    }
+                    else {
+                        UPDATE_1(prob);
+                        prob = probs + IsRepG2 + state;
+                        IF_BIT_0(prob) {
+                            UPDATE_0(prob);
+                            distance = rep2;
+                        }
+                        else {
+                            UPDATE_1(prob);
+                            distance = rep3;
+                            rep3 = rep2;
+                        }
+                        rep2 = rep1;
+                    }
+                    rep1 = rep0;
+                    rep0 = distance;
+                }
+                state = state < kNumLitStates ? 8 : 11;
+                prob = probs + RepLenCoder;
+            }
+
+            #ifdef _LZMA_SIZE_OPT
+            {
+                unsigned lim, offset;
+                LZMA2_prob *probLen = prob + LenChoice;
+                IF_BIT_0(probLen) {
+                    UPDATE_0(probLen);
+                    probLen = prob + LenLow + GET_LEN_STATE;
+                    offset = 0;
+                    lim = (1 << kLenNumLowBits);
+                }
+                else {
+                    UPDATE_1(probLen);
+                    probLen = prob + LenChoice2;
+                    IF_BIT_0(probLen) {
+                        UPDATE_0(probLen);
+                        probLen = prob + LenLow + GET_LEN_STATE + (1 << kLenNumLowBits);
+                        offset = kLenNumLowSymbols;
+                        lim = (1 << kLenNumLowBits);
+                    }
+                    else {
+                        UPDATE_1(probLen);
+                        probLen = prob + LenHigh;
+                        offset = kLenNumLowSymbols * 2;
+                        lim = (1 << kLenNumHighBits);
+                    }
+                }
+                TREE_DECODE(probLen, lim, len);
+                len += offset;
+            }
+            #else
+            {
+                LZMA2_prob *probLen = prob + LenChoice;
+                IF_BIT_0(probLen) {
+                    UPDATE_0(probLen);
+                    probLen = prob + LenLow + GET_LEN_STATE;
+                    len = 1;
+                    TREE_GET_BIT(probLen, len);
+                    TREE_GET_BIT(probLen, len);
+                    TREE_GET_BIT(probLen, len);
+                    len -= 8;
+                }
+                else {
+                    UPDATE_1(probLen);
+                    probLen = prob + LenChoice2;
+                    IF_BIT_0(probLen) {
+                        UPDATE_0(probLen);
+                        probLen = prob + LenLow + GET_LEN_STATE + (1 << kLenNumLowBits);
+                        len = 1;
+                        TREE_GET_BIT(probLen, len);
+                        TREE_GET_BIT(probLen, len);
+                        TREE_GET_BIT(probLen, len);
+                    }
+                    else {
+                        UPDATE_1(probLen);
+                        probLen = prob + LenHigh;
+                        TREE_DECODE(probLen, (1 << kLenNumHighBits), len);
+                        len += kLenNumLowSymbols * 2;
+                    }
+                }
+            }
+            #endif
+
+            if (state >= kNumStates) {
+                U32 distance;
+                prob = probs + PosSlot +
+                        ((len < kNumLenToPosStates ? len : kNumLenToPosStates - 1) << kNumPosSlotBits);
+                TREE_6_DECODE(prob, distance);
+                if (distance >= kStartPosModelIndex) {
+                    unsigned pos_slot = (unsigned)distance;
+                    unsigned num_direct_bits = (unsigned)(((distance >> 1) - 1));
+                    distance = (2 | (distance & 1));
+                    if (pos_slot < kEndPosModelIndex) {
+                        distance <<= num_direct_bits;
+                        prob = probs + SpecPos;
+                        {
+                            U32 m = 1;
+                            distance++;
+                            do {
+                                REV_BIT_VAR(prob, distance, m);
+                            }
+                            while (--num_direct_bits);
+                            distance -= m;
+                        }
+                    }
+                    else {
+                        num_direct_bits -= kNumAlignBits;
+                        do {
+                            NORMALIZE
+                            range >>= 1;
+
+                            {
+                                U32 t;
+                                code -= range;
+                                t = (0 - ((U32)code >> 31)); /* (U32)((Int32)code >> 31) */
+                                distance = (distance << 1) + (t + 1);
+                                code += range & t;
+                            }
+                            /*
+                            distance <<= 1;
+                            if (code >= range) {
+                                code -= range;
+                                distance |= 1;
+                            }
+                            */
+                        }
+                        while (--num_direct_bits);
+                        prob = probs + Align;
+                        distance <<= kNumAlignBits;
+                        {
+                            unsigned i = 1;
+                            REV_BIT_CONST(prob, i, 1);
+                            REV_BIT_CONST(prob, i, 2);
+                            REV_BIT_CONST(prob, i, 4);
+                            REV_BIT_LAST (prob, i, 8);
+                            distance |= i;
+                        }
+                        if (distance == (U32)0xFFFFFFFF) {
+                            len = kMatchSpecLenStart;
+                            state -= kNumStates;
+                            break;
+                        }
+                    }
+                }
+
+                rep3 = rep2;
+                rep2 = rep1;
+                rep1 = rep0;
+                rep0 = distance + 1;
+                state = (state < kNumStates + kNumLitStates) ? kNumLitStates : kNumLitStates + 3;
+                if (distance >= (check_dic_size == 0 ? processed_pos: check_dic_size)) {
+                    p->dic_pos = dic_pos;
+                    return 1;
+                }
+            }
+
+            len += kMatchMinLen;
+
+            {
+                size_t rem;
+                unsigned curLen;
+                size_t pos;
+
+                if ((rem = limit - dic_pos) == 0) {
+                    p->dic_pos = dic_pos;
+                    return 1;
+                }
+
+                curLen = ((rem < len) ? (unsigned)rem : len);
+                pos = dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0);
+
+                processed_pos += (U32)curLen;
+
+                len -= curLen;
+                if (curLen <= dic_buf_size - pos) {
+                    BYTE *dest = dic + dic_pos;
+                    ptrdiff_t src = (ptrdiff_t)pos - (ptrdiff_t)dic_pos;
+                    const BYTE *lim = dest + curLen;
+                    dic_pos += (size_t)curLen;
+                    do
+                        *(dest) = (BYTE)*(dest + src);
+                    while (++dest != lim);
+                }
+                else {
+                    do {
+                        dic[dic_pos++] = dic[pos];
+                        if (++pos == dic_buf_size)
+                            pos = 0;
+                    }
+                    while (--curLen != 0);
+                }
+            }
+        }
+    }
+    while (dic_pos < limit && buf < buf_limit);
+
+    NORMALIZE;
+
+    p->buf = buf;
+    p->range = range;
+    p->code = code;
+    p->remain_len = (U32)len;
+    p->dic_pos = dic_pos;
+    p->processed_pos = processed_pos;
+    p->reps[0] = rep0;
+    p->reps[1] = rep1;
+    p->reps[2] = rep2;
+    p->reps[3] = rep3;
+    p->state = (U32)state;
+
+    return 0;
+}
+
+static void LZMA_writeRem(LZMA2_DCtx *p, size_t limit)
+{
+    if (p->remain_len != 0 && p->remain_len < kMatchSpecLenStart) {
+        BYTE *dic = p->dic;
+        size_t dic_pos = p->dic_pos;
+        size_t dic_buf_size = p->dic_buf_size;
+        unsigned len = (unsigned)p->remain_len;
+        size_t rep0 = p->reps[0]; /* we use size_t to avoid the BUG of VC14 for AMD64 */
+        size_t rem = limit - dic_pos;
+        if (rem < len)
+            len = (unsigned)(rem);
+
+        if (p->check_dic_size == 0 && p->prop.dict_size - p->processed_pos <= len)
+            p->check_dic_size = p->prop.dict_size;
+
+        p->processed_pos += (U32)len;
+        p->remain_len -= (U32)len;
+        while (len != 0) {
+            len--;
+            dic[dic_pos] = dic[dic_pos - rep0 + (dic_pos < rep0 ? dic_buf_size : 0)];
+            dic_pos++;
+        }
+        p->dic_pos = dic_pos;
+    }
+}
+
+
+#define kRange0 0xFFFFFFFF
+#define kBound0 ((kRange0 >> kNumBitModelTotalBits) << (kNumBitModelTotalBits - 1))
+#define kBadRepCode (kBound0 + (((kRange0 - kBound0) >> kNumBitModelTotalBits) << (kNumBitModelTotalBits - 1)))
+#if kBadRepCode != (0xC0000000 - 0x400)
+    #error Stop_Compiling_Bad_LZMA_Check
+#endif
+
+static int LZMA_decodeReal2(LZMA2_DCtx *p, size_t limit, const BYTE *buf_limit)
+{
+    do {
+        size_t limit2 = limit;
+        if (p->check_dic_size == 0) {
+            U32 rem = p->prop.dict_size - p->processed_pos;
+            if (limit - p->dic_pos > rem)
+                limit2 = p->dic_pos + rem;
+
+            if (p->processed_pos == 0)
+                if (p->code >= kBadRepCode)
+                    return 1;
+        }
+
+        if (LZMA_decodeReal(p, limit2, buf_limit) != 0)
+            return 1;
+
+        if (p->check_dic_size == 0 && p->processed_pos >= p->prop.dict_size)
+            p->check_dic_size = p->prop.dict_size;
+
+        LZMA_writeRem(p, limit);
+    }
+    while (p->dic_pos < limit && p->buf < buf_limit && p->remain_len < kMatchSpecLenStart);
+
+    return 0;
+}
+
+typedef enum
+{
+    DUMMY_ERROR, /* unexpected end of input stream */
+    DUMMY_LIT,
+    DUMMY_MATCH,
+    DUMMY_REP
+} LZMA_dummy;
+
+static LZMA_dummy LZMA_tryDummy(const LZMA2_DCtx *p, const BYTE *buf, size_t in_size)
+{
+    U32 range = p->range;
+    U32 code = p->code;
+    const BYTE *buf_limit = buf + in_size;
+    const LZMA2_prob *probs = GET_PROBS;
+    unsigned state = (unsigned)p->state;
+    LZMA_dummy res;
+
+    {
+        const LZMA2_prob *prob;
+        U32 bound;
+        unsigned ttt;
+        unsigned pos_state = CALC_POS_STATE(p->processed_pos, (1 << p->prop.pb) - 1);
+
+        prob = probs + IsMatch + COMBINED_PS_STATE;
+        IF_BIT_0_CHECK(prob) {
+            UPDATE_0_CHECK
+
+            /* if (buf_limit - buf >= 7) return DUMMY_LIT; */
+
+            prob = probs + Literal;
+            if (p->check_dic_size != 0 || p->processed_pos != 0)
+                prob += ((U32)LZMA_LIT_SIZE *
+                        ((((p->processed_pos) & ((1 << (p->prop.lp)) - 1)) << p->prop.lc) +
+                        (p->dic[(p->dic_pos == 0 ? p->dic_buf_size : p->dic_pos) - 1] >> (8 - p->prop.lc))));
+
+            if (state < kNumLitStates) {
+                unsigned symbol = 1;
+                do { GET_BIT_CHECK(prob + symbol, symbol) } while (symbol < 0x100);
+            }
+            else {
+                unsigned match_byte = p->dic[p->dic_pos - p->reps[0] +
+                        (p->dic_pos < p->reps[0] ? p->dic_buf_size : 0)];
+                unsigned offs = 0x100;
+                unsigned symbol = 1;
+                do {
+                    unsigned bit;
+                    const LZMA2_prob *prob_lit;
+                    match_byte += match_byte;
+                    bit = offs;
+                    offs &= match_byte;
+                    prob_lit = prob + (offs + bit + symbol);
+                    GET_BIT2_CHECK(prob_lit, symbol, offs ^= bit; , ; )
+                }
+                while (symbol < 0x100);
+            }
+            res = DUMMY_LIT;
+        }
+        else {
+            unsigned len;
+            UPDATE_1_CHECK;
+
+            prob = probs + IsRep + state;
+            IF_BIT_0_CHECK(prob) {
+                UPDATE_0_CHECK;
+                state = 0;
+                prob = probs + LenCoder;
+                res = DUMMY_MATCH;
+            }
+            else {
+                UPDATE_1_CHECK;
+                res = DUMMY_REP;
+                prob = probs + IsRepG0 + state;
+                IF_BIT_0_CHECK(prob) {
+                    UPDATE_0_CHECK;
+                    prob = probs + IsRep0Long + COMBINED_PS_STATE;
+                    IF_BIT_0_CHECK(prob) {
+                        UPDATE_0_CHECK;
+                        NORMALIZE_CHECK;
+                        return DUMMY_REP;
+                    }
+                    else {
+                        UPDATE_1_CHECK;
+                    }
+                }
+                else {
+                    UPDATE_1_CHECK;
+                    prob = probs + IsRepG1 + state;
+                    IF_BIT_0_CHECK(prob) {
+                        UPDATE_0_CHECK;
+                    }
+                    else {
+                        UPDATE_1_CHECK;
+                        prob = probs + IsRepG2 + state;
+                        IF_BIT_0_CHECK(prob) {
+                            UPDATE_0_CHECK;
+                        }
+                        else {
+                            UPDATE_1_CHECK;
+                        }
+                    }
+                }
+                state = kNumStates;
+                prob = probs + RepLenCoder;
+            }
+            {
+                unsigned limit, offset;
+                const LZMA2_prob *probLen = prob + LenChoice;
+                IF_BIT_0_CHECK(probLen) {
+                    UPDATE_0_CHECK;
+                    probLen = prob + LenLow + GET_LEN_STATE;
+                    offset = 0;
+                    limit = 1 << kLenNumLowBits;
+                }
+                else {
+                    UPDATE_1_CHECK;
+                    probLen = prob + LenChoice2;
+                    IF_BIT_0_CHECK(probLen) {
+                        UPDATE_0_CHECK;
+                        probLen = prob + LenLow + GET_LEN_STATE + (1 << kLenNumLowBits);
+                        offset = kLenNumLowSymbols;
+                        limit = 1 << kLenNumLowBits;
+                    }
+                    else {
+                        UPDATE_1_CHECK;
+                        probLen = prob + LenHigh;
+                        offset = kLenNumLowSymbols * 2;
+                        limit = 1 << kLenNumHighBits;
+                    }
+                }
+                TREE_DECODE_CHECK(probLen, limit, len);
+                len += offset;
+            }
+
+            if (state < 4) {
+                unsigned pos_slot;
+                prob = probs + PosSlot +
+                        ((len < kNumLenToPosStates - 1 ? len : kNumLenToPosStates - 1) <<
+                        kNumPosSlotBits);
+                TREE_DECODE_CHECK(prob, 1 << kNumPosSlotBits, pos_slot);
+                if (pos_slot >= kStartPosModelIndex) {
+                    unsigned num_direct_bits = ((pos_slot >> 1) - 1);
+
+                    /* if (buf_limit - buf >= 8) return DUMMY_MATCH; */
+
+                    if (pos_slot < kEndPosModelIndex) {
+                        prob = probs + SpecPos + ((2 | (pos_slot & 1)) << num_direct_bits);
+                    }
+                    else {
+                        num_direct_bits -= kNumAlignBits;
+                        do {
+                            NORMALIZE_CHECK
+                            range >>= 1;
+                            code -= range & (((code - range) >> 31) - 1);
+                            /* if (code >= range) code -= range; */
+                        }
+                        while (--num_direct_bits);
+                        prob = probs + Align;
+                        num_direct_bits = kNumAlignBits;
+                    }
+                    {
+                        unsigned i = 1;
+                        unsigned m = 1;
+                        do {
+                            REV_BIT_CHECK(prob, i, m);
+                        }
+                        while (--num_direct_bits);
+                    }
+                }
+            }
+        }
+    }
+    NORMALIZE_CHECK;
+    return res;
+}
+
+
+static void LZMA_initDicAndState(LZMA2_DCtx *p, int init_dic, int init_state)
+{
+    p->remain_len = kMatchSpecLenStart + 1;
+    p->temp_buf_size = 0;
+
+    if (init_dic) {
+        p->processed_pos = 0;
+        p->check_dic_size = 0;
+        p->remain_len = kMatchSpecLenStart + 2;
+    }
+    if (init_state)
+        p->remain_len = kMatchSpecLenStart + 2;
+}
+
+
+
+static size_t LZMA_decodeToDic(LZMA2_DCtx *p, size_t dic_limit, const BYTE *src, size_t *src_len,
+        LZMA2_finishMode finish_mode, LZMA2_status *status)
+{
+    size_t in_size = *src_len;
+    (*src_len) = 0;
+
+    *status = LZMA2_STATUS_NOT_SPECIFIED;
+
+    if (p->remain_len > kMatchSpecLenStart) {
+        for (; in_size > 0 && p->temp_buf_size < RC_INIT_SIZE; (*src_len)++, in_size--)
+            p->temp_buf[p->temp_buf_size++] = *src++;
+        if (p->temp_buf_size != 0 && p->temp_buf[0] != 0)
+            return FL2_ERROR(corruption_detected);
+        if (p->temp_buf_size < RC_INIT_SIZE) {
+            *status = LZMA2_STATUS_NEEDS_MORE_INPUT;
+            return 0;
+        }
+        p->code =
+                ((U32)p->temp_buf[1] << 24)
+            | ((U32)p->temp_buf[2] << 16)
+            | ((U32)p->temp_buf[3] << 8)
+            | ((U32)p->temp_buf[4]);
+        p->range = 0xFFFFFFFF;
+        p->temp_buf_size = 0;
+
+        if (p->remain_len > kMatchSpecLenStart + 1) {
+            size_t num_probs = LZMA_getNumProbs(&p->prop);
+            size_t i;
+            LZMA2_prob *probs = p->probs;
+            for (i = 0; i < num_probs; i++)
+                probs[i] = kBitModelTotal >> 1;
+            p->reps[0] = p->reps[1] = p->reps[2] = p->reps[3] = 1;
+            p->state = 0;
+        }
+
+        p->remain_len = 0;
+    }
+
+    LZMA_writeRem(p, dic_limit);
+
+    while (p->remain_len != kMatchSpecLenStart) {
+            int check_end_mark_now = 0;
+
+            if (p->dic_pos >= dic_limit) {
+                if (p->remain_len == 0 && p->code == 0) {
+                    *status = LZMA2_STATUS_MAYBE_FINISHED_WITHOUT_MARK;
+                    return 0;
+                }
+                if (finish_mode == LZMA2_FINISH_ANY) {
+                    *status = LZMA2_STATUS_NOT_FINISHED;
+                    return 0;
+                }
+                if (p->remain_len != 0) {
+                    *status = LZMA2_STATUS_NOT_FINISHED;
+                    return FL2_ERROR(corruption_detected);
+                }
+                check_end_mark_now = 1;
+            }
+
+            if (p->temp_buf_size == 0) {
+                size_t processed;
+                const BYTE *buf_limit;
+                if (in_size < LZMA_REQUIRED_INPUT_MAX || check_end_mark_now) {
+                    int dummy_res = LZMA_tryDummy(p, src, in_size);
+                    if (dummy_res == DUMMY_ERROR) {
+                        memcpy(p->temp_buf, src, in_size);
+                        p->temp_buf_size = (unsigned)in_size;
+                        (*src_len) += in_size;
+                        *status = LZMA2_STATUS_NEEDS_MORE_INPUT;
+                        return 0;
+                    }
+                    if (check_end_mark_now && dummy_res != DUMMY_MATCH) {
+                        *status = LZMA2_STATUS_NOT_FINISHED;
+                        return FL2_ERROR(corruption_detected);
+                    }
+                    buf_limit = src;
+                }
+                else
+                    buf_limit = src + in_size - LZMA_REQUIRED_INPUT_MAX;
+                p->buf = src;
+                if (LZMA_decodeReal2(p, dic_limit, buf_limit) != 0)
+                    return FL2_ERROR(corruption_detected);
+                processed = (size_t)(p->buf - src);
+                (*src_len) += processed;
+                src += processed;
+                in_size -= processed;
+            }
+            else {
+                unsigned rem = p->temp_buf_size, look_ahead = 0;
+                while (rem < LZMA_REQUIRED_INPUT_MAX && look_ahead < in_size)
+                    p->temp_buf[rem++] = src[look_ahead++];
+                p->temp_buf_size = rem;
+                if (rem < LZMA_REQUIRED_INPUT_MAX || check_end_mark_now) {
+                    int dummy_res = LZMA_tryDummy(p, p->temp_buf, (size_t)rem);
+                    if (dummy_res == DUMMY_ERROR) {
+                        (*src_len) += (size_t)look_ahead;
+                        *status = LZMA2_STATUS_NEEDS_MORE_INPUT;
+                        return 0;
+                    }
+                    if (check_end_mark_now && dummy_res != DUMMY_MATCH) {
+                        *status = LZMA2_STATUS_NOT_FINISHED;
+                        return FL2_ERROR(corruption_detected);
+                    }
+                }
+                p->buf = p->temp_buf;
+                if (LZMA_decodeReal2(p, dic_limit, p->buf) != 0)
+                    return FL2_ERROR(corruption_detected);
+
+                {
+                    unsigned kkk = (unsigned)(p->buf - p->temp_buf);
+                    if (rem < kkk)
+                        return FL2_ERROR(internal); /* some internal error */
+                    rem -= kkk;
+                    if (look_ahead < rem)
+                        return FL2_ERROR(internal); /* some internal error */
+                    look_ahead -= rem;
+                }
+                (*src_len) += (size_t)look_ahead;
+                src += look_ahead;
+                in_size -= (size_t)look_ahead;
+                p->temp_buf_size = 0;
+            }
+    }
+
+    if (p->code != 0)
+        return FL2_ERROR(corruption_detected);
+    *status = LZMA2_STATUS_FINISHED_WITH_MARK;
+    return 0;
+}
+
+
+/* ---------- LZMA2 ---------- */
+
+/*
+00000000  -  End of data
+00000001 U U  -  Uncompressed, reset dic, need reset state and set new prop
+00000010 U U  -  Uncompressed, no reset
+100uuuuu U U P P  -  LZMA, no reset
+101uuuuu U U P P  -  LZMA, reset state
+110uuuuu U U P P S  -  LZMA, reset state + set new prop
+111uuuuu U U P P S  -  LZMA, reset state + set new prop, reset dic
+
+  u, U - Unpack Size
+  P - Pack Size
+  S - Props
+*/
+
+#define LZMA2_IS_UNCOMPRESSED_STATE(p) (((p)->control & (1 << 7)) == 0)
+#define LZMA2_IS_THERE_PROP(control) ((control) >= 0xC0)
+
+#define LZMA2_DIC_SIZE_FROM_PROP(p) (((U32)2 | ((p) & 1)) << ((p) / 2 + 11))
+#define LZMA2_DICT_PROP_MAX 40U
+
+typedef enum
+{
+    LZMA2_STATE_CONTROL,
+    LZMA2_STATE_UNPACK0,
+    LZMA2_STATE_UNPACK1,
+    LZMA2_STATE_PACK0,
+    LZMA2_STATE_PACK1,
+    LZMA2_STATE_PROP,
+    LZMA2_STATE_DATA,
+    LZMA2_STATE_DATA_CONT,
+    LZMA2_STATE_FINISHED,
+    LZMA2_STATE_ERROR
+} LZMA2_state;
+
+void LZMA_constructDCtx(LZMA2_DCtx *const p)
+{
+    p->dic = NULL;
+    p->dic_buf_size = 0;
+    p->dic_pos = 0;
+    p->lzma2_state = LZMA2_STATE_ERROR;
+}
+
+size_t LZMA2_getDictSizeFromProp(BYTE const dict_prop)
+{
+    if (dict_prop > LZMA2_DICT_PROP_MAX)
+        return FL2_ERROR(corruption_detected);
+    if (dict_prop == LZMA2_DICT_PROP_MAX)
+        return 0xFFFFFFFF;
+    return LZMA2_DIC_SIZE_FROM_PROP(dict_prop);
+}
+
+size_t LZMA2_initDecoder(LZMA2_DCtx *const p, BYTE const dict_prop, BYTE *const dic, size_t const dic_buf_size)
+{
+    size_t const dict_size = LZMA2_getDictSizeFromProp(dict_prop);
+    if (FL2_isError(dict_size))
+        return dict_size;
+
+    p->prop.lc = LZMA2_LCLP_MAX;
+    p->prop.lp = 0;
+    p->prop.pb = 0;
+    p->prop.dict_size = (U32)dict_size;
+    p->dic = dic;
+    p->dic_buf_size = dic_buf_size;
+    p->dic_pos = 0;
+    p->lzma2_state = LZMA2_STATE_CONTROL;
+    p->need_init_level = LZMA2_CONTROL_DIC_RESET;
+    p->unpack_size = 0;
+    p->pack_size = 0;
+    LZMA_initDicAndState(p, 1, 1);
+
+    return 0;
+}
+
+static unsigned LZMA2_nextChunkInfo(LZMA2_DCtx *const p, BYTE b)
+{
+    switch (p->lzma2_state) {
+    case LZMA2_STATE_CONTROL:
+        p->control = b;
+        DEBUGLOG(6, "LZMA2 control %02X at %u", b, (U32)p->dic_pos);
+        if (b == 0)
+            return LZMA2_STATE_FINISHED;
+        if (LZMA2_IS_UNCOMPRESSED_STATE(p)) {
+            if (b == LZMA2_CONTROL_COPY_RESET_DIC)
+                p->need_init_level = 0xC0;
+            else if (b > 2 || p->need_init_level == LZMA2_CONTROL_DIC_RESET)
+                return LZMA2_STATE_ERROR;
+        }
+        else {
+            if (b < p->need_init_level)
+                return LZMA2_STATE_ERROR;
+            p->need_init_level = 0;
+            p->unpack_size = (U32)(b & 0x1F) << 16;
+        }
+        return LZMA2_STATE_UNPACK0;
+
+    case LZMA2_STATE_UNPACK0:
+        p->unpack_size |= (U32)b << 8;
+        return LZMA2_STATE_UNPACK1;
+
+    case LZMA2_STATE_UNPACK1:
+        p->unpack_size |= (U32)b;
+        p->unpack_size++;
+        return LZMA2_IS_UNCOMPRESSED_STATE(p) ? LZMA2_STATE_DATA : LZMA2_STATE_PACK0;
+
+    case LZMA2_STATE_PACK0:
+        p->pack_size = (U32)b << 8;
+        return LZMA2_STATE_PACK1;
+
+    case LZMA2_STATE_PACK1:
+        p->pack_size |= (U32)b;
+        p->pack_size++;
+        return (p->control & 0x40) ? LZMA2_STATE_PROP : LZMA2_STATE_DATA;
+
+    case LZMA2_STATE_PROP:
+    {
+        unsigned lc, lp;
+        if (b >= (9 * 5 * 5))
+            return LZMA2_STATE_ERROR;
+        lc = b % 9;
+        b /= 9;
+        p->prop.pb = (BYTE)(b / 5);
+        lp = b % 5;
+        if (lc + lp > LZMA2_LCLP_MAX)
+            return LZMA2_STATE_ERROR;
+        p->prop.lc = (BYTE)lc;
+        p->prop.lp = (BYTE)lp;
+        return LZMA2_STATE_DATA;
+    }
+    }
+    return LZMA2_STATE_ERROR;
+}
+
+static void LZMA_updateWithUncompressed(LZMA2_DCtx *const p, const BYTE *src, size_t size)
+{
+    memcpy(p->dic + p->dic_pos, src, size);
+    p->dic_pos += size;
+    if (p->check_dic_size == 0 && p->prop.dict_size - p->processed_pos <= size)
+        p->check_dic_size = p->prop.dict_size;
+    p->processed_pos += (U32)size;
+}
+
+size_t LZMA2_decodeToDic(LZMA2_DCtx *const p, size_t const dic_limit,
+    const BYTE *src, size_t *const src_len, LZMA2_finishMode const finish_mode)
+{
+    size_t const in_size = *src_len;
+    *src_len = 0;
+
+    while (p->lzma2_state != LZMA2_STATE_ERROR) {
+        size_t dic_pos;
+
+        if (p->lzma2_state == LZMA2_STATE_FINISHED)
+            return LZMA2_STATUS_FINISHED_WITH_MARK;
+
+        dic_pos = p->dic_pos;
+
+        if (dic_pos == dic_limit && finish_mode == LZMA2_FINISH_ANY) {
+            /* A completed chunk and the end marker require no output space */
+            int const chunk_done = (p->lzma2_state == LZMA2_STATE_DATA_CONT && p->unpack_size == 0 && p->pack_size == 0);
+            int const end_mark = (p->lzma2_state == LZMA2_STATE_CONTROL && *src_len < in_size && *src == 0);
+            if (!chunk_done && !end_mark)
+                return LZMA2_STATUS_NOT_FINISHED;
+        }
+
+        if (p->lzma2_state != LZMA2_STATE_DATA && p->lzma2_state != LZMA2_STATE_DATA_CONT) {
+            if (*src_len == in_size)
+                return LZMA2_STATUS_NEEDS_MORE_INPUT;
+            (*src_len)++;
+            p->lzma2_state = LZMA2_nextChunkInfo(p, *src++);
+            if (dic_pos == dic_limit && p->lzma2_state != LZMA2_STATE_FINISHED)
+                break;
+            continue;
+        }
+
+        {
+            size_t in_cur = in_size - *src_len;
+            size_t out_cur = dic_limit - dic_pos;
+            LZMA2_finishMode cur_finish_mode = LZMA2_FINISH_ANY;
+
+            if (out_cur >= p->unpack_size) {
+                out_cur = (size_t)p->unpack_size;
+                cur_finish_mode = LZMA2_FINISH_END;
+            }
+
+            if (LZMA2_IS_UNCOMPRESSED_STATE(p)) {
+                if (in_cur == 0)
+                    return LZMA2_STATUS_NEEDS_MORE_INPUT;
+
+                if (p->lzma2_state == LZMA2_STATE_DATA) {
+                    int const init_dic = (p->control == LZMA2_CONTROL_COPY_RESET_DIC);
+                    LZMA_initDicAndState(p, init_dic, 0);
+                }
+
+                if (in_cur > out_cur)
+                    in_cur = out_cur;
+                if (in_cur == 0)
+                    break;
+
+                LZMA_updateWithUncompressed(p, src, in_cur);
+
+                src += in_cur;
+                *src_len += in_cur;
+                p->unpack_size -= (U32)in_cur;
+                p->lzma2_state = (p->unpack_size == 0) ? LZMA2_STATE_CONTROL : LZMA2_STATE_DATA_CONT;
+            }
+            else {
+                LZMA2_status status;
+                size_t res;
+
+                if (p->lzma2_state == LZMA2_STATE_DATA) {
+                    int const init_dic = (p->control >= LZMA2_CONTROL_DIC_RESET);
+                    int const init_state = (p->control >= 0xA0);
+                    LZMA_initDicAndState(p, init_dic, init_state);
+                    p->lzma2_state = LZMA2_STATE_DATA_CONT;
+                }
+
+                if (in_cur > p->pack_size)
+                    in_cur = (size_t)p->pack_size;
+
+                res = LZMA_decodeToDic(p, dic_pos + out_cur, src, &in_cur, cur_finish_mode, &status);
+
+                src += in_cur;
+                *src_len += in_cur;
+                p->pack_size -= (U32)in_cur;
+                out_cur = p->dic_pos - dic_pos;
+                p->unpack_size -= (U32)out_cur;
+
+                if (FL2_isError(res))
+                    break;
+
+                if (status == LZMA2_STATUS_NEEDS_MORE_INPUT) {
+                    if (p->pack_size == 0)
+                        break;
+                    return LZMA2_STATUS_NEEDS_MORE_INPUT;
+                }
+
+                if (in_cur == 0 && out_cur == 0) {
+                    if (status != LZMA2_STATUS_MAYBE_FINISHED_WITHOUT_MARK
+                        || p->unpack_size != 0
+                        || p->pack_size != 0)
+                        break;
+                    p->lzma2_state = LZMA2_STATE_CONTROL;
+                }
+            }
+        }
+    }
+
+    p->lzma2_state = LZMA2_STATE_ERROR;
+    return FL2_ERROR(corruption_detected);
+}
+
+size_t LZMA2_decodeToBuf(LZMA2_DCtx *const p, BYTE *dest, size_t *const dest_len,
+    const BYTE *src, size_t *const src_len, LZMA2_finishMode const finish_mode)
+{
+    size_t out_size = *dest_len;
+    size_t in_size = *src_len;
+    *src_len = *dest_len = 0;
+
+    for (;;) {
+        size_t in_cur = in_size;
+        size_t out_cur;
+        size_t dic_pos;
+        LZMA2_finishMode cur_finish_mode;
+        size_t res;
+
+        if (p->dic_pos == p->dic_buf_size)
+            p->dic_pos = 0;
+        dic_pos = p->dic_pos;
+        cur_finish_mode = LZMA2_FINISH_ANY;
+        out_cur = p->dic_buf_size - dic_pos;
+
+        if (out_cur >= out_size) {
+            out_cur = out_size;
+            cur_finish_mode = finish_mode;
+        }
+
+        res = LZMA2_decodeToDic(p, dic_pos + out_cur, src, &in_cur, cur_finish_mode);
+
+        src += in_cur;
+        in_size -= in_cur;
+        *src_len += in_cur;
+        out_cur = p->dic_pos - dic_pos;
+        memcpy(dest, p->dic + dic_pos, out_cur);
+        dest += out_cur;
+        out_size -= out_cur;
+        *dest_len += out_cur;
+        if (FL2_isError(res) || out_cur == 0 || out_size == 0)
+            return res;
+    }
+}
+
+LZMA2_parseRes LZMA2_parseInput(const BYTE *const in_buf, size_t const pos, ptrdiff_t const len,
+    LZMA2_chunk *const chunk, size_t *const header_size)
+{
+    const BYTE *const in = in_buf + pos;
+    unsigned control;
+
+    if (len <= 0)
+        return CHUNK_MORE_DATA;
+
+    control = in[0];
+    if (control == 0) {
+        chunk->pack_size = 0;
+        chunk->unpack_size = 0;
+        *header_size = 1;
+        return CHUNK_FINAL;
+    }
+    if (len < 3)
+        return CHUNK_MORE_DATA;
+
+    if (control < 0x80) {
+        /* uncompressed chunk */
+        if (control > 2)
+            return CHUNK_ERROR;
+        chunk->unpack_size = (((U32)in[1] << 8) | in[2]) + 1;
+        chunk->pack_size = chunk->unpack_size;
+        *header_size = 3;
+        return (control == LZMA2_CONTROL_COPY_RESET_DIC) ? CHUNK_DICT_RESET : CHUNK_CONTINUE;
+    }
+    else {
+        size_t const hdr_size = 5 + LZMA2_IS_THERE_PROP(control);
+        if ((size_t)len < hdr_size)
+            return CHUNK_MORE_DATA;
+        if (LZMA2_IS_THERE_PROP(control) && in[5] >= (9 * 5 * 5))
+            return CHUNK_ERROR;
+        chunk->unpack_size = (((U32)(control & 0x1F) << 16) | ((U32)in[1] << 8) | in[2]) + 1;
+        chunk->pack_size = (((size_t)in[3] << 8) | in[4]) + 1;
+        *header_size = hdr_size;
+        return (control >= LZMA2_CONTROL_DIC_RESET) ? CHUNK_DICT_RESET : CHUNK_CONTINUE;
+    }
+}
+
+size_t LZMA2_decMemoryUsage(size_t const dict_size)
+{
+    return sizeof(LZMA2_DCtx) + dict_size;
+}
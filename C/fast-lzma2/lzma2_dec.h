@@ -0,0 +1,133 @@
+/* lzma2_dec.h -- LZMA2 Decoder
+Based on LzmaDec.h and Lzma2Dec.h : Igor Pavlov
+Modified for FL2 by Conor McCarthy
+Public domain
+*/
+
+#ifndef RADYX_LZMA2_DECODER_H
+#define RADYX_LZMA2_DECODER_H
+
+#include "mem.h"
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+typedef U16 LZMA2_prob;
+
+#define LZMA2_LCLP_MAX 4U
+#define LZMA2_PROB_COUNT_MAX (1984U + (0x300U << LZMA2_LCLP_MAX))
+
+/* LZMA_REQUIRED_INPUT_MAX = number of required input bytes for worst case.
+   Num bits = log2((2^11 / 31) ^ 22) + 26 < 134 + 26 = 160; */
+#define LZMA_REQUIRED_INPUT_MAX 20
+
+#define LZMA2_CONTROL_COPY_RESET_DIC 1U
+#define LZMA2_CONTROL_DIC_RESET 0xE0U
+
+/* Largest possible chunk header : control, unpack size (2), pack size (2), lc/lp/pb */
+#define LZMA2_CHUNK_HEADER_MAX 6U
+/* Largest possible unpacked chunk size */
+#define LZMA2_CHUNK_UNPACK_MAX ((size_t)1 << 21)
+
+typedef enum
+{
+    LZMA2_FINISH_ANY,   /* finish at any point */
+    LZMA2_FINISH_END    /* block must be finished at the end */
+} LZMA2_finishMode;
+
+typedef enum
+{
+    LZMA2_STATUS_NOT_SPECIFIED,               /* use main error code instead */
+    LZMA2_STATUS_FINISHED_WITH_MARK,          /* stream was finished with end mark. */
+    LZMA2_STATUS_NOT_FINISHED,                /* stream was not finished */
+    LZMA2_STATUS_NEEDS_MORE_INPUT,            /* you must provide more input bytes */
+    LZMA2_STATUS_MAYBE_FINISHED_WITHOUT_MARK  /* there is probability that stream was finished without end mark */
+} LZMA2_status;
+
+typedef struct
+{
+    BYTE lc;
+    BYTE lp;
+    BYTE pb;
+    BYTE pad_;
+    U32 dict_size;
+} LZMA_props;
+
+typedef struct
+{
+    /* LZMA decoder state */
+    LZMA_props prop;
+    BYTE *dic;
+    size_t dic_buf_size;
+    size_t dic_pos;
+    const BYTE *buf;
+    U32 range;
+    U32 code;
+    U32 processed_pos;
+    U32 check_dic_size;
+    U32 reps[4];
+    U32 state;
+    U32 remain_len;
+    unsigned temp_buf_size;
+    BYTE temp_buf[LZMA_REQUIRED_INPUT_MAX];
+    /* LZMA2 chunk state */
+    U32 pack_size;
+    U32 unpack_size;
+    unsigned lzma2_state;
+    BYTE control;
+    BYTE need_init_level;
+    LZMA2_prob probs[LZMA2_PROB_COUNT_MAX];
+} LZMA2_DCtx;
+
+/* Chunk information obtained by LZMA2_parseInput() without decoding */
+typedef struct
+{
+    size_t pack_size;   /* bytes following the header */
+    U32 unpack_size;
+} LZMA2_chunk;
+
+typedef enum
+{
+    CHUNK_MORE_DATA,    /* header is incomplete */
+    CHUNK_CONTINUE,     /* chunk depends on preceding data */
+    CHUNK_DICT_RESET,   /* chunk resets the dictionary, i.e. it can be decoded independently */
+    CHUNK_FINAL,        /* end marker */
+    CHUNK_ERROR
+} LZMA2_parseRes;
+
+void LZMA_constructDCtx(LZMA2_DCtx *const p);
+
+size_t LZMA2_getDictSizeFromProp(BYTE const dict_prop);
+
+/* LZMA2_initDecoder() :
+ * Prepare to decode a new stream into the dictionary buffer `dic`.
+ * Returns 0 or an error code if `dict_prop` is invalid. */
+size_t LZMA2_initDecoder(LZMA2_DCtx *const p, BYTE const dict_prop, BYTE *const dic, size_t const dic_buf_size);
+
+/* LZMA2_decodeToDic() :
+ * Decode into p->dic until p->dic_pos reaches dic_limit or the end marker is found.
+ * *src_len is updated with the amount of input consumed.
+ * Returns an LZMA2_status value or an error code. */
+size_t LZMA2_decodeToDic(LZMA2_DCtx *const p, size_t const dic_limit,
+    const BYTE *src, size_t *const src_len, LZMA2_finishMode const finish_mode);
+
+/* LZMA2_decodeToBuf() :
+ * Decode using p->dic as a circular dictionary, copying output to `dest`. */
+size_t LZMA2_decodeToBuf(LZMA2_DCtx *const p, BYTE *dest, size_t *const dest_len,
+    const BYTE *src, size_t *const src_len, LZMA2_finishMode const finish_mode);
+
+/* LZMA2_parseInput() :
+ * Read the chunk header at in_buf[pos] without decoding. `len` is the number of
+ * bytes available from pos. On success, chunk->pack_size holds the number of bytes
+ * following the header and the header size is returned in *header_size. */
+LZMA2_parseRes LZMA2_parseInput(const BYTE *const in_buf, size_t const pos, ptrdiff_t const len,
+    LZMA2_chunk *const chunk, size_t *const header_size);
+
+size_t LZMA2_decMemoryUsage(size_t const dict_size);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* RADYX_LZMA2_DECODER_H */
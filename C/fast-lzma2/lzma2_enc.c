@@ -15,6 +15,7 @@ Public domain
 #include "count.h"
 #include "radix_mf.h"
 #include "range_enc.h"
+#include "util.h"
 
 #ifdef FL2_XZ_BUILD
 #  include "tuklib_integer.h"
@@ -91,6 +92,11 @@ Public domain
 
 #define kMaxChunkUncompressedSize (1UL << 21U)
 
+/* Adaptive strategy: chunks between tests of the optimal parser against fast mode, and the
+ * minimum gain in parts per thousand for the optimal parser to be kept */
+#define kAdaptiveProbeInterval 8U
+#define kAdaptiveMinGain 5U
+
 #define kChunkHeaderSize 5U
 #define kChunkResetShift 5U
 #define kChunkUncompressedDictReset 1U
@@ -180,6 +186,15 @@ typedef struct
     U32 reps[kNumReps];
 } OptimalNode;
 
+/* Literal context bits and position masks, passed by value to the encoding functions so the
+ * chunk encoders can be instantiated with constants for common settings. See LZMA2_encodeChunk() */
+typedef struct
+{
+    unsigned lc;
+    size_t lit_pos_mask;
+    size_t pos_mask;
+} LcLpPb;
+
 #define MARK_LITERAL(node) (node).dist = kNullDist; (node).extra = 0;
 #define MARK_SHORT_REP(node) (node).dist = 0; (node).extra = 0;
 
@@ -201,7 +216,6 @@ struct LZMA2_ECtx_s
     unsigned pb;
     unsigned fast_length;
     size_t len_end_max;
-    size_t lit_pos_mask;
     size_t pos_mask;
     unsigned match_cycles;
     FL2_strategy strategy;
@@ -211,6 +225,10 @@ struct LZMA2_ECtx_s
     size_t chunk_size;
     /* Don't encode a symbol beyond this limit (used by fast mode) */
     size_t chunk_limit;
+    /* Chunks written since the last reset, for statistics */
+    size_t chunks_compressed;
+    size_t chunks_stored;
+    size_t chunks_fast; /* encoded in fast mode by the adaptive strategy */
 
     EncoderStates states;
 
@@ -250,7 +268,6 @@ LZMA2_ECtx* LZMA2_createECtx(void)
     enc->pb = 2;
     enc->fast_length = 48;
     enc->len_end_max = kOptimizerBufferSize - 1;
-    enc->lit_pos_mask = (1 << enc->lp) - 1;
     enc->pos_mask = (1 << enc->pb) - 1;
     enc->match_cycles = 1;
     enc->strategy = FL2_ultra;
@@ -261,6 +278,7 @@ LZMA2_ECtx* LZMA2_createECtx(void)
     enc->hash_dict_3 = 0;
     enc->chain_mask_3 = 0;
     enc->hash_alloc_3 = 0;
+    LZMA2_resetChunkCounts(enc);
     return enc;
 }
 
@@ -272,12 +290,22 @@ void LZMA2_freeECtx(LZMA2_ECtx *const enc)
     free(enc);
 }
 
-#define LITERAL_PROBS(enc, pos, prev_symbol) (enc->states.literal_probs + ((((pos) & enc->lit_pos_mask) << enc->lc) + ((prev_symbol) >> (8 - enc->lc))) * kNumLiterals * kNumLitTables)
+#define LITERAL_PROBS(enc, props, pos, prev_symbol) (enc->states.literal_probs + ((((pos) & (props).lit_pos_mask) << (props).lc) + ((prev_symbol) >> (8 - (props).lc))) * kNumLiterals * kNumLitTables)
 
 #define LEN_TO_DIST_STATE(len) (((len) < kNumLenToPosStates + 1) ? (len) - 2 : kNumLenToPosStates - 1)
 
 #define IS_LIT_STATE(state) ((state) < 7)
 
+HINT_INLINE
+LcLpPb LZMA_lcLpPb(unsigned const lc, unsigned const lp, unsigned const pb)
+{
+    LcLpPb props;
+    props.lc = lc;
+    props.lit_pos_mask = ((size_t)1 << lp) - 1;
+    props.pos_mask = ((size_t)1 << pb) - 1;
+    return props;
+}
+
 HINT_INLINE
 unsigned LZMA_getRepLen1Price(LZMA2_ECtx* const enc, size_t const state, size_t const pos_state)
 {
@@ -334,12 +362,12 @@ static unsigned LZMA_getLiteralPriceMatched(const Probability *const prob_table,
 }
 
 HINT_INLINE
-void LZMA_encodeLiteral(LZMA2_ECtx *const enc, size_t const index, U32 symbol, unsigned const prev_symbol)
+void LZMA_encodeLiteral(LZMA2_ECtx *const enc, LcLpPb const props, size_t const index, U32 symbol, unsigned const prev_symbol)
 {
-    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & enc->pos_mask]);
+    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & props.pos_mask]);
     enc->states.state = LIT_NEXT_STATE(enc->states.state);
 
-    Probability* const prob_table = LITERAL_PROBS(enc, index, prev_symbol);
+    Probability* const prob_table = LITERAL_PROBS(enc, props, index, prev_symbol);
     symbol |= 0x100;
     do {
         RC_encodeBit(&enc->rc, prob_table + (symbol >> 8), symbol & (1 << 7));
@@ -348,13 +376,13 @@ void LZMA_encodeLiteral(LZMA2_ECtx *const enc, size_t const index, U32 symbol, u
 }
 
 HINT_INLINE
-void LZMA_encodeLiteralMatched(LZMA2_ECtx *const enc, const BYTE* const data_block, size_t const index, U32 symbol)
+void LZMA_encodeLiteralMatched(LZMA2_ECtx *const enc, LcLpPb const props, const BYTE* const data_block, size_t const index, U32 symbol)
 {
-    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & enc->pos_mask]);
+    RC_encodeBit0(&enc->rc, &enc->states.is_match[enc->states.state][index & props.pos_mask]);
     enc->states.state = LIT_NEXT_STATE(enc->states.state);
 
     unsigned match_symbol = data_block[index - enc->states.reps[0] - 1];
-    Probability* const prob_table = LITERAL_PROBS(enc, index, data_block[index - 1]);
+    Probability* const prob_table = LITERAL_PROBS(enc, props, index, data_block[index - 1]);
     unsigned offset = 0x100;
     symbol |= 0x100;
     do {
@@ -367,15 +395,15 @@ void LZMA_encodeLiteralMatched(LZMA2_ECtx *const enc, const BYTE* const data_blo
 }
 
 HINT_INLINE
-void LZMA_encodeLiteralBuf(LZMA2_ECtx *const enc, const BYTE* const data_block, size_t const index)
+void LZMA_encodeLiteralBuf(LZMA2_ECtx *const enc, LcLpPb const props, const BYTE* const data_block, size_t const index)
 {
     U32 const symbol = data_block[index];
     if (IS_LIT_STATE(enc->states.state)) {
         unsigned const prev_symbol = data_block[index - 1];
-        LZMA_encodeLiteral(enc, index, symbol, prev_symbol);
+        LZMA_encodeLiteral(enc, props, index, symbol, prev_symbol);
     }
     else {
-        LZMA_encodeLiteralMatched(enc, data_block, index, symbol);
+        LZMA_encodeLiteralMatched(enc, props, data_block, index, symbol);
     }
 }
 
@@ -580,10 +608,11 @@ size_t LZMA_encodeChunkFast(LZMA2_ECtx *const enc,
     FL2_dataBlock const block,
     FL2_matchTable* const tbl,
     int const struct_tbl,
+    LcLpPb const props,
     size_t index,
     size_t const uncompressed_end)
 {
-    size_t const pos_mask = enc->pos_mask;
+    size_t const pos_mask = props.pos_mask;
     size_t prev = index;
     unsigned const search_depth = tbl->params.depth;
 
@@ -737,7 +766,7 @@ _encode:
                 return prev;
 
             if (block.data[prev] != block.data[prev - enc->states.reps[0] - 1]) {
-                LZMA_encodeLiteralBuf(enc, block.data, prev);
+                LZMA_encodeLiteralBuf(enc, props, block.data, prev);
                 ++prev;
             }
             else {
@@ -761,7 +790,7 @@ _encode:
     }
     while (prev < index && enc->rc.out_index < enc->chunk_limit) {
         if (block.data[prev] != block.data[prev - enc->states.reps[0] - 1])
-            LZMA_encodeLiteralBuf(enc, block.data, prev);
+            LZMA_encodeLiteralBuf(enc, props, block.data, prev);
         else
             LZMA_encodeRepMatchShort(enc, prev & pos_mask);
         ++prev;
@@ -814,9 +843,8 @@ static void LZMA_reverseOptimalChain(OptimalNode* const opt_buf, size_t cur)
     }
 }
 
-static unsigned LZMA_getLiteralPrice(LZMA2_ECtx *const enc, size_t const index, size_t const state, unsigned const prev_symbol, U32 symbol, unsigned const match_byte)
+static unsigned LZMA_getLiteralPrice(const Probability* const prob_table, size_t const state, U32 symbol, unsigned const match_byte)
 {
-    const Probability* const prob_table = LITERAL_PROBS(enc, index, prev_symbol);
     if (IS_LIT_STATE(state)) {
         unsigned price = 0;
         symbol |= 0x100;
@@ -952,10 +980,11 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
     size_t const cur,
     size_t len_end,
     int const is_hybrid,
+    LcLpPb const props,
     U32* const reps)
 {
     OptimalNode* const cur_opt = &enc->opt_buf[cur];
-    size_t const pos_mask = enc->pos_mask;
+    size_t const pos_mask = props.pos_mask;
     size_t const pos_state = (index & pos_mask);
     const BYTE* const data = block.data + index;
     size_t const fast_length = enc->fast_length;
@@ -1022,7 +1051,7 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
         BYTE try_lit = cur_and_lit_price + kMinLitPrice / 2U <= next_price;
         if (try_lit) {
             /* cur_and_lit_price is used later for the literal + rep0 test */
-            cur_and_lit_price += LZMA_getLiteralPrice(enc, index, state, data[-1], cur_byte, match_byte);
+            cur_and_lit_price += LZMA_getLiteralPrice(LITERAL_PROBS(enc, props, index, data[-1]), state, cur_byte, match_byte);
             /* Try literal */
             if (cur_and_lit_price < next_price) {
                 next_opt->price = cur_and_lit_price;
@@ -1118,7 +1147,7 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
                 U32 rep_lit_rep_total_price =
                     cur_rep_price + enc->states.rep_len_states.prices[pos_state][len_test - kMatchLenMin]
                     + GET_PRICE_0(enc->states.is_match[state_2][pos_state_next])
-                    + LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, index + len_test, data[len_test - 1]),
+                    + LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, props, index + len_test, data[len_test - 1]),
                         data[len_test], data_2[len_test]);
 
                 state_2 = kState_LitAfterRep;
@@ -1228,7 +1257,7 @@ size_t LZMA_optimalParse(LZMA2_ECtx* const enc, FL2_dataBlock const block,
                         size_t pos_state_next = (index + len_test) & pos_mask;
                         U32 match_lit_rep_total_price = cur_and_len_price +
                             GET_PRICE_0(enc->states.is_match[state_2][pos_state_next]) +
-                            LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, index + len_test, data[len_test - 1]),
+                            LZMA_getLiteralPriceMatched(LITERAL_PROBS(enc, props, index + len_test, data[len_test - 1]),
                                 data[len_test], data_2[len_test]);
 
                         state_2 = kState_LitAfterMatch;
@@ -1288,6 +1317,7 @@ FORCE_NOINLINE
 static size_t LZMA_initMatchesPos0Best(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     RMF_match const match,
     size_t const index,
+    size_t const pos_state,
     size_t start_len,
     unsigned const normal_match_price)
 {
@@ -1308,8 +1338,6 @@ static size_t LZMA_initMatchesPos0Best(LZMA2_ECtx *const enc, FL2_dataBlock cons
 
         enc->matches[start_match - 1].length = (U32)start_len - 1; /* Avoids an if..else branch in the loop. [-1] is ok */
 
-        size_t pos_state = index & enc->pos_mask;
-
         for (ptrdiff_t match_index = enc->match_count - 1; match_index >= start_match; --match_index) {
             size_t len_test = enc->matches[match_index].length;
             size_t const distance = enc->matches[match_index].dist;
@@ -1350,6 +1378,7 @@ size_t LZMA_initOptimizerPos0(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     RMF_match const match,
     size_t const index,
     int const is_hybrid,
+    LcLpPb const props,
     U32* const reps)
 {
     size_t const max_length = MIN(block.end - index, kMatchLenMax);
@@ -1384,14 +1413,14 @@ size_t LZMA_initOptimizerPos0(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     unsigned const cur_byte = *data;
     unsigned const match_byte = *(data - reps[0] - 1);
     size_t const state = enc->states.state;
-    size_t const pos_state = index & enc->pos_mask;
+    size_t const pos_state = index & props.pos_mask;
     Probability const is_match_prob = enc->states.is_match[state][pos_state];
     Probability const is_rep_prob = enc->states.is_rep[state];
 
     enc->opt_buf[0].state = state;
     /* Set the price for literal */
     enc->opt_buf[1].price = GET_PRICE_0(is_match_prob) +
-        LZMA_getLiteralPrice(enc, index, state, data[-1], cur_byte, match_byte);
+        LZMA_getLiteralPrice(LITERAL_PROBS(enc, props, index, data[-1]), state, cur_byte, match_byte);
     MARK_LITERAL(enc->opt_buf[1]);
 
     unsigned const match_price = GET_PRICE_1(is_match_prob);
@@ -1434,7 +1463,7 @@ size_t LZMA_initOptimizerPos0(LZMA2_ECtx *const enc, FL2_dataBlock const block,
     }
     else {
         /* Hybrid mode */
-        size_t main_len = LZMA_initMatchesPos0Best(enc, block, match, index, len, normal_match_price);
+        size_t main_len = LZMA_initMatchesPos0Best(enc, block, match, index, pos_state, len, normal_match_price);
         return MAX(main_len, rep_lens[rep_max_index]);
     }
 }
@@ -1444,6 +1473,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
     FL2_matchTable* const tbl,
     int const struct_tbl,
     int const is_hybrid,
+    LcLpPb const props,
     size_t start_index,
     size_t const uncompressed_end,
     RMF_match match)
@@ -1451,7 +1481,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
     size_t len_end = enc->len_end_max;
     unsigned const search_depth = tbl->params.depth;
     do {
-        size_t const pos_mask = enc->pos_mask;
+        size_t const pos_mask = props.pos_mask;
 
         /* Reset all prices that were set last time */
         for (; (len_end & 3) != 0; --len_end)
@@ -1466,7 +1496,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
         /* Set everything up at position 0 */
         size_t index = start_index;
         U32 reps[kNumReps];
-        len_end = LZMA_initOptimizerPos0(enc, block, match, index, is_hybrid, reps);
+        len_end = LZMA_initOptimizerPos0(enc, block, match, index, is_hybrid, props, reps);
         match.length = 0;
         size_t cur = 1;
 
@@ -1509,7 +1539,7 @@ size_t LZMA_encodeOptimumSequence(LZMA2_ECtx *const enc, FL2_dataBlock const blo
                 if (match.length >= enc->fast_length)
                     break;
 
-                len_end = LZMA_optimalParse(enc, block, match, index, cur, len_end, is_hybrid, reps);
+                len_end = LZMA_optimalParse(enc, block, match, index, cur, len_end, is_hybrid, props, reps);
             }
 reverse:
             DEBUGLOG(6, "End optimal parse at %u", (U32)cur);
@@ -1521,7 +1551,7 @@ reverse:
             unsigned const len = enc->opt_buf[i].len;
 
             if (len == 1 && enc->opt_buf[i].dist == kNullDist) {
-                LZMA_encodeLiteralBuf(enc, block.data, start_index + i);
+                LZMA_encodeLiteralBuf(enc, props, block.data, start_index + i);
                 ++i;
             }
             else {
@@ -1652,6 +1682,7 @@ size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
     FL2_dataBlock const block,
     FL2_matchTable* const tbl,
     int const struct_tbl,
+    LcLpPb const props,
     size_t index,
     size_t const uncompressed_end)
 {
@@ -1667,10 +1698,10 @@ size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
         if (match.length > 1) {
             /* Template-like inline function */
             if (enc->strategy == FL2_ultra) {
-                index = LZMA_encodeOptimumSequence(enc, block, tbl, struct_tbl, 1, index, uncompressed_end, match);
+                index = LZMA_encodeOptimumSequence(enc, block, tbl, struct_tbl, 1, props, index, uncompressed_end, match);
             }
             else {
-                index = LZMA_encodeOptimumSequence(enc, block, tbl, struct_tbl, 0, index, uncompressed_end, match);
+                index = LZMA_encodeOptimumSequence(enc, block, tbl, struct_tbl, 0, props, index, uncompressed_end, match);
             }
             if (enc->match_price_count >= kMatchRepriceFrequency) {
                 LZMA_fillAlignPrices(enc);
@@ -1684,11 +1715,11 @@ size_t LZMA_encodeChunkBest(LZMA2_ECtx *const enc,
         }
         else {
             if (block.data[index] != block.data[index - enc->states.reps[0] - 1]) {
-                LZMA_encodeLiteralBuf(enc, block.data, index);
+                LZMA_encodeLiteralBuf(enc, props, block.data, index);
                 ++index;
             }
             else {
-                LZMA_encodeRepMatchShort(enc, index & enc->pos_mask);
+                LZMA_encodeRepMatchShort(enc, index & props.pos_mask);
                 ++index;
             }
         }
@@ -1745,6 +1776,20 @@ static void LZMA_encoderStates_Reset(EncoderStates* const es, unsigned const lc,
         es->dist_align_encoders[i] = kProbInitValue;
 }
 
+void LZMA2_resetChunkCounts(LZMA2_ECtx *const enc)
+{
+    enc->chunks_compressed = 0;
+    enc->chunks_stored = 0;
+    enc->chunks_fast = 0;
+}
+
+void LZMA2_getChunkCounts(const LZMA2_ECtx *const enc, size_t *const compressed, size_t *const stored, size_t *const fast)
+{
+    *compressed = enc->chunks_compressed;
+    *stored = enc->chunks_stored;
+    *fast = enc->chunks_fast;
+}
+
 BYTE LZMA2_getDictSizeProp(size_t const dictionary_size)
 {
     BYTE dict_size_prop = 0;
@@ -1785,7 +1830,6 @@ static void LZMA2_reset(LZMA2_ECtx *const enc, size_t const max_distance)
     RC_reset(&enc->rc);
     LZMA_encoderStates_Reset(&enc->states, enc->lc, enc->lp, enc->fast_length);
     enc->pos_mask = (1 << enc->pb) - 1;
-    enc->lit_pos_mask = (1 << enc->lp) - 1;
     U32 i = 0;
     for (; max_distance > (size_t)1 << i; ++i) {
     }
@@ -1911,24 +1955,37 @@ static size_t LZMA2_encodeChunk(LZMA2_ECtx *const enc,
     FL2_dataBlock const block,
     size_t const index, size_t const uncompressed_end)
 {
+    LcLpPb const props = LZMA_lcLpPb(enc->lc, enc->lp, enc->pb);
+
     /* Template-like inline functions */
     if (enc->strategy == FL2_fast) {
         if (tbl->is_struct) {
-            return LZMA_encodeChunkFast(enc, block, tbl, 1,
+            return LZMA_encodeChunkFast(enc, block, tbl, 1, props,
+                index, uncompressed_end);
+        }
+        else {
+            return LZMA_encodeChunkFast(enc, block, tbl, 0, props,
+                index, uncompressed_end);
+        }
+    }
+    else if (enc->lc == 3 && enc->lp == 0 && enc->pb == 2) {
+        /* The default properties are constants in this instance */
+        if (tbl->is_struct) {
+            return LZMA_encodeChunkBest(enc, block, tbl, 1, LZMA_lcLpPb(3, 0, 2),
                 index, uncompressed_end);
         }
         else {
-            return LZMA_encodeChunkFast(enc, block, tbl, 0,
+            return LZMA_encodeChunkBest(enc, block, tbl, 0, LZMA_lcLpPb(3, 0, 2),
                 index, uncompressed_end);
         }
     }
     else {
         if (tbl->is_struct) {
-            return LZMA_encodeChunkBest(enc, block, tbl, 1,
+            return LZMA_encodeChunkBest(enc, block, tbl, 1, props,
                 index, uncompressed_end);
         }
         else {
-            return LZMA_encodeChunkBest(enc, block, tbl, 0,
+            return LZMA_encodeChunkBest(enc, block, tbl, 0, props,
                 index, uncompressed_end);
         }
     }
@@ -1955,6 +2012,12 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
 	BYTE encode_properties = 1;
     BYTE incompressible = 0;
 
+    /* Adaptive strategy state */
+    BYTE const adaptive = options->min_rate != 0 && options->strategy != FL2_fast;
+    UTIL_time_t const adaptive_start = UTIL_getTime();
+    unsigned probe_countdown = 0;
+    BYTE best_gains = 1;
+
     if (block.end <= block.start)
         return 0;
 
@@ -1992,20 +2055,44 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
         EncoderStates saved_states;
         size_t next_index;
 
+        /* Segments found incompressible by the match table pre-scan are stored directly */
+        size_t const skip_end = RMF_skipRunEnd(tbl, index, block.end);
+        BYTE const store = incompressible || skip_end > index;
+
+        if (store && index == start) {
+            /* A stored chunk won't fit in the temp buffer, but the table space it occupies is not needed */
+            out_dest = RMF_getTableAsOutputBuffer(tbl, start);
+            enc->chunk_size = kChunkSize;
+            enc->chunk_limit = kMaxChunkCompressedSize - kMaxMatchEncodeSize * 2;
+        }
+
         RC_reset(&enc->rc);
         RC_setOutputBuffer(&enc->rc, out_dest + header_size);
 
-        if (!incompressible) {
+        if (!store) {
             size_t cur = index;
-            size_t const end = (enc->strategy == FL2_fast) ? MIN(block.end, index + kMaxChunkUncompressedSize - kMatchLenMax + 1)
+            BYTE probe = 0;
+
+            if (adaptive && index != start) {
+                /* Fall back to fast mode when behind schedule or when the optimal parser gains too little */
+                BYTE const on_time = UTIL_clockSpanMicro(adaptive_start) * options->min_rate <= (U64)(index - start) * 1000U;
+                /* The trial output must not overwrite table entries which will be read again */
+                probe = on_time && probe_countdown == 0
+                    && out_dest + header_size + kMaxChunkCompressedSize <= RMF_getTableAsOutputBuffer(tbl, index);
+                probe_countdown -= (probe_countdown != 0);
+                enc->strategy = (on_time && (probe || best_gains)) ? options->strategy : FL2_fast;
+            }
+
+            size_t const limit = (enc->strategy == FL2_fast) ? MIN(block.end, index + kMaxChunkUncompressedSize - kMatchLenMax + 1)
                 : MIN(block.end, index + kMaxChunkUncompressedSize - kOptimizerBufferSize + 2); /* last byte of opt_buf unused */
+            size_t const end = RMF_nextSkipStart(tbl, index, limit);
 
             /* Copy states in case chunk is incompressible */
             saved_states = enc->states;
 
             if (index == 0) {
                 /* First byte of the dictionary */
-                LZMA_encodeLiteral(enc, 0, block.data[0], 0);
+                LZMA_encodeLiteral(enc, LZMA_lcLpPb(enc->lc, enc->lp, enc->pb), 0, block.data[0], 0);
                 ++cur;
             }
             if (index == start) {
@@ -2025,11 +2112,39 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
                 enc->chunk_size = kChunkSize;
                 enc->chunk_limit = kMaxChunkCompressedSize - kMaxMatchEncodeSize * 2;
             }
+            size_t fast_size = 0;
+            size_t fast_end = 0;
+            if (probe) {
+                /* Trial encode in fast mode, then rewind and encode with the configured strategy */
+                unsigned const match_price_count = enc->match_price_count;
+                unsigned const rep_len_price_count = enc->rep_len_price_count;
+
+                enc->strategy = FL2_fast;
+                fast_end = LZMA2_encodeChunk(enc, tbl, block, cur, end);
+                RC_flush(&enc->rc);
+                fast_size = enc->rc.out_index;
+
+                enc->states = saved_states;
+                enc->match_price_count = match_price_count;
+                enc->rep_len_price_count = rep_len_price_count;
+                enc->strategy = options->strategy;
+                RC_reset(&enc->rc);
+                RC_setOutputBuffer(&enc->rc, out_dest + header_size);
+            }
             next_index = LZMA2_encodeChunk(enc, tbl, block, cur, end);
             RC_flush(&enc->rc);
+            if (probe) {
+                /* Compare the compressed bytes per input byte */
+                best_gains = (U64)enc->rc.out_index * (fast_end - index) * 1000U
+                    < (U64)fast_size * (next_index - index) * (1000U - kAdaptiveMinGain);
+                probe_countdown = kAdaptiveProbeInterval;
+                DEBUGLOG(5, "Adaptive probe at %u : fast %u => %u, best %u => %u", (unsigned)index,
+                    (unsigned)(fast_end - index), (unsigned)fast_size, (unsigned)(next_index - index), (unsigned)enc->rc.out_index);
+            }
+            enc->chunks_fast += (enc->strategy == FL2_fast && options->strategy != FL2_fast);
         }
         else {
-            next_index = MIN(index + kChunkSize, block.end);
+            next_index = MIN(index + kChunkSize, (skip_end > index) ? skip_end : block.end);
         }
         size_t compressed_size = enc->rc.out_index;
         size_t uncompressed_size = next_index - index;
@@ -2047,7 +2162,7 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
         header[1] = (BYTE)((uncompressed_size - 1) >> 8);
         header[2] = (BYTE)(uncompressed_size - 1);
         /* Output an uncompressed chunk if necessary */
-        if (incompressible || uncompressed_size + 3 <= compressed_size + header_size) {
+        if (store || uncompressed_size + 3 <= compressed_size + header_size) {
             DEBUGLOG(6, "Storing chunk : was %u => %u", (unsigned)uncompressed_size, (unsigned)compressed_size);
 
             header[0] = (index == 0) ? kChunkUncompressedDictReset : kChunkUncompressed;
@@ -2059,8 +2174,10 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
             header_size = 3 + (header - out_dest);
 
             /* Restore states if compression was attempted */
-            if (!incompressible)
+            if (!store)
                 enc->states = saved_states;
+
+            ++enc->chunks_stored;
         }
         else {
             DEBUGLOG(6, "Compressed chunk : %u => %u", (unsigned)uncompressed_size, (unsigned)compressed_size);
@@ -2079,8 +2196,9 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
                 header[5] = LZMA_getLcLpPbCode(enc);
                 encode_properties = 0;
             }
+            ++enc->chunks_compressed;
         }
-        if (incompressible || uncompressed_size + 3 <= compressed_size + (compressed_size >> kRandomFilterMarginBits) + header_size) {
+        if (store || uncompressed_size + 3 <= compressed_size + (compressed_size >> kRandomFilterMarginBits) + header_size) {
             /* Test the next chunk for compressibility */
             incompressible = LZMA2_isChunkIncompressible(tbl, block, next_index, enc->strategy);
         }
@@ -34,6 +34,7 @@ typedef struct
     FL2_strategy strategy;
     unsigned second_dict_bits;
     unsigned reset_interval;
+    unsigned min_rate; /* bytes per millisecond each encoder must sustain, 0 = fixed strategy */
 } FL2_lzma2Parameters;
 
 
@@ -52,6 +53,10 @@ size_t LZMA2_encode(LZMA2_ECtx *const enc,
     FL2_atomic *const progress_out,
     int *const canceled);
 
+void LZMA2_resetChunkCounts(LZMA2_ECtx *const enc);
+
+void LZMA2_getChunkCounts(const LZMA2_ECtx *const enc, size_t *const compressed, size_t *const stored, size_t *const fast);
+
 BYTE LZMA2_getDictSizeProp(size_t const dictionary_size);
 
 size_t LZMA2_compressBound(size_t src_size);
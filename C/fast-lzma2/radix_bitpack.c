@@ -12,6 +12,7 @@
 #include "fl2_threading.h"
 #include "fl2_internal.h"
 #include "radix_internal.h"
+#include "count.h"
 
 typedef struct FL2_matchTable_s FL2_matchTable;
 
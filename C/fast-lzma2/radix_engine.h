@@ -9,9 +9,36 @@
 */
 
 #include <stdio.h>  
+#include <string.h>  /* memcpy */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define RMF_SSE2
+#elif (defined(__ARM_NEON) && defined(__aarch64__)) || defined(_M_ARM64)
+#  include <arm_neon.h>
+#  define RMF_NEON
+#endif
 
 #define MAX_READ_BEYOND_DEPTH 2
 
+/* Step back from aligned position i over any preceding data which repeats the 4-byte pattern u.
+ * Long repeats are scanned 16 bytes at a time where SIMD is available. */
+static ptrdiff_t RMF_findRepeatStart(const BYTE* const data_block, ptrdiff_t i, U32 const u)
+{
+#if defined(RMF_SSE2)
+    __m128i const pattern = _mm_set1_epi32((int)u);
+    while (i >= 16 && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data_block + i - 16)), pattern)) == 0xFFFF)
+        i -= 16;
+#elif defined(RMF_NEON)
+    uint8x16_t const pattern = vreinterpretq_u8_u32(vdupq_n_u32(u));
+    while (i >= 16 && vminvq_u8(vceqq_u8(vld1q_u8(data_block + i - 16), pattern)) == 0xFF)
+        i -= 16;
+#endif
+    while (i != 0 && *(U32*)(data_block + i - 4) == u)
+        i -= 4;
+    return i;
+}
+
 /* If a repeating byte is found, fill that section of the table with matches of distance 1 */
 static size_t RMF_handleRepeat(RMF_builder* const tbl, const BYTE* const data_block, size_t const start, ptrdiff_t i, U32 depth)
 {
@@ -21,8 +48,7 @@ static size_t RMF_handleRepeat(RMF_builder* const tbl, const BYTE* const data_bl
     /* Find the start */
     i += (4 - (i & 3)) & 3;
     U32 u = *(U32*)(data_block + i);
-    while (i != 0 && *(U32*)(data_block + i - 4) == u)
-      i -= 4;
+    i = RMF_findRepeatStart(data_block, i, u);
     while (i != 0 && data_block[i - 1] == (BYTE)u)
       --i;
 
@@ -52,8 +78,7 @@ static size_t RMF_handleRepeat2(RMF_builder* const tbl, const BYTE* const data_b
     ptrdiff_t realign = i & 1;
     i += (4 - (i & 3)) & 3;
     U32 u = *(U32*)(data_block + i);
-    while (i != 0 && *(U32*)(data_block + i - 4) == u)
-        i -= 4;
+    i = RMF_findRepeatStart(data_block, i, u);
     while (i != 0 && data_block[i - 1] == data_block[i + 1])
         --i;
     i += (i & 1) ^ realign;
@@ -103,6 +128,68 @@ static void RMF_initReference(FL2_matchTable* const tbl, const void* const data,
 }
 #endif
 
+/* Fill positions [0, carry_start) with the links saved from the end of the previous block,
+ * and restore the lists they form. Returns the number of lists placed on the stack.
+ */
+static size_t RMF_relocateCarry(FL2_matchTable* const tbl)
+{
+    size_t const length = tbl->carry_start;
+    if (length == 0)
+        return 0;
+
+    const RMF_carry* const carry = tbl->carry;
+#ifdef RMF_BITPACK
+    memcpy(tbl->table, carry->links, length * sizeof(U32));
+#else
+    for (size_t i = 0; i < length; ++i)
+        InitMatchLink(i, carry->links[i]);
+#endif
+    size_t st_index = 0;
+    for (size_t radix_16 = 0; radix_16 < RADIX16_TABLE_SIZE; ++radix_16) {
+        if (carry->counts[radix_16] != 0) {
+            tbl->list_heads[radix_16].head = carry->heads[radix_16];
+            tbl->list_heads[radix_16].count = carry->counts[radix_16];
+            tbl->stack[st_index++] = (U32)radix_16;
+        }
+    }
+    return st_index;
+}
+
+/* Add the list counts so far to the counts preceding the retained part */
+static void RMF_addCarryBaseCounts(FL2_matchTable* const tbl)
+{
+    U32* const base_counts = tbl->carry->base_counts;
+    for (size_t radix_16 = 0; radix_16 < RADIX16_TABLE_SIZE; ++radix_16)
+        if (tbl->list_heads[radix_16].head != RADIX_NULL_LINK)
+            base_counts[radix_16] += tbl->list_heads[radix_16].count;
+}
+
+/* Save the links of positions [from, end - 2) relative to from, for the next block. Links which
+ * point below from are cut, and the lists are limited to their retained part.
+ */
+static void RMF_saveCarry(FL2_matchTable* const tbl, size_t const end, size_t const from)
+{
+    RMF_carry* const carry = tbl->carry;
+    size_t const block_size = end - 2;
+
+    for (size_t radix_16 = 0; radix_16 < RADIX16_TABLE_SIZE; ++radix_16) {
+        U32 const head = tbl->list_heads[radix_16].head;
+        if (head != RADIX_NULL_LINK && head >= from) {
+            carry->heads[radix_16] = head - (U32)from;
+            carry->counts[radix_16] = tbl->list_heads[radix_16].count - carry->base_counts[radix_16];
+        }
+        else {
+            carry->counts[radix_16] = 0;
+        }
+    }
+    for (size_t i = from; i < block_size; ++i) {
+        U32 const link = GetInitialMatchLink(i);
+        carry->links[i - from] = (link != RADIX_NULL_LINK && link >= from) ? link - (U32)from : RADIX_NULL_LINK;
+    }
+    carry->length = block_size - from;
+    carry->overlap = end - from;
+}
+
 size_t
 #ifdef RMF_BITPACK
 RMF_bitpackInit
@@ -124,44 +211,178 @@ RMF_structuredInit
     }
 #endif
 
-    SetNull(0);
-
     const BYTE* const data_block = (const BYTE*)data;
-    size_t st_index = 0;
-    /* Initial 2-byte radix value */
-    size_t radix_16 = ((size_t)data_block[0] << 8) | data_block[1];
-    tbl->stack[st_index++] = (U32)radix_16;
-    tbl->list_heads[radix_16].head = 0;
-    tbl->list_heads[radix_16].count = 1;
-
-    radix_16 = ((size_t)((BYTE)radix_16) << 8) | data_block[2];
+    size_t st_index = RMF_relocateCarry(tbl);
 
     ptrdiff_t rpt_total = 0;
-    ptrdiff_t i = 1;
+    ptrdiff_t i = tbl->carry_start;
     ptrdiff_t const block_size = end - 2;
-    for (; i < block_size; ++i) {
-        /* Pre-load the next value for speed increase on some hardware. Execution can continue while memory read is pending */
-        size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
+    ptrdiff_t const carry_from = RMF_carrySaveFrom(tbl, end);
+    while (i < block_size) {
+        if (carry_from != 0 && i == carry_from) {
+            memset(tbl->carry->base_counts, 0, sizeof(tbl->carry->base_counts));
+            RMF_addCarryBaseCounts(tbl);
+        }
+        /* Positions in incompressible segments are left out of the lists */
+        ptrdiff_t const skip_end = RMF_skipRunEnd(tbl, i, block_size);
+        for (; i < skip_end; ++i)
+            SetNull(i);
 
-        U32 const prev = tbl->list_heads[radix_16].head;
-        if (prev != RADIX_NULL_LINK) {
-            /* Link this position to the previous occurrence */
-            InitMatchLink(i, prev);
-            /* Set the previous to this position */
-            tbl->list_heads[radix_16].head = (U32)i;
-            ++tbl->list_heads[radix_16].count;
-            radix_16 = next_radix;
+        ptrdiff_t run_end = RMF_nextSkipStart(tbl, i, block_size);
+        /* Stop at the retained part to take the counts */
+        if (i < carry_from && carry_from < run_end)
+            run_end = carry_from;
+        /* Initial 2-byte radix value */
+        size_t radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+        for (; i < run_end; ++i) {
+            /* Pre-load the next value for speed increase on some hardware. Execution can continue while memory read is pending */
+            size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
+
+            U32 const prev = tbl->list_heads[radix_16].head;
+            if (prev != RADIX_NULL_LINK) {
+                /* Link this position to the previous occurrence */
+                InitMatchLink(i, prev);
+                /* Set the previous to this position */
+                tbl->list_heads[radix_16].head = (U32)i;
+                ++tbl->list_heads[radix_16].count;
+                radix_16 = next_radix;
+            }
+            else {
+                SetNull(i);
+                tbl->list_heads[radix_16].head = (U32)i;
+                tbl->list_heads[radix_16].count = 1;
+                tbl->stack[st_index++] = (U32)radix_16;
+                radix_16 = next_radix;
+            }
         }
-        else {
+    }
+    /* Handle the last value */
+    size_t const radix_16 = ((size_t)data_block[block_size] << 8) | data_block[block_size + 1];
+    if (RMF_skipRunEnd(tbl, block_size, end) == (size_t)block_size
+        && tbl->list_heads[radix_16].head != RADIX_NULL_LINK)
+        SetMatchLinkAndLength(block_size, tbl->list_heads[radix_16].head, 2);
+    else
+        SetNull(block_size);
+
+    /* Never a match at the last byte */
+    SetNull(end - 1);
+
+    tbl->end_index = (U32)st_index;
+
+    if (carry_from != 0)
+        RMF_saveCarry(tbl, end, carry_from);
+
+    return rpt_total;
+}
+
+/* Build the 2-byte chains for one segment of the block using the thread's builder.
+ * The segment's head and count for each radix value are left in tails_16, and the first
+ * occurrences are saved on the builder stack in order as { position, radix } pairs.
+ * Links into preceding segments are filled in by the merge.
+ */
+void
+#ifdef RMF_BITPACK
+RMF_bitpackInitSegment
+#else
+RMF_structuredInitSegment
+#endif
+(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const job, size_t const seg_count)
+{
+    RMF_builder* const builder = tbl->builders[job];
+    const BYTE* const data_block = (const BYTE*)data;
+    ptrdiff_t const block_size = end - 2;
+    /* Positions relocated from the carry are not scanned */
+    ptrdiff_t const base = tbl->carry_start;
+    ptrdiff_t const seg_size = (block_size - base) / seg_count;
+    ptrdiff_t i = base + seg_size * job;
+    ptrdiff_t const seg_end = (job + 1 == seg_count) ? block_size : i + seg_size;
+    ptrdiff_t const carry_from = RMF_carrySaveFrom(tbl, end);
+    size_t st_index = 0;
+
+    if (job == 0)
+        tbl->carry_lists = RMF_relocateCarry(tbl);
+
+    while (i < seg_end) {
+        if (carry_from != 0 && i == carry_from) {
+            /* The counts in preceding segments are added by the merge */
+            U32* const base_counts = tbl->carry->base_counts;
+            for (size_t radix_16 = 0; radix_16 < RADIX16_TABLE_SIZE; ++radix_16)
+                base_counts[radix_16] = (builder->tails_16[radix_16].prev_index != RADIX_NULL_LINK)
+                    ? builder->tails_16[radix_16].list_count : 0;
+            tbl->carry_seg = job;
+        }
+        ptrdiff_t const skip_end = RMF_skipRunEnd(tbl, i, seg_end);
+        for (; i < skip_end; ++i)
             SetNull(i);
-            tbl->list_heads[radix_16].head = (U32)i;
-            tbl->list_heads[radix_16].count = 1;
-            tbl->stack[st_index++] = (U32)radix_16;
+
+        ptrdiff_t run_end = RMF_nextSkipStart(tbl, i, seg_end);
+        if (i < carry_from && carry_from < run_end)
+            run_end = carry_from;
+        size_t radix_16 = ((size_t)data_block[i] << 8) | data_block[i + 1];
+        for (; i < run_end; ++i) {
+            size_t const next_radix = ((size_t)((BYTE)radix_16) << 8) | data_block[i + 2];
+
+            U32 const prev = builder->tails_16[radix_16].prev_index;
+            builder->tails_16[radix_16].prev_index = (U32)i;
+            if (prev != RADIX_NULL_LINK) {
+                InitMatchLink(i, prev);
+                ++builder->tails_16[radix_16].list_count;
+            }
+            else {
+                builder->tails_16[radix_16].list_count = 1;
+                builder->stack[st_index].head = (U32)i;
+                builder->stack[st_index].count = (U32)radix_16;
+                ++st_index;
+            }
             radix_16 = next_radix;
         }
     }
+    /* Terminate the list of first occurrences */
+    builder->stack[st_index].count = RADIX_NULL_LINK;
+}
+
+/* Join the segment chains in order, resulting in a table identical to that from a single-threaded init.
+ * The first occurrence in each segment links to the last occurrence in the preceding segments, and
+ * radix values not seen before are added to the stack in the order found.
+ */
+size_t
+#ifdef RMF_BITPACK
+RMF_bitpackMergeSegments
+#else
+RMF_structuredMergeSegments
+#endif
+(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const seg_count)
+{
+    const BYTE* const data_block = (const BYTE*)data;
+    size_t st_index = tbl->carry_lists;
+
+    for (size_t job = 0; job < seg_count; ++job) {
+        RMF_builder* const builder = tbl->builders[job];
+        if (job == tbl->carry_seg)
+            RMF_addCarryBaseCounts(tbl);
+        for (const RMF_tableHead* first = builder->stack; first->count != RADIX_NULL_LINK; ++first) {
+            size_t const radix_16 = first->count;
+            RMF_listTail* const tail = builder->tails_16 + radix_16;
+            U32 const prev = tbl->list_heads[radix_16].head;
+            if (prev != RADIX_NULL_LINK) {
+                InitMatchLink(first->head, prev);
+                tbl->list_heads[radix_16].count += tail->list_count;
+            }
+            else {
+                SetNull(first->head);
+                tbl->list_heads[radix_16].count = tail->list_count;
+                tbl->stack[st_index++] = (U32)radix_16;
+            }
+            tbl->list_heads[radix_16].head = tail->prev_index;
+            /* Restore the tail table for use by the builder */
+            tail->prev_index = RADIX_NULL_LINK;
+        }
+    }
     /* Handle the last value */
-    if (tbl->list_heads[radix_16].head != RADIX_NULL_LINK)
+    size_t const block_size = end - 2;
+    size_t const radix_16 = ((size_t)data_block[block_size] << 8) | data_block[block_size + 1];
+    if (RMF_skipRunEnd(tbl, block_size, end) == block_size
+        && tbl->list_heads[radix_16].head != RADIX_NULL_LINK)
         SetMatchLinkAndLength(block_size, tbl->list_heads[radix_16].head, 2);
     else
         SetNull(block_size);
@@ -171,7 +392,10 @@ RMF_structuredInit
 
     tbl->end_index = (U32)st_index;
 
-    return rpt_total;
+    if (tbl->carry_seg != (size_t)-1)
+        RMF_saveCarry(tbl, end, RMF_carrySaveFrom(tbl, end));
+
+    return 0;
 }
 
 /* Copy the list into a buffer and recurse it there. This decreases cache misses and allows */
@@ -459,10 +683,7 @@ static void RMF_bruteForce(RMF_builder* const tbl,
         size_t longest_index = j;
         const BYTE* const data = data_src + buffer[i];
         do {
-            const BYTE* data_2 = data_src + buffer[j];
-            size_t len_test = 0;
-            while (data[len_test] == data_2[len_test] && len_test < limit)
-                ++len_test;
+            size_t const len_test = ZSTD_count(data, data_src + buffer[j], data + limit);
 
             if (len_test > longest) {
                 longest_index = j;
@@ -480,17 +701,16 @@ static void RMF_bruteForce(RMF_builder* const tbl,
     } while (i < list_count - 1 && buffer[i] >= block_start);
 }
 
-/* RMF_recurseLists16() : 
- * Match strings at depth 2 using a 16-bit radix to lengthen to depth 4
+/* RMF_splitLists16() :
+ * Match strings at depth 2 using a 16-bit radix to lengthen to depth 4, dividing the list into sub-lists.
+ * The sub-lists are saved in `lists` as { head, count } and the number of them is returned.
  */
-static void RMF_recurseLists16(RMF_builder* const tbl,
+static size_t RMF_splitLists16(RMF_builder* const tbl,
     const BYTE* const data_block,
-    size_t const block_start,
     size_t link,
     U32 count,
-    U32 const max_depth)
+    RMF_tableHead* const lists)
 {
-    U32 const table_max_depth = MIN(max_depth, RADIX_MAX_LENGTH);
     /* Offset data pointer. This function is only called at depth 2 */
     const BYTE* const data_src = data_block + 2;
     /* Load radix values from the data chars */
@@ -533,9 +753,9 @@ static void RMF_recurseLists16(RMF_builder* const tbl,
         }
         else {
             tbl->tails_16[radix_16].list_count = 1;
-            tbl->stack[st_index].head = (U32)link;
+            lists[st_index].head = (U32)link;
             /* Store a reference to this table location to retrieve the count at the end */
-            tbl->stack[st_index].count = (U32)radix_16;
+            lists[st_index].count = (U32)radix_16;
             ++st_index;
         }
         link = next_link;
@@ -556,47 +776,72 @@ static void RMF_recurseLists16(RMF_builder* const tbl,
         tbl->tails_8[reset_list[i]].prev_index = RADIX_NULL_LINK;
 
     for (size_t i = 0; i < st_index; ++i) {
-        tbl->tails_16[tbl->stack[i].count].prev_index = RADIX_NULL_LINK;
-        tbl->stack[i].count = tbl->tails_16[tbl->stack[i].count].list_count;
+        tbl->tails_16[lists[i].count].prev_index = RADIX_NULL_LINK;
+        lists[i].count = tbl->tails_16[lists[i].count].list_count;
     }
 
+    return st_index;
+}
+
+/* Recurse one sub-list produced by RMF_splitLists16() */
+static void RMF_recurseSubList16(RMF_builder* const tbl,
+    const BYTE* const data_block,
+    size_t const block_start,
+    RMF_tableHead const list,
+    U32 const max_depth,
+    size_t const stack_base)
+{
+    if (list.count < 2) {
+        /* Nothing to do */
+        return;
+    }
+    if (list.head < block_start)
+        return;
+
+    /* The current depth */
+    U32 const depth = GetMatchLength(list.head);
+    if (list.count <= MAX_BRUTE_FORCE_LIST_SIZE) {
+        /* Quicker to use brute force, each string compared with all previous strings */
+        RMF_bruteForce(tbl, data_block,
+            block_start,
+            list.head,
+            list.count,
+            depth,
+            MIN(max_depth, RADIX_MAX_LENGTH));
+        return;
+    }
+    /* Send to the buffer at depth 4 */
+    RMF_recurseListsBuffered(tbl,
+        data_block,
+        block_start,
+        list.head,
+        (BYTE)depth,
+        (BYTE)max_depth,
+        list.count,
+        stack_base);
+}
+
+/* RMF_recurseLists16() : 
+ * Match strings at depth 2 using a 16-bit radix to lengthen to depth 4
+ */
+static void RMF_recurseLists16(RMF_builder* const tbl,
+    const BYTE* const data_block,
+    size_t const block_start,
+    size_t const link,
+    U32 const count,
+    U32 const max_depth)
+{
+    size_t st_index = RMF_splitLists16(tbl, data_block, link, count, tbl->stack);
+
     while (st_index > 0) {
         --st_index;
-        U32 const list_count = tbl->stack[st_index].count;
-        if (list_count < 2) {
-            /* Nothing to do */
-            continue;
-        }
-        link = tbl->stack[st_index].head;
-        if (link < block_start)
-            continue;
         if (st_index > STACK_SIZE - RADIX16_TABLE_SIZE
-            && st_index > STACK_SIZE - list_count)
+            && st_index > STACK_SIZE - tbl->stack[st_index].count)
         {
             /* Potential stack overflow. Rare. */
             continue;
         }
-        /* The current depth */
-        U32 const depth = GetMatchLength(link);
-        if (list_count <= MAX_BRUTE_FORCE_LIST_SIZE) {
-            /* Quicker to use brute force, each string compared with all previous strings */
-            RMF_bruteForce(tbl, data_block,
-                block_start,
-                link,
-                list_count,
-                depth,
-                table_max_depth);
-            continue;
-        }
-        /* Send to the buffer at depth 4 */
-        RMF_recurseListsBuffered(tbl,
-            data_block,
-            block_start,
-            link,
-            (BYTE)depth,
-            (BYTE)max_depth,
-            list_count,
-            st_index);
+        RMF_recurseSubList16(tbl, data_block, block_start, tbl->stack[st_index], max_depth, st_index);
     }
 }
 
@@ -900,7 +1145,7 @@ static void RMF_recurseListsReference(RMF_builder* const tbl,
 /* Atomically take a list from the head table */
 static ptrdiff_t RMF_getNextList_mt(FL2_matchTable* const tbl)
 {
-    if (tbl->st_index < tbl->end_index) {
+    if (FL2_atomic_load(tbl->st_index) < tbl->end_index) {
         long index = FL2_atomic_increment(tbl->st_index);
         if (index < tbl->end_index)
             return index;
@@ -919,6 +1164,101 @@ static ptrdiff_t RMF_getNextList_st(FL2_matchTable* const tbl)
     return -1;
 }
 
+/* Claim a sub-list of owner. The claim is a compare-and-swap so the index never passes the
+ * number published, which lets the owner store another split once all are copied out.
+ * Returns 0 if none are waiting. */
+static int RMF_takeSplitList(RMF_builder* const owner, RMF_tableHead* const list)
+{
+    for (;;) {
+        long const index = FL2_atomic_load(owner->split_index);
+        if (index >= FL2_atomic_load(owner->split_count))
+            return 0;
+        if (FL2_atomic_compareExchange(owner->split_index, index, index + 1)) {
+            /* split_base can't change until split_taken is incremented */
+            *list = owner->split_lists[index - owner->split_base];
+            FL2_atomic_increment(owner->split_taken);
+            return 1;
+        }
+    }
+}
+
+/* Returns 1 if any builder has a sub-list which is not yet claimed */
+static int RMF_splitListWaiting(const FL2_matchTable* const tbl)
+{
+    for (unsigned i = 0; i < tbl->thread_count; ++i)
+        if (FL2_atomic_load(tbl->builders[i]->split_index) < FL2_atomic_load(tbl->builders[i]->split_count))
+            return 1;
+    return 0;
+}
+
+/* Take a sub-list from any builder which has split a long list, and recurse it.
+ * Returns 0 if none are waiting. */
+static int RMF_recurseSplitList(FL2_matchTable* const tbl,
+    RMF_builder* const builder,
+    FL2_dataBlock const block,
+    U32 const max_depth)
+{
+    for (unsigned i = 0; i < tbl->thread_count; ++i) {
+        RMF_tableHead list;
+        if (RMF_takeSplitList(tbl->builders[i], &list)) {
+            RMF_recurseSubList16(builder, block.data, block.start, list, max_depth, 0);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Divide a long list by the next 2 bytes and publish the sub-lists for any thread to take.
+ * The sub-lists of a previous split are finished first, since they share the storage. */
+static void RMF_splitList(FL2_matchTable* const tbl,
+    RMF_builder* const builder,
+    FL2_dataBlock const block,
+    RMF_tableHead const list_head,
+    U32 const max_depth)
+{
+    RMF_tableHead list;
+    while (RMF_takeSplitList(builder, &list))
+        RMF_recurseSubList16(builder, block.data, block.start, list, max_depth, 0);
+    /* Wait for other threads to copy out the last ones they claimed, which takes a few instructions */
+    while (FL2_atomic_load(builder->split_taken) != builder->split_count)
+        FL2_pause();
+    builder->split_base = builder->split_count;
+    long const split_count = (long)RMF_splitLists16(builder, block.data, list_head.head, list_head.count, builder->split_lists);
+    FL2_atomic_add(builder->split_count, split_count);
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    FL2_pthread_cond_broadcast(&tbl->split_cond);
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+}
+
+/* Help with the sub-lists of long lists after the head table is empty. While any thread is still
+ * taking lists from the head table it may split another one, so wait on split_cond for it rather
+ * than leave it to finish alone. A thread which starts after the others have left still does its share. */
+static void RMF_helpSplitLists(FL2_matchTable* const tbl,
+    RMF_builder* const builder,
+    FL2_dataBlock const block,
+    U32 const max_depth)
+{
+    FL2_pthread_mutex_lock(&tbl->split_mutex);
+    FL2_atomic_add(tbl->builders_active, -1);
+    if (FL2_atomic_load(tbl->builders_active) == 0)
+        FL2_pthread_cond_broadcast(&tbl->split_cond);
+    FL2_pthread_mutex_unlock(&tbl->split_mutex);
+
+    for (;;) {
+        if (RMF_recurseSplitList(tbl, builder, block, max_depth))
+            continue;
+        FL2_pthread_mutex_lock(&tbl->split_mutex);
+        while (!RMF_splitListWaiting(tbl)
+            && FL2_atomic_load(tbl->builders_active) != 0
+            && FL2_atomic_load(tbl->st_index) < RADIX_CANCEL_INDEX)
+            FL2_pthread_cond_wait(&tbl->split_cond, &tbl->split_mutex);
+        int const done = !RMF_splitListWaiting(tbl) || FL2_atomic_load(tbl->st_index) >= RADIX_CANCEL_INDEX;
+        FL2_pthread_mutex_unlock(&tbl->split_mutex);
+        if (done)
+            return;
+    }
+}
+
 /* Iterate the head table concurrently with other threads, and recurse each list until max_depth is reached */
 void
 #ifdef RMF_BITPACK
@@ -941,6 +1281,12 @@ RMF_structuredBuildTable
     ptrdiff_t next_progress = (job == 0) ? 0 : RADIX16_TABLE_SIZE;
     ptrdiff_t(*getNextList)(FL2_matchTable* const tbl)
         = multi_thread ? RMF_getNextList_mt : RMF_getNextList_st;
+    RMF_builder* const builder = tbl->builders[job];
+    /* Lists this long are divided so other threads can share the work */
+    size_t const split_min = multi_thread ? MAX(RADIX_SPLIT_LIST_MIN, block.end / ((size_t)tbl->thread_count << 2)) : (size_t)-1;
+
+    if (multi_thread)
+        FL2_atomic_increment(tbl->builders_active);
 
     for (;;)
     {
@@ -963,24 +1309,29 @@ RMF_structuredBuildTable
 
 #ifdef RMF_REFERENCE
         if (tbl->params.use_ref_mf) {
-            RMF_recurseListsReference(tbl->builders[job], block.data, block.end, list_head.head, list_head.count, max_depth);
+            RMF_recurseListsReference(builder, block.data, block.end, list_head.head, list_head.count, max_depth);
             continue;
         }
 #endif
         if (list_head.head >= bounded_start) {
-            RMF_recurseListsBound(tbl->builders[job], block.data, block.end, &list_head, max_depth);
+            RMF_recurseListsBound(builder, block.data, block.end, &list_head, max_depth);
             if (list_head.count < 2 || list_head.head < block.start)
                 continue;
         }
-        if (best && list_head.count > tbl->builders[job]->match_buffer_limit)
+        if (best && list_head.count > builder->match_buffer_limit)
         {
-            /* Not worth buffering or too long */
-            RMF_recurseLists16(tbl->builders[job], block.data, block.start, list_head.head, list_head.count, max_depth);
+            /* Not worth buffering or too long. Lists which would hold up one thread are shared. */
+            if (list_head.count >= split_min)
+                RMF_splitList(tbl, builder, block, list_head, max_depth);
+            else
+                RMF_recurseLists16(builder, block.data, block.start, list_head.head, list_head.count, max_depth);
         }
         else {
-            RMF_recurseListsBuffered(tbl->builders[job], block.data, block.start, list_head.head, 2, (BYTE)max_depth, list_head.count, 0);
+            RMF_recurseListsBuffered(builder, block.data, block.start, list_head.head, 2, (BYTE)max_depth, list_head.count, 0);
         }
     }
+    if (multi_thread)
+        RMF_helpSplitLists(tbl, builder, block, max_depth);
 }
 
 int
@@ -1005,10 +1356,8 @@ RMF_structuredIntegrityCheck
         U32 const length = GetMatchLength(index);
         if (index && length < RADIX_MAX_LENGTH && link - 1 == GetMatchLink(index - 1) && length + 1 == GetMatchLength(index - 1))
             continue;
-        U32 len_test = 0;
         U32 const limit = MIN((U32)(end - index), RADIX_MAX_LENGTH);
-        for (; len_test < limit && data[link + len_test] == data[index + len_test]; ++len_test) {
-        }
+        U32 const len_test = (U32)ZSTD_count(data + index, data + link, data + index + limit);
         if (len_test < length) {
             printf("Failed integrity check: pos %X, length %u, actual %u\r\n", (U32)index, length, len_test);
             err = 1;
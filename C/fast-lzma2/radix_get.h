@@ -42,8 +42,8 @@ static size_t RMF_bitpackExtendMatch(const BYTE* const data,
         return limit - start_index;
     }
 
-    while (end_index < limit && data[end_index - dist] == data[end_index])
-        ++end_index;
+    if (end_index < limit)
+        end_index += ZSTD_count(data + end_index, data + end_index - dist, data + limit);
 
     DEBUGLOG(7, "RMF_bitpackExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
     return end_index - start_index;
@@ -74,8 +74,8 @@ static size_t RMF_structuredExtendMatch(const BYTE* const data,
         return limit - start_index;
     }
 
-    while (end_index < limit && data[end_index - dist] == data[end_index])
-        ++end_index;
+    if (end_index < limit)
+        end_index += ZSTD_count(data + end_index, data + end_index - dist, data + limit);
 
     DEBUGLOG(7, "RMF_structuredExtendMatch : pos %u, link %u, init length %u, full length %u", (U32)start_index, link, (U32)length, (U32)(end_index - start_index));
     return end_index - start_index;
@@ -12,6 +12,7 @@
 #define RADIX_INTERNAL_H
 
 #include "atomic.h"
+#include "fl2_threading.h"
 #include "radix_mf.h"
 
 #if defined(FL2_XZ_BUILD) && defined(TUKLIB_FAST_UNALIGNED_ACCESS)
@@ -33,10 +34,16 @@ extern "C" {
 #define RADIX8_TABLE_SIZE ((size_t)1 << 8)
 #define STACK_SIZE (RADIX16_TABLE_SIZE * 3)
 #define MAX_BRUTE_FORCE_LIST_SIZE 5
+#define INIT_MIN_BYTES_PER_THREAD ((size_t)1 << 20)
+#define RADIX_SPLIT_LIST_MIN ((size_t)1 << 16)
 #define BUFFER_LINK_MASK 0xFFFFFFU
 #define MATCH_BUFFER_OVERLAP 6
 #define BITPACK_MAX_LENGTH 63U
 #define STRUCTURED_MAX_LENGTH 255U
+#define RMF_SKIP_SEGMENT_LOG 16U
+#define RMF_SKIP_SEGMENT_SIZE ((size_t)1 << RMF_SKIP_SEGMENT_LOG)
+
+#define RMF_CARRY_ALIGNMENT 16U /* matches the alignment of the overlap in the dictionary buffer */
 
 #define RADIX_LINK_BITS 26
 #define RADIX_LINK_MASK ((1U << RADIX_LINK_BITS) - 1)
@@ -86,13 +93,38 @@ typedef struct
     RMF_listTail tails_8[RADIX8_TABLE_SIZE];
     RMF_tableHead stack[STACK_SIZE];
     RMF_listTail tails_16[RADIX16_TABLE_SIZE];
+    /* Sub-lists of a long list, for any thread to take. The counters only increase during
+     * a build, and split_lists holds those from split_base to split_count. */
+    FL2_atomic split_index; /* number claimed */
+    FL2_atomic split_taken; /* number copied out by the thread which claimed it */
+    FL2_atomic split_count; /* number published */
+    long split_base;
+    RMF_tableHead split_lists[RADIX16_TABLE_SIZE];
     RMF_buildMatch match_buffer[1];
 } RMF_builder;
 
+/* Initial chain links of the part of a block which becomes the next block's overlap, relocated
+ * to their positions in the next block, and the heads and counts of the chains they form */
+struct RMF_carry_s
+{
+    size_t capacity;    /* max links */
+    size_t length;      /* links held, for positions [0, length) of the next block */
+    size_t overlap;     /* the next block's start, or 0 if nothing is held */
+    U32 counts[RADIX16_TABLE_SIZE];
+    U32 heads[RADIX16_TABLE_SIZE];
+    U32 base_counts[RADIX16_TABLE_SIZE]; /* counts before the retained part, taken during init */
+    U32 links[1];
+};
+
 struct FL2_matchTable_s
 {
     FL2_atomic st_index;
     long end_index;
+    FL2_atomic builders_active; /* threads still taking lists from the head table */
+    /* Threads which are done with the head table wait here for sub-lists. Broadcast when a list
+     * is split, when builders_active reaches 0, and on cancel. */
+    FL2_pthread_mutex_t split_mutex;
+    FL2_pthread_cond_t split_cond;
     int is_struct;
     int alloc_struct;
     unsigned thread_count;
@@ -100,6 +132,14 @@ struct FL2_matchTable_s
     size_t progress;
     RMF_parameters params;
     RMF_builder** builders;
+    BYTE* skip_map;     /* one byte per segment of RMF_SKIP_SEGMENT_SIZE from skip_base : nonzero if incompressible */
+    size_t skip_base;
+    size_t skip_count;  /* number of segments flagged */
+    RMF_carry* carry;   /* set by RMF_setCarry() for the next init */
+    size_t carry_start; /* positions below this are relocated from carry instead of being scanned */
+    size_t carry_from;  /* links from here are saved to carry, or 0 */
+    size_t carry_lists; /* number of lists relocated from carry */
+    size_t carry_seg;   /* init segment in which carry_from occurs */
     U32 stack[RADIX16_TABLE_SIZE];
     RMF_tableHead list_heads[RADIX16_TABLE_SIZE];
     U32 table[1];
@@ -107,6 +147,10 @@ struct FL2_matchTable_s
 
 size_t RMF_bitpackInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const end);
 size_t RMF_structuredInit(struct FL2_matchTable_s* const tbl, const void* data, size_t const end);
+void RMF_bitpackInitSegment(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end, size_t const job, size_t const seg_count);
+void RMF_structuredInitSegment(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end, size_t const job, size_t const seg_count);
+size_t RMF_bitpackMergeSegments(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end, size_t const seg_count);
+size_t RMF_structuredMergeSegments(struct FL2_matchTable_s* const tbl, const void* const data, size_t const end, size_t const seg_count);
 void RMF_bitpackBuildTable(struct FL2_matchTable_s* const tbl,
 	size_t const job,
     unsigned const multi_thread,
@@ -122,6 +166,7 @@ void RMF_recurseListChunk(RMF_builder* const tbl,
     U32 const max_depth,
     U32 const list_count,
     size_t const stack_base);
+size_t RMF_carrySaveFrom(const struct FL2_matchTable_s* const tbl, size_t const end);
 int RMF_bitpackIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t index, size_t const end, unsigned max_depth);
 int RMF_structuredIntegrityCheck(const struct FL2_matchTable_s* const tbl, const BYTE* const data, size_t index, size_t const end, unsigned max_depth);
 void RMF_bitpackLimitLengths(struct FL2_matchTable_s* const tbl, size_t const index);
@@ -10,11 +10,14 @@
 
 #include <stddef.h>     /* size_t, ptrdiff_t */
 #include <stdlib.h>     /* malloc, free */
+#include <string.h>     /* memset */
 #include "fast-lzma2.h"
 #include "fl2_errors.h"
 #include "mem.h"          /* U32, U64, MEM_64bits */
 #include "fl2_internal.h"
 #include "radix_internal.h"
+#include "count.h"
+#include "util.h"           /* UTIL_allocLarge, UTIL_freeLarge */
 
 #ifdef __GNUC__
 #  pragma GCC diagnostic ignored "-Wmaybe-uninitialized" /* warning: 'rpt_head_next' may be used uninitialized in this function */
@@ -27,6 +30,14 @@
 #define MATCH_BUFFER_ELBOW (1UL << MATCH_BUFFER_ELBOW_BITS)
 #define MIN_MATCH_BUFFER_SIZE 256U /* min buffer size at least FL2_SEARCH_DEPTH_MAX + 2 for bounded build */
 #define MAX_MATCH_BUFFER_SIZE (1UL << 24) /* max buffer size constrained by 24-bit link values */
+#define SKIP_SEGMENT_MIN (RMF_SKIP_SEGMENT_SIZE / 16U) /* shorter segments at the block end are never skipped */
+#define SKIP_MAX_DEVIATION 20U /* character count deviation limit, as used by the encoder's ultra strategy */
+#define SKIP_ANCHOR_BITS 6U /* duplicate check samples one position in 64 on average */
+#define SKIP_ANCHOR_TABLE_LOG_MIN 12U
+#define SKIP_ANCHOR_TABLE_LOG_MAX 18U
+#define SKIP_REPEAT_TABLE_LOG 12U
+#define SKIP_PAIR_TABLE_LOG 12U
+#define SKIP_PAIR_MAX_DISTANCE 4U /* byte pairs up to this far apart are tested for order-1 redundancy */
 
 static void RMF_initTailTable(RMF_builder* const tbl)
 {
@@ -53,6 +64,10 @@ static RMF_builder* RMF_createBuilder(size_t match_buffer_size)
 
     builder->match_buffer_size = match_buffer_size;
     builder->match_buffer_limit = match_buffer_size;
+    builder->split_index = 0;
+    builder->split_taken = 0;
+    builder->split_count = 0;
+    builder->split_base = 0;
 
     RMF_initTailTable(builder);
 
@@ -200,6 +215,17 @@ static void RMF_initListHeads(FL2_matchTable* const tbl)
     }
 }
 
+static void RMF_initSplitLists(FL2_matchTable* const tbl)
+{
+    for (unsigned i = 0; i < tbl->thread_count; ++i) {
+        tbl->builders[i]->split_index = 0;
+        tbl->builders[i]->split_taken = 0;
+        tbl->builders[i]->split_count = 0;
+        tbl->builders[i]->split_base = 0;
+    }
+    tbl->builders_active = 0;
+}
+
 /* RMF_createMatchTable() :
  * Create a match table. Reduce the dict size to input size if possible.
  * A thread_count of 0 will be raised to 1.
@@ -217,10 +243,35 @@ FL2_matchTable* RMF_createMatchTable(const RMF_parameters* const p, size_t const
 
     size_t const table_bytes = is_struct ? ((dictionary_size + 3U) / 4U) * sizeof(RMF_unit)
         : dictionary_size * sizeof(U32);
-    FL2_matchTable* const tbl = malloc(sizeof(FL2_matchTable) + table_bytes - sizeof(U32));
+    FL2_matchTable* const tbl = UTIL_allocLarge(sizeof(FL2_matchTable) + table_bytes - sizeof(U32), params.large_pages);
     if (tbl == NULL)
         return NULL;
 
+    /* One extra entry terminates a run of skipped segments which ends at the last segment */
+    tbl->skip_map = calloc((dictionary_size >> RMF_SKIP_SEGMENT_LOG) + 2, 1);
+    if (tbl->skip_map == NULL) {
+        UTIL_freeLarge(tbl);
+        return NULL;
+    }
+    if (FL2_pthread_mutex_init(&tbl->split_mutex, NULL)) {
+        free(tbl->skip_map);
+        UTIL_freeLarge(tbl);
+        return NULL;
+    }
+    if (FL2_pthread_cond_init(&tbl->split_cond, NULL)) {
+        FL2_pthread_mutex_destroy(&tbl->split_mutex);
+        free(tbl->skip_map);
+        UTIL_freeLarge(tbl);
+        return NULL;
+    }
+    tbl->skip_base = 0;
+    tbl->skip_count = 0;
+    tbl->carry = NULL;
+    tbl->carry_start = 0;
+    tbl->carry_from = 0;
+    tbl->carry_lists = 0;
+    tbl->carry_seg = (size_t)-1;
+
     tbl->is_struct = is_struct;
     tbl->alloc_struct = is_struct;
     tbl->thread_count = thread_count + !thread_count;
@@ -245,13 +296,18 @@ void RMF_freeMatchTable(FL2_matchTable* const tbl)
     DEBUGLOG(3, "RMF_freeMatchTable");
 
     RMF_freeBuilderTable(tbl->builders, tbl->thread_count);
-    free(tbl);
+    FL2_pthread_cond_destroy(&tbl->split_cond);
+    FL2_pthread_mutex_destroy(&tbl->split_mutex);
+    free(tbl->skip_map);
+    UTIL_freeLarge(tbl);
 }
 
 BYTE RMF_compatibleParameters(const FL2_matchTable* const tbl, const RMF_parameters * const p, size_t const dict_reduce)
 {
     RMF_parameters params = RMF_clampParams(*p);
     RMF_reduceDict(&params, dict_reduce);
+    if (tbl->params.large_pages != params.large_pages)
+        return 0;
     return tbl->params.dictionary_size > params.dictionary_size
         || (tbl->params.dictionary_size == params.dictionary_size && tbl->alloc_struct >= RMF_isStruct(params.dictionary_size));
 }
@@ -274,16 +330,280 @@ void RMF_initProgress(FL2_matchTable * const tbl)
         tbl->progress = 0;
 }
 
+/* RMF_isSegmentIncompressible() :
+ * Test the character counts of data[start, end) for the flat distribution of
+ * compressed or encrypted data. The measure is the same as the encoder's chunk test.
+ */
+static int RMF_isSegmentIncompressible(const BYTE* const data, size_t const start, size_t const end)
+{
+    U32 char_count[4][256];
+    U64 char_total = 0;
+    size_t const size = end - start;
+    /* Expected normal character count * 4 */
+    U32 const avg = (U32)(size / 64U);
+    size_t index = start;
+
+    /* Count into four tables to avoid stalls on repeated characters */
+    memset(char_count, 0, sizeof(char_count));
+    for (; index + 4 <= end; index += 4) {
+        char_count[0][data[index]] += 4;
+        char_count[1][data[index + 1]] += 4;
+        char_count[2][data[index + 2]] += 4;
+        char_count[3][data[index + 3]] += 4;
+    }
+    for (; index < end; ++index)
+        char_count[0][data[index]] += 4;
+    /* Sum the deviations */
+    for (size_t i = 0; i < 256; ++i) {
+        U32 const count = char_count[0][i] + char_count[1][i] + char_count[2][i] + char_count[3][i];
+        S64 const delta = (S64)count - avg;
+        char_total += (U64)(delta * delta);
+    }
+    /* Equivalent to sqrt(char_total) / sqrt(size) <= SKIP_MAX_DEVIATION */
+    return char_total <= (U64)SKIP_MAX_DEVIATION * SKIP_MAX_DEVIATION * size;
+}
+
+/* RMF_hasRepeats() :
+ * Search a segment for any 8-byte string occurring twice at a short distance. Data with a flat
+ * character distribution can still be compressible if it is periodic, e.g. a sequence of counters.
+ */
+static int RMF_hasRepeats(const BYTE* const data, size_t const start, size_t const end)
+{
+    U32 table[1U << SKIP_REPEAT_TABLE_LOG];
+
+    memset(table, 0xFF, sizeof(table));
+    for (size_t index = start; index + 8 <= end; ++index) {
+        U64 const value = MEM_read64(data + index);
+        size_t const slot = (size_t)((value * 0x9E3779B185EBCA87ULL) >> (64 - SKIP_REPEAT_TABLE_LOG));
+        U32 const prev = table[slot];
+        table[slot] = (U32)index;
+        if (prev != RADIX_NULL_LINK && MEM_read64(data + prev) == value)
+            return 1;
+    }
+    return 0;
+}
+
+/* RMF_hasPairStructure() :
+ * Test the counts of byte pairs data[i], data[i + dist] for dist 1 to SKIP_PAIR_MAX_DISTANCE.
+ * A flat character distribution can hide order-1 redundancy, e.g. random bytes which are each
+ * written twice. For random data the sum of squared deviations of the pair counts from their mean
+ * is close to the number of pairs, so a sum 5/4 of that or more marks the segment compressible.
+ */
+static int RMF_hasPairStructure(const BYTE* const data, size_t const start, size_t const end)
+{
+    U32 pair_count[1U << SKIP_PAIR_TABLE_LOG];
+
+    for (size_t dist = 1; dist <= SKIP_PAIR_MAX_DISTANCE; ++dist) {
+        U64 const pairs = end - start - dist;
+        U64 total = 0;
+
+        memset(pair_count, 0, sizeof(pair_count));
+        for (size_t index = start; index + dist < end; ++index) {
+            U32 const pair = data[index] | ((U32)data[index + dist] << 8);
+            ++pair_count[(pair * 2654435761U) >> (32 - SKIP_PAIR_TABLE_LOG)];
+        }
+        for (size_t i = 0; i < (1U << SKIP_PAIR_TABLE_LOG); ++i)
+            total += (U64)pair_count[i] * pair_count[i];
+        /* total - pairs^2 / table size is the sum of squared deviations */
+        if (((total << SKIP_PAIR_TABLE_LOG) - pairs * pairs) * 4 >= (pairs * 5) << SKIP_PAIR_TABLE_LOG)
+            return 1;
+    }
+    return 0;
+}
+
+/* RMF_unflagDuplicates() :
+ * Random data which occurs more than once is compressible. Sample 8-byte strings at
+ * content-defined positions over the whole buffer, and clear the flags on any segments
+ * containing a repeat. Samples are taken where a hash of 4 bytes has its top bits clear,
+ * so the same positions are chosen in each copy of the data.
+ * Returns 0, or 1 if the table couldn't be allocated.
+ */
+static int RMF_unflagDuplicates(FL2_matchTable* const tbl, const BYTE* const data, size_t const end)
+{
+    size_t table_log = SKIP_ANCHOR_TABLE_LOG_MIN;
+    while (table_log < SKIP_ANCHOR_TABLE_LOG_MAX && ((size_t)1 << (table_log + SKIP_ANCHOR_BITS)) < end)
+        ++table_log;
+
+    U32* const anchors = malloc(sizeof(U32) << table_log);
+    if (anchors == NULL)
+        return 1;
+    memset(anchors, 0xFF, sizeof(U32) << table_log);
+
+    size_t const base = tbl->skip_base;
+    for (size_t index = 0; index + 8 <= end; ++index) {
+        if ((MEM_read32(data + index) * 2654435761U) >> (32 - SKIP_ANCHOR_BITS))
+            continue;
+        U64 const value = MEM_read64(data + index);
+        size_t const slot = (size_t)((value * 0x9E3779B185EBCA87ULL) >> (64 - table_log));
+        U32 const prev = anchors[slot];
+        anchors[slot] = (U32)index;
+        if (prev != RADIX_NULL_LINK && MEM_read64(data + prev) == value) {
+            if (index >= base)
+                tbl->skip_map[(index - base) >> RMF_SKIP_SEGMENT_LOG] = 0;
+            if (prev >= base)
+                tbl->skip_map[(prev - base) >> RMF_SKIP_SEGMENT_LOG] = 0;
+        }
+    }
+    free(anchors);
+    return 0;
+}
+
+/* RMF_scanIncompressible() :
+ * Mark segments of the block which appear to be incompressible. Positions in these segments
+ * are not added to the match table, and the encoder stores them uncompressed.
+ * Must be called before the table is initialized. The whole buffer from offset 0 is searched
+ * for duplicates, but only segments in [block.start, block.end) are flagged.
+ * Returns the number of bytes flagged.
+ */
+size_t RMF_scanIncompressible(FL2_matchTable* const tbl, FL2_dataBlock const block)
+{
+    size_t const seg_count = (block.end - block.start + RMF_SKIP_SEGMENT_SIZE - 1) >> RMF_SKIP_SEGMENT_LOG;
+
+    tbl->skip_base = block.start;
+    tbl->skip_count = 0;
+    memset(tbl->skip_map, 0, seg_count + 1);
+
+    if (!tbl->params.skip_incompressible)
+        return 0;
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf)
+        return 0;
+#endif
+
+    for (size_t seg = 0; seg < seg_count; ++seg) {
+        size_t const start = block.start + (seg << RMF_SKIP_SEGMENT_LOG);
+        size_t const end = MIN(start + RMF_SKIP_SEGMENT_SIZE, block.end);
+        if (end - start >= SKIP_SEGMENT_MIN
+            && RMF_isSegmentIncompressible(block.data, start, end)
+            && !RMF_hasRepeats(block.data, start, end)
+            && !RMF_hasPairStructure(block.data, start, end)) {
+            tbl->skip_map[seg] = 1;
+            ++tbl->skip_count;
+        }
+    }
+    if (tbl->skip_count == 0)
+        return 0;
+
+    if (RMF_unflagDuplicates(tbl, block.data, block.end)) {
+        memset(tbl->skip_map, 0, seg_count);
+        tbl->skip_count = 0;
+        return 0;
+    }
+
+    size_t skipped = 0;
+    tbl->skip_count = 0;
+    for (size_t seg = 0; seg < seg_count; ++seg) {
+        if (tbl->skip_map[seg]) {
+            size_t const start = block.start + (seg << RMF_SKIP_SEGMENT_LOG);
+            skipped += MIN(start + RMF_SKIP_SEGMENT_SIZE, block.end) - start;
+            ++tbl->skip_count;
+        }
+    }
+    DEBUGLOG(5, "RMF_scanIncompressible : %u of %u segments skipped", (U32)tbl->skip_count, (U32)seg_count);
+    return skipped;
+}
+
+/* RMF_skipRunEnd() :
+ * Returns the end of the run of skipped segments containing index, limited to end,
+ * or index if it is not in a skipped segment.
+ */
+size_t RMF_skipRunEnd(const FL2_matchTable* const tbl, size_t const index, size_t const end)
+{
+    if (tbl->skip_count == 0 || index < tbl->skip_base)
+        return index;
+
+    size_t seg = (index - tbl->skip_base) >> RMF_SKIP_SEGMENT_LOG;
+    if (!tbl->skip_map[seg])
+        return index;
+    while (tbl->skip_map[seg])
+        ++seg;
+    return MIN(tbl->skip_base + (seg << RMF_SKIP_SEGMENT_LOG), end);
+}
+
+/* RMF_nextSkipStart() :
+ * Returns the start of the first skipped segment at or after index, or end if none.
+ */
+size_t RMF_nextSkipStart(const FL2_matchTable* const tbl, size_t const index, size_t const end)
+{
+    if (tbl->skip_count == 0)
+        return end;
+
+    size_t const from = MAX(index, tbl->skip_base);
+    size_t seg = (from - tbl->skip_base) >> RMF_SKIP_SEGMENT_LOG;
+    size_t pos = from;
+    while (pos < end && !tbl->skip_map[seg]) {
+        ++seg;
+        pos = tbl->skip_base + (seg << RMF_SKIP_SEGMENT_LOG);
+    }
+    return MIN(pos, end);
+}
+
+/* RMF_clearCarry() :
+ * The carry settings apply to one init only.
+ */
+static void RMF_clearCarry(FL2_matchTable* const tbl)
+{
+    tbl->carry = NULL;
+    tbl->carry_start = 0;
+    tbl->carry_from = 0;
+    tbl->carry_seg = (size_t)-1;
+}
+
 size_t RMF_initTable(FL2_matchTable* const tbl, const void* const data, size_t const end)
 {
     DEBUGLOG(5, "RMF_initTable : size %u", (U32)end);
 
     tbl->st_index = ATOMIC_INITIAL_VALUE;
+    RMF_initSplitLists(tbl);
+
+    size_t const res = tbl->is_struct ? RMF_structuredInit(tbl, data, end) : RMF_bitpackInit(tbl, data, end);
+    RMF_clearCarry(tbl);
+    return res;
+}
+
+/* RMF_initSegmentCount() :
+ * Number of threads to use for RMF_initTableSegment().
+ * Returns 1 if the table should be initialized with RMF_initTable().
+ */
+size_t RMF_initSegmentCount(const FL2_matchTable* const tbl, size_t const end)
+{
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf)
+        return 1;
+#endif
+    size_t const seg_count = MIN(tbl->thread_count, end / INIT_MIN_BYTES_PER_THREAD);
+    return seg_count + !seg_count;
+}
+
+/* RMF_initTableSegment() :
+ * Initialize one segment of the table. May be called concurrently for
+ * each job in [0, RMF_initSegmentCount()). */
+void RMF_initTableSegment(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const job)
+{
+    size_t const seg_count = RMF_initSegmentCount(tbl, end);
+
+    DEBUGLOG(5, "RMF_initTableSegment : size %u, segment %u of %u", (U32)end, (U32)job, (U32)seg_count);
 
     if (tbl->is_struct)
-        return RMF_structuredInit(tbl, data, end);
+        RMF_structuredInitSegment(tbl, data, end, job, seg_count);
     else
-        return RMF_bitpackInit(tbl, data, end);
+        RMF_bitpackInitSegment(tbl, data, end, job, seg_count);
+}
+
+/* RMF_mergeTableSegments() :
+ * Complete a table initialized by RMF_initTableSegment(). All segments must be finished.
+ */
+size_t RMF_mergeTableSegments(FL2_matchTable* const tbl, const void* const data, size_t const end)
+{
+    size_t const seg_count = RMF_initSegmentCount(tbl, end);
+
+    tbl->st_index = ATOMIC_INITIAL_VALUE;
+    RMF_initSplitLists(tbl);
+
+    size_t const res = tbl->is_struct ? RMF_structuredMergeSegments(tbl, data, end, seg_count)
+        : RMF_bitpackMergeSegments(tbl, data, end, seg_count);
+    RMF_clearCarry(tbl);
+    return res;
 }
 
 static void RMF_handleRepeat(RMF_buildMatch* const match_buffer,
@@ -300,8 +620,8 @@ static void RMF_handleRepeat(RMF_buildMatch* const match_buffer,
     const BYTE* const data = data_block + match_buffer[index].from;
     const BYTE* const data_2 = data - rpt_len;
 
-    while (data[length] == data_2[length] && length < max_len)
-        ++length;
+    if (length < max_len)
+        length += (U32)ZSTD_count(data + length, data_2 + length, data + max_len);
 
     for (; length <= max_len && count; --count) {
         size_t next_i = match_buffer[index].next & 0xFFFFFF;
@@ -363,9 +683,8 @@ static void RMF_bruteForceBuffered(RMF_builder* const tbl,
             len_test -= slot;
             if (len_test) {
                 /* Complete the match length count in the raw input buffer */
-                const BYTE* data_2 = buffer[j].data_src;
-                while (data[len_test] == data_2[len_test] && len_test < limit)
-                    ++len_test;
+                if (len_test < limit)
+                    len_test += ZSTD_count(data + len_test, buffer[j].data_src + len_test, data + limit);
             }
             if (len_test > longest) {
                 longest_index = j;
@@ -694,8 +1013,13 @@ int RMF_buildTable(FL2_matchTable* const tbl,
 
 void RMF_cancelBuild(FL2_matchTable * const tbl)
 {
-    if(tbl != NULL)
+    if(tbl != NULL) {
         FL2_atomic_add(tbl->st_index, RADIX_CANCEL_INDEX - ATOMIC_INITIAL_VALUE);
+        /* Wake threads waiting for sub-lists */
+        FL2_pthread_mutex_lock(&tbl->split_mutex);
+        FL2_pthread_cond_broadcast(&tbl->split_cond);
+        FL2_pthread_mutex_unlock(&tbl->split_mutex);
+    }
 }
 
 void RMF_resetIncompleteBuild(FL2_matchTable * const tbl)
@@ -734,3 +1058,86 @@ size_t RMF_memoryUsage(size_t const dict_size, unsigned const buffer_resize, uns
     size += ((buf_size - 1) * sizeof(RMF_buildMatch) + sizeof(RMF_builder)) * thread_count;
     return size;
 }
+
+/* RMF_createCarry() :
+ * Create storage for the chain links of an overlap of up to overlap bytes, plus the
+ * alignment which the dictionary buffer may add.
+ */
+RMF_carry* RMF_createCarry(size_t const overlap)
+{
+    size_t const capacity = overlap + RMF_CARRY_ALIGNMENT;
+    RMF_carry* const carry = malloc(sizeof(RMF_carry) + (capacity - 1) * sizeof(U32));
+
+    if (carry == NULL)
+        return NULL;
+
+    carry->capacity = capacity;
+    RMF_resetCarry(carry);
+    return carry;
+}
+
+void RMF_freeCarry(RMF_carry* const carry)
+{
+    free(carry);
+}
+
+size_t RMF_carryCapacity(const RMF_carry* const carry)
+{
+    return carry->capacity - RMF_CARRY_ALIGNMENT;
+}
+
+void RMF_resetCarry(RMF_carry* const carry)
+{
+    if (carry == NULL)
+        return;
+    carry->length = 0;
+    carry->overlap = 0;
+}
+
+/* RMF_setCarry() :
+ * Prepare the next init of tbl, for a block beginning at start. If carry holds the links of
+ * an overlap of this size, they are relocated instead of scanning the overlap again.
+ * If next_from != 0, the caller will keep the data from next_from onward as the overlap of the
+ * next block, and the links from there are saved to carry. carry may be NULL.
+ */
+void RMF_setCarry(FL2_matchTable* const tbl, RMF_carry* const carry, size_t const start, size_t const next_from)
+{
+    RMF_clearCarry(tbl);
+    if (carry == NULL)
+        return;
+#ifdef RMF_REFERENCE
+    if (tbl->params.use_ref_mf) {
+        RMF_resetCarry(carry);
+        return;
+    }
+#endif
+    tbl->carry = carry;
+    if (start > 2 && carry->overlap == start)
+        tbl->carry_start = carry->length;
+    /* The links are used once */
+    carry->overlap = 0;
+    tbl->carry_from = next_from;
+}
+
+/* RMF_carrySaveFrom() :
+ * Returns the position from which the current init saves links to the carry, or 0 if none.
+ */
+size_t RMF_carrySaveFrom(const FL2_matchTable* const tbl, size_t const end)
+{
+    size_t const from = tbl->carry_from;
+    size_t const block_size = end - 2;
+
+    if (from == 0 || from < tbl->carry_start || from >= block_size
+        || block_size - from > tbl->carry->capacity)
+        return 0;
+    /* Positions in incompressible segments are left out of the chains but the next block
+     * needs them, because its overlap is not scanned for incompressible data */
+    if (RMF_nextSkipStart(tbl, from, block_size) != block_size)
+        return 0;
+    return from;
+}
+
+size_t RMF_carryMemoryUsage(size_t const overlap)
+{
+    return sizeof(RMF_carry) + (overlap + RMF_CARRY_ALIGNMENT - 1) * sizeof(U32);
+}
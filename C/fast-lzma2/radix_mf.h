@@ -19,6 +19,7 @@ extern "C" {
 #endif
 
 typedef struct FL2_matchTable_s FL2_matchTable;
+typedef struct RMF_carry_s RMF_carry;
 
 #define OVERLAP_FROM_DICT_SIZE(d, o) (((d) >> 4) * (o))
 
@@ -31,6 +32,9 @@ typedef struct
     unsigned overlap_fraction;
     unsigned divide_and_conquer;
     unsigned depth;
+    unsigned skip_incompressible;
+    unsigned large_pages;
+    unsigned reuse_overlap;
 #ifdef RMF_REFERENCE
     unsigned use_ref_mf;
 #endif
@@ -42,7 +46,13 @@ BYTE RMF_compatibleParameters(const FL2_matchTable* const tbl, const RMF_paramet
 size_t RMF_applyParameters(FL2_matchTable* const tbl, const RMF_parameters* const params, size_t const dict_reduce);
 size_t RMF_threadCount(const FL2_matchTable * const tbl);
 void RMF_initProgress(FL2_matchTable * const tbl);
+size_t RMF_scanIncompressible(FL2_matchTable* const tbl, FL2_dataBlock const block);
+size_t RMF_skipRunEnd(const FL2_matchTable* const tbl, size_t const index, size_t const end);
+size_t RMF_nextSkipStart(const FL2_matchTable* const tbl, size_t const index, size_t const end);
 size_t RMF_initTable(FL2_matchTable* const tbl, const void* const data, size_t const end);
+size_t RMF_initSegmentCount(const FL2_matchTable* const tbl, size_t const end);
+void RMF_initTableSegment(FL2_matchTable* const tbl, const void* const data, size_t const end, size_t const job);
+size_t RMF_mergeTableSegments(FL2_matchTable* const tbl, const void* const data, size_t const end);
 int RMF_buildTable(FL2_matchTable* const tbl,
 	size_t const job,
     unsigned const multi_thread,
@@ -53,6 +63,12 @@ int RMF_integrityCheck(const FL2_matchTable* const tbl, const BYTE* const data,
 void RMF_limitLengths(FL2_matchTable* const tbl, size_t const index);
 BYTE* RMF_getTableAsOutputBuffer(FL2_matchTable* const tbl, size_t const index);
 size_t RMF_memoryUsage(size_t const dict_size, unsigned const buffer_resize, unsigned const thread_count);
+RMF_carry* RMF_createCarry(size_t const overlap);
+void RMF_freeCarry(RMF_carry* const carry);
+size_t RMF_carryCapacity(const RMF_carry* const carry);
+void RMF_resetCarry(RMF_carry* const carry);
+void RMF_setCarry(FL2_matchTable* const tbl, RMF_carry* const carry, size_t const start, size_t const next_from);
+size_t RMF_carryMemoryUsage(size_t const overlap);
 
 #if defined (__cplusplus)
 }
@@ -12,11 +12,17 @@
 extern "C" {
 #endif
 
+/* MAP_ANONYMOUS and MAP_HUGETLB are hidden by the _POSIX_C_SOURCE setting in platform.h */
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#  define _DEFAULT_SOURCE
+#endif
+
 
 /*-****************************************
 *  Dependencies
 ******************************************/
 #include "util.h"       /* note : ensure that platform.h is included first ! */
+#include "atomic.h"     /* FL2_atomic_compareExchange, FL2_pause */
 #include <errno.h>
 #include <assert.h>
 
@@ -702,6 +708,317 @@ int UTIL_countPhysicalCores(void)
 
 #endif
 
+
+/*-****************************************
+*  Large page allocation
+******************************************/
+
+#if defined(_WIN32)
+
+typedef SIZE_T (WINAPI *UTIL_GetLargePageMinimumP)(void);
+
+size_t UTIL_largePageSize(void)
+{
+    static size_t pageSize = (size_t)-1;
+
+    if (pageSize != (size_t)-1) return pageSize;
+
+    pageSize = 0;
+    {   UTIL_GetLargePageMinimumP const largePageMinimum = (UTIL_GetLargePageMinimumP)
+            GetProcAddress(GetModuleHandle(TEXT("kernel32.dll")), "GetLargePageMinimum");
+        if (largePageMinimum != NULL) {
+            size_t const size = largePageMinimum();
+            if (size != 0 && (size & (size - 1)) == 0)
+                pageSize = size;
+        }
+    }
+    return pageSize;
+}
+
+/* Requires the lock pages in memory privilege, which the caller must enable */
+static void* UTIL_mapLarge(size_t size, size_t page)
+{
+    return VirtualAlloc(NULL, (size + page - 1) & ~(page - 1), MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+}
+
+static void UTIL_unmapLarge(void* base, size_t mapSize)
+{
+    (void)mapSize;
+    VirtualFree(base, 0, MEM_RELEASE);
+}
+
+#elif defined(__linux__)
+
+#include <sys/mman.h>   /* mmap, madvise */
+
+/* parse Hugepagesize from /proc/meminfo */
+size_t UTIL_largePageSize(void)
+{
+    static size_t pageSize = (size_t)-1;
+
+    if (pageSize != (size_t)-1) return pageSize;
+
+    pageSize = 0;
+    {   FILE* const meminfo = fopen("/proc/meminfo", "r");
+        char buff[80];
+
+        if (meminfo == NULL)
+            return pageSize;
+
+        while (fgets(buff, sizeof(buff), meminfo) != NULL) {
+            if (strncmp(buff, "Hugepagesize:", 13) == 0) {
+                size_t const size = (size_t)strtoul(buff + 13, NULL, 10) << 10;
+                if ((size & (size - 1)) == 0)
+                    pageSize = size;
+                break;
+            }
+        }
+        fclose(meminfo);
+    }
+    return pageSize;
+}
+
+static void* UTIL_mapLarge(size_t size, size_t page)
+{
+    size_t const mapSize = (size + page - 1) & ~(page - 1);
+    BYTE* ptr;
+
+#ifdef MAP_HUGETLB
+    ptr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+        return ptr;
+#endif
+    /* No reserved huge pages are free. Map an extra page and trim it so the block is
+     * page aligned, which transparent huge pages require. */
+    ptr = mmap(NULL, mapSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    {   size_t const lead = (page - ((size_t)ptr & (page - 1))) & (page - 1);
+        if (lead != 0)
+            munmap(ptr, lead);
+        ptr += lead;
+        munmap(ptr + mapSize, page - lead);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, mapSize, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+static void UTIL_unmapLarge(void* base, size_t mapSize)
+{
+    munmap(base, mapSize);
+}
+
+#else
+
+size_t UTIL_largePageSize(void)
+{
+    return 0;
+}
+
+static void* UTIL_mapLarge(size_t size, size_t page)
+{
+    (void)size;
+    (void)page;
+    return NULL;
+}
+
+static void UTIL_unmapLarge(void* base, size_t mapSize)
+{
+    (void)base;
+    (void)mapSize;
+}
+
+#endif
+
+/* Mapped blocks are recorded in a list of small side allocations so the mapping is
+ * exactly the rounded request. Blocks not found in the list came from malloc. */
+typedef struct UTIL_largeMap_s UTIL_largeMap;
+struct UTIL_largeMap_s {
+    UTIL_largeMap* next;
+    void* base;
+    size_t mapSize;
+};
+
+static UTIL_largeMap* g_largeMaps = NULL;
+static FL2_atomic g_largeMapsLock = 0;
+
+static void UTIL_lockLargeMaps(void)
+{
+    while (!FL2_atomic_compareExchange(g_largeMapsLock, 0, 1))
+        FL2_pause();
+}
+
+static void UTIL_unlockLargeMaps(void)
+{
+    FL2_atomic_compareExchange(g_largeMapsLock, 1, 0);
+}
+
+void* UTIL_allocLarge(size_t size, int large_pages)
+{
+    if (large_pages) {
+        size_t const page = UTIL_largePageSize();
+        /* Not worth it for blocks much smaller than a page */
+        if (page != 0 && size > page / 2 && size <= (size_t)-1 - page) {
+            UTIL_largeMap* const map = malloc(sizeof(UTIL_largeMap));
+            if (map == NULL)
+                return NULL;
+            map->base = UTIL_mapLarge(size, page);
+            if (map->base != NULL) {
+                map->mapSize = (size + page - 1) & ~(page - 1);
+                UTIL_lockLargeMaps();
+                map->next = g_largeMaps;
+                g_largeMaps = map;
+                UTIL_unlockLargeMaps();
+                return map->base;
+            }
+            free(map);
+        }
+    }
+    return malloc(size);
+}
+
+void UTIL_freeLarge(void* ptr)
+{
+    UTIL_largeMap* map = NULL;
+    UTIL_largeMap** link;
+
+    if (ptr == NULL)
+        return;
+    UTIL_lockLargeMaps();
+    for (link = &g_largeMaps; *link != NULL; link = &(*link)->next) {
+        if ((*link)->base == ptr) {
+            map = *link;
+            *link = map->next;
+            break;
+        }
+    }
+    UTIL_unlockLargeMaps();
+    if (map != NULL) {
+        UTIL_unmapLarge(map->base, map->mapSize);
+        free(map);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+
+/*-****************************************
+*  Memory limit
+******************************************/
+
+/* each line is hierarchy-ID:controller-list:path, where v2 has ID 0 and no controllers */
+int UTIL_parseCgroupLine(char* line, char** dir)
+{
+    char* const controllers = strchr(line, ':');
+    char* path;
+    int version = 0;
+
+    if (controllers == NULL)
+        return 0;
+    path = strchr(controllers + 1, ':');
+    if (path == NULL || path[1] != '/')
+        return 0;
+    /* classify before the separators are overwritten */
+    if (controllers == line + 1 && line[0] == '0' && path == controllers + 1)
+        version = 2;
+    else {
+        *path = '\0';
+        if (strstr(controllers + 1, "memory") != NULL)
+            version = 1;
+    }
+    ++path;
+    path[strcspn(path, "\n")] = '\0';
+    *dir = path;
+    return version;
+}
+
+#if defined(_WIN32)
+
+U64 UTIL_memoryLimit(void)
+{
+    MEMORYSTATUSEX stat;
+
+    stat.dwLength = sizeof(stat);
+    if (!GlobalMemoryStatusEx(&stat))
+        return 0;
+    /* A 32-bit process is limited by its address space */
+    return (stat.ullTotalVirtual < stat.ullTotalPhys) ? stat.ullTotalVirtual : stat.ullTotalPhys;
+}
+
+#elif defined(__linux__)
+
+/* read a cgroup limit file, which contains a byte count or "max" */
+static U64 UTIL_readCgroupLimit(const char* path)
+{
+    FILE* const f = fopen(path, "r");
+    char buff[32];
+    U64 limit = 0;
+
+    if (f == NULL)
+        return 0;
+    if (fgets(buff, sizeof(buff), f) != NULL && buff[0] >= '0' && buff[0] <= '9')
+        limit = (U64)strtoull(buff, NULL, 10);
+    fclose(f);
+    return limit;
+}
+
+/* apply the lowest limit found in cgroup dir and its ancestors */
+static U64 UTIL_cgroupLimit(U64 limit, const char* root, char* dir, const char* file)
+{
+    char path[512];
+
+    for (;;) {
+        size_t len = strlen(dir);
+        U64 value;
+
+        while (len > 0 && dir[len - 1] == '/')
+            dir[--len] = '\0';
+        snprintf(path, sizeof(path), "%s%s/%s", root, dir, file);
+        value = UTIL_readCgroupLimit(path);
+        /* v1 reports an unlimited group as a huge page-rounded value */
+        if (value != 0 && value < limit)
+            limit = value;
+        if (len == 0)
+            return limit;
+        *strrchr(dir, '/') = '\0';
+    }
+}
+
+/* physical memory, reduced by any cgroup v1 or v2 memory limit on this process */
+U64 UTIL_memoryLimit(void)
+{
+    long const pages = sysconf(_SC_PHYS_PAGES);
+    long const pageSize = sysconf(_SC_PAGESIZE);
+    U64 limit = (pages > 0 && pageSize > 0) ? (U64)pages * (U64)pageSize : (U64)-1;
+    FILE* const cgroup = fopen("/proc/self/cgroup", "r");
+    char buff[512];
+
+    if (cgroup != NULL) {
+        while (fgets(buff, sizeof(buff), cgroup) != NULL) {
+            char* dir;
+            int const version = UTIL_parseCgroupLine(buff, &dir);
+            if (version == 2)
+                limit = UTIL_cgroupLimit(limit, "/sys/fs/cgroup", dir, "memory.max");
+            else if (version == 1)
+                limit = UTIL_cgroupLimit(limit, "/sys/fs/cgroup/memory", dir, "memory.limit_in_bytes");
+        }
+        fclose(cgroup);
+    }
+    return (limit == (U64)-1) ? 0 : limit;
+}
+
+#else
+
+U64 UTIL_memoryLimit(void)
+{
+    return 0;
+}
+
+#endif
+
 #if defined (__cplusplus)
 }
 #endif
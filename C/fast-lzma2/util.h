@@ -222,6 +222,30 @@ UTIL_STATIC void UTIL_freeFileList(const char** filenameTable, char* allocatedBu
 
 int UTIL_countPhysicalCores(void);
 
+/*-****************************************
+*  Large page allocation
+******************************************/
+/* Returns the large (huge) page size of the OS, or 0 if unknown or unavailable */
+size_t UTIL_largePageSize(void);
+
+/* Allocate a block backed by large pages if large_pages != 0 and the OS can supply them,
+ * otherwise by ordinary memory. On Linux, reserved huge pages are tried first, then
+ * transparent huge pages. The block must be freed with UTIL_freeLarge(). */
+void* UTIL_allocLarge(size_t size, int large_pages);
+void UTIL_freeLarge(void* ptr);
+
+/*-****************************************
+*  Memory limit
+******************************************/
+/* Returns the memory available to the process: physical memory, lowered on Linux by any
+ * cgroup v1 or v2 limit on the process or its parent groups. Returns 0 if unknown. */
+U64 UTIL_memoryLimit(void);
+
+/* Parses one line of /proc/self/cgroup in place. Returns 2 for the cgroup v2 line,
+ * 1 for a v1 line of the memory controller, or 0 for any other line. If nonzero,
+ * *dir points to the group's path within the line. */
+int UTIL_parseCgroupLine(char* line, char** dir);
+
 #if defined (__cplusplus)
 }
 #endif
@@ -223,6 +223,7 @@ HRESULT CDecoder::Decode(
     UInt64 startPos,
     const CFolders &folders, unsigned folderIndex,
     const UInt64 *unpackSize
+    , const CResetPoint *startPoint
 
     , ISequentialOutStream *outStream
     , ICompressProgressInfo *compressProgress
@@ -264,6 +265,22 @@ HRESULT CDecoder::Decode(
     fullUnpack = (*unpackSize == folderUnpackSize);
   }
 
+  UInt64 packOffset = 0;
+  UInt64 pointUnpackSize = 0;
+  if (startPoint)
+  {
+    // only a folder with one coder can be decoded from the reset point
+    if (folderInfo.Coders.Size() != 1 || folderInfo.PackStreams.Size() != 1)
+      return E_FAIL;
+    pointUnpackSize = (unpackSize ? *unpackSize : folderUnpackSize);
+    if (startPoint->UnpackPos > pointUnpackSize
+        || startPoint->PackPos >= packPositions[1] - packPositions[0])
+      return E_FAIL;
+    pointUnpackSize -= startPoint->UnpackPos;
+    unpackSize = &pointUnpackSize;
+    packOffset = startPoint->PackPos;
+  }
+
   /*
   We don't need to init isEncrypted and passwordIsDefined
   We must upgrade them only
@@ -464,7 +481,7 @@ HRESULT CDecoder::Decode(
         int index = folderInfo.Find_in_PackStreams(packStreamIndex);
         if (index < 0)
           return E_NOTIMPL;
-        packSizes[j] = packPositions[(unsigned)index + 1] - packPositions[(unsigned)index];
+        packSizes[j] = packPositions[(unsigned)index + 1] - packPositions[(unsigned)index] - packOffset;
         packSizesPointers[j] = &packSizes[j];
       }
     }
@@ -505,7 +522,7 @@ HRESULT CDecoder::Decode(
   for (unsigned j = 0; j < folderInfo.PackStreams.Size(); j++)
   {
     CMyComPtr<ISequentialInStream> packStream;
-    UInt64 packPos = startPos + packPositions[j];
+    UInt64 packPos = startPos + packPositions[j] + packOffset;
 
     if (folderInfo.PackStreams.Size() == 1)
     {
@@ -539,7 +556,7 @@ HRESULT CDecoder::Decode(
     CLimitedSequentialInStream *streamSpec = new CLimitedSequentialInStream;
     inStreams.AddNew() = streamSpec;
     streamSpec->SetStream(packStream);
-    streamSpec->Init(packPositions[j + 1] - packPositions[j]);
+    streamSpec->Init(packPositions[j + 1] - packPositions[j] - packOffset);
   }
   
   unsigned num = inStreams.Size();
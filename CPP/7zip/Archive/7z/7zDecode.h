@@ -50,6 +50,7 @@ public:
       const CFolders &folders, unsigned folderIndex,
       const UInt64 *unpackSize // if (!unpackSize), then full folder is required
                                // if (unpackSize), then only *unpackSize bytes from folder are required
+      , const CResetPoint *startPoint // if (startPoint), then the data before that point of folder is not decoded
 
       , ISequentialOutStream *outStream
       , ICompressProgressInfo *compressProgress
@@ -485,6 +485,30 @@ HRESULT CEncoder::Encode(
   return S_OK;
 }
 
+HRESULT CEncoder::GetResetPoints(CRecordVector<CResetPoint> &points)
+{
+  points.Clear();
+  if (!_mixerRef || _bindInfo.Coders.Size() != 1 || _bindInfo.PackStreams.Size() != 1)
+    return S_OK;
+
+  CMyComPtr<ICompressGetResetPoints> getResetPoints;
+  _mixer->GetCoder(0).GetUnknown()->QueryInterface(IID_ICompressGetResetPoints, (void **)&getResetPoints);
+  if (!getResetPoints)
+    return S_OK;
+
+  UInt32 numPoints;
+  RINOK(getResetPoints->GetNumResetPoints(&numPoints));
+  for (UInt32 i = 0; i < numPoints; i++)
+  {
+    CResetPoint point;
+    RINOK(getResetPoints->GetResetPoint(i, &point.PackPos, &point.UnpackPos));
+    // the start of folder is not stored
+    if (point.UnpackPos != 0)
+      points.Add(point);
+  }
+  return S_OK;
+}
+
 
 CEncoder::CEncoder(const CCompressionMethodMode &options):
     _constructed(false)
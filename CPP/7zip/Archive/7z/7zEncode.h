@@ -85,6 +85,9 @@ public:
       ISequentialOutStream *outStream,
       CRecordVector<UInt64> &packSizes,
       ICompressProgressInfo *compressProgress);
+
+  // it returns the reset points of the last folder, if it's encoded with one coder
+  HRESULT GetResetPoints(CRecordVector<CResetPoint> &points);
 };
 
 }}
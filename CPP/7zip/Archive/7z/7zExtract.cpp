@@ -6,8 +6,17 @@
 
 #include "../../../Common/ComTry.h"
 
+#include "../../../Windows/Synchronization.h"
+
 #include "../../Common/ProgressUtils.h"
 
+#if !defined(_7ZIP_ST) && !defined(EXTRACT_ONLY)
+#include "../../Common/InOutTempBuffer.h"
+#include "../../Common/LockedStream.h"
+#include "../../Common/ProgressMt.h"
+#include "../../Common/VirtThread.h"
+#endif
+
 #include "7zDecode.h"
 #include "7zHandler.h"
 
@@ -16,6 +25,12 @@
 namespace NArchive {
 namespace N7z {
 
+#ifndef _7ZIP_ST
+#define CALLBACK_LOCK NWindows::NSynchronization::COptCriticalSectionLock callbackLock(CallbackCS);
+#else
+#define CALLBACK_LOCK
+#endif
+
 class CFolderOutStream:
   public ISequentialOutStream,
   public CMyUnknownImp
@@ -29,6 +44,7 @@ private:
   bool _calcCrc;
   UInt32 _crc;
   UInt64 _rem;
+  UInt64 _discardRem;
 
   const UInt32 *_indexes;
   unsigned _numFiles;
@@ -47,25 +63,34 @@ public:
 
   bool ExtraWriteWasCut;
 
+  #ifndef _7ZIP_ST
+  // if set, calls to ExtractCallback are serialized with decoder threads
+  NWindows::NSynchronization::CCriticalSection *CallbackCS;
+  #endif
+
   CFolderOutStream():
       TestMode(false),
       CheckCrc(true)
+      #ifndef _7ZIP_ST
+      , CallbackCS(NULL)
+      #endif
       {}
 
   STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize);
 
-  HRESULT Init(unsigned startIndex, const UInt32 *indexes, unsigned numFiles);
+  HRESULT Init(unsigned startIndex, const UInt32 *indexes, unsigned numFiles, UInt64 numDiscardBytes);
   HRESULT FlushCorrupted(Int32 callbackOperationResult);
 
   bool WasWritingFinished() const { return _numFiles == 0; }
 };
 
 
-HRESULT CFolderOutStream::Init(unsigned startIndex, const UInt32 *indexes, unsigned numFiles)
+HRESULT CFolderOutStream::Init(unsigned startIndex, const UInt32 *indexes, unsigned numFiles, UInt64 numDiscardBytes)
 {
   _fileIndex = startIndex;
   _indexes = indexes;
   _numFiles = numFiles;
+  _discardRem = numDiscardBytes;
   
   _fileIsOpen = false;
   ExtraWriteWasCut = false;
@@ -89,6 +114,7 @@ HRESULT CFolderOutStream::OpenFile(bool isCorrupted)
       && !fi.IsDir)
     askMode = NExtract::NAskMode::kTest;
   
+  CALLBACK_LOCK
   CMyComPtr<ISequentialOutStream> realOutStream;
   RINOK(ExtractCallback->GetStream(_fileIndex, &realOutStream, askMode));
   
@@ -109,6 +135,7 @@ HRESULT CFolderOutStream::OpenFile(bool isCorrupted)
 
 HRESULT CFolderOutStream::CloseFile_and_SetResult(Int32 res)
 {
+  CALLBACK_LOCK
   _stream.Release();
   _fileIsOpen = false;
   
@@ -149,6 +176,18 @@ STDMETHODIMP CFolderOutStream::Write(const void *data, UInt32 size, UInt32 *proc
   
   while (size != 0)
   {
+    if (_discardRem != 0)
+    {
+      // the tail of file that precedes (startIndex) file
+      UInt32 cur = (size < _discardRem ? size : (UInt32)_discardRem);
+      if (processedSize)
+        *processedSize += cur;
+      data = (const Byte *)data + cur;
+      size -= cur;
+      _discardRem -= cur;
+      continue;
+    }
+
     if (_fileIsOpen)
     {
       UInt32 cur = (size < _rem ? size : (UInt32)_rem);
@@ -214,6 +253,243 @@ HRESULT CFolderOutStream::FlushCorrupted(Int32 callbackOperationResult)
   return S_OK;
 }
 
+struct CExtractStep
+{
+  UInt32 ItemIndex;
+  UInt32 StartFileIndex;
+  UInt32 NumFiles;
+  CNum FolderIndex;
+  UInt64 PackSize;
+  UInt64 UnpackSize;
+  const CResetPoint *ResetPoint; // if defined, the decoding starts from that point
+  UInt64 NumDiscardBytes;        // the bytes after ResetPoint that precede StartFileIndex
+
+  bool NeedDecoding() const { return FolderIndex != kNumNoIndex && UnpackSize != 0; }
+};
+
+// it finds the items starting from (i) that are extracted with one pass over one folder
+
+static void GetExtractStep(const CDbEx &db, const UInt32 *indices, UInt32 numItems,
+    bool allFilesMode, UInt32 i, CExtractStep &step)
+{
+  UInt32 fileIndex = allFilesMode ? i : indices[i];
+  CNum folderIndex = db.FileIndexToFolderIndexMap[fileIndex];
+
+  step.ItemIndex = i;
+  step.FolderIndex = folderIndex;
+  step.NumFiles = 1;
+  step.PackSize = 0;
+  step.UnpackSize = 0;
+  step.ResetPoint = NULL;
+  step.NumDiscardBytes = 0;
+
+  if (folderIndex != kNumNoIndex)
+  {
+    step.PackSize = db.GetFolderFullPackSize(folderIndex);
+    const UInt32 firstFile = fileIndex;
+    UInt32 nextFile = fileIndex + 1;
+    fileIndex = db.FolderStartFileIndex[folderIndex];
+    UInt32 k;
+
+    for (k = i + 1; k < numItems; k++)
+    {
+      UInt32 fileIndex2 = allFilesMode ? k : indices[k];
+      if (db.FileIndexToFolderIndexMap[fileIndex2] != folderIndex
+          || fileIndex2 < nextFile)
+        break;
+      nextFile = fileIndex2 + 1;
+    }
+    
+    step.NumFiles = k - i;
+    
+    UInt64 firstFileOffset = 0;
+    for (k = fileIndex; k < nextFile; k++)
+    {
+      if (k == firstFile)
+        firstFileOffset = step.UnpackSize;
+      step.UnpackSize += db.Files[k].Size;
+    }
+
+    /* If there is a dictionary reset point in folder before the first required file,
+       we skip the files before the point, and we discard the tail of the file
+       that contains the point. */
+
+    step.ResetPoint = db.FindResetPoint(folderIndex, firstFileOffset);
+    if (step.ResetPoint)
+    {
+      UInt64 pos = 0;
+      for (; pos < step.ResetPoint->UnpackPos; fileIndex++)
+        pos += db.Files[fileIndex].Size;
+      step.NumDiscardBytes = pos - step.ResetPoint->UnpackPos;
+    }
+  }
+
+  step.StartFileIndex = fileIndex;
+}
+
+static HRESULT ReportFolderResult(CFolderOutStream *folderOutStream,
+    IArchiveExtractCallbackMessage *callbackMessage,
+    NWindows::NSynchronization::CCriticalSection *callbackCS,
+    CNum folderIndex, HRESULT result, bool dataAfterEnd_Error)
+{
+  if (result == S_FALSE || result == E_NOTIMPL || dataAfterEnd_Error)
+  {
+    bool wasFinished = folderOutStream->WasWritingFinished();
+
+    int resOp = NExtract::NOperationResult::kDataError;
+    
+    if (result != S_FALSE)
+    {
+      if (result == E_NOTIMPL)
+        resOp = NExtract::NOperationResult::kUnsupportedMethod;
+      else if (wasFinished && dataAfterEnd_Error)
+        resOp = NExtract::NOperationResult::kDataAfterEnd;
+    }
+
+    RINOK(folderOutStream->FlushCorrupted(resOp));
+
+    if (wasFinished)
+    {
+      // we don't show error, if it's after required files
+      if (/* !folderOutStream->ExtraWriteWasCut && */ callbackMessage)
+      {
+        NWindows::NSynchronization::COptCriticalSectionLock lock(callbackCS);
+        RINOK(callbackMessage->ReportExtractResult(NEventIndexType::kBlockIndex, folderIndex, resOp));
+      }
+    }
+    return S_OK;
+  }
+  
+  if (result != S_OK)
+    return result;
+
+  return folderOutStream->FlushCorrupted(NExtract::NOperationResult::kDataError);
+}
+
+
+#if !defined(_7ZIP_ST) && !defined(EXTRACT_ONLY)
+
+#ifndef _NO_CRYPTO
+
+class CLockedGetTextPassword:
+  public ICryptoGetTextPassword,
+  public CMyUnknownImp
+{
+public:
+  CMyComPtr<ICryptoGetTextPassword> GetTextPassword;
+  NWindows::NSynchronization::CCriticalSection *CallbackCS;
+
+  MY_UNKNOWN_IMP
+  STDMETHOD(CryptoGetTextPassword)(BSTR *password);
+};
+
+STDMETHODIMP CLockedGetTextPassword::CryptoGetTextPassword(BSTR *password)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(*CallbackCS);
+  return GetTextPassword->CryptoGetTextPassword(password);
+}
+
+#endif
+
+// it decodes one folder to the temp buffer
+
+class CThreadFolderDecoder: public CVirtThread
+{
+public:
+  CDecoder *Decoder;
+  HRESULT Result;
+  bool DataAfterEnd_Error;
+
+  CMyComPtr<IInStream> InStream;
+  UInt64 StartPos;
+  const CFolders *Folders;
+  CNum FolderIndex;
+  UInt64 UnpackSize;
+  const CResetPoint *ResetPoint;
+
+  CInOutTempBuffer TempBuffer;
+  CSequentialOutTempBufferImp *OutStreamSpec;
+  CMyComPtr<ISequentialOutStream> OutStream;
+
+  CMtCompressProgress *ProgressSpec;
+  CMyComPtr<ICompressProgressInfo> Progress;
+
+  #ifndef _NO_CRYPTO
+  CMyComPtr<ICryptoGetTextPassword> getTextPassword;
+  #endif
+
+  UInt32 NumThreads;
+  UInt64 MemUsage;
+
+  DECL_EXTERNAL_CODECS_LOC_VARS2;
+
+  CThreadFolderDecoder():
+      Decoder(NULL),
+      Result(E_FAIL),
+      DataAfterEnd_Error(false),
+      StartPos(0),
+      Folders(NULL),
+      FolderIndex(0),
+      UnpackSize(0),
+      ResetPoint(NULL),
+      NumThreads(1),
+      MemUsage(0)
+  {
+    TempBuffer.Create();
+    OutStreamSpec = new CSequentialOutTempBufferImp;
+    OutStream = OutStreamSpec;
+    OutStreamSpec->Init(&TempBuffer);
+    ProgressSpec = new CMtCompressProgress;
+    Progress = ProgressSpec;
+  }
+
+  ~CThreadFolderDecoder()
+  {
+    CVirtThread::WaitThreadFinish();
+    delete Decoder;
+  }
+
+  virtual void Execute();
+};
+
+void CThreadFolderDecoder::Execute()
+{
+  try
+  {
+    #ifndef _NO_CRYPTO
+      bool isEncrypted = false;
+      bool passwordIsDefined = false;
+      UString password;
+    #endif
+
+    DataAfterEnd_Error = false;
+
+    Result = Decoder->Decode(
+        EXTERNAL_CODECS_LOC_VARS
+        InStream,
+        StartPos,
+        *Folders, FolderIndex,
+        &UnpackSize,
+        ResetPoint,
+
+        OutStream,
+        Progress,
+        NULL // *inStreamMainRes
+        , DataAfterEnd_Error
+
+        _7Z_DECODER_CRYPRO_VARS
+        , true, NumThreads, MemUsage
+        );
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+}
+
+#endif
+
+
 STDMETHODIMP CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     Int32 testModeSpec, IArchiveExtractCallback *extractCallbackSpec)
 {
@@ -259,7 +535,7 @@ STDMETHODIMP CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   CMyComPtr<ICompressProgressInfo> progress = lps;
   lps->Init(extractCallback, false);
 
-  CDecoder decoder(
+  const bool useMixerMT =
     #if !defined(USE_MIXER_MT)
       false
     #elif !defined(USE_MIXER_ST)
@@ -273,9 +549,7 @@ STDMETHODIMP CHandler::Extract(const UInt32 *indices, UInt32 numItems,
     #else
       _useMultiThreadMixer
     #endif
-    );
-
-  UInt64 curPacked, curUnpacked;
+    ;
 
   CMyComPtr<IArchiveExtractCallbackMessage> callbackMessage;
   extractCallback.QueryInterface(IID_IArchiveExtractCallbackMessage, &callbackMessage);
@@ -288,49 +562,163 @@ STDMETHODIMP CHandler::Extract(const UInt32 *indices, UInt32 numItems,
   folderOutStream->TestMode = (testModeSpec != 0);
   folderOutStream->CheckCrc = (_crcSize != 0);
 
-  for (UInt32 i = 0;; lps->OutSize += curUnpacked, lps->InSize += curPacked)
+  #if !defined(_7ZIP_ST) && !defined(EXTRACT_ONLY)
+
+  if (_numFolderThreads > 1)
   {
-    RINOK(lps->SetCur());
+    CRecordVector<CExtractStep> steps;
+    CRecordVector<unsigned> decodeSteps;
+    
+    for (UInt32 i = 0; i < numItems;)
+    {
+      CExtractStep step;
+      GetExtractStep(_db, indices, numItems, allFilesMode, i, step);
+      if (step.NeedDecoding())
+        decodeSteps.Add(steps.Size());
+      steps.Add(step);
+      i += step.NumFiles;
+    }
 
-    if (i >= numItems)
-      break;
+    if (decodeSteps.Size() > 1)
+    {
+      /* Folders are decoded to temp buffers by several threads.
+         The decoded data is passed to folderOutStream in the order of items,
+         so the calls of extractCallback are the same as in single-thread mode. */
 
-    curUnpacked = 0;
-    curPacked = 0;
+      unsigned numDecoders = decodeSteps.Size();
+      if (numDecoders > _numFolderThreads)
+        numDecoders = _numFolderThreads;
+      UInt32 numThreads = _numThreads / numDecoders;
+      if (numThreads == 0)
+        numThreads = 1;
 
-    UInt32 fileIndex = allFilesMode ? i : indices[i];
-    CNum folderIndex = _db.FileIndexToFolderIndexMap[fileIndex];
+      CMtCompressProgressMixer mtProgressMixer;
+      mtProgressMixer.Init(numDecoders, progress);
+      NWindows::NSynchronization::CCriticalSection &callbackCS = mtProgressMixer.CriticalSection;
+      folderOutStream->CallbackCS = &callbackCS;
 
-    UInt32 numSolidFiles = 1;
+      CLockedInStream lockedInStream;
+      lockedInStream.Init(_inStream);
 
-    if (folderIndex != kNumNoIndex)
-    {
-      curPacked = _db.GetFolderFullPackSize(folderIndex);
-      UInt32 nextFile = fileIndex + 1;
-      fileIndex = _db.FolderStartFileIndex[folderIndex];
-      UInt32 k;
+      #ifndef _NO_CRYPTO
+      CMyComPtr<ICryptoGetTextPassword> getTextPassword;
+      {
+        CMyComPtr<ICryptoGetTextPassword> getTextPasswordReal;
+        extractCallback.QueryInterface(IID_ICryptoGetTextPassword, &getTextPasswordReal);
+        if (getTextPasswordReal)
+        {
+          CLockedGetTextPassword *getTextPasswordSpec = new CLockedGetTextPassword;
+          getTextPassword = getTextPasswordSpec;
+          getTextPasswordSpec->GetTextPassword = getTextPasswordReal;
+          getTextPasswordSpec->CallbackCS = &callbackCS;
+        }
+      }
+      #endif
+
+      CObjectVector<CThreadFolderDecoder> threadDecoders;
 
-      for (k = i + 1; k < numItems; k++)
+      for (unsigned t = 0; t < numDecoders; t++)
       {
-        UInt32 fileIndex2 = allFilesMode ? k : indices[k];
-        if (_db.FileIndexToFolderIndexMap[fileIndex2] != folderIndex
-            || fileIndex2 < nextFile)
-          break;
-        nextFile = fileIndex2 + 1;
+        CThreadFolderDecoder &td = threadDecoders.AddNew();
+        td.Decoder = new CDecoder(useMixerMT);
+        #ifdef EXTERNAL_CODECS
+        td.__externalCodecs = EXTERNAL_CODECS_VARS2;
+        #endif
+        CLockedInStreamImp *inStreamSpec = new CLockedInStreamImp;
+        td.InStream = inStreamSpec;
+        inStreamSpec->Init(&lockedInStream);
+        td.StartPos = _db.ArcInfo.DataStartPosition;
+        td.Folders = &_db;
+        #ifndef _NO_CRYPTO
+        td.getTextPassword = getTextPassword;
+        #endif
+        td.NumThreads = numThreads;
+        td.MemUsage = _memUsage / numDecoders;
+        td.ProgressSpec->Init(&mtProgressMixer, t);
+        RINOK(td.Create());
+      }
+
+      UInt64 totalPacked = 0;
+      UInt64 totalUnpacked = 0;
+      unsigned numStarted = 0;
+      unsigned numFinished = 0;
+
+      FOR_VECTOR (stepIndex, steps)
+      {
+        for (; numStarted < decodeSteps.Size() && numStarted < numFinished + numDecoders; numStarted++)
+        {
+          const CExtractStep &step = steps[decodeSteps[numStarted]];
+          CThreadFolderDecoder &td = threadDecoders[numStarted % numDecoders];
+          td.FolderIndex = step.FolderIndex;
+          td.UnpackSize = step.UnpackSize;
+          td.ResetPoint = step.ResetPoint;
+          td.TempBuffer.InitWriting();
+          td.ProgressSpec->Reinit();
+          td.Result = E_FAIL;
+          td.Start();
+        }
+
+        const CExtractStep &step = steps[stepIndex];
+        totalPacked += step.PackSize;
+        totalUnpacked += step.UnpackSize;
+
+        RINOK(folderOutStream->Init(step.StartFileIndex,
+            allFilesMode ? NULL : indices + step.ItemIndex,
+            step.NumFiles, step.NumDiscardBytes));
+
+        if (!step.NeedDecoding())
+        {
+          if (!folderOutStream->WasWritingFinished())
+            return E_FAIL;
+          continue;
+        }
+
+        CThreadFolderDecoder &td = threadDecoders[numFinished % numDecoders];
+        td.WaitExecuteFinish();
+        numFinished++;
+
+        HRESULT result = td.Result;
+        if (result == S_OK || result == S_FALSE || result == E_NOTIMPL)
+        {
+          // the data that was decoded before an error is written to files too
+          RINOK(td.TempBuffer.WriteToStream(outStream));
+        }
+
+        RINOK(ReportFolderResult(folderOutStream, callbackMessage, &callbackCS,
+            step.FolderIndex, result, td.DataAfterEnd_Error));
       }
-      
-      numSolidFiles = k - i;
-      
-      for (k = fileIndex; k < nextFile; k++)
-        curUnpacked += _db.Files[k].Size;
+
+      lps->InSize = totalPacked;
+      lps->OutSize = totalUnpacked;
+      return lps->SetCur();
     }
+  }
+
+  #endif
+
+  CDecoder decoder(useMixerMT);
+
+  UInt64 curPacked, curUnpacked;
+
+  for (UInt32 i = 0;; lps->OutSize += curUnpacked, lps->InSize += curPacked)
+  {
+    RINOK(lps->SetCur());
+
+    if (i >= numItems)
+      break;
+
+    CExtractStep step;
+    GetExtractStep(_db, indices, numItems, allFilesMode, i, step);
+
+    curUnpacked = step.UnpackSize;
+    curPacked = step.PackSize;
 
     {
-      HRESULT result = folderOutStream->Init(fileIndex,
+      HRESULT result = folderOutStream->Init(step.StartFileIndex,
           allFilesMode ? NULL : indices + i,
-          numSolidFiles);
+          step.NumFiles, step.NumDiscardBytes);
 
-      i += numSolidFiles;
+      i += step.NumFiles;
 
       RINOK(result);
     }
@@ -356,12 +744,23 @@ STDMETHODIMP CHandler::Extract(const UInt32 *indices, UInt32 numItems,
 
       bool dataAfterEnd_Error = false;
 
+      if (step.ResetPoint)
+      {
+        // the data before the point is counted as processed
+        lps->InSize += step.ResetPoint->PackPos;
+        lps->OutSize += step.ResetPoint->UnpackPos;
+        curPacked -= step.ResetPoint->PackPos;
+        curUnpacked -= step.ResetPoint->UnpackPos;
+        RINOK(lps->SetCur());
+      }
+
       HRESULT result = decoder.Decode(
           EXTERNAL_CODECS_VARS
           _inStream,
           _db.ArcInfo.DataStartPosition,
-          _db, folderIndex,
-          &curUnpacked,
+          _db, step.FolderIndex,
+          &step.UnpackSize,
+          step.ResetPoint,
 
           outStream,
           progress,
@@ -374,37 +773,8 @@ STDMETHODIMP CHandler::Extract(const UInt32 *indices, UInt32 numItems,
           #endif
           );
 
-      if (result == S_FALSE || result == E_NOTIMPL || dataAfterEnd_Error)
-      {
-        bool wasFinished = folderOutStream->WasWritingFinished();
-
-        int resOp = NExtract::NOperationResult::kDataError;
-        
-        if (result != S_FALSE)
-        {
-          if (result == E_NOTIMPL)
-            resOp = NExtract::NOperationResult::kUnsupportedMethod;
-          else if (wasFinished && dataAfterEnd_Error)
-            resOp = NExtract::NOperationResult::kDataAfterEnd;
-        }
-
-        RINOK(folderOutStream->FlushCorrupted(resOp));
-
-        if (wasFinished)
-        {
-          // we don't show error, if it's after required files
-          if (/* !folderOutStream->ExtraWriteWasCut && */ callbackMessage)
-          {
-            RINOK(callbackMessage->ReportExtractResult(NEventIndexType::kBlockIndex, folderIndex, resOp));
-          }
-        }
-        continue;
-      }
-      
-      if (result != S_OK)
-        return result;
-
-      RINOK(folderOutStream->FlushCorrupted(NExtract::NOperationResult::kDataError));
+      RINOK(ReportFolderResult(folderOutStream, callbackMessage, NULL,
+          step.FolderIndex, result, dataAfterEnd_Error));
       continue;
     }
     catch(...)
@@ -7,6 +7,16 @@
 namespace NArchive {
 namespace N7z {
 
+#ifndef _7ZIP_ST
+
+#define CALLBACK_LOCK NWindows::NSynchronization::COptCriticalSectionLock callbackLock(CallbackCS);
+
+#else
+
+#define CALLBACK_LOCK
+
+#endif
+
 void CFolderInStream::Init(IArchiveUpdateCallback *updateCallback,
     const UInt32 *indexes, unsigned numFiles)
 {
@@ -36,6 +46,7 @@ HRESULT CFolderInStream::OpenStream()
 
   while (_index < _numFiles)
   {
+    CALLBACK_LOCK
     CMyComPtr<ISequentialInStream> stream;
     HRESULT result = _updateCallback->GetStream(_indexes[_index], &stream);
     if (result != S_OK)
@@ -94,6 +105,7 @@ STDMETHODIMP CFolderInStream::Read(void *data, UInt32 size, UInt32 *processedSiz
         return S_OK;
       }
       
+      CALLBACK_LOCK
       _stream.Release();
       _index++;
       AddFileInfo(true);
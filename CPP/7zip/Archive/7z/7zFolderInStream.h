@@ -8,6 +8,10 @@
 #include "../../../Common/MyCom.h"
 #include "../../../Common/MyVector.h"
 
+#ifndef _7ZIP_ST
+#include "../../../Windows/Synchronization.h"
+#endif
+
 #include "../../ICoder.h"
 #include "../IArchive.h"
 
@@ -39,6 +43,13 @@ public:
   CRecordVector<UInt32> CRCs;
   CRecordVector<UInt64> Sizes;
 
+  #ifndef _7ZIP_ST
+  // if set, calls to _updateCallback are serialized with other folder streams
+  NWindows::NSynchronization::CCriticalSection *CallbackCS;
+
+  CFolderInStream(): CallbackCS(NULL) {}
+  #endif
+
   MY_UNKNOWN_IMP2(ISequentialInStream, ICompressGetSubStreamSize)
   STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize);
   STDMETHOD(GetSubStreamSize)(UInt64 subStream, UInt64 *value);
@@ -55,8 +55,10 @@ public:
   CBoolPair Write_Attrib;
 
   bool _useMultiThreadMixer;
+  UInt32 _numFolderThreads;
 
   bool _removeSfxBlock;
+  bool _appendMode;
   
   // bool _volumeMode;
 
@@ -270,6 +270,23 @@ STDMETHODIMP CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
   if (db && !db->CanUpdate())
     return E_NOTIMPL;
 
+  if (_appendMode)
+  {
+    /* In append mode (outStream) must be the stream of opened archive.
+       We check the size to reject the stream of new empty file. */
+    if (!db || _removeSfxBlock)
+      return E_INVALIDARG;
+    CMyComPtr<IOutStream> outSeekStream;
+    outStream->QueryInterface(IID_IOutStream, (void **)&outSeekStream);
+    if (!outSeekStream)
+      return E_NOTIMPL;
+    UInt64 inSize, outSize;
+    RINOK(_inStream->Seek(0, STREAM_SEEK_END, &inSize));
+    RINOK(outSeekStream->Seek(0, STREAM_SEEK_END, &outSize));
+    if (inSize != outSize || outSize < db->ArcInfo.StartPosition + db->PhySize)
+      return E_INVALIDARG;
+  }
+
   /*
   CMyComPtr<IArchiveGetRawProps> getRawProps;
   updateCallback->QueryInterface(IID_IArchiveGetRawProps, (void **)&getRawProps);
@@ -294,10 +311,10 @@ STDMETHODIMP CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
   
   if (db && !db->Files.IsEmpty())
   {
-    if (!Write_CTime.Def) need_CTime = !db->CTime.Defs.IsEmpty();
-    if (!Write_ATime.Def) need_ATime = !db->ATime.Defs.IsEmpty();
-    if (!Write_MTime.Def) need_MTime = !db->MTime.Defs.IsEmpty();
-    if (!Write_Attrib.Def) need_Attrib = !db->Attrib.Defs.IsEmpty();
+    if (!Write_CTime.Def) need_CTime = !db->CTime.IsEmpty();
+    if (!Write_ATime.Def) need_ATime = !db->ATime.IsEmpty();
+    if (!Write_MTime.Def) need_MTime = !db->MTime.IsEmpty();
+    if (!Write_Attrib.Def) need_Attrib = !db->Attrib.IsEmpty();
   }
 
   // UString s;
@@ -550,9 +567,19 @@ STDMETHODIMP CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
 
   CCompressionMethodMode methodMode, headerMethod;
 
+  #ifndef _7ZIP_ST
+  // the thread budget is shared between the concurrently compressed solid blocks
+  UInt32 numFolderThreads = _numFolderThreads;
+  if (numFolderThreads > _numThreads)
+    numFolderThreads = _numThreads;
+  if (numFolderThreads == 0)
+    numFolderThreads = 1;
+  const UInt32 numMethodThreads = _numThreads / numFolderThreads;
+  #endif
+
   HRESULT res = SetMainMethod(methodMode
     #ifndef _7ZIP_ST
-    , _numThreads
+    , numMethodThreads
     #endif
     );
   RINOK(res);
@@ -560,7 +587,7 @@ STDMETHODIMP CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
   RINOK(SetHeaderMethod(headerMethod));
   
   #ifndef _7ZIP_ST
-  methodMode.NumThreads = _numThreads;
+  methodMode.NumThreads = numMethodThreads;
   methodMode.MultiThreadMixer = _useMultiThreadMixer;
   headerMethod.NumThreads = 1;
   headerMethod.MultiThreadMixer = _useMultiThreadMixer;
@@ -636,9 +663,13 @@ STDMETHODIMP CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
   options.UseTypeSorting = _useTypeSorting;
 
   options.RemoveSfxBlock = _removeSfxBlock;
+  options.AppendMode = _appendMode;
   // options.VolumeMode = _volumeMode;
 
   options.MultiThreadMixer = _useMultiThreadMixer;
+  #ifndef _7ZIP_ST
+  options.NumFolderThreads = numFolderThreads;
+  #endif
 
   COutArchive archive;
   CArchiveDatabaseOut newDatabase;
@@ -709,6 +740,7 @@ static HRESULT ParseBond(UString &srcString, UInt32 &coder, UInt32 &stream)
 void COutHandler::InitProps7z()
 {
   _removeSfxBlock = false;
+  _appendMode = false;
   _compressHeaders = true;
   _encryptHeadersSpecified = false;
   _encryptHeaders = false;
@@ -720,6 +752,7 @@ void COutHandler::InitProps7z()
   Write_Attrib.Init();
 
   _useMultiThreadMixer = true;
+  _numFolderThreads = 1;
 
   // _volumeMode = false;
 
@@ -834,6 +867,7 @@ HRESULT COutHandler::SetProperty(const wchar_t *nameSpec, const PROPVARIANT &val
   if (index == 0)
   {
     if (name.IsEqualTo("rsfx")) return PROPVARIANT_to_bool(value, _removeSfxBlock);
+    if (name.IsEqualTo("ap")) return PROPVARIANT_to_bool(value, _appendMode);
     if (name.IsEqualTo("hc")) return PROPVARIANT_to_bool(value, _compressHeaders);
     // if (name.IsEqualToNoCase(L"HS")) return PROPVARIANT_to_bool(value, _useParents);
     
@@ -858,6 +892,7 @@ HRESULT COutHandler::SetProperty(const wchar_t *nameSpec, const PROPVARIANT &val
     if (name.IsEqualTo("tr")) return PROPVARIANT_to_BoolPair(value, Write_Attrib);
     
     if (name.IsEqualTo("mtf")) return PROPVARIANT_to_bool(value, _useMultiThreadMixer);
+    if (name.IsEqualTo("mtb")) return ParsePropToUInt32(UString(), value, _numFolderThreads);
 
     if (name.IsEqualTo("qs")) return PROPVARIANT_to_bool(value, _useTypeSorting);
 
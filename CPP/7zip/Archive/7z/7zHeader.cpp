@@ -11,6 +11,7 @@ Byte kSignature[kSignatureSize] = {'7', 'z', 0xBC, 0xAF, 0x27, 0x1C};
 #ifdef _7Z_VOL
 Byte kFinishSignature[kSignatureSize] = {'7', 'z', 0xBC, 0xAF, 0x27, 0x1C + 1};
 #endif
+Byte kAppendSignature[kSignatureSize] = {'7', 'z', 'A', 'p', 'p', 0x1A};
 
 // We can change signature. So file doesn't contain correct signature.
 // struct SignatureInitializer { SignatureInitializer() { kSignature[0]--; } };
@@ -21,6 +21,12 @@ extern Byte kSignature[kSignatureSize];
 extern Byte kFinishSignature[kSignatureSize];
 #endif
 
+/* Append mode writes a marker at the old end of archive before new data.
+   The marker is a copy of the old start header with kAppendSignature,
+   so the tail left by an interrupted append can be recognized. */
+extern Byte kAppendSignature[kSignatureSize];
+const unsigned kAppendMarkerSize = 32;
+
 struct CArchiveVersion
 {
   Byte Major;
@@ -88,11 +94,13 @@ namespace NID
     kEncodedHeader,
 
     kStartPos,
-    kDummy
+    kDummy,
 
     // kNtSecure,
     // kParent,
     // kIsAux
+
+    kResetPoints = 0x40 // in kUnpackInfo. Older versions skip it.
   };
 }
 
@@ -459,6 +459,34 @@ void CFolders::ParseFolderInfo(unsigned folderIndex, CFolder &folder) const
     throw 20120424;
 }
 
+const CResetPoint *CFolders::FindResetPoint(unsigned folderIndex, UInt64 unpackPos) const
+{
+  unsigned num = GetNumResetPoints(folderIndex);
+  if (num == 0
+      || FoStartPackStreamIndex[folderIndex + 1] - FoStartPackStreamIndex[folderIndex] != 1
+      || GetNumFolderUnpackSizes(folderIndex) != 1)
+    return NULL;
+  
+  const CResetPoint *points = &ResetPoints[FoStartResetPointIndex[folderIndex]];
+  unsigned left = 0, right = num;
+  while (left != right)
+  {
+    unsigned mid = (left + right) / 2;
+    if (points[mid].UnpackPos <= unpackPos)
+      left = mid + 1;
+    else
+      right = mid;
+  }
+  if (left == 0)
+    return NULL;
+  
+  const CResetPoint *point = &points[left - 1];
+  if (point->UnpackPos >= GetFolderUnpackSize(folderIndex)
+      || point->PackPos >= GetStreamPackSize(FoStartPackStreamIndex[folderIndex]))
+    return NULL;
+  return point;
+}
+
 
 void CDatabase::GetPath(unsigned index, UString &path) const
 {
@@ -818,10 +846,54 @@ void CInArchive::ReadUnpackInfo(
       ReadHashDigests(numFolders, folders.FolderCRCs);
       continue;
     }
+    if (type == NID::kResetPoints)
+    {
+      ReadResetPoints(folders);
+      continue;
+    }
     SkipData();
   }
 }
 
+void CInArchive::ReadResetPoints(CFolders &folders)
+{
+  const UInt64 size = ReadNumber();
+  if (size > _inByteBack->GetRem())
+    ThrowIncorrect();
+  CStreamSwitch streamSwitch;
+  streamSwitch.Set(this, _inByteBack->GetPtr(), (size_t)size, true);
+
+  const CNum numFolders = folders.NumFolders;
+  folders.FoStartResetPointIndex.Alloc(numFolders + 1);
+  folders.ResetPoints.Clear();
+
+  for (CNum i = 0; i < numFolders; i++)
+  {
+    folders.FoStartResetPointIndex[i] = folders.ResetPoints.Size();
+    CNum numPoints = ReadNum();
+    if (numPoints > _inByteBack->GetRem() / 2)
+      ThrowIncorrect();
+    CResetPoint point;
+    point.PackPos = 0;
+    point.UnpackPos = 0;
+    for (CNum k = 0; k < numPoints; k++)
+    {
+      const UInt64 packDelta = ReadNumber();
+      const UInt64 unpackDelta = ReadNumber();
+      // the start of folder is not stored, and points are sorted
+      if (packDelta == 0 || unpackDelta == 0
+          || point.PackPos + packDelta < packDelta
+          || point.UnpackPos + unpackDelta < unpackDelta)
+        ThrowIncorrect();
+      point.PackPos += packDelta;
+      point.UnpackPos += unpackDelta;
+      folders.ResetPoints.Add(point);
+    }
+  }
+  
+  folders.FoStartResetPointIndex[numFolders] = folders.ResetPoints.Size();
+}
+
 void CInArchive::ReadSubStreamsInfo(
     CFolders &folders,
     CRecordVector<UInt64> &unpackSizes,
@@ -1047,25 +1119,87 @@ void CInArchive::ReadBoolVector2(unsigned numItems, CBoolVector &v)
     p[i] = true;
 }
 
-void CInArchive::ReadUInt64DefVector(const CObjectVector<CByteBuffer> &dataVector,
-    CUInt64DefVector &v, unsigned numItems)
+static const Byte k_NumBits_In_Nibble[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+#define NUM_BITS_IN_BYTE(b) (k_NumBits_In_Nibble[(b) & 0xF] + k_NumBits_In_Nibble[(b) >> 4])
+
+const Byte *CPackedDefVector::GetValPtr(unsigned index, unsigned valSize) const
 {
-  ReadBoolVector2(numItems, v.Defs);
+  size_t pos = index;
+  if (DefBits)
+  {
+    pos = GroupStart[index >> kDefGroupBits];
+    const Byte *p = DefBits + ((index >> kDefGroupBits) << (kDefGroupBits - 3));
+    unsigned rem = index & (((unsigned)1 << kDefGroupBits) - 1);
+    for (; rem >= 8; rem -= 8, p++)
+      pos += NUM_BITS_IN_BYTE(*p);
+    if (rem != 0)
+    {
+      unsigned b = (unsigned)*p >> (8 - rem);
+      pos += NUM_BITS_IN_BYTE(b);
+    }
+  }
+  return Vals + pos * valSize;
+}
 
-  CStreamSwitch streamSwitch;
-  streamSwitch.Set(this, &dataVector);
-  
-  v.Vals.ClearAndSetSize(numItems);
-  UInt64 *p = &v.Vals[0];
-  const bool *defs = &v.Defs[0];
+bool CPackedUInt64Vector::GetItem(unsigned index, UInt64 &value) const
+{
+  if (ValidAndDefined(index))
+  {
+    value = Get64(GetValPtr(index, 8));
+    return true;
+  }
+  value = 0;
+  return false;
+}
 
-  for (unsigned i = 0; i < numItems; i++)
+bool CPackedUInt32Vector::GetItem(unsigned index, UInt32 &value) const
+{
+  if (ValidAndDefined(index))
   {
-    UInt64 t = 0;
-    if (defs[i])
-      t = ReadUInt64();
-    p[i] = t;
+    value = Get32(GetValPtr(index, 4));
+    return true;
+  }
+  value = 0;
+  return false;
+}
+
+void CInArchive::ReadPackedDefVector(const CObjectVector<CByteBuffer> &dataVector,
+    CPackedDefVector &v, unsigned numItems, unsigned valSize)
+{
+  v.Clear();
+  
+  size_t numDefined = numItems;
+  Byte allAreDefined = ReadByte();
+  if (allAreDefined == 0)
+  {
+    const size_t numBytes = ((size_t)numItems + 7) >> 3;
+    if (numBytes > _inByteBack->GetRem())
+      ThrowEndOfData();
+    const Byte *p = _inByteBack->GetPtr();
+    _inByteBack->SkipDataNoCheck(numBytes);
+    v.DefBits = p;
+    v.GroupStart.Alloc((numItems >> kDefGroupBits) + 1);
+    numDefined = 0;
+    for (size_t i = 0; i < numBytes; i++)
+    {
+      if ((i & ((1 << (kDefGroupBits - 3)) - 1)) == 0)
+        v.GroupStart[i >> (kDefGroupBits - 3)] = (CNum)numDefined;
+      unsigned b = p[i];
+      if (i == numBytes - 1 && (numItems & 7) != 0)
+        b &= (0xFF << (8 - (numItems & 7))) & 0xFF;
+      numDefined += NUM_BITS_IN_BYTE(b);
+    }
   }
+
+  CStreamSwitch streamSwitch;
+  streamSwitch.Set(this, &dataVector);
+  
+  if (numDefined > _inByteBack->GetRem() / valSize)
+    ThrowEndOfData();
+  v.Vals = _inByteBack->GetPtr();
+  _inByteBack->SkipDataNoCheck(numDefined * valSize);
+  v.Size = numItems;
 }
 
 HRESULT CInArchive::ReadAndDecodePackedStreams(
@@ -1107,6 +1241,7 @@ HRESULT CInArchive::ReadAndDecodePackedStreams(
         _stream, baseOffset + dataOffset,
         folders, i,
         NULL, // *unpackSize
+        NULL, // *startPoint
         
         outStream,
         NULL, // *compressProgress
@@ -1152,7 +1287,7 @@ HRESULT CInArchive::ReadHeader(
     type = ReadID();
   }
  
-  CObjectVector<CByteBuffer> dataVector;
+  CObjectVector<CByteBuffer> &dataVector = db.HeaderDataVector;
   
   if (type == NID::kAdditionalStreamsInfo)
   {
@@ -1219,17 +1354,17 @@ HRESULT CInArchive::ReadHeader(
         CStreamSwitch streamSwitch;
         streamSwitch.Set(this, &dataVector);
         size_t rem = _inByteBack->GetRem();
-        db.NamesBuf.Alloc(rem);
-        ReadBytes(db.NamesBuf, rem);
+        db.NamesBuf = _inByteBack->GetPtr();
+        _inByteBack->SkipRem();
         db.NameOffsets.Alloc(numFiles + 1);
         size_t pos = 0;
         unsigned i;
         for (i = 0; i < numFiles; i++)
         {
           size_t curRem = (rem - pos) / 2;
-          const UInt16 *buf = (const UInt16 *)(db.NamesBuf + pos);
+          const Byte *buf = db.NamesBuf + pos;
           size_t j;
-          for (j = 0; j < curRem && buf[j] != 0; j++);
+          for (j = 0; j < curRem && Get16(buf + j * 2) != 0; j++);
           if (j == curRem)
             ThrowEndOfData();
           db.NameOffsets[i] = pos / 2;
@@ -1241,14 +1376,7 @@ HRESULT CInArchive::ReadHeader(
         break;
       }
 
-      case NID::kWinAttrib:
-      {
-        ReadBoolVector2(numFiles, db.Attrib.Defs);
-        CStreamSwitch streamSwitch;
-        streamSwitch.Set(this, &dataVector);
-        Read_UInt32_Vector(db.Attrib);
-        break;
-      }
+      case NID::kWinAttrib:  ReadPackedDefVector(dataVector, db.Attrib, (unsigned)numFiles, 4); break;
       
       /*
       case NID::kIsAux:
@@ -1290,10 +1418,10 @@ HRESULT CInArchive::ReadHeader(
       }
       case NID::kEmptyFile:  ReadBoolVector(numEmptyStreams, emptyFileVector); break;
       case NID::kAnti:  ReadBoolVector(numEmptyStreams, antiFileVector); break;
-      case NID::kStartPos:  ReadUInt64DefVector(dataVector, db.StartPos, (unsigned)numFiles); break;
-      case NID::kCTime:  ReadUInt64DefVector(dataVector, db.CTime, (unsigned)numFiles); break;
-      case NID::kATime:  ReadUInt64DefVector(dataVector, db.ATime, (unsigned)numFiles); break;
-      case NID::kMTime:  ReadUInt64DefVector(dataVector, db.MTime, (unsigned)numFiles); break;
+      case NID::kStartPos:  ReadPackedDefVector(dataVector, db.StartPos, (unsigned)numFiles, 8); break;
+      case NID::kCTime:  ReadPackedDefVector(dataVector, db.CTime, (unsigned)numFiles, 8); break;
+      case NID::kATime:  ReadPackedDefVector(dataVector, db.ATime, (unsigned)numFiles, 8); break;
+      case NID::kMTime:  ReadPackedDefVector(dataVector, db.MTime, (unsigned)numFiles, 8); break;
       case NID::kDummy:
       {
         for (UInt64 j = 0; j < size; j++)
@@ -1583,7 +1711,8 @@ HRESULT CInArchive::ReadDatabase2(
   size_t nextHeaderSize_t = (size_t)nextHeaderSize;
   if (nextHeaderSize_t != nextHeaderSize)
     return E_OUTOFMEMORY;
-  CByteBuffer buffer2(nextHeaderSize_t);
+  CByteBuffer &buffer2 = db.HeaderBufs.AddNew();
+  buffer2.Alloc(nextHeaderSize_t);
 
   RINOK(ReadStream_FALSE(_stream, buffer2, nextHeaderSize_t));
 
@@ -1596,8 +1725,6 @@ HRESULT CInArchive::ReadDatabase2(
   CStreamSwitch streamSwitch;
   streamSwitch.Set(this, buffer2);
   
-  CObjectVector<CByteBuffer> dataVector;
-  
   UInt64 type = ReadID();
   if (type != NID::kHeader)
   {
@@ -1607,16 +1734,17 @@ HRESULT CInArchive::ReadDatabase2(
         EXTERNAL_CODECS_LOC_VARS
         db.ArcInfo.StartPositionAfterHeader,
         db.ArcInfo.DataStartPosition2,
-        dataVector
+        db.HeaderBufs
         _7Z_DECODER_CRYPRO_VARS
         );
     RINOK(result);
-    if (dataVector.Size() == 0)
+    if (db.HeaderBufs.Size() == 1)
       return S_OK;
-    if (dataVector.Size() > 1)
+    if (db.HeaderBufs.Size() > 2)
       ThrowIncorrect();
     streamSwitch.Remove();
-    streamSwitch.Set(this, dataVector.Front());
+    buffer2.Free();
+    streamSwitch.Set(this, db.HeaderBufs.Back());
     if (ReadID() != NID::kHeader)
       ThrowIncorrect();
   }
@@ -63,6 +63,9 @@ struct CFolders
   CObjArray<size_t> FoCodersDataOffset;    // NumFolders + 1
   CByteBuffer CodersData;
 
+  CObjArray<CNum> FoStartResetPointIndex;  // NumFolders + 1, if reset points are defined
+  CRecordVector<CResetPoint> ResetPoints;
+
   CParsedMethods ParsedMethods;
 
   void ParseFolderInfo(unsigned folderIndex, CFolder &folder) const;
@@ -87,6 +90,16 @@ struct CFolders
     return PackPositions[index + 1] - PackPositions[index];
   }
 
+  unsigned GetNumResetPoints(unsigned folderIndex) const
+  {
+    if (!FoStartResetPointIndex)
+      return 0;
+    return (unsigned)(FoStartResetPointIndex[folderIndex + 1] - FoStartResetPointIndex[folderIndex]);
+  }
+
+  // returns NULL, if decoding of folder can't start after its beginning
+  const CResetPoint *FindResetPoint(unsigned folderIndex, UInt64 unpackPos) const;
+
   CFolders(): NumPackStreams(0), NumFolders(0) {}
 
   void Clear()
@@ -104,18 +117,68 @@ struct CFolders
     FoToMainUnpackSizeIndex.Free();
     FoCodersDataOffset.Free();
     CodersData.Free();
+    FoStartResetPointIndex.Free();
+    ResetPoints.Clear();
+  }
+};
+
+/*
+  CPackedDefVector refers to a vector of file properties in the header buffer.
+  The values are not copied out of the header: an item is parsed, when it's requested.
+  If some items are not defined, we store the number of defined items
+  before each group of (1 << kDefGroupBits) items to locate the value.
+*/
+
+const unsigned kDefGroupBits = 8;
+
+struct CPackedDefVector
+{
+  const Byte *DefBits;        // NULL, if all items are defined
+  const Byte *Vals;           // values of defined items
+  unsigned Size;              // 0, if the property is not stored
+  CObjArray<CNum> GroupStart; // if (DefBits)
+
+  CPackedDefVector(): DefBits(NULL), Vals(NULL), Size(0) {}
+
+  void Clear()
+  {
+    DefBits = NULL;
+    Vals = NULL;
+    Size = 0;
+    GroupStart.Free();
   }
+
+  bool IsEmpty() const { return Size == 0; }
+
+  bool ValidAndDefined(unsigned index) const
+  {
+    return index < Size && (!DefBits || ((DefBits[index >> 3] >> (7 - (index & 7))) & 1) != 0);
+  }
+  
+  const Byte *GetValPtr(unsigned index, unsigned valSize) const;
+};
+
+struct CPackedUInt64Vector: public CPackedDefVector
+{
+  bool GetItem(unsigned index, UInt64 &value) const;
+};
+
+struct CPackedUInt32Vector: public CPackedDefVector
+{
+  bool GetItem(unsigned index, UInt32 &value) const;
 };
 
 struct CDatabase: public CFolders
 {
+  // CFileItem is 16 bytes (Size, Crc, flags) that are used together,
+  // so Files stays a record vector. Other properties are parsed on access.
   CRecordVector<CFileItem> Files;
 
-  CUInt64DefVector CTime;
-  CUInt64DefVector ATime;
-  CUInt64DefVector MTime;
-  CUInt64DefVector StartPos;
-  CUInt32DefVector Attrib;
+  CPackedUInt64Vector CTime;
+  CPackedUInt64Vector ATime;
+  CPackedUInt64Vector MTime;
+  CPackedUInt64Vector StartPos;
+  CPackedUInt32Vector Attrib;
   CBoolVector IsAnti;
   /*
   CBoolVector IsAux;
@@ -123,9 +186,16 @@ struct CDatabase: public CFolders
   CRecordVector<UInt32> SecureIDs;
   */
 
-  CByteBuffer NamesBuf;
+  const Byte *NamesBuf;           // utf-16 names in header buffer
   CObjArray<size_t> NameOffsets; // numFiles + 1, offsets of utf-16 symbols
 
+  // the buffers of header and of its additional streams.
+  // NamesBuf and packed property vectors point to data in these buffers.
+  CObjectVector<CByteBuffer> HeaderBufs;
+  CObjectVector<CByteBuffer> HeaderDataVector;
+
+  CDatabase(): NamesBuf(NULL) {}
+
   /*
   void ClearSecure()
   {
@@ -139,7 +209,7 @@ struct CDatabase: public CFolders
     CFolders::Clear();
     // ClearSecure();
 
-    NamesBuf.Free();
+    NamesBuf = NULL;
     NameOffsets.Free();
     
     Files.Clear();
@@ -150,6 +220,9 @@ struct CDatabase: public CFolders
     Attrib.Clear();
     IsAnti.Clear();
     // IsAux.Clear();
+
+    HeaderBufs.Clear();
+    HeaderDataVector.Clear();
   }
 
   bool IsSolid() const
@@ -268,7 +341,7 @@ struct CDbEx: public CDatabase
   }
 
   void FillLinks();
-  
+
   UInt64 GetFolderStreamPos(CNum folderIndex, unsigned indexInFolder) const
   {
     return ArcInfo.DataStartPosition +
@@ -391,6 +464,7 @@ class CInArchive
   void ReadUnpackInfo(
       const CObjectVector<CByteBuffer> *dataVector,
       CFolders &folders);
+  void ReadResetPoints(CFolders &folders);
   
   void ReadSubStreamsInfo(
       CFolders &folders,
@@ -406,8 +480,8 @@ class CInArchive
 
   void ReadBoolVector(unsigned numItems, CBoolVector &v);
   void ReadBoolVector2(unsigned numItems, CBoolVector &v);
-  void ReadUInt64DefVector(const CObjectVector<CByteBuffer> &dataVector,
-      CUInt64DefVector &v, unsigned numItems);
+  void ReadPackedDefVector(const CObjectVector<CByteBuffer> &dataVector,
+      CPackedDefVector &v, unsigned numItems, unsigned valSize);
   HRESULT ReadAndDecodePackedStreams(
       DECL_EXTERNAL_CODECS_LOC_VARS
       UInt64 baseOffset, UInt64 &dataOffset,
@@ -90,6 +90,16 @@ public:
 };
 
 
+// position in the pack stream of a single-coder folder, where the coder can start decoding again
+// without the preceding data (a dictionary reset of LZMA2)
+
+struct CResetPoint
+{
+  UInt64 PackPos;
+  UInt64 UnpackPos;
+};
+
+
 struct CUInt32DefVector
 {
   CBoolVector Defs;
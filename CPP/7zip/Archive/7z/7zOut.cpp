@@ -77,6 +77,7 @@ HRESULT COutArchive::WriteFinishHeader(const CFinishHeader &h)
 HRESULT COutArchive::Create(ISequentialOutStream *stream, bool endMarker)
 {
   Close();
+  _appendMode = false;
   #ifdef _7Z_VOL
   // endMarker = false;
   _endMarker = endMarker;
@@ -113,6 +114,32 @@ HRESULT COutArchive::Create(ISequentialOutStream *stream, bool endMarker)
   return S_OK;
 }
 
+HRESULT COutArchive::CreateAppend(ISequentialOutStream *stream, UInt64 startPos, UInt64 appendPos,
+    const Byte *appendMarker)
+{
+  Close();
+  #ifdef _7Z_VOL
+  _endMarker = false;
+  #endif
+  _appendMode = true;
+  SeqStream = stream;
+  SeqStream.QueryInterface(IID_IOutStream, &Stream);
+  if (!Stream)
+    return E_NOTIMPL;
+  _prefixHeaderPos = startPos + kSignatureSize + 2;
+  RINOK(Stream->Seek(appendPos, STREAM_SEEK_SET, NULL));
+  return WriteDirect(appendMarker, kAppendMarkerSize);
+}
+
+HRESULT COutArchive::FlushStream()
+{
+  CMyComPtr<IOutStreamFlush> flushStream;
+  Stream.QueryInterface(IID_IOutStreamFlush, &flushStream);
+  if (flushStream)
+    return flushStream->Flush();
+  return S_OK;
+}
+
 void COutArchive::Close()
 {
   SeqStream.Release();
@@ -391,10 +418,65 @@ void COutArchive::WriteUnpackInfo(const CObjectVector<CFolder> &folders, const C
     WriteNumber(outFolders.CoderUnpackSizes[i]);
   
   WriteHashDigests(outFolders.FolderUnpackCRCs);
+
+  WriteResetPoints(folders.Size(), outFolders);
   
   WriteByte(NID::kEnd);
 }
 
+void COutArchive::WriteResetPoints(unsigned numFolders, const COutFolders &outFolders)
+{
+  const CRecordVector<CNum> &pointFolders = outFolders.ResetPointFolders;
+  const CRecordVector<CResetPoint> &points = outFolders.ResetPoints;
+  if (points.IsEmpty())
+    return;
+
+  // for each folder: the number of points, and then the deltas of their positions.
+  // (dataSize) must be exact: older versions skip the property with SkipData().
+  
+  UInt64 dataSize = 0;
+  unsigned i;
+  unsigned k = 0;
+  
+  for (i = 0; i < numFolders; i++)
+  {
+    CNum num = 0;
+    UInt64 packPos = 0;
+    UInt64 unpackPos = 0;
+    for (; k < points.Size() && pointFolders[k] == i; k++, num++)
+    {
+      const CResetPoint &p = points[k];
+      dataSize += GetBigNumberSize(p.PackPos - packPos) + GetBigNumberSize(p.UnpackPos - unpackPos);
+      packPos = p.PackPos;
+      unpackPos = p.UnpackPos;
+    }
+    dataSize += GetBigNumberSize(num);
+  }
+
+  WriteByte(NID::kResetPoints);
+  WriteNumber(dataSize);
+  
+  k = 0;
+  
+  for (i = 0; i < numFolders; i++)
+  {
+    unsigned start = k;
+    while (k < points.Size() && pointFolders[k] == i)
+      k++;
+    WriteNumber(k - start);
+    UInt64 packPos = 0;
+    UInt64 unpackPos = 0;
+    for (; start < k; start++)
+    {
+      const CResetPoint &p = points[start];
+      WriteNumber(p.PackPos - packPos);
+      WriteNumber(p.UnpackPos - unpackPos);
+      packPos = p.PackPos;
+      unpackPos = p.UnpackPos;
+    }
+  }
+}
+
 void COutArchive::WriteSubStreamsInfo(const CObjectVector<CFolder> &folders,
     const COutFolders &outFolders,
     const CRecordVector<UInt64> &unpackSizes,
@@ -855,8 +937,20 @@ HRESULT COutArchive::WriteDatabase(
     h.NextHeaderSize = headerSize;
     h.NextHeaderCRC = headerCRC;
     h.NextHeaderOffset = headerOffset;
+    if (_appendMode)
+    {
+      /* Old start header still refers to old header that was not overwritten.
+         So the archive stays consistent, if we are interrupted before that point. */
+      UInt64 endPos;
+      RINOK(Stream->Seek(0, STREAM_SEEK_CUR, &endPos));
+      RINOK(Stream->SetSize(endPos));
+      RINOK(FlushStream());
+    }
     RINOK(Stream->Seek(_prefixHeaderPos, STREAM_SEEK_SET, NULL));
-    return WriteStartHeader(h);
+    RINOK(WriteStartHeader(h));
+    if (_appendMode)
+      return FlushStream();
+    return S_OK;
   }
 }
 
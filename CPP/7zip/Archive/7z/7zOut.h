@@ -104,11 +104,22 @@ struct COutFolders
   CRecordVector<CNum> NumUnpackStreamsVector;
   CRecordVector<UInt64> CoderUnpackSizes; // including unpack sizes of bond coders
 
+  CRecordVector<CNum> ResetPointFolders;   // folder index of each reset point, in increasing order
+  CRecordVector<CResetPoint> ResetPoints;
+
+  void AddResetPoint(CNum folderIndex, const CResetPoint &point)
+  {
+    ResetPointFolders.Add(folderIndex);
+    ResetPoints.Add(point);
+  }
+
   void OutFoldersClear()
   {
     FolderUnpackCRCs.Clear();
     NumUnpackStreamsVector.Clear();
     CoderUnpackSizes.Clear();
+    ResetPointFolders.Clear();
+    ResetPoints.Clear();
   }
 
   void OutFoldersReserveDown()
@@ -116,6 +127,8 @@ struct COutFolders
     FolderUnpackCRCs.ReserveDown();
     NumUnpackStreamsVector.ReserveDown();
     CoderUnpackSizes.ReserveDown();
+    ResetPointFolders.ReserveDown();
+    ResetPoints.ReserveDown();
   }
 };
 
@@ -268,6 +281,7 @@ class COutArchive
   void WriteUnpackInfo(
       const CObjectVector<CFolder> &folders,
       const COutFolders &outFolders);
+  void WriteResetPoints(unsigned numFolders, const COutFolders &outFolders);
 
   void WriteSubStreamsInfo(
       const CObjectVector<CFolder> &folders,
@@ -300,6 +314,7 @@ class COutArchive
   #endif
 
   bool _useAlign;
+  bool _appendMode;
 
   HRESULT WriteSignature();
   #ifdef _7Z_VOL
@@ -309,12 +324,19 @@ class COutArchive
   #ifdef _7Z_VOL
   HRESULT WriteFinishHeader(const CFinishHeader &h);
   #endif
+  HRESULT FlushStream();
   CMyComPtr<IOutStream> Stream;
 public:
 
-  COutArchive() { _outByte.Create(1 << 16); }
+  COutArchive(): _appendMode(false) { _outByte.Create(1 << 16); }
   CMyComPtr<ISequentialOutStream> SeqStream;
   HRESULT Create(ISequentialOutStream *stream, bool endMarker);
+  
+  /* (stream) contains existing archive that starts at (startPos).
+     (appendMarker) is written at (appendPos) and new data follows it. The start header is
+     changed only after the new header was flushed. */
+  HRESULT CreateAppend(ISequentialOutStream *stream, UInt64 startPos, UInt64 appendPos,
+      const Byte *appendMarker);
   void Close();
   HRESULT SkipPrefixArchiveHeader();
   HRESULT WriteDatabase(
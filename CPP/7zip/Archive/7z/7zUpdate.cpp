@@ -7,8 +7,11 @@
 #include "../../../Common/Wildcard.h"
 
 #include "../../Common/CreateCoder.h"
+#include "../../Common/InOutTempBuffer.h"
 #include "../../Common/LimitedStreams.h"
+#include "../../Common/ProgressMt.h"
 #include "../../Common/ProgressUtils.h"
+#include "../../Common/StreamUtils.h"
 
 #include "../../Compress/CopyCoder.h"
 
@@ -1498,6 +1501,7 @@ void CThreadDecoder::Execute()
       
       // send_UnpackSize ? &UnpackSize : NULL,
       NULL, // unpackSize : FULL unpack
+      NULL, // startPoint
       
       Fos,
       NULL, // compressProgress
@@ -1527,6 +1531,84 @@ void CThreadDecoder::Execute()
 
 #endif
 
+struct CSolidFolderRange
+{
+  unsigned StartIndex;
+  unsigned NumFiles;
+  UInt64 UnpackSize;
+};
+
+#ifndef _7ZIP_ST
+
+class CThreadEncoder: public CVirtThread
+{
+public:
+  CEncoder *Encoder;
+  HRESULT Result;
+
+  CFolderInStream *InStreamSpec;
+  CMyComPtr<ISequentialInStream> InStream;
+
+  CInOutTempBuffer TempBuffer;
+  CSequentialOutTempBufferImp *OutStreamSpec;
+  CMyComPtr<ISequentialOutStream> OutStream;
+
+  CMtCompressProgress *ProgressSpec;
+  CMyComPtr<ICompressProgressInfo> Progress;
+
+  UInt64 InSizeForReduce;
+  UInt64 UnpackSize;
+  CFolder *Folder;
+  CRecordVector<UInt64> CoderUnpackSizes;
+  CRecordVector<UInt64> PackSizes;
+
+  DECL_EXTERNAL_CODECS_LOC_VARS2;
+
+  CThreadEncoder():
+      Encoder(NULL),
+      Result(E_FAIL),
+      InSizeForReduce(0),
+      UnpackSize(0),
+      Folder(NULL)
+  {
+    InStreamSpec = new CFolderInStream;
+    InStream = InStreamSpec;
+    TempBuffer.Create();
+    OutStreamSpec = new CSequentialOutTempBufferImp;
+    OutStream = OutStreamSpec;
+    OutStreamSpec->Init(&TempBuffer);
+    ProgressSpec = new CMtCompressProgress;
+    Progress = ProgressSpec;
+  }
+
+  ~CThreadEncoder()
+  {
+    CVirtThread::WaitThreadFinish();
+    delete Encoder;
+  }
+
+  virtual void Execute();
+};
+
+void CThreadEncoder::Execute()
+{
+  try
+  {
+    Result = Encoder->Encode(
+        EXTERNAL_CODECS_LOC_VARS
+        InStream,
+        &InSizeForReduce,
+        *Folder, CoderUnpackSizes, UnpackSize,
+        OutStream, PackSizes, Progress);
+  }
+  catch(...)
+  {
+    Result = E_FAIL;
+  }
+}
+
+#endif
+
 #ifndef _NO_CRYPTO
 
 class CCryptoGetTextPassword:
@@ -1560,6 +1642,223 @@ static void GetFile(const CDatabase &inDb, unsigned index, CFileItem &file, CFil
   // file2.IsAux = inDb.IsItemAux(index);
 }
 
+// it adds the reset points of folder that was encoded last
+
+static HRESULT AddResetPoints(CEncoder &encoder, CArchiveDatabaseOut &newDatabase, CNum folderIndex)
+{
+  CRecordVector<CResetPoint> points;
+  RINOK(encoder.GetResetPoints(points));
+  FOR_VECTOR (i, points)
+    newDatabase.AddResetPoint(folderIndex, points[i]);
+  return S_OK;
+}
+
+static HRESULT AddResetPoints(CEncoder &encoder, CArchiveDatabaseOut &newDatabase)
+{
+  return AddResetPoints(encoder, newDatabase, newDatabase.Folders.Size() - 1);
+}
+
+// it adds the info of old folder that is stored without changes
+
+static void AddCopiedFolder(const CDbEx *db, unsigned folderIndex, CArchiveDatabaseOut &newDatabase)
+{
+  CFolder &folder = newDatabase.Folders.AddNew();
+  db->ParseFolderInfo(folderIndex, folder);
+  CNum startIndex = db->FoStartPackStreamIndex[folderIndex];
+  FOR_VECTOR(j, folder.PackStreams)
+  {
+    newDatabase.PackSizes.Add(db->GetStreamPackSize(startIndex + j));
+    // newDatabase.PackCRCsDefined.Add(db.PackCRCsDefined[startIndex + j]);
+    // newDatabase.PackCRCs.Add(db.PackCRCs[startIndex + j]);
+  }
+
+  size_t indexStart = db->FoToCoderUnpackSizes[folderIndex];
+  size_t indexEnd = db->FoToCoderUnpackSizes[folderIndex + 1];
+  for (; indexStart < indexEnd; indexStart++)
+    newDatabase.CoderUnpackSizes.Add(db->CoderUnpackSizes[indexStart]);
+
+  unsigned numResetPoints = db->GetNumResetPoints(folderIndex);
+  for (unsigned k = 0; k < numResetPoints; k++)
+    newDatabase.AddResetPoint(newDatabase.Folders.Size() - 1,
+        db->ResetPoints[db->FoStartResetPointIndex[folderIndex] + k]);
+}
+
+// it adds the files of old folder that are not replaced by new data
+
+static void AddCopiedFolderFiles(
+    const CDbEx *db, unsigned folderIndex,
+    const CObjectVector<CUpdateItem> &updateItems,
+    const CIntArr &fileIndexToUpdateIndexMap,
+    CArchiveDatabaseOut &newDatabase)
+{
+  CNum numUnpackStreams = db->NumUnpackStreamsVector[folderIndex];
+  CNum numCopyFiles = 0;
+  CNum indexInFolder = 0;
+  for (CNum fi = db->FolderStartFileIndex[folderIndex]; indexInFolder < numUnpackStreams; fi++)
+  {
+    if (db->Files[fi].HasStream)
+    {
+      indexInFolder++;
+      int updateIndex = fileIndexToUpdateIndexMap[fi];
+      if (updateIndex >= 0)
+      {
+        const CUpdateItem &ui = updateItems[updateIndex];
+        if (ui.NewData)
+          continue;
+
+        UString name;
+        CFileItem file;
+        CFileItem2 file2;
+        GetFile(*db, fi, file, file2);
+
+        if (ui.NewProps)
+        {
+          UpdateItem_To_FileItem2(ui, file2);
+          file.IsDir = ui.IsDir;
+          name = ui.Name;
+        }
+        else
+          db->GetPath(fi, name);
+
+        /*
+        file.Parent = ui.ParentFolderIndex;
+        if (ui.TreeFolderIndex >= 0)
+          treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
+        if (totalSecureDataSize != 0)
+          newDatabase.SecureIDs.Add(ui.SecureIndex);
+        */
+        newDatabase.AddFile(file, file2, name);
+        numCopyFiles++;
+      }
+    }
+  }
+  newDatabase.NumUnpackStreamsVector.Add(numCopyFiles);
+}
+
+/* Packed streams of 7z archive are contiguous. In append mode, the bytes
+   between old and new packed streams (old header) are covered by
+   a folder without files. */
+
+static void AddGapFolder(UInt64 size, CArchiveDatabaseOut &newDatabase)
+{
+  if (size == 0)
+    return;
+  CFolder &folder = newDatabase.Folders.AddNew();
+  folder.Coders.SetSize(1);
+  CCoderInfo &coder = folder.Coders[0];
+  coder.MethodID = k_Copy;
+  coder.NumStreams = 1;
+  folder.PackStreams.SetSize(1);
+  folder.PackStreams[0] = 0;
+  newDatabase.PackSizes.Add(size);
+  newDatabase.CoderUnpackSizes.Add(size);
+  newDatabase.NumUnpackStreamsVector.Add(0);
+}
+
+/* The marker is the start header of (db) with kAppendSignature.
+   Any tail after the end of (db) must start with that marker (or be a part of it):
+   then it's a leftover from an interrupted append to this same archive state. */
+
+static HRESULT ReadAppendMarker(IInStream *inStream, const CDbEx &db, Byte *marker)
+{
+  RINOK(inStream->Seek(db.ArcInfo.StartPosition, STREAM_SEEK_SET, NULL));
+  RINOK(ReadStream_FALSE(inStream, marker, kAppendMarkerSize));
+  if (memcmp(marker, kSignature, kSignatureSize) != 0)
+    return E_FAIL;
+  memcpy(marker, kAppendSignature, kSignatureSize);
+  return S_OK;
+}
+
+static HRESULT CheckAppendTail(IInStream *inStream, UInt64 endPos, const Byte *marker)
+{
+  UInt64 fileSize;
+  RINOK(inStream->Seek(0, STREAM_SEEK_END, &fileSize));
+  if (fileSize <= endPos)
+    return S_OK;
+  size_t size = kAppendMarkerSize;
+  if (fileSize - endPos < size)
+    size = (size_t)(fileSize - endPos);
+  Byte buf[kAppendMarkerSize];
+  RINOK(inStream->Seek(endPos, STREAM_SEEK_SET, NULL));
+  RINOK(ReadStream_FALSE(inStream, buf, size));
+  if (memcmp(buf, marker, size) != 0)
+    return E_NOTIMPL;
+  return S_OK;
+}
+
+static HRESULT AddFolderFiles(
+    const CDbEx *db,
+    const CObjectVector<CUpdateItem> &updateItems,
+    const UInt32 *indices, unsigned numSubFiles,
+    const CFolderInStream &inStream,
+    CArchiveDatabaseOut &newDatabase,
+    UInt64 &skippedSize)
+{
+  CNum numUnpackStreams = 0;
+  skippedSize = 0;
+  
+  for (unsigned subIndex = 0; subIndex < numSubFiles; subIndex++)
+  {
+    const CUpdateItem &ui = updateItems[indices[subIndex]];
+    CFileItem file;
+    CFileItem2 file2;
+    UString name;
+    if (ui.NewProps)
+    {
+      UpdateItem_To_FileItem(ui, file, file2);
+      name = ui.Name;
+    }
+    else
+    {
+      GetFile(*db, ui.IndexInArchive, file, file2);
+      db->GetPath(ui.IndexInArchive, name);
+    }
+    if (file2.IsAnti || file.IsDir)
+      return E_FAIL;
+    
+    /*
+    CFileItem &file = newDatabase.Files[
+          startFileIndexInDatabase + i + subIndex];
+    */
+    if (!inStream.Processed[subIndex])
+    {
+      skippedSize += ui.Size;
+      continue;
+      // file.Name += ".locked";
+    }
+
+    file.Crc = inStream.CRCs[subIndex];
+    file.Size = inStream.Sizes[subIndex];
+    
+    // if (file.Size >= 0) // test purposes
+    if (file.Size != 0)
+    {
+      file.CrcDefined = true;
+      file.HasStream = true;
+      numUnpackStreams++;
+    }
+    else
+    {
+      file.CrcDefined = false;
+      file.HasStream = false;
+    }
+
+    /*
+    file.Parent = ui.ParentFolderIndex;
+    if (ui.TreeFolderIndex >= 0)
+      treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
+    if (totalSecureDataSize != 0)
+      newDatabase.SecureIDs.Add(ui.SecureIndex);
+    */
+    newDatabase.AddFile(file, file2, name);
+  }
+
+  // numUnpackStreams = 0 is very bad case for locked files
+  // v3.13 doesn't understand it.
+  newDatabase.NumUnpackStreamsVector.Add(numUnpackStreams);
+  return S_OK;
+}
+
 HRESULT Update(
     DECL_EXTERNAL_CODECS_LOC_VARS
     IInStream *inStream,
@@ -1596,13 +1895,24 @@ HRESULT Update(
     return E_NOTIMPL;
   */
 
+  if (options.AppendMode && (!db || options.RemoveSfxBlock))
+    return E_INVALIDARG;
+
+  Byte appendMarker[kAppendMarkerSize];
+  if (options.AppendMode)
+  {
+    RINOK(ReadAppendMarker(inStream, *db, appendMarker));
+    RINOK(CheckAppendTail(inStream, db->ArcInfo.StartPosition + db->PhySize, appendMarker));
+  }
+
   UInt64 startBlockSize = db ? db->ArcInfo.StartPosition: 0;
-  if (startBlockSize > 0 && !options.RemoveSfxBlock)
+  if (startBlockSize > 0 && !options.RemoveSfxBlock && !options.AppendMode)
   {
     RINOK(WriteRange(inStream, seqOutStream, 0, startBlockSize, NULL));
   }
 
   CIntArr fileIndexToUpdateIndexMap;
+  CBoolArr appendKeepFolders;
   UInt64 complexity = 0;
   UInt64 inSizeForReduce2 = 0;
   bool needEncryptedRepack = false;
@@ -1639,6 +1949,13 @@ HRESULT Update(
         fileIndexToUpdateIndexMap[(unsigned)index] = i;
     }
 
+    if (options.AppendMode)
+    {
+      appendKeepFolders.Alloc(db->NumFolders);
+      for (i = 0; i < db->NumFolders; i++)
+        appendKeepFolders[i] = false;
+    }
+
     for (i = 0; i < db->NumFolders; i++)
     {
       CNum indexInFolder = 0;
@@ -1667,6 +1984,19 @@ HRESULT Update(
       if (numCopyItems == 0)
         continue;
 
+      if (options.AppendMode)
+      {
+        /* A folder without removed files stays in place.
+           If only some files were removed, the remaining files are repacked
+           to new folder after the old end of archive, as in normal update.
+           The bytes of old folder become a gap. */
+        if (numCopyItems == numUnpackStreams)
+        {
+          appendKeepFolders[i] = true;
+          continue;
+        }
+      }
+
       CFolderRepack rep;
       rep.FolderIndex = i;
       rep.NumCopyFiles = numCopyItems;
@@ -1825,8 +2155,16 @@ HRESULT Update(
   
   // ---------- Compress ----------
 
-  RINOK(archive.Create(seqOutStream, false));
-  RINOK(archive.SkipPrefixArchiveHeader());
+  if (options.AppendMode)
+  {
+    RINOK(archive.CreateAppend(seqOutStream, db->ArcInfo.StartPosition,
+        db->ArcInfo.StartPosition + db->PhySize, appendMarker));
+  }
+  else
+  {
+    RINOK(archive.Create(seqOutStream, false));
+    RINOK(archive.SkipPrefixArchiveHeader());
+  }
 
   /*
   CIntVector treeFolderToArcIndex;
@@ -1925,6 +2263,40 @@ HRESULT Update(
     }
   }
 
+  if (options.AppendMode)
+  {
+    // ---------- Keep old folders in place ----------
+
+    /* Adjacent gaps (data before first packed stream, removed folders,
+       gap folders of previous appends) are merged to one gap folder. */
+
+    UInt64 pos = db->ArcInfo.StartPositionAfterHeader;
+    UInt64 gapSize = 0;
+    
+    if (db->NumPackStreams != 0)
+    {
+      gapSize = db->ArcInfo.DataStartPosition - pos;
+      pos = db->ArcInfo.DataStartPosition + db->PackPositions[db->NumPackStreams];
+    }
+
+    for (CNum folderIndex = 0; folderIndex < db->NumFolders; folderIndex++)
+    {
+      if (!appendKeepFolders[folderIndex])
+      {
+        gapSize += db->GetFolderFullPackSize(folderIndex);
+        continue;
+      }
+      AddGapFolder(gapSize, newDatabase);
+      gapSize = 0;
+      AddCopiedFolder(db, folderIndex, newDatabase);
+      AddCopiedFolderFiles(db, folderIndex, updateItems, fileIndexToUpdateIndexMap, newDatabase);
+    }
+
+    // the last gap includes the old header and the append marker
+    gapSize += db->ArcInfo.StartPosition + db->PhySize + kAppendMarkerSize - pos;
+    AddGapFolder(gapSize, newDatabase);
+  }
+
   lps->ProgressOffset = 0;
 
   {
@@ -2014,20 +2386,7 @@ HRESULT Update(
             db->GetFolderStreamPos(folderIndex, 0), packSize, progress));
         lps->ProgressOffset += packSize;
         
-        CFolder &folder = newDatabase.Folders.AddNew();
-        db->ParseFolderInfo(folderIndex, folder);
-        CNum startIndex = db->FoStartPackStreamIndex[folderIndex];
-        FOR_VECTOR(j, folder.PackStreams)
-        {
-          newDatabase.PackSizes.Add(db->GetStreamPackSize(startIndex + j));
-          // newDatabase.PackCRCsDefined.Add(db.PackCRCsDefined[startIndex + j]);
-          // newDatabase.PackCRCs.Add(db.PackCRCs[startIndex + j]);
-        }
-
-        size_t indexStart = db->FoToCoderUnpackSizes[folderIndex];
-        size_t indexEnd = db->FoToCoderUnpackSizes[folderIndex + 1];
-        for (; indexStart < indexEnd; indexStart++)
-          newDatabase.CoderUnpackSizes.Add(db->CoderUnpackSizes[indexStart]);
+        AddCopiedFolder(db, folderIndex, newDatabase);
       }
       else
       {
@@ -2136,6 +2495,7 @@ HRESULT Update(
                   *db, folderIndex,
                   // &importantUnpackSize, // *unpackSize
                   NULL, // *unpackSize : FULL unpack
+                  NULL, // *startPoint
                 
                   NULL, // *outStream
                   NULL, // *compressProgress
@@ -2241,6 +2601,8 @@ HRESULT Update(
 
           if (curUnpackSize != sizeToEncode)
             return E_FAIL;
+
+          RINOK(AddResetPoints(encoder, newDatabase));
         }
 
         for (; startPackIndex < newDatabase.PackSizes.Size(); startPackIndex++)
@@ -2248,46 +2610,7 @@ HRESULT Update(
         lps->InSize += curUnpackSize;
       }
       
-      newDatabase.NumUnpackStreamsVector.Add(rep.NumCopyFiles);
-      
-      CNum indexInFolder = 0;
-      for (CNum fi = db->FolderStartFileIndex[folderIndex]; indexInFolder < numUnpackStreams; fi++)
-      {
-        if (db->Files[fi].HasStream)
-        {
-          indexInFolder++;
-          int updateIndex = fileIndexToUpdateIndexMap[fi];
-          if (updateIndex >= 0)
-          {
-            const CUpdateItem &ui = updateItems[updateIndex];
-            if (ui.NewData)
-              continue;
-
-            UString name;
-            CFileItem file;
-            CFileItem2 file2;
-            GetFile(*db, fi, file, file2);
-
-            if (ui.NewProps)
-            {
-              UpdateItem_To_FileItem2(ui, file2);
-              file.IsDir = ui.IsDir;
-              name = ui.Name;
-            }
-            else
-              db->GetPath(fi, name);
-
-            /*
-            file.Parent = ui.ParentFolderIndex;
-            if (ui.TreeFolderIndex >= 0)
-              treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
-            if (totalSecureDataSize != 0)
-              newDatabase.SecureIDs.Add(ui.SecureIndex);
-            */
-            newDatabase.AddFile(file, file2, name);
-          }
-        }
-      }
+      AddCopiedFolderFiles(db, folderIndex, updateItems, fileIndexToUpdateIndexMap, newDatabase);
     }
 
 
@@ -2330,6 +2653,8 @@ HRESULT Update(
       */
     }
     
+    CRecordVector<CSolidFolderRange> folderRanges;
+
     for (i = 0; i < numFiles;)
     {
       UInt64 totalSize = 0;
@@ -2358,14 +2683,117 @@ HRESULT Update(
       if (numSubFiles < 1)
         numSubFiles = 1;
 
+      CSolidFolderRange range;
+      range.StartIndex = i;
+      range.NumFiles = numSubFiles;
+      range.UnpackSize = totalSize;
+      folderRanges.Add(range);
+      i += numSubFiles;
+    }
+
+    #ifndef _7ZIP_ST
+
+    if (options.NumFolderThreads > 1 && folderRanges.Size() > 1)
+    {
+      /* Each encoder compresses its solid block to a temp buffer.
+         The buffers are copied to the archive in block order,
+         so the archive is the same as in the single-threaded path. */
+
+      unsigned numEncoders = folderRanges.Size();
+      if (numEncoders > options.NumFolderThreads)
+        numEncoders = options.NumFolderThreads;
+
+      RINOK(lps->SetCur());
+
+      CMtCompressProgressMixer mtProgressMixer;
+      mtProgressMixer.Init(numEncoders, progress);
+      NWindows::NSynchronization::CCriticalSection &callbackCS = mtProgressMixer.CriticalSection;
+
+      CObjectVector<CThreadEncoder> threadEncoders;
+      
+      for (unsigned t = 0; t < numEncoders; t++)
+      {
+        CThreadEncoder &te = threadEncoders.AddNew();
+        te.Encoder = new CEncoder(method);
+        #ifdef EXTERNAL_CODECS
+        te.__externalCodecs = __externalCodecs;
+        #endif
+        te.InSizeForReduce = inSizeForReduce;
+        te.InStreamSpec->CallbackCS = &callbackCS;
+        te.ProgressSpec->Init(&mtProgressMixer, t);
+        RINOK(te.Create());
+      }
+
+      UInt64 groupInSize = 0;
+      UInt64 groupOutSize = 0;
+      unsigned numStarted = 0;
+      const unsigned startFolderIndex = newDatabase.Folders.Size();
+
+      FOR_VECTOR (rangeIndex, folderRanges)
+      {
+        for (; numStarted < folderRanges.Size() && numStarted < rangeIndex + numEncoders; numStarted++)
+        {
+          const CSolidFolderRange &range = folderRanges[numStarted];
+          CThreadEncoder &te = threadEncoders[numStarted % numEncoders];
+          te.InStreamSpec->Init(updateCallback, &indices[range.StartIndex], range.NumFiles);
+          te.TempBuffer.InitWriting();
+          te.ProgressSpec->Reinit();
+          te.UnpackSize = range.UnpackSize;
+          te.Folder = &newDatabase.Folders.AddNew();
+          te.CoderUnpackSizes.Clear();
+          te.PackSizes.Clear();
+          te.Result = E_FAIL;
+          te.Start();
+        }
+
+        const CSolidFolderRange &range = folderRanges[rangeIndex];
+        CThreadEncoder &te = threadEncoders[rangeIndex % numEncoders];
+        te.WaitExecuteFinish();
+        
+        RINOK(te.Result);
+        if (!te.InStreamSpec->WasFinished())
+          return E_FAIL;
+
+        RINOK(te.TempBuffer.WriteToStream(archive.SeqStream));
+        
+        newDatabase.CoderUnpackSizes += te.CoderUnpackSizes;
+        newDatabase.PackSizes += te.PackSizes;
+        RINOK(AddResetPoints(*te.Encoder, newDatabase, startFolderIndex + rangeIndex));
+        FOR_VECTOR (k, te.PackSizes)
+          groupOutSize += te.PackSizes[k];
+        groupInSize += te.UnpackSize;
+
+        UInt64 skippedSize;
+        RINOK(AddFolderFiles(db, updateItems, &indices[range.StartIndex], range.NumFiles,
+            *te.InStreamSpec, newDatabase, skippedSize));
+
+        if (skippedSize != 0 && complexity >= skippedSize)
+        {
+          NWindows::NSynchronization::CCriticalSectionLock lock(callbackCS);
+          complexity -= skippedSize;
+          RINOK(updateCallback->SetTotal(complexity));
+        }
+      }
+
+      lps->InSize += groupInSize;
+      lps->OutSize += groupOutSize;
+      continue;
+    }
+
+    #endif
+
+    FOR_VECTOR (rangeIndex, folderRanges)
+    {
+      const CSolidFolderRange &range = folderRanges[rangeIndex];
+
       RINOK(lps->SetCur());
 
       CFolderInStream *inStreamSpec = new CFolderInStream;
       CMyComPtr<ISequentialInStream> solidInStream(inStreamSpec);
-      inStreamSpec->Init(updateCallback, &indices[i], numSubFiles);
+      inStreamSpec->Init(updateCallback, &indices[range.StartIndex], range.NumFiles);
       
       unsigned startPackIndex = newDatabase.PackSizes.Size();
-      UInt64 curFolderUnpackSize = totalSize;
+      UInt64 curFolderUnpackSize = range.UnpackSize;
       // curFolderUnpackSize = (UInt64)(Int64)-1;
       
       RINOK(encoder.Encode(
@@ -2379,6 +2807,8 @@ HRESULT Update(
       if (!inStreamSpec->WasFinished())
         return E_FAIL;
 
+      RINOK(AddResetPoints(encoder, newDatabase));
+
       for (; startPackIndex < newDatabase.PackSizes.Size(); startPackIndex++)
         lps->OutSize += newDatabase.PackSizes[startPackIndex];
 
@@ -2387,69 +2817,9 @@ HRESULT Update(
       // newDatabase.PackCRCsDefined.Add(false);
       // newDatabase.PackCRCs.Add(0);
 
-      CNum numUnpackStreams = 0;
-      UInt64 skippedSize = 0;
-      
-      for (unsigned subIndex = 0; subIndex < numSubFiles; subIndex++)
-      {
-        const CUpdateItem &ui = updateItems[indices[i + subIndex]];
-        CFileItem file;
-        CFileItem2 file2;
-        UString name;
-        if (ui.NewProps)
-        {
-          UpdateItem_To_FileItem(ui, file, file2);
-          name = ui.Name;
-        }
-        else
-        {
-          GetFile(*db, ui.IndexInArchive, file, file2);
-          db->GetPath(ui.IndexInArchive, name);
-        }
-        if (file2.IsAnti || file.IsDir)
-          return E_FAIL;
-        
-        /*
-        CFileItem &file = newDatabase.Files[
-              startFileIndexInDatabase + i + subIndex];
-        */
-        if (!inStreamSpec->Processed[subIndex])
-        {
-          skippedSize += ui.Size;
-          continue;
-          // file.Name += ".locked";
-        }
-
-        file.Crc = inStreamSpec->CRCs[subIndex];
-        file.Size = inStreamSpec->Sizes[subIndex];
-        
-        // if (file.Size >= 0) // test purposes
-        if (file.Size != 0)
-        {
-          file.CrcDefined = true;
-          file.HasStream = true;
-          numUnpackStreams++;
-        }
-        else
-        {
-          file.CrcDefined = false;
-          file.HasStream = false;
-        }
-
-        /*
-        file.Parent = ui.ParentFolderIndex;
-        if (ui.TreeFolderIndex >= 0)
-          treeFolderToArcIndex[ui.TreeFolderIndex] = newDatabase.Files.Size();
-        if (totalSecureDataSize != 0)
-          newDatabase.SecureIDs.Add(ui.SecureIndex);
-        */
-        newDatabase.AddFile(file, file2, name);
-      }
-
-      // numUnpackStreams = 0 is very bad case for locked files
-      // v3.13 doesn't understand it.
-      newDatabase.NumUnpackStreamsVector.Add(numUnpackStreams);
-      i += numSubFiles;
+      UInt64 skippedSize;
+      RINOK(AddFolderFiles(db, updateItems, &indices[range.StartIndex], range.NumFiles,
+          *inStreamSpec, newDatabase, skippedSize));
 
       if (skippedSize != 0 && complexity >= skippedSize)
       {
@@ -102,6 +102,13 @@ struct CUpdateOptions
   
   bool RemoveSfxBlock;
   bool MultiThreadMixer;
+  UInt32 NumFolderThreads; // number of new solid blocks that are compressed concurrently
+
+  /* AppendMode: seqOutStream is the stream of the archive (db).
+     Old folders stay in place, new folders are written after the end of archive.
+     If some files of a folder are removed, the other files are repacked to new folder.
+     The bytes of removed folders stay in the archive as gap folders without files. */
+  bool AppendMode;
 
   CUpdateOptions():
       Method(NULL),
@@ -114,7 +121,9 @@ struct CUpdateOptions
       SolidExtension(false),
       UseTypeSorting(true),
       RemoveSfxBlock(false),
-      MultiThreadMixer(true)
+      MultiThreadMixer(true),
+      NumFolderThreads(1),
+      AppendMode(false)
     {}
 };
 
@@ -32,6 +32,8 @@ namespace NArchive {
 namespace NXz {
 
 #define k_LZMA2_Name "LZMA2"
+#define k_FLZMA2_Name "FLZMA2"
+#define kDefaultMethodName k_LZMA2_Name
 
 
 struct CBlockInfo
@@ -1098,6 +1100,10 @@ STDMETHODIMP CHandler::UpdateItems(ISequentialOutStream *outStream, UInt32 numIt
     lzma2Props.lzmaProps.level = GetLevel();
 
     xzProps.reduceSize = size;
+    if (!_methods.IsEmpty())
+    {
+      RINOK(encoderSpec->SetMethodName(_methods[0].MethodName));
+    }
     /*
     {
       NCOM::CPropVariant prop = (UInt64)size;
@@ -1283,9 +1289,10 @@ STDMETHODIMP CHandler::SetProperties(const wchar_t * const *names, const PROPVAR
   {
     AString &methodName = _methods[0].MethodName;
     if (methodName.IsEmpty())
-      methodName = k_LZMA2_Name;
+      methodName = kDefaultMethodName;
     else if (
-        !methodName.IsEqualTo_Ascii_NoCase(k_LZMA2_Name)
+        !methodName.IsEqualTo_Ascii_NoCase(k_FLZMA2_Name)
+        && !methodName.IsEqualTo_Ascii_NoCase(k_LZMA2_Name)
         && !methodName.IsEqualTo_Ascii_NoCase("xz"))
       return E_INVALIDARG;
   }
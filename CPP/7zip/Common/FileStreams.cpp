@@ -403,11 +403,16 @@ STDMETHODIMP COutFileStream::SetSize(UInt64 newSize)
   
   #else
   
-  return E_FAIL;
+  return File.SetLength(newSize) ? S_OK : E_FAIL;
   
   #endif
 }
 
+STDMETHODIMP COutFileStream::Flush()
+{
+  return ConvertBoolToHRESULT(File.Flush());
+}
+
 HRESULT COutFileStream::GetSize(UInt64 *size)
 {
   return ConvertBoolToHRESULT(File.GetLength(*size));
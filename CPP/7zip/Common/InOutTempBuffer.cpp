@@ -111,7 +111,6 @@ HRESULT CInOutTempBuffer::WriteToStream(ISequentialOutStream *stream)
   return (_crc == crc && size == _size) ? S_OK : E_FAIL;
 }
 
-/*
 STDMETHODIMP CSequentialOutTempBufferImp::Write(const void *data, UInt32 size, UInt32 *processed)
 {
   if (!_buf->Write(data, size))
@@ -124,4 +123,3 @@ STDMETHODIMP CSequentialOutTempBufferImp::Write(const void *data, UInt32 size, U
     *processed = size;
   return S_OK;
 }
-*/
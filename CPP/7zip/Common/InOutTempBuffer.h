@@ -31,7 +31,6 @@ public:
   UInt64 GetDataSize() const { return _size; }
 };
 
-/*
 class CSequentialOutTempBufferImp:
   public ISequentialOutStream,
   public CMyUnknownImp
@@ -39,10 +38,9 @@ class CSequentialOutTempBufferImp:
   CInOutTempBuffer *_buf;
 public:
   void Init(CInOutTempBuffer *buffer)  { _buf = buffer; }
-  MY_UNKNOWN_IMP
+  MY_UNKNOWN_IMP1(ISequentialOutStream)
 
   STDMETHOD(Write)(const void *data, UInt32 size, UInt32 *processedSize);
 };
-*/
 
 #endif
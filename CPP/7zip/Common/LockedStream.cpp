@@ -1,3 +1,64 @@
 // LockedStream.cpp
 
 #include "StdAfx.h"
+
+#include "LockedStream.h"
+
+HRESULT CLockedInStream::Read(UInt64 startPos, void *data, UInt32 size, UInt32 *processedSize)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(_criticalSection);
+  if (_pos != startPos)
+  {
+    _pos = (UInt64)(Int64)-1;
+    RINOK(_stream->Seek(startPos, STREAM_SEEK_SET, NULL));
+    _pos = startPos;
+  }
+  UInt32 realProcessedSize = 0;
+  HRESULT res = _stream->Read(data, size, &realProcessedSize);
+  _pos += realProcessedSize;
+  if (processedSize)
+    *processedSize = realProcessedSize;
+  return res;
+}
+
+HRESULT CLockedInStream::GetSize(UInt64 *size)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(_criticalSection);
+  _pos = (UInt64)(Int64)-1;
+  RINOK(_stream->Seek(0, STREAM_SEEK_END, size));
+  _pos = *size;
+  return S_OK;
+}
+
+STDMETHODIMP CLockedInStreamImp::Read(void *data, UInt32 size, UInt32 *processedSize)
+{
+  UInt32 realProcessedSize = 0;
+  HRESULT res = _lockedInStream->Read(_pos, data, size, &realProcessedSize);
+  _pos += realProcessedSize;
+  if (processedSize)
+    *processedSize = realProcessedSize;
+  return res;
+}
+
+STDMETHODIMP CLockedInStreamImp::Seek(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition)
+{
+  switch (seekOrigin)
+  {
+    case STREAM_SEEK_SET: break;
+    case STREAM_SEEK_CUR: offset += _pos; break;
+    case STREAM_SEEK_END:
+    {
+      UInt64 size;
+      RINOK(_lockedInStream->GetSize(&size));
+      offset += size;
+      break;
+    }
+    default: return STG_E_INVALIDFUNCTION;
+  }
+  if (offset < 0)
+    return HRESULT_WIN32_ERROR_NEGATIVE_SEEK;
+  _pos = offset;
+  if (newPosition)
+    *newPosition = offset;
+  return S_OK;
+}
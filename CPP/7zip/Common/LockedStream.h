@@ -3,4 +3,46 @@
 #ifndef __LOCKED_STREAM_H
 #define __LOCKED_STREAM_H
 
+#include "../../Common/MyCom.h"
+#include "../../Windows/Synchronization.h"
+
+#include "../IStream.h"
+
+class CLockedInStream
+{
+  CMyComPtr<IInStream> _stream;
+  UInt64 _pos;
+  NWindows::NSynchronization::CCriticalSection _criticalSection;
+public:
+  void Init(IInStream *stream)
+  {
+    _stream = stream;
+    _pos = (UInt64)(Int64)-1;
+  }
+  HRESULT Read(UInt64 startPos, void *data, UInt32 size, UInt32 *processedSize);
+  HRESULT GetSize(UInt64 *size);
+};
+
+/* CLockedInStreamImp is a seekable view of CLockedInStream with its own position.
+   Several views of one stream can be read from different threads. */
+
+class CLockedInStreamImp:
+  public IInStream,
+  public CMyUnknownImp
+{
+  CLockedInStream *_lockedInStream;
+  UInt64 _pos;
+public:
+  void Init(CLockedInStream *lockedInStream, UInt64 startPos = 0)
+  {
+    _lockedInStream = lockedInStream;
+    _pos = startPos;
+  }
+
+  MY_UNKNOWN_IMP2(ISequentialInStream, IInStream)
+
+  STDMETHOD(Read)(void *data, UInt32 size, UInt32 *processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64 *newPosition);
+};
+
 #endif
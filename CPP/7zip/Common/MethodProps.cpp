@@ -375,6 +375,12 @@ static bool IsLogSizeProp(PROPID propid)
   return false;
 }
 
+// mem=auto is passed as a string to coders which can fit themselves to the available memory
+static bool IsAutoMemProp(PROPID propid, const UString &s)
+{
+  return propid == NCoderPropID::kUsedMemorySize && s.IsEqualTo_Ascii_NoCase("auto");
+}
+
 HRESULT CMethodProps::SetParam(const UString &name, const UString &value)
 {
   int index = FindPropIdExact(name);
@@ -384,7 +390,9 @@ HRESULT CMethodProps::SetParam(const UString &name, const UString &value)
   CProp prop;
   prop.Id = index;
 
-  if (IsLogSizeProp(prop.Id))
+  if (IsAutoMemProp(prop.Id, value))
+    prop.Value = value;
+  else if (IsLogSizeProp(prop.Id))
   {
     RINOK(StringToDictSize(value, prop.Value));
   }
@@ -465,7 +473,12 @@ HRESULT CMethodProps::ParseParamsFromPROPVARIANT(const UString &realName, const
   CProp prop;
   prop.Id = index;
   
-  if (IsLogSizeProp(prop.Id))
+  UString s;
+  if (value.vt == VT_BSTR)
+    s = value.bstrVal;
+  if (IsAutoMemProp(prop.Id, s))
+    prop.Value = s;
+  else if (IsLogSizeProp(prop.Id))
   {
     RINOK(PROPVARIANT_to_DictSize(value, prop.Value));
   }
@@ -6,6 +6,11 @@
 
 #include "../../../C/fast-lzma2/fl2_errors.h"
 
+#include "../../Common/MyString.h"
+
+#include "../../Windows/Synchronization.h"
+#include "../../Windows/System.h"
+
 #include "../Common/CWrappers.h"
 #include "../Common/StreamUtils.h"
 
@@ -146,52 +151,219 @@ static HRESULT TranslateError(size_t res)
 
 #define CHECK_P(f) if (FL2_isError(f)) return E_INVALIDARG;  /* check and convert error code */
 
+#ifdef _7ZIP_LARGE_PAGES
+extern "C"
+{
+  extern SIZE_T g_LargePageSize;
+}
+#endif
+
+static NWindows::NSynchronization::CCriticalSection g_FastStatsCS;
+static FL2_cStreamStats g_FastStats;
+
+static void AddFastEncoderStats(const FL2_cStreamStats &s)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(g_FastStatsCS);
+  g_FastStats.blocks += s.blocks;
+  g_FastStats.inputSize += s.inputSize;
+  g_FastStats.initTime += s.initTime;
+  g_FastStats.buildTime += s.buildTime;
+  g_FastStats.encodeTime += s.encodeTime;
+  g_FastStats.encodeBusyTime += s.encodeBusyTime;
+  g_FastStats.encodeIdleTime += s.encodeIdleTime;
+  g_FastStats.poolWaitTime += s.poolWaitTime;
+  g_FastStats.dictShifts += s.dictShifts;
+  g_FastStats.dictShiftBytes += s.dictShiftBytes;
+  g_FastStats.compressedChunks += s.compressedChunks;
+  g_FastStats.storedChunks += s.storedChunks;
+  g_FastStats.skippedBytes += s.skippedBytes;
+}
+
+void GetFastEncoderStats(FL2_cStreamStats &stats)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(g_FastStatsCS);
+  stats = g_FastStats;
+}
+
+static CFastEncoderConfig g_FastConfig;
+
+static void SetFastEncoderConfig(const CFastEncoderConfig &config)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(g_FastStatsCS);
+  g_FastConfig = config;
+}
+
+void GetFastEncoderConfig(CFastEncoderConfig &config)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(g_FastStatsCS);
+  config = g_FastConfig;
+}
+
+// One set of worker threads for all Fast LZMA2 encoders in the process, so encoders
+// running at once share the cores instead of each starting its own threads.
+// The pool is freed when the last encoder using it is freed, not by a static
+// destructor, which could run while a codec DLL is unloaded.
+
+static NWindows::NSynchronization::CCriticalSection g_FastPoolCS;
+static FL2_threadPool *g_FastPool;
+static unsigned g_FastPoolRefs;
+
+// The pool has a thread for each processor, or as many as the first encoder asks for if
+// that is more. An encoder with more threads than the pool still attaches to it, and then
+// runs at most (pool size + 1) jobs at once. Returns NULL if the pool can not be created,
+// in which case the encoder creates its own threads.
+static FL2_threadPool *AcquireFastPool(unsigned numThreads)
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(g_FastPoolCS);
+  if (g_FastPool == NULL)
+  {
+    unsigned poolThreads = NWindows::NSystem::GetNumberOfProcessors();
+    if (poolThreads < numThreads)
+      poolThreads = numThreads;
+    // The calling thread of the encoder runs one job itself
+    g_FastPool = FL2_createThreadPool(poolThreads - 1);
+    if (g_FastPool == NULL)
+      return NULL;
+  }
+  g_FastPoolRefs++;
+  return g_FastPool;
+}
+
+static void ReleaseFastPool()
+{
+  NWindows::NSynchronization::CCriticalSectionLock lock(g_FastPoolCS);
+  if (--g_FastPoolRefs == 0)
+  {
+    FL2_freeThreadPool(g_FastPool);
+    g_FastPool = NULL;
+  }
+}
+
 #define MIN_BLOCK_SIZE (1U << 20)
+#define FAST_PIPELINE_MIN_THREADS 4
 #define MAX_BLOCK_SIZE (1U << 28)
 
 CFastEncoder::FastLzma2::FastLzma2()
   : fcs(NULL),
-  dict_pos(0)
+  fcsPool(NULL),
+  fcsThreads(0),
+  fcsDualBuffer(0),
+  dict_pos(0),
+  out_total(0)
 {
 }
 
 CFastEncoder::FastLzma2::~FastLzma2()
+{
+  FreeStream();
+}
+
+void CFastEncoder::FastLzma2::FreeStream()
 {
   FL2_freeCCtx(fcs);
+  fcs = NULL;
+  if (fcsPool != NULL)
+    ReleaseFastPool();
+  fcsPool = NULL;
 }
 
 HRESULT CFastEncoder::FastLzma2::SetCoderProperties(const PROPID *propIDs, const PROPVARIANT *coderProps, UInt32 numProps)
 {
   CLzma2EncProps lzma2Props;
   Lzma2EncProps_Init(&lzma2Props);
+  // The configuration is fitted to a memory budget only if one is given with mem=size,
+  // or with mem=auto for 3/4 of the memory available, leaving the rest to the process
+  UInt64 memLimit = 0;
+  bool fit = false;
 
   for (UInt32 i = 0; i < numProps; i++)
   {
+    if (propIDs[i] == NCoderPropID::kUsedMemorySize)
+    {
+      const PROPVARIANT &prop = coderProps[i];
+      if (prop.vt == VT_UI4)
+        memLimit = prop.ulVal;
+      else if (prop.vt == VT_UI8)
+        memLimit = prop.uhVal.QuadPart;
+      else if (prop.vt == VT_BSTR && StringsAreEqualNoCase_Ascii(prop.bstrVal, "auto"))
+        memLimit = FL2_getMemoryLimit() / 4 * 3;
+      else
+        return E_INVALIDARG;
+      fit = true;
+      continue;
+    }
     RINOK(SetLzma2Prop(propIDs[i], coderProps[i], lzma2Props));
   }
-  if (fcs == NULL) {
-    fcs = FL2_createCStreamMt(lzma2Props.numTotalThreads, 1);
-    if (fcs == NULL)
-      return E_OUTOFMEMORY;
-  }
+  bool highCompression = false;
   if (lzma2Props.lzmaProps.algo > 2) {
     if (lzma2Props.lzmaProps.algo > 3)
       return E_INVALIDARG;
     lzma2Props.lzmaProps.algo = 2;
-    FL2_CCtx_setParameter(fcs, FL2_p_highCompression, 1);
-    FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, lzma2Props.lzmaProps.level);
-  }
-  else {
-    FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, lzma2Props.lzmaProps.level);
+    highCompression = true;
   }
+  int level = min(max(lzma2Props.lzmaProps.level, 0), highCompression ? FL2_maxHighCLevel() : FL2_maxCLevel());
+  FL2_compressionParameters params;
+  CHECK_P(FL2_getLevelParameters(level, highCompression, &params));
   size_t dictSize = lzma2Props.lzmaProps.dictSize;
   if (!dictSize) {
-    dictSize = (UInt32)FL2_CCtx_getParameter(fcs, FL2_p_dictionarySize);
+    dictSize = params.dictionarySize;
   }
   UInt64 reduceSize = lzma2Props.lzmaProps.reduceSize;
   reduceSize += (reduceSize < (UInt64)-1); /* prevent extra buffer shift after read */
   dictSize = (UInt32)min(dictSize, reduceSize);
   dictSize = max(dictSize, FL2_DICTSIZE_MIN);
+
+  params.dictionarySize = dictSize;
+  if (lzma2Props.lzmaProps.algo >= 0)
+    params.strategy = (FL2_strategy)lzma2Props.lzmaProps.algo;
+  unsigned numThreads = lzma2Props.numTotalThreads < 0 ? 0 : (unsigned)lzma2Props.numTotalThreads;
+  int dualBuffer = 1;
+  // A zero limit only normalizes the values, so nothing is reduced
+  CFastEncoderConfig config;
+  config.memUsage = FL2_fitCStreamParams(&params, &numThreads, &dualBuffer, 0);
+  // Build the next match table while the current block is encoded if the input spans
+  // several blocks and there are enough threads for both. The second table must fit in
+  // the memory budget, or in 3/4 of the memory available if none is given.
+  if (numThreads >= FAST_PIPELINE_MIN_THREADS && reduceSize / 2 > dictSize)
+  {
+    UInt64 budget = fit ? memLimit : FL2_getMemoryLimit() / 4 * 3;
+    size_t pipelinedUsage = FL2_estimateCStreamSize_byParams(&params, numThreads, FL2_DUAL_BUFFER_PIPELINED);
+    if (fit || budget == 0 || pipelinedUsage <= budget)
+    {
+      dualBuffer = FL2_DUAL_BUFFER_PIPELINED;
+      config.memUsage = pipelinedUsage;
+    }
+  }
+  config.requestedDictSize = (UInt32)params.dictionarySize;
+  config.requestedThreads = numThreads;
+  // an unknown memory size (mem=auto) leaves the configuration as requested
+  if (fit && memLimit != 0)
+  {
+    config.fitted = true;
+    config.memLimit = memLimit;
+    config.memUsage = FL2_fitCStreamParams(&params, &numThreads, &dualBuffer, memLimit);
+  }
+  dictSize = params.dictionarySize;
+  config.dictSize = (UInt32)dictSize;
+  config.numThreads = numThreads;
+  config.dualBuffer = dualBuffer;
+  SetFastEncoderConfig(config);
+
+  if (fcs != NULL && (numThreads != fcsThreads || dualBuffer != fcsDualBuffer))
+    FreeStream();
+  if (fcs == NULL) {
+    if (numThreads > 1)
+      fcsPool = AcquireFastPool(numThreads);
+    fcs = FL2_createCStreamWithPool(numThreads, dualBuffer, fcsPool);
+    if (fcs == NULL) {
+      FreeStream();
+      return E_OUTOFMEMORY;
+    }
+    fcsThreads = numThreads;
+    fcsDualBuffer = dualBuffer;
+  }
+  FL2_CCtx_setParameter(fcs, FL2_p_highCompression, highCompression);
+  FL2_CCtx_setParameter(fcs, FL2_p_compressionLevel, level);
   CHECK_P(FL2_CCtx_setParameter(fcs, FL2_p_dictionarySize, dictSize));
   if (lzma2Props.lzmaProps.algo >= 0) {
     CHECK_P(FL2_CCtx_setParameter(fcs, FL2_p_strategy, (unsigned)lzma2Props.lzmaProps.algo));
@@ -219,6 +391,10 @@ HRESULT CFastEncoder::FastLzma2::SetCoderProperties(const PROPID *propIDs, const
   }
   CHECK_P(FL2_CCtx_setParameter(fcs, FL2_p_resetInterval, r));
   FL2_CCtx_setParameter(fcs, FL2_p_omitProperties, 1);
+  #ifdef _7ZIP_LARGE_PAGES
+  // the page size is set only in large pages mode (-slp), as for BigAlloc()
+  FL2_CCtx_setParameter(fcs, FL2_p_largePages, g_LargePageSize != 0);
+  #endif
   FL2_setCStreamTimeout(fcs, 500);
   return S_OK;
 }
@@ -233,6 +409,9 @@ HRESULT CFastEncoder::FastLzma2::Begin()
   CHECK_S(FL2_initCStream(fcs, 0));
   CHECK_S(FL2_getDictionaryBuffer(fcs, &dict));
   dict_pos = 0;
+  out_total = 0;
+  reset_pack_pos.Clear();
+  reset_unpack_pos.Clear();
   return S_OK;
 }
 
@@ -291,6 +470,13 @@ bool CFastEncoder::FastLzma2::UpdateProgress(ICompressProgressInfo *progress)
 
 HRESULT CFastEncoder::FastLzma2::WriteBuffers(ISequentialOutStream *outStream)
 {
+  int dictReset;
+  UInt64 blockStart = FL2_getCStreamBlockStart(fcs, &dictReset);
+  // The end marker may be output after the block was, so check that the block is new
+  if (dictReset && (reset_unpack_pos.IsEmpty() || blockStart > reset_unpack_pos.Back())) {
+    reset_pack_pos.Add(out_total);
+    reset_unpack_pos.Add(blockStart);
+  }
   size_t csize;
   for (;;) {
     FL2_cBuffer cbuf;
@@ -303,10 +489,17 @@ HRESULT CFastEncoder::FastLzma2::WriteBuffers(ISequentialOutStream *outStream)
     HRESULT err = WriteStream(outStream, cbuf.src, cbuf.size);
     if (err != S_OK)
       return err;
+    out_total += cbuf.size;
   }
   return S_OK;
 }
 
+void CFastEncoder::FastLzma2::GetResetPoint(unsigned index, UInt64 &packPos, UInt64 &unpackPos) const
+{
+  packPos = reset_pack_pos[index];
+  unpackPos = reset_unpack_pos[index];
+}
+
 HRESULT CFastEncoder::FastLzma2::End(ISequentialOutStream *outStream, ICompressProgressInfo *progress)
 {
   if (dict_pos) {
@@ -321,6 +514,9 @@ HRESULT CFastEncoder::FastLzma2::End(ISequentialOutStream *outStream, ICompressP
     res = FL2_endStream(fcs, nullptr);
     CHECK_H(WaitAndReport(res, progress));
   }
+  FL2_cStreamStats stats;
+  FL2_getCStreamStats(fcs, NULL, &stats);
+  AddFastEncoderStats(stats);
   return S_OK;
 }
 
@@ -359,6 +555,20 @@ STDMETHODIMP CFastEncoder::WriteCoderProperties(ISequentialOutStream *outStream)
   return WriteStream(outStream, &prop, 1);
 }
 
+STDMETHODIMP CFastEncoder::GetNumResetPoints(UInt32 *numPoints)
+{
+  *numPoints = _encoder.GetNumResetPoints();
+  return S_OK;
+}
+
+STDMETHODIMP CFastEncoder::GetResetPoint(UInt32 index, UInt64 *packPos, UInt64 *unpackPos)
+{
+  if (index >= _encoder.GetNumResetPoints())
+    return E_INVALIDARG;
+  _encoder.GetResetPoint(index, *packPos, *unpackPos);
+  return S_OK;
+}
+
 
 STDMETHODIMP CFastEncoder::Code(ISequentialInStream *inStream, ISequentialOutStream *outStream,
   const UInt64 * /* inSize */, const UInt64 * /* outSize */, ICompressProgressInfo *progress)
@@ -8,6 +8,7 @@
 
 #include "../../Common/MyCom.h"
 #include "../../Common/MyBuffer.h"
+#include "../../Common/MyVector.h"
 
 #include "../ICoder.h"
 
@@ -43,6 +44,7 @@ class CFastEncoder :
   public ICompressCoder,
   public ICompressSetCoderProperties,
   public ICompressWriteCoderProperties,
+  public ICompressGetResetPoints,
   public CMyUnknownImp
 {
   class FastLzma2
@@ -57,15 +59,25 @@ class CFastEncoder :
     HRESULT AddByteCount(size_t count, ISequentialOutStream *outStream, ICompressProgressInfo *progress);
     HRESULT End(ISequentialOutStream *outStream, ICompressProgressInfo *progress);
     void Cancel();
+    unsigned GetNumResetPoints() const { return reset_pack_pos.Size(); }
+    void GetResetPoint(unsigned index, UInt64 &packPos, UInt64 &unpackPos) const;
 
   private:
     bool UpdateProgress(ICompressProgressInfo *progress);
     HRESULT WaitAndReport(size_t& res, ICompressProgressInfo *progress);
     HRESULT WriteBuffers(ISequentialOutStream *outStream);
+    void FreeStream();
 
     FL2_CStream* fcs;
+    FL2_threadPool* fcsPool;  // the process-wide pool if fcs is attached to it
+    unsigned fcsThreads;
+    int fcsDualBuffer;
     FL2_dictBuffer dict;
     size_t dict_pos;
+    UInt64 out_total;
+    // dictionary resets in the current stream
+    CRecordVector<UInt64> reset_pack_pos;
+    CRecordVector<UInt64> reset_unpack_pos;
 
     FastLzma2(const FastLzma2&) = delete;
     FastLzma2& operator=(const FastLzma2&) = delete;
@@ -74,20 +86,46 @@ class CFastEncoder :
   FastLzma2 _encoder;
 
 public:
-  MY_UNKNOWN_IMP3(
+  MY_UNKNOWN_IMP4(
     ICompressCoder,
     ICompressSetCoderProperties,
-    ICompressWriteCoderProperties)
+    ICompressWriteCoderProperties,
+    ICompressGetResetPoints)
 
   STDMETHOD(Code)(ISequentialInStream *inStream, ISequentialOutStream *outStream,
     const UInt64 *inSize, const UInt64 *outSize, ICompressProgressInfo *progress);
   STDMETHOD(SetCoderProperties)(const PROPID *propIDs, const PROPVARIANT *props, UInt32 numProps);
   STDMETHOD(WriteCoderProperties)(ISequentialOutStream *outStream);
+  STDMETHOD(GetNumResetPoints)(UInt32 *numPoints);
+  STDMETHOD(GetResetPoint)(UInt32 index, UInt64 *packPos, UInt64 *unpackPos);
 
   CFastEncoder();
   virtual ~CFastEncoder();
 };
 
+// Sums of the Fast LZMA2 counters for all streams completed in this process
+void GetFastEncoderStats(FL2_cStreamStats &stats);
+
+// Configuration selected for the most recent Fast LZMA2 stream. It is fitted to a memory
+// limit only if the mem property was given, and may then be smaller than requested.
+struct CFastEncoderConfig
+{
+  bool fitted;
+  UInt64 memLimit;        // 0 if not fitted
+  UInt64 memUsage;        // estimate for the selected configuration
+  UInt32 requestedDictSize;
+  UInt32 dictSize;
+  unsigned requestedThreads;
+  unsigned numThreads;
+  int dualBuffer;
+
+  CFastEncoderConfig(): fitted(false), memLimit(0), memUsage(0), requestedDictSize(0), dictSize(0),
+      requestedThreads(0), numThreads(0), dualBuffer(0) {}
+  bool IsReduced() const { return dictSize < requestedDictSize || numThreads < requestedThreads; }
+};
+
+void GetFastEncoderConfig(CFastEncoderConfig &config);
+
 }}
 
 #endif
@@ -30,6 +30,7 @@ void CEncoder::InitCoderProps()
 CEncoder::CEncoder()
 {
   XzProps_Init(&xzProps);
+  _fastLzma2 = false;
   _encoder = NULL;
   _encoder = XzEnc_Create(&g_Alloc, &g_BigAlloc);
   if (!_encoder)
@@ -89,6 +90,21 @@ HRESULT CEncoder::SetCheckSize(UInt32 checkSizeInBytes)
 }
 
 
+HRESULT CEncoder::SetMethodName(const AString &name)
+{
+  // LZMA2 is the default. FLZMA2 selects the Fast LZMA2 encoder.
+  if (name.IsEqualTo_Ascii_NoCase("FLZMA2"))
+    _fastLzma2 = true;
+  else if (name.IsEmpty()
+      || name.IsEqualTo_Ascii_NoCase("LZMA2")
+      || name.IsEqualTo_Ascii_NoCase("xz"))
+    _fastLzma2 = false;
+  else
+    return E_INVALIDARG;
+  return S_OK;
+}
+
+
 HRESULT CEncoder::SetCoderProp(PROPID propID, const PROPVARIANT &prop)
 {
   if (propID == NCoderPropID::kNumThreads)
@@ -229,6 +245,7 @@ STDMETHODIMP CEncoder::Code(ISequentialInStream *inStream, ISequentialOutStream
   outWrap.Init(outStream);
   progressWrap.Init(progress);
 
+  xzProps.fastLzma2 = _fastLzma2 ? 1 : 0;
   SRes res = XzEnc_SetProps(_encoder, &xzProps);
   if (res == SZ_OK)
     res = XzEnc_Encode(_encoder, &outWrap.vt, &inWrap.vt, progress ? &progressWrap.vt : NULL);
@@ -6,6 +6,7 @@
 #include "../../../C/XzEnc.h"
 
 #include "../../Common/MyCom.h"
+#include "../../Common/MyString.h"
 
 #include "../ICoder.h"
 
@@ -20,6 +21,7 @@ class CEncoder:
   public CMyUnknownImp
 {
   CXzEncHandle _encoder;
+  bool _fastLzma2;
 public:
   CXzProps xzProps;
 
@@ -30,6 +32,7 @@ public:
 
   void InitCoderProps();
   HRESULT SetCheckSize(UInt32 checkSizeInBytes);
+  HRESULT SetMethodName(const AString &name);
   HRESULT SetCoderProp(PROPID propID, const PROPVARIANT &prop);
   
   STDMETHOD(Code)(ISequentialInStream *inStream, ISequentialOutStream *outStream,
@@ -197,6 +197,18 @@ CODER_INTERFACE(ICompressSetMemLimit, 0x28)
   STDMETHOD(SetMemLimit)(UInt64 memUsage) PURE;
 };
 
+CODER_INTERFACE(ICompressGetResetPoints, 0x29)
+{
+  STDMETHOD(GetNumResetPoints)(UInt32 *numPoints) PURE;
+  STDMETHOD(GetResetPoint)(UInt32 index, UInt64 *packPos, UInt64 *unpackPos) PURE;
+
+  /* The encoder reports the positions in the last stream written by Code()
+     from which a new decoder can decode the rest of the stream without
+     the preceding data (full dictionary resets of LZMA2).
+     Points are sorted by increasing positions.
+     (packPos) is offset in the output stream, (unpackPos) is offset in the input stream. */
+};
+
 
 
 CODER_INTERFACE(ICompressGetSubStreamSize, 0x30)
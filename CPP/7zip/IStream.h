@@ -100,6 +100,15 @@ STREAM_INTERFACE(IOutStreamFinish, 0x07)
   STDMETHOD(OutStreamFinish)() PURE;
 };
 
+/* IOutStreamFlush::Flush() returns, when all data written to stream
+   is stored on the device. The archive handlers use it to order writes,
+   when they change existing archive in place. */
+
+STREAM_INTERFACE(IOutStreamFlush, 0x0A)
+{
+  STDMETHOD(Flush)() PURE;
+};
+
 
 STREAM_INTERFACE(IStreamGetProps, 0x08)
 {
@@ -147,7 +147,8 @@ enum Enum
   kNameTrailReplace,
 
   kDeleteAfterCompressing,
-  kSetArcMTime
+  kSetArcMTime,
+  kAppend
 
   #ifndef _NO_CRYPTO
   , kPassword
@@ -269,7 +270,8 @@ static const CSwitchForm kSwitchForms[] =
   { "snt", NSwitchType::kMinus },
   
   { "sdel" },
-  { "stl" }
+  { "stl" },
+  { "sap" }
 
   #ifndef _NO_CRYPTO
   , { "p",  NSwitchType::kString }
@@ -1242,9 +1244,15 @@ void CArcCmdLineParser::Parse2(CArcCmdLineOptions &options)
 
     updateOptions.DeleteAfterCompressing = parser[NKey::kDeleteAfterCompressing].ThereIs;
     updateOptions.SetArcMTime = parser[NKey::kSetArcMTime].ThereIs;
+    updateOptions.AppendMode = parser[NKey::kAppend].ThereIs;
 
     if (updateOptions.StdOutMode && updateOptions.EMailMode)
       throw CArcCmdLineException("stdout mode and email mode cannot be combined");
+
+    if (updateOptions.AppendMode
+        && (updateOptions.StdOutMode || updateOptions.EMailMode
+          || updateOptions.SfxMode || updateOptions.VolumesSizes.Size() != 0))
+      throw CArcCmdLineException("-sap switch cannot be combined with stdout, email, SFX or volume mode");
     
     if (updateOptions.StdOutMode)
     {
@@ -775,6 +775,8 @@ static HRESULT Compress(
   CStdOutFileStream *stdOutFileStreamSpec = NULL;
   COutMultiVolStream *volStreamSpec = NULL;
 
+  const bool appendMode = options.AppendMode && isUpdatingItself && !options.StdOutMode;
+
   if (options.VolumesSizes.Size() == 0)
   {
     if (options.StdOutMode)
@@ -790,6 +792,18 @@ static HRESULT Compress(
       bool isOK = false;
       FString realPath;
       
+      if (appendMode)
+      {
+        /* we write to the existing archive file.
+           It's not temp file, so we don't add it to (tempFiles). */
+        if (options.SfxMode || arc->ArcStreamOffset != 0)
+          return E_NOTIMPL;
+        realPath = us2fs(archivePath.GetFinalPath());
+        if (!outStreamSpec->Open(realPath, OPEN_EXISTING))
+          return errorInfo.SetFromLastError("cannot open file", realPath);
+        isOK = true;
+      }
+      else
       for (unsigned i = 0; i < (1 << 16); i++)
       {
         if (archivePath.Temp)
@@ -843,7 +857,17 @@ static HRESULT Compress(
     */
   }
 
-  RINOK(SetProperties(outArchive, options.MethodMode.Properties));
+  if (appendMode)
+  {
+    CObjectVector<CProperty> props = options.MethodMode.Properties;
+    CProperty &prop = props.AddNew();
+    prop.Name = "ap";
+    RINOK(SetProperties(outArchive, props));
+  }
+  else
+  {
+    RINOK(SetProperties(outArchive, options.MethodMode.Properties));
+  }
 
   if (options.SfxMode)
   {
@@ -1194,6 +1218,18 @@ HRESULT UpdateArchive(
       op.stream = NULL;
       op.filePath = arcPath;
 
+      CMyComPtr<IInStream> appendInStream;
+      if (options.AppendMode)
+      {
+        /* the archive file will be opened for writing later,
+           so we must allow write sharing for the input stream */
+        CInFileStream *inStreamSpec = new CInFileStream;
+        appendInStream = inStreamSpec;
+        if (!inStreamSpec->OpenShared(us2fs(arcPath), true))
+          return errorInfo.SetFromLastError("cannot open file", us2fs(arcPath));
+        op.stream = appendInStream;
+      }
+
       RINOK(callback->StartOpenArchive(arcPath));
 
       HRESULT result = arcLink.Open_Strict(op, openCallback);
@@ -1220,7 +1256,9 @@ HRESULT UpdateArchive(
       arc.MTimeDefined = !fi.IsDevice;
       arc.MTime = fi.MTime;
 
-      if (arc.ErrorInfo.ThereIsTail)
+      /* in append mode the 7z handler accepts only the tail
+         that was left by an interrupted append, and it returns E_NOTIMPL for other tails */
+      if (arc.ErrorInfo.ThereIsTail && !options.AppendMode)
       {
         errorInfo.SystemError = (DWORD)E_NOTIMPL;
         errorInfo.Message = "There is some data block after the end of the archive";
@@ -1362,7 +1400,8 @@ HRESULT UpdateArchive(
     CArchivePath &ap = options.Commands[0].ArchivePath;
     ap = options.ArchivePath;
     // if ((archive != 0 && !usesTempDir) || !options.WorkingDir.IsEmpty())
-    if ((thereIsInArchive || !options.WorkingDir.IsEmpty()) && !usesTempDir && options.VolumesSizes.Size() == 0)
+    if ((thereIsInArchive || !options.WorkingDir.IsEmpty()) && !usesTempDir && options.VolumesSizes.Size() == 0
+        && !(thereIsInArchive && options.AppendMode))
     {
       createTempFile = true;
       ap.Temp = true;
@@ -1412,7 +1451,8 @@ HRESULT UpdateArchive(
       // ap.TempPrefix = tempDirPrefix;
     }
     if (!options.StdOutMode &&
-        (ci > 0 || !createTempFile))
+        (ci > 0 || !createTempFile) &&
+        !(ci == 0 && thereIsInArchive && options.AppendMode && options.UpdateArchiveItself))
     {
       const FString path = us2fs(ap.GetFinalPath());
       if (NFind::DoesFileOrDirExist(path))
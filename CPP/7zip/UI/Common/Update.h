@@ -115,6 +115,9 @@ struct CUpdateOptions
 
   bool SetArcMTime;
 
+  // the archive is updated in place: new data is appended after existing data
+  bool AppendMode;
+
   CObjectVector<CRenamePair> RenamePairs;
 
   bool InitFormatIndex(const CCodecs *codecs, const CObjectVector<COpenType> &types, const UString &arcPath);
@@ -133,7 +136,8 @@ struct CUpdateOptions
     PathMode(NWildcard::k_RelatPath),
     
     DeleteAfterCompressing(false),
-    SetArcMTime(false)
+    SetArcMTime(false),
+    AppendMode(false)
 
       {};
 
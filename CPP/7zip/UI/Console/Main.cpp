@@ -30,6 +30,8 @@
 
 #ifdef EXTERNAL_CODECS
 #include "../Common/LoadCodecs.h"
+#else
+#include "../../Compress/Lzma2Encoder.h"
 #endif
 
 #include "../../Common/RegisterCodec.h"
@@ -122,6 +124,7 @@ static const char * const kHelpString =
     #endif
     "  -r[-|0] : Recurse subdirectories\n"
     "  -sa{a|e|s} : set Archive name mode\n"
+    "  -sap : append new data to existing 7z archive in place\n"
     "  -scc{UTF-8|WIN|DOS} : set charset for for console input/output\n"
     "  -scs{UTF-8|UTF-16LE|UTF-16BE|WIN|DOS|{id}} : set charset for list files\n"
     "  -scrc[CRC32|CRC64|SHA1|SHA256|*] : set hash function for x, e, h commands\n"
@@ -479,6 +482,94 @@ static void PrintStat()
   *g_StdStream << endl;
 }
 
+#ifndef EXTERNAL_CODECS
+
+static void PrintFastLzma2Stat()
+{
+  FL2_cStreamStats st;
+  NCompress::NLzma2::GetFastEncoderStats(st);
+  if (st.blocks == 0)
+    return;
+
+  *g_StdStream << endl << "Fast LZMA2 :";
+  PrintNum(st.blocks, 8);
+  *g_StdStream << " blocks";
+  PrintNum((st.inputSize + (1 << 20) - 1) >> 20, 8);
+  *g_StdStream << " MB";
+
+  // counters are in microseconds, PrintTime() takes 100 ns units
+  const UInt64 total = (st.initTime + st.buildTime + st.encodeTime) * 10;
+  PrintTime("Init   ", st.initTime * 10, total);
+  PrintTime("Build  ", st.buildTime * 10, total);
+  PrintTime("Encode ", st.encodeTime * 10, total);
+  PrintTime("Wait   ", st.poolWaitTime * 10, total);
+  const UInt64 threadTotal = (st.encodeBusyTime + st.encodeIdleTime) * 10;
+  PrintTime("Busy   ", st.encodeBusyTime * 10, threadTotal);
+  PrintTime("Idle   ", st.encodeIdleTime * 10, threadTotal);
+
+  *g_StdStream << endl << "Shifts  =";
+  PrintNum(st.dictShifts, 8);
+  PrintNum((st.dictShiftBytes + (1 << 20) - 1) >> 20, 8);
+  *g_StdStream << " MB";
+  *g_StdStream << endl << "Chunks  =";
+  PrintNum(st.compressedChunks, 8);
+  *g_StdStream << " compressed";
+  PrintNum(st.storedChunks, 8);
+  *g_StdStream << " stored";
+  PrintNum((st.skippedBytes + (1 << 20) - 1) >> 20, 8);
+  *g_StdStream << " MB skipped";
+
+  NCompress::NLzma2::CFastEncoderConfig config;
+  NCompress::NLzma2::GetFastEncoderConfig(config);
+  *g_StdStream << endl << "Memory  =";
+  PrintNum((config.memUsage + (1 << 20) - 1) >> 20, 8);
+  *g_StdStream << " MB";
+  if (config.fitted)
+  {
+    *g_StdStream << " of";
+    PrintNum(config.memLimit >> 20, 8);
+    *g_StdStream << " MB limit";
+  }
+  *g_StdStream << endl << "Config  =";
+  PrintNum(config.dictSize >> 10, 8);
+  *g_StdStream << " KB dict";
+  if (config.dictSize < config.requestedDictSize)
+  {
+    *g_StdStream << " (reduced from ";
+    PrintNum(config.requestedDictSize >> 10, 0);
+    *g_StdStream << " KB)";
+  }
+  PrintNum(config.numThreads, 4);
+  *g_StdStream << " threads";
+  if (config.numThreads < config.requestedThreads)
+  {
+    *g_StdStream << " (reduced from ";
+    PrintNum(config.requestedThreads, 0);
+    *g_StdStream << ")";
+  }
+  PrintNum(config.dualBuffer, 4);
+  *g_StdStream << " dual buffer";
+  *g_StdStream << endl;
+}
+
+// The mem property lets the encoder reduce the dictionary and threads, which is
+// reported without -bt so it is not missed
+static void PrintFastLzma2Reduction(CStdOutStream &so)
+{
+  NCompress::NLzma2::CFastEncoderConfig config;
+  NCompress::NLzma2::GetFastEncoderConfig(config);
+  if (!config.IsReduced())
+    return;
+  so << endl << "Fast LZMA2 fitted to the memory limit of " << (config.memLimit >> 20) << " MB :";
+  if (config.dictSize < config.requestedDictSize)
+    so << " dictionary " << (config.requestedDictSize >> 10) << " KB -> " << (config.dictSize >> 10) << " KB";
+  if (config.numThreads < config.requestedThreads)
+    so << " threads " << config.requestedThreads << " -> " << config.numThreads;
+  so << endl;
+}
+
+#endif
+
 static void PrintHexId(CStdOutStream &so, UInt64 id)
 {
   char s[32];
@@ -1115,6 +1206,11 @@ int Main2(
     if (!se)
       se = g_ErrStream;
 
+    #ifndef EXTERNAL_CODECS
+    if (se)
+      PrintFastLzma2Reduction(*se);
+    #endif
+
     retCode = WarningsCheck(hresultMain, callback, errorInfo,
         g_StdStream, se,
         true // options.EnableHeaders
@@ -1146,7 +1242,12 @@ int Main2(
     ShowMessageAndThrowException(kUserErrorMessage, NExitCode::kUserError);
 
   if (options.ShowTime && g_StdStream)
+  {
     PrintStat();
+    #ifndef EXTERNAL_CODECS
+    PrintFastLzma2Stat();
+    #endif
+  }
 
   ThrowException_if_Error(hresultMain);
 
@@ -166,7 +166,8 @@ static const EMethodID g_BZip2Methods[] =
 
 static const EMethodID g_XzMethods[] =
 {
-  kLZMA2
+  kLZMA2,
+  kFLZMA2
 };
 
 static const EMethodID g_SwfcMethods[] =
@@ -1834,8 +1835,11 @@ UInt64 CCompressDialog::GetMemoryUsage(UInt32 dict, UInt64 &decompressMemory)
     {
       if (level > FL2_MAX_7Z_CLEVEL)
         level = FL2_MAX_7Z_CLEVEL;
-      /* dual buffer is enabled in Lzma2Encoder.cpp so size is dict * 6 */
-      size += dict * 6 + (1UL << 18) * numThreads;
+      /* dual buffer is enabled in Lzma2Encoder.cpp so size is dict * 2 plus the match table.
+         With 4 or more threads the next table may be built while a block is encoded,
+         which takes a second match table. */
+      size += (UInt64)dict * 2 + (1UL << 18) * numThreads;
+      UInt64 tableSize = (UInt64)dict * 4;
       UInt32 bufSize = dict >> MATCH_BUFFER_SHIFT;
       if (bufSize > MATCH_BUFFER_ELBOW) {
         UInt32 extra = 0;
@@ -1846,9 +1850,12 @@ UInt64 CCompressDialog::GetMemoryUsage(UInt32 dict, UInt64 &decompressMemory)
           extra += MATCH_BUFFER_ELBOW >> 5;
         bufSize = MATCH_BUFFER_ELBOW + extra;
       }
-      size += (bufSize * 12 + RMF_BUILDER_SIZE) * numThreads;
+      tableSize += (UInt64)(bufSize * 12 + RMF_BUILDER_SIZE) * numThreads;
       if (dict > (UInt32(1) << 26))
-        size += dict;
+        tableSize += dict;
+      size += tableSize;
+      if (numThreads >= 4)
+        size += tableSize;
       if (FL2_7zCParameters[level].strategy == FL2_ultra)
         size += (UInt32(4) << 14) + (UInt32(4) << FL2_7zCParameters[level].chainLog);
       decompressMemory = dict + (2 << 20);
@@ -81,6 +81,12 @@ bool COutFile::Create(const char *name, bool createAlways)
 
 bool COutFile::Open(const char *name, DWORD creationDisposition)
 {
+  switch (creationDisposition)
+  {
+    case OPEN_EXISTING: return OpenBinary(name, O_WRONLY);
+    case OPEN_ALWAYS: return OpenBinary(name, O_CREAT | O_WRONLY);
+    case CREATE_ALWAYS: return Create(name, true);
+  }
   return Create(name, false);
 }
 
@@ -89,4 +95,22 @@ ssize_t COutFile::Write(const void *data, size_t size)
   return write(_handle, data, size);
 }
 
+bool COutFile::SetLength(UInt64 length)
+{
+  #ifdef _WIN32
+  return _chsize_s(_handle, (__int64)length) == 0;
+  #else
+  return ftruncate(_handle, (off_t)length) == 0;
+  #endif
+}
+
+bool COutFile::Flush()
+{
+  #ifdef _WIN32
+  return _commit(_handle) == 0;
+  #else
+  return fsync(_handle) == 0;
+  #endif
+}
+
 }}}
@@ -46,6 +46,8 @@ public:
   bool Create(const char *name, bool createAlways);
   bool Open(const char *name, DWORD creationDisposition);
   ssize_t Write(const void *data, size_t size);
+  bool SetLength(UInt64 length);
+  bool Flush();
 };
 
 }}}
@@ -220,6 +220,12 @@ MY_EXTERN_C LONG CompareFileTime(const FILETIME* ft1, const FILETIME* ft2);
 #define CP_OEMCP  1
 #define CP_UTF8   65001
 
+// creationDisposition values for COutFile::Open()
+#define CREATE_NEW    1
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS   4
+
 typedef enum tagSTREAM_SEEK
 {
   STREAM_SEEK_SET = 0,
@@ -159,6 +159,16 @@ public:
   ~CCriticalSectionLock() { Unlock(); }
 };
 
+// it locks the critical section only if (object) is not NULL
+
+class COptCriticalSectionLock
+{
+  CCriticalSection *_object;
+public:
+  COptCriticalSectionLock(CCriticalSection *object): _object(object) { if (_object) _object->Enter(); }
+  ~COptCriticalSectionLock() { if (_object) _object->Leave(); }
+};
+
 }}
 
 #endif